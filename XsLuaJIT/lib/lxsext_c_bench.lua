@@ -0,0 +1,96 @@
+-- Counts lxs_string heap traffic per library call.
+--
+-- Requires a build with LUAXS_STR_ALLOC_STATS enabled (the default when
+-- LUAXS_DEBUG is 1). Run it once as is and once with LUAXS_STR_INLINE_CAPACITY
+-- set to 0 to compare inline storage against plain heap buffers.
+
+local N = 10000
+
+local short = 'a short string, 32 characters..'
+local long  = string.rep('x', 200)
+
+local cases = {
+	{ 'buffer.new',              function() return buffer.new() end },
+	{ 'buffer.new(64)',          function() return buffer.new(64) end },
+	{ 'buffer:append (short)',   function() return buffer.new():append(short) end },
+	{ 'buffer:append (long)',    function() return buffer.new():append(long) end },
+	{ 'buffer:upper:tostring',   function() return buffer.new():append(short):upper():tostring() end },
+	{ 'buffer:trim:tostring',    function() return buffer.new():append('  ', short, '  '):trim():tostring() end },
+	{ 'buffer:chunked:append',   function() return buffer.new():chunked(64):append(long, long) end },
+	{ 'buffer:rep',              function() return buffer.new():rep(4, 'ab') end },
+	{ 'buffer:substr',           function() return buffer.new():append(short):substr(1, 8) end },
+	{ 'string.format',           function() return string.format('%d: %s', 1, short) end },
+	{ 'string.rep',              function() return string.rep('ab', 8) end },
+	{ 'string.reverse',          function() return string.reverse(short) end },
+	{ 'string.upper',            function() return string.upper(short) end },
+	{ 'string.trim',             function() return string.trim('  ' .. short .. '  ') end },
+	{ 'string.split',            function() return string.split(short, ' ,') end },
+	{ 'table.concat',            function() return table.concat({ 'a', 'b', 'c' }, ',') end },
+	{ 'table.join',              function() return table.join({ 'a', 'b', 'c' }, ',') end },
+}
+
+local function run(name, fn)
+	collectgarbage('collect')
+	buffer.allocstats(true)
+	for i = 1, N do
+		fn()
+	end
+	collectgarbage('collect')
+	local s = buffer.allocstats()
+	io.write(string.format('%-24s %9.3f %9.3f %9.3f %9.3f\n', name,
+		s.allocs / N, s.reallocs / N, s.frees / N, s.inlined / N))
+end
+
+io.write(string.format('%-24s %9s %9s %9s %9s\n',
+	'per call', 'allocs', 'reallocs', 'frees', 'inlined'))
+for _, case in ipairs(cases) do
+	if pcall(case[2]) then
+		run(case[1], case[2])
+	else
+		io.write(string.format('%-24s n/a\n', case[1]))
+	end
+end
+
+-- Marshal output compression: sizes and throughput on a save-like state.
+
+local function state(n)
+	local world = { tick = 12345, entities = {} }
+	for i = 1, n do
+		world.entities[i] = {
+			id    = i,
+			class = 'npc_' .. (i % 40),
+			hp    = 100 - i % 7,
+			pos   = { x = i * 0.25, y = -i * 0.5, z = 0 },
+			flags = { alive = true, hostile = i % 3 == 0 },
+		}
+	end
+	return world
+end
+
+local function time(fn, reps)
+	local t = os.clock()
+	for i = 1, reps do
+		fn()
+	end
+	return (os.clock() - t) / reps
+end
+
+local world = state(20000)
+local raw   = marshal.encode(world)
+local z     = marshal.encode(world, nil, nil, 2, true)
+local mb    = #raw / 1048576
+
+io.write(string.format('\nmarshal: %d bytes, compressed %d bytes (%.1f%%)\n',
+	#raw, #z, 100 * #z / #raw))
+io.write(string.format('%-24s %9.1f MB/s\n', 'encode',
+	mb / time(function() marshal.encode(world) end, 5)))
+io.write(string.format('%-24s %9.1f MB/s\n', 'encode, compressed',
+	mb / time(function() marshal.encode(world, nil, nil, 2, true) end, 5)))
+io.write(string.format('%-24s %9.1f MB/s\n', 'decode',
+	mb / time(function() marshal.decode(raw) end, 5)))
+io.write(string.format('%-24s %9.1f MB/s\n', 'decode, compressed',
+	mb / time(function() marshal.decode(z) end, 5)))
+io.write(string.format('%-24s %9.1f MB/s\n', 'buffer:compress',
+	mb / time(function() buffer.compress(raw) end, 20)))
+io.write(string.format('%-24s %9.1f MB/s\n', 'buffer:decompress',
+	mb / time(function() buffer.compress(raw):decompress() end, 20)))
@@ -32,6 +32,38 @@ local StringLibraryExtensions = {}
 		assertEquals(split('a.b,c', ',;' ), { 'a.b', 'c'    })
 	end
 
+	function StringLibraryExtensions:TestSplitLongInput()
+		local split = string.split
+		local word  = string.rep('x', 37)
+		assertEquals(split(word,                         ','  ), { word               })
+		assertEquals(split(word .. ',' .. word,          ','  ), { word, word         })
+		assertEquals(split(word .. ';' .. word .. '.',   '.,;'), { word, word, ''     })
+		assertEquals(split(string.rep(',', 40),          ','  ), split(string.rep(',', 40), ',;'))
+		assertEquals(#split(string.rep(',', 40),         ','  ), 41)
+	end
+
+	function StringLibraryExtensions:TestGSplit()
+		local function collect(s, seps)
+			local t = {}
+			for token in string.gsplit(s, seps) do
+				t[#t + 1] = token
+			end
+			return t
+		end
+		assertError(string.gsplit, nil, ',')
+		assertEquals(collect('',       ',' ), { ''            })
+		assertEquals(collect('a,b,c',  ',' ), { 'a', 'b', 'c' })
+		assertEquals(collect(',a,,b,', ',' ), string.split(',a,,b,', ','))
+		assertEquals(collect('a.b,c',  ',;'), { 'a.b', 'c'    })
+
+		local b = buffer.new():append('ab,,cde')
+		local ranges = {}
+		for off, len in b:gsplit(',') do
+			ranges[#ranges + 1] = off .. ':' .. len
+		end
+		assertEquals(ranges, { '1:2', '4:0', '5:3' })
+	end
+
 	function StringLibraryExtensions:TestJoin()
 		local join = string.join
 		assertError(join, nil, nil)
@@ -74,6 +106,683 @@ local StringLibraryExtensions = {}
 		assertEquals(joinh('.,', self:make_map({ 'a', 'b', 'c' })), 'a.,b.,c')
 	end
 
+	function StringLibraryExtensions:TestNestedStringBuffers()
+		local function inner(w)
+			return string.format('<%s:%s>', w, table.concat({ w:upper(), w:reverse() }, ','))
+		end
+		assertEquals(string.gsub('ab cd', '%w+', inner), '<ab:AB,ba> <cd:CD,dc>')
+		assertEquals(string.reverse(''), '')
+		assertEquals(string.reverse('a'), 'a')
+
+		-- a callback raising an error must not leave the outer buffer busy
+		assertError(string.gsub, 'ab', '%w', function() error('x') end)
+		assertEquals(string.rep('ab', 3), 'ababab')
+		assertEquals(string.gsub('ab', '%w', '%0%0'), 'aabb')
+	end
+
+	function StringLibraryExtensions:TestChunkedBuffer()
+		local b = buffer.new():chunked(4)
+		b:append('ab', 'cdef', 'ghijklmnop', 'q')
+		assertEquals(b:len(), 17)
+		assertEquals(b:tostring(), 'abcdefghijklmnopq')
+		b:append('rs')
+		assertEquals(b:upper():tostring(), 'ABCDEFGHIJKLMNOPQRS')
+		b:clear():append('x')
+		assertEquals(b:chunked(false):tostring(), 'x')
+	end
+
+	function StringLibraryExtensions:TestBufferView()
+		local b = buffer.new():append('key=12.5;')
+		local k = b:view(1, 3)
+		local v = b:view(5, 4)
+		assertEquals(k:len(), 3)
+		assertEquals(k:tostring(), 'key')
+		assertEquals(k:equals('key'), true)
+		assertEquals(k:starts_with('ke'), true)
+		assertEquals(v:ends_with('.5'), true)
+		assertEquals(v:tonumber(), 12.5)
+		assertEquals(b:view(4, 1):tonumber(), nil)
+		assertEquals({ b:view():find('=') }, { 4, 4 })
+		assertEquals(k == b:view(1, 3), true)
+		assertEquals(k < v, false)
+
+		b:remove(1, 4)
+		assertEquals(k:isvalid(), false)
+		assertError(k.tostring, k)
+		-- passing the chunked parent flattens it before the view is read
+		local function chunked_view()
+			local c = buffer.new():append('ab'):chunked(4)
+			local cv = c:view()
+			c:append(string.rep('c', 256))
+			assertEquals(cv:isvalid(), true)
+			return c, cv
+		end
+		b, k = chunked_view()
+		assertError(k.find, k, b)
+		b, k = chunked_view()
+		assertError(k.equals, k, b)
+		b, k = chunked_view()
+		assertError(k.equals, b, k)
+	end
+
+	function StringLibraryExtensions:TestBufferPack()
+		local b = buffer.new()
+		b:write_u16(513):write_i8(-2):write_f64(0.25, '>')
+		assertEquals(b:tostring(), '\1\2\254\63\208\0\0\0\0\0\0')
+		assertEquals(b:read_u16(), 513)
+		assertEquals(b:read_u8(), 254)
+		assertEquals(b:read_f64('>'), 0.25)
+		assertError(b.read_u8, b)
+
+		b:clear():pack('>hIzs', -300, 70000, 'id', 'name')
+		local h, i, z, s = b:unpack('>hIzs')
+		assertEquals(h, -300)
+		assertEquals(i, 70000)
+		assertEquals(z, 'id')
+		assertEquals(s, 'name')
+		assertEquals(b:seek(), b:len() + 1)
+		assertEquals(b:seek(3), 3)
+		assertEquals(b:read_u32('>'), 70000)
+
+		-- integer fields reject values they can't hold
+		assertEquals(b:clear():write_i8(-128):write_u8(255):tostring(), '\128\255')
+		assertError(b.write_u8, b, 300)
+		assertError(b.write_u8, b, -1)
+		assertError(b.write_i8, b, 128)
+		assertError(b.write_u32, b, 0 / 0)
+		assertError(b.write_i64, b, 1 / 0)
+		assertError(b.pack, b, 'H', 65536)
+
+		-- a length prefix that would wrap the read cursor
+		b:clear():append('x'):append('\255\255\255\255')
+		b:seek(2)
+		assertError(b.unpack, b, 's')
+	end
+
+	function StringLibraryExtensions:TestPlainFind()
+		local hay    = string.rep('a', 100000) .. 'b'
+		local needle = string.rep('a', 1000) .. 'b'
+		assertEquals(select(1, hay:find(needle, 1, true)), 99001)
+		assertEquals(select(2, hay:find(needle)), 100001)
+		assertEquals(hay:find(needle .. 'a', 1, true), nil)
+		assertEquals(('key=value'):match('=v'), '=v')
+		assertEquals(('key=value'):match('=x'), nil)
+	end
+
+	function StringLibraryExtensions:TestPatternCache()
+		for round = 1, 2 do
+			assertEquals({ ('hello world'):find('o w') }, { 5, 7 })
+			assertEquals({ ('key = value'):match('(%w+)%s*=%s*(%w+)') }, { 'key', 'value' })
+			assertEquals({ ('abc abc'):gsub('%f[%w]%w+', 'x') }, { 'x x', 2 })
+			assertEquals({ ('a(b(c)d)e'):find('%b()') }, { 2, 8 })
+			assertEquals(('  x'):match('^%s*(.-)$'), 'x')
+			local t = {}
+			for w in ('^a^b'):gmatch('^%a') do t[#t + 1] = w end
+			assertEquals(t, { '^a', '^b' })
+			assertError(string.find, 'abc', '[a')
+		end
+		-- replacements may evict the running pattern
+		local r = ('a1b2'):gsub('%d', function()
+			for i = 1, 40 do ('x'):match('x' .. i .. '*') end
+			return '#'
+		end)
+		assertEquals(r, 'a#b#')
+		-- more distinct patterns than the cache holds
+		for round = 1, 2 do
+			for i = 1, 100 do
+				assertEquals(('<' .. i .. '>'):match('<(' .. i .. ')>'), tostring(i))
+			end
+		end
+	end
+
+	function StringLibraryExtensions:TestFormat()
+		for round = 1, 2 do
+			assertEquals(('%5d|%-5d|%05d|%+d|% d'):format(42, 42, -42, 7, 7), '   42|42   |-0042|+7| 7')
+			assertEquals(('%x %X %o %u'):format(255, 255, 8, 3), 'ff FF 10 3')
+			assertEquals(('%.2f %g %g %8.3f'):format(3.14159, 0.1, 1e5, -2.5), '3.14 0.1 100000   -2.500')
+			assertEquals(('%s|%5s|%-5s|%.2s'):format('ab', 'ab', 'ab', 'abc'), 'ab|   ab|ab   |ab')
+			assertEquals(('%c%c 100%%'):format(72, 105), 'Hi 100%')
+			assertEquals(('%q'):format('a\n"'), '"a\\\n\\""')
+			assertError(string.format, '%d')
+			assertError(string.format, '%y', 1)
+		end
+		-- more distinct formats than the cache holds
+		for i = 1, 100 do
+			assertEquals(('<%d>' .. i):format(i), '<' .. i .. '>' .. i)
+		end
+	end
+
+	function StringLibraryExtensions:TestNumberConversion()
+		-- %G is always formatted by the CRT
+		local function crt(x) return (('%.14G'):format(x):lower()) end
+		for _, x in ipairs({ 0, -0, 1, -1, 0.1, 1/3, 123456.789, 1e14, 1e-5, 2^53, -2^63, 1e300 }) do
+			assertEquals(tostring(x), crt(x))
+			assertEquals(tonumber(('%.17g'):format(x)), x)
+		end
+		math.randomseed(42)
+		for i = 1, 10000 do
+			local x = (math.random() - 0.5) * 10 ^ math.random(-20, 20)
+			if i % 2 == 0 then x = math.floor(x) end
+			assertEquals(tostring(x), crt(x))
+			assertEquals(x .. '', crt(x))
+			assertEquals(tonumber(('%.17g'):format(x)), x)
+			assertEquals(tonumber(' ' .. ('%.14g'):format(x) .. ' '), tonumber(crt(x)))
+		end
+		assertEquals(tonumber('0x10'), 16)
+		assertEquals(tonumber('1e'), nil)
+		assertEquals(tonumber('.'), nil)
+	end
+
+	function StringLibraryExtensions:TestStringTable()
+		local t = {}
+		for i = 1, 2000 do
+			t['gamedata\\scripts\\' .. string.rep('x', i % 300) .. i .. '.script'] = i
+		end
+		for i = 1, 2000 do
+			local key = table.concat({ 'gamedata', 'scripts', string.rep('x', i % 300) .. i .. '.script' }, '\\')
+			assertEquals(t[key], i)
+		end
+		if debug.strstats then
+			local s = debug.strstats(true)
+			assert(s.nuse > 2000 and s.size >= s.nuse / 2)
+			assert(s.maxchain < 16)
+			local _ = 'strstats' .. 1
+			s = debug.strstats()
+			assert(s.lookups >= 1 and s.probes >= 0)
+		end
+		t = nil
+		collectgarbage('collect')
+		for i = 1, 2000 do
+			assertEquals(string.rep('y', i % 7) .. i, string.rep('y', i % 7) .. tostring(i))
+		end
+		if debug.strstats then
+			assert(debug.strstats().pending >= 0)
+		end
+	end
+
+	function StringLibraryExtensions:TestSort()
+		local function sorted(t, lt)
+			for i = 2, #t do
+				assert(not lt(t[i], t[i - 1]))
+			end
+			return true
+		end
+		local lt = function(a, b) return a < b end
+		local gt = function(a, b) return a > b end
+
+		local nums, strs, desc = {}, {}, {}
+		for i = 1, 1000 do
+			nums[i] = (i * 7919) % 1009
+			strs[i] = 'key' .. nums[i]
+			desc[i] = i
+		end
+		table.sort(nums)
+		table.sort(strs)
+		table.sort(desc, gt)
+		assert(sorted(nums, lt) and sorted(strs, lt) and sorted(desc, gt))
+
+		local mixed = { 3, 1, 2, setmetatable({}, { __lt = function() return false end }) }
+		assertError(table.sort, mixed)
+		local same = {}
+		for i = 1, 100 do
+			same[i] = i % 3
+		end
+		assertError(table.sort, same, function(a, b) return true end)
+		assertError(table.sort, desc, function(a, b)
+			for i = 1, 1000 do
+				desc[i] = nil
+			end
+			desc.shrink = true -- rehashes, the array part goes away
+			return a < b
+		end)
+	end
+
+	function StringLibraryExtensions:TestStableSort()
+		local items = {}
+		for i = 1, 500 do
+			items[i] = { key = i % 7, seq = i }
+		end
+		table.stable_sort(items, function(a, b) return a.key < b.key end)
+		for i = 2, #items do
+			local a, b = items[i - 1], items[i]
+			assert(a.key < b.key or (a.key == b.key and a.seq < b.seq))
+		end
+
+		local nums = {}
+		for i = 1, 1000 do
+			nums[i] = i + (i % 10 == 0 and 5 or 0)
+		end
+		table.stable_sort(nums)
+		for i = 2, #nums do
+			assert(nums[i - 1] <= nums[i])
+		end
+
+		-- an error in the final merge restores the buffered elements: sorting
+		-- again yields exactly the elements of a reference copy
+		local function by_seq(a, b) return a.seq < b.seq end
+		local sorted, total = {}, 0
+		for i = 1, #items do sorted[i] = items[i] end
+		table.stable_sort(sorted, function(a, b)
+			total = total + 1
+			return by_seq(a, b)
+		end)
+
+		local n = 0
+		assertError(table.stable_sort, items, function(a, b)
+			n = n + 1
+			if n == total - 10 then error('stop') end
+			return by_seq(a, b)
+		end)
+		assertEquals(n, total - 10)
+		assertEquals(#items, 500)
+		table.stable_sort(items, by_seq)
+		for i = 1, 500 do
+			assert(items[i] == sorted[i])
+		end
+	end
+
+	function StringLibraryExtensions:TestVectorFunctions()
+		local t = {}
+		for i = 1, 100 do
+			t[i] = i - 50
+		end
+		assertEquals(table.sumi(t), 50)
+		assertEquals(table.mini(t), -49)
+		assertEquals(table.maxi(t), 50)
+		assertEquals(table.maxi({ -3, -2 }), -2)
+		assertEquals(table.sumi(t, function(i, v) return v > 0 and 1 or 0 end), 50)
+		assertEquals(table.sumi({}), nil)
+		assertError(table.sumi, { 1, 'x' })
+
+		local h = { 'a', 'b' }
+		h[4], h[3] = 'd', 'c'
+		assertEquals(table.joini(h, ','), 'a,b,c,d')
+		assertEquals(table.findi(h, function(i, v) return v == 'd' end), 4)
+
+		local evens = table.retaini(t, function(i, v) return v % 2 == 0 end)
+		assertEquals(#evens, 50)
+		assertEquals(#t, 100)
+		assert(table.retaini(t, function(i, v) return v % 2 == 0 end, true) == t)
+		assertEquals(#t, 50)
+		assertEquals(t[50], 50)
+		assertEquals(t[51], nil)
+
+		assert(table.mapi(t, function(i, v) return v * 2 end, true) == t)
+		assertEquals(t[50], 100)
+	end
+
+	function StringLibraryExtensions:TestMoveClear()
+		local t = { 1, 2, 3, 4, 5 }
+		assert(table.move(t, 1, 3, 3) == t)
+		assertEquals(table.concat(t, ','), '1,2,1,2,3')
+		table.move(t, 2, 5, 1)
+		assertEquals(table.concat(t, ','), '2,1,2,3,3')
+
+		local u = table.move(t, 1, 5, 4, { 'a' })
+		assertEquals(u[1], 'a')
+		assertEquals(u[3], nil)
+		assertEquals(table.concat(u, ',', 4, 8), '2,1,2,3,3')
+		assertError(table.move, t, 1, 2)
+
+		table.insert(t, 1, 0)
+		assertEquals(table.concat(t, ','), '0,2,1,2,3,3')
+		assertEquals(table.remove(t, 2), 2)
+		assertEquals(table.concat(t, ','), '0,1,2,3,3')
+		assertEquals(#t, 5)
+
+		t.x = 'y'
+		table.clear(t, true)
+		assertEquals(#t, 0)
+		assertEquals(next(t), nil)
+		t[1], t.x = 'a', 'b'
+		table.clear(t)
+		assertEquals(next(t), nil)
+	end
+
+	function StringLibraryExtensions:TestMarshalClone()
+		local mt     = {}
+		local shared = { 'shared' }
+		local const  = { 'const' }
+		local src    = setmetatable({ 1, 2, a = shared, b = shared, c = const, d = { e = { f = 1 } } }, mt)
+		src.self = src
+
+		local c = marshal.clone(src, { const })
+		assertEquals(c[2], 2)
+		assert(c ~= src and c.self == c)
+		assert(c.a ~= shared and c.a == c.b)
+		assertEquals(c.a[1], 'shared')
+		assert(c.c == const)
+		assertEquals(getmetatable(c), nil)
+		assert(getmetatable(marshal.clone(src, nil, nil, true)) == mt)
+
+		local shallow = marshal.clone(src, nil, 1)
+		assert(shallow ~= src and shallow.d == src.d)
+		assert(marshal.clone(src, nil, 2).d.e == src.d.e)
+		assert(marshal.clone(src, nil, 0) == src)
+		assertEquals(marshal.clone('x'), 'x')
+
+		-- closures are copied with their upvalues, so they act on the copy
+		local e = { hp = 10, find = string.find }
+		e.damage = function(n) e.hp = e.hp - n end
+		local ec = marshal.clone(e)
+		assert(ec.damage ~= e.damage)
+		ec.damage(3)
+		assertEquals(ec.hp, 7)
+		assertEquals(e.hp, 10)
+		assert(ec.find == string.find)
+		assert(marshal.clone(e, nil, 1).damage == e.damage)
+	end
+
+	function StringLibraryExtensions:TestMarshalStream()
+		local big = {}
+		for i = 1, 2000 do
+			big[i] = { id = i, name = 'entity' .. i }
+		end
+		big.self = big
+		local bytes = marshal.encode(big)
+
+		local b = buffer.new()
+		assert(marshal.encode(big, nil, b) == b)
+		assertEquals(b:tostring(), bytes)
+		marshal.encode('second', nil, b)
+		local t = marshal.decode(b)
+		assertEquals(t[2000].name, 'entity2000')
+		assert(t.self == t)
+		assertEquals(marshal.decode(b), 'second')
+
+		local f = io.tmpfile()
+		marshal.encode(big, nil, f)
+		marshal.encode(42, nil, f)
+		f:seek('set')
+		t = marshal.decode(f)
+		assertEquals(#t, 2000)
+		assertEquals(marshal.decode(f), 42)
+		f:close()
+		assertError(marshal.decode, string.sub(bytes, 1, 100))
+	end
+
+	function StringLibraryExtensions:TestMarshalFormats()
+		local rows = {}
+		for i = 1, 100 do
+			rows[i] = { name = 'row', value = i * 0.5, id = -i, flag = i % 2 == 0 }
+		end
+		rows[50] = nil
+		rows.shared = rows[1]
+		rows.numbers = { 0, 2^53, -2^53, 2^60, 1/0, -1/0, 0.1 }
+
+		local v1 = marshal.encode(rows, nil, nil, 1)
+		local v2 = marshal.encode(rows, nil, nil, 2)
+		assert(#v2 * 2 < #v1)
+		assertError(marshal.encode, rows, nil, nil, 3)
+
+		for _, bytes in ipairs({ v1, v2 }) do
+			local t = marshal.decode(bytes)
+			assertEquals(t[100].value, 50)
+			assertEquals(t[99].id, -99)
+			assertEquals(t[2].flag, true)
+			assertEquals(t[50], nil)
+			assert(t.shared == t[1])
+			assertEquals(t.numbers, rows.numbers)
+		end
+		assertEquals(1 / marshal.decode(marshal.encode(-0, nil, nil, 2)), -1 / 0)
+		assertError(marshal.decode, string.sub(v2, 1, #v2 - 1))
+
+		-- a hash part far larger than its pairs, at the end of the blob
+		local emptied = {}
+		for i = 1, 64 do emptied['k' .. i] = i end
+		for i = 1, 64 do emptied['k' .. i] = nil end
+		assertEquals(next(marshal.decode(marshal.encode(emptied))), nil)
+		assertEquals(next(marshal.decode(marshal.encode({ 1, emptied }))[2]), nil)
+
+		-- a corrupt array size in a stream only presizes a bounded table
+		local one = marshal.encode({ true }, nil, nil, 2)
+		local at  = string.find(one, '\8\1\0\2\0', 1, true)
+		assert(at)
+		local f = io.tmpfile()
+		f:write(string.sub(one, 1, at - 1), '\8\255\255\255\255\7\0\2\0')
+		f:seek('set')
+		assertError(marshal.decode, f)
+		f:close()
+
+		-- __persist hooks appending to the buffer being decoded move its
+		-- content; the decoder follows it, and fails if it is cut off
+		local grow = setmetatable({}, { __persist = function()
+			return function()
+				marshal_test_sink:append(string.rep('x', 65536))
+				return 'grown'
+			end
+		end })
+		local cut = setmetatable({}, { __persist = function()
+			return function()
+				marshal_test_sink:clear()
+				return 'cut'
+			end
+		end })
+		for _, args in ipairs({ { 1 }, { 2 }, { 2, true } }) do
+			local b = buffer.new()
+			marshal.encode({ grow, 'after', grow, { 'nested' } }, nil, b, args[1], args[2])
+			marshal_test_sink = b
+			local t = marshal.decode(b)
+			assertEquals(t[1], 'grown')
+			assertEquals(t[2], 'after')
+			assertEquals(t[4][1], 'nested')
+
+			b:clear()
+			marshal.encode({ cut, 'after' }, nil, b, args[1], args[2])
+			assertError(marshal.decode, b)
+		end
+		marshal_test_sink = nil
+	end
+
+	function StringLibraryExtensions:TestMarshalDelta()
+		local world = { entities = {}, tick = 0 }
+		for i = 1, 200 do
+			world.entities[i] = { id = i, hp = 100, pos = { x = i, y = -i } }
+		end
+		world.player = world.entities[1]
+
+		local snap, recv = marshal.snapshot(), marshal.snapshot()
+		local full = marshal.encode_delta(world, snap)
+		local copy = marshal.decode_delta(full, recv)
+		assertEquals(copy.entities[200].pos.y, -200)
+		assert(copy.player == copy.entities[1])
+
+		world.tick = 1
+		world.entities[7].hp = 50
+		world.entities[8].pos = nil
+		world.entities[201] = { id = 201 }
+		world.player = nil
+		local delta = marshal.encode_delta(world, snap)
+		assert(#delta * 20 < #full)
+		assert(marshal.decode_delta(delta, recv) == copy)
+		assertEquals(copy.tick, 1)
+		assertEquals(copy.entities[7].hp, 50)
+		assertEquals(copy.entities[8].pos, nil)
+		assertEquals(copy.entities[201].id, 201)
+		assertEquals(copy.player, nil)
+
+		-- a failed delta leaves the snapshot as it was
+		world.tick = 2
+		world.entities[9].hp = 1
+		world.entities[202] = { id = 202, file = io.stdout }
+		assertError(marshal.encode_delta, world, snap)
+		world.entities[202].file = nil
+		world.entities[203] = { id = 203 }
+		marshal.decode_delta(marshal.encode_delta(world, snap), recv)
+		assertEquals(copy.tick, 2)
+		assertEquals(copy.entities[9].hp, 1)
+		assertEquals(copy.entities[201].id, 201)
+		assertEquals(copy.entities[202].id, 202)
+		assertEquals(copy.entities[203].id, 203)
+
+		-- values with a __persist hook are sent again even when only their
+		-- content changed
+		world.clock = setmetatable({ time = 10 }, { __persist = function(self)
+			local time = self.time
+			return function() return { time = time } end
+		end })
+		marshal.decode_delta(marshal.encode_delta(world, snap), recv)
+		assertEquals(copy.clock.time, 10)
+		world.clock.time = 11
+		marshal.decode_delta(marshal.encode_delta(world, snap), recv)
+		assertEquals(copy.clock.time, 11)
+		world.clock = nil
+		marshal.decode_delta(marshal.encode_delta(world, snap), recv)
+		assertEquals(copy.clock, nil)
+
+		assertEquals(#marshal.encode_delta(world, snap), #marshal.encode_delta(world, marshal.snapshot(world)))
+	end
+
+	function StringLibraryExtensions:TestMarshalOpen()
+		local t = { name = 'root', list = { 1, 2, 'three' }, deep = { a = { b = { c = 'leaf' } } } }
+		t.self, t.again = t, t.list
+		local s = marshal.encode(t, nil, nil, 2)
+
+		local p = marshal.open(s)
+		assertEquals(next(p), nil)
+		assertEquals(p.name, 'root')
+		assert(next(p) ~= nil)
+		assert(p.self == p)
+		assert(p.again == p.list)
+		assertEquals(p.list[3], 'three')
+		assertEquals(#p.list, 3)
+		assertEquals(p.deep.a.b.c, 'leaf')
+
+		local q = marshal.open(s)
+		marshal.materialize(q.deep, true)
+		assertEquals(rawget(rawget(rawget(q.deep, 'a'), 'b'), 'c'), 'leaf')
+		assertEquals(marshal.materialize(42), 42)
+
+		local b = buffer.new():append(s):append(marshal.encode('next'))
+		assertEquals(marshal.open(b).list[2], 2)
+		assertEquals(marshal.decode(b), 'next')
+
+		assertError(marshal.open, marshal.encode(t, nil, nil, 1))
+
+		-- a failed fill leaves a proxy behind, which the next lookup fills
+		local flaky = setmetatable({}, { __persist = function()
+			return function()
+				marshal_test_calls = marshal_test_calls + 1
+				if marshal_test_calls == 1 then error('flaky') end
+				return 'restored'
+			end
+		end })
+		marshal_test_calls = 0
+		local list = marshal.open(marshal.encode({ list = { 1, flaky, 3 } }, nil, nil, 2)).list
+		assertError(function() return list[1] end)
+		assertEquals(next(list), nil)
+		assertEquals(list[2], 'restored')
+		assertEquals(#list, 3)
+		marshal_test_calls = nil
+	end
+
+	function StringLibraryExtensions:TestCompress()
+		local text = string.rep('entity hp=100 pos=(1,2) ', 5000) .. 'tail'
+		local b = buffer.new():append(text):compress()
+		assert(#b < #text / 10)
+		assertEquals(b:decompress():tostring(), text)
+		assertEquals(buffer.compress(''):decompress():tostring(), '')
+		assertEquals(buffer.decompress(buffer.compress('abc'), buffer.new():append('>')):tostring(), '>abc')
+		assertError(buffer.decompress, 'not a frame')
+
+		local world = { entities = {} }
+		for i = 1, 5000 do
+			world.entities[i] = { id = i, name = 'npc_' .. (i % 50), hp = 100, pos = { x = i / 3, y = 0 } }
+		end
+		local raw = marshal.encode(world)
+		local z = marshal.encode(world, nil, nil, 2, true)
+		assert(#z * 2 < #raw)
+		assertEquals(marshal.decode(z).entities[4321].name, 'npc_21')
+
+		local s = buffer.new()
+		marshal.encode(world, nil, s, 2, true)
+		marshal.encode('after', nil, s, 2, true)
+		assertEquals(marshal.decode(s).entities[5000].pos.x, 5000 / 3)
+		assertEquals(marshal.decode(s), 'after')
+		assertError(marshal.encode, world, nil, nil, 1, true)
+	end
+
+	function StringLibraryExtensions:TestContainer()
+		local function keys(gen)
+			local t = {}
+			for k in gen do t[#t + 1] = k end
+			return table.concat(t, ',')
+		end
+
+		local s = container.new_set('number', { 5, 3, 1, 3, 9 })
+		assertEquals(#s, 4)
+		assertEquals(keys(s:iter()), '1,3,5,9')
+		assertEquals(keys(s:lower_bound(3)), '3,5,9')
+		assertEquals(keys(s:upper_bound(3)), '5,9')
+		assertEquals(keys(s:range(2, 6)), '3,5')
+		assertEquals(select(2, s:insert(4)), true)
+		assertEquals(select(2, s:insert(4)), false)
+		assertEquals(select(2, s:remove(4)), true)
+		assertError(s.insert, s, 0 / 0)
+		assert(container.new_set('number', { 1, 3 }):is_subset_of(s))
+		assertEquals(keys(s:sym_diff(container.new_set('number', { 1, 7 })):iter()), '3,5,7,9')
+		assert(s == container.new_set('number', { 9, 7, 5, 3 }))
+		assert(container.is_container(s) and not container.is_container({}))
+
+		local h = container.new_hash_set('string', { 'x', 'y', 'x' })
+		assertEquals(#h, 2)
+		assert(h:contains('x') and not h:contains('z'))
+		local ok, err = pcall(h.contains, h, 5)
+		assert(not ok and string.find(err, 'string expected', 1, true), err)
+		ok, err = pcall(h.insert_all, h, { 1 })
+		assert(not ok and string.find(err, 'got number', 1, true), err)
+		ok, err = pcall(s.contains, s, 0 / 0)
+		assert(not ok and string.find(err, 'NaN', 1, true), err)
+
+		for _, new in ipairs({ 'new_map', 'new_hash_map', 'new_vector_map' }) do
+			local m = container[new]('string', { b = 2, a = 1 })
+			assertEquals(m:get('b'), 2)
+			m:set('c', false)
+			assertEquals(m:get('c'), false)
+			assertEquals(select(2, m:insert('c', 3)), false)
+			m:set('c', nil)
+			assertEquals(#m, 2)
+			for k, v in m:iter() do m:set(k, v * 10) end
+			assertEquals(m:get('a'), 10)
+			assertError(function() for k in m:iter() do m:set(k .. k, 1) end end)
+			assertError(m.insert_all, m, { 1 })
+		end
+		assertEquals(keys(container.new_vector_map('string', { b = 1, a = 1, c = 1 }):lower_bound('b')), 'b,c')
+	end
+
+	function StringLibraryExtensions:TestPriorityQueue()
+		local q = container.new_queue()
+		assertEquals(q:pop(), nil)
+		local h = {}
+		for i, p in ipairs({ 5, 1, 3, 1, 9, 7 }) do h[i] = q:push(p, 'v' .. i) end
+		assertEquals(#q, 6)
+		assertEquals(q:peek(), 'v2')
+
+		assert(q:update_priority(h[5], 0))
+		assertEquals(q:priority(h[5]), 0)
+		assertEquals(q:remove(h[3]), 'v3')
+		assertEquals(q:remove(h[3]), nil)
+		assertEquals(q:update_priority(h[3], 1), false)
+
+		local due, n = q:pop_until(1)
+		assertEquals(n, 3)
+		assertEquals(table.concat(due, ','), 'v5,v2,v4')
+		assertEquals(select(2, q:pop()), 5)
+		assertEquals(q:pop(), 'v6')
+		assertEquals(#q, 0)
+		assertError(q.push, q, 0 / 0, 'nan')
+
+		-- handles aren't reused, a stale one can't cancel a later entry
+		local old = q:push(1, 'a')
+		q:pop()
+		local new = q:push(2, 'b')
+		assert(new ~= old)
+		assertEquals(q:remove(old), nil)
+		assertEquals(q:update_priority(old, 0), false)
+		assertEquals(q:priority(new), 2)
+		assertEquals(q:pop(), 'b')
+	end
+
 	function StringLibraryExtensions:TestTrim()
 		local trim = string.trim
 		assertError(trim, nil)
@@ -86,6 +795,15 @@ local StringLibraryExtensions = {}
 		assertEquals(trim('\0'                  ), '')
 	end
 
+	function StringLibraryExtensions:TestTrimLongInput()
+		local pad  = string.rep(' \t\r\n', 20)
+		local word = string.rep('ab ', 20) .. 'c'
+		assertEquals(string.trim(pad .. word .. pad ), word)
+		assertEquals(string.ltrim(pad .. word .. pad), word .. pad)
+		assertEquals(string.rtrim(pad .. word .. pad), pad .. word)
+		assertEquals(string.trim(pad                ), '')
+	end
+
 	function StringLibraryExtensions:TestLeftTrim()
 		local ltrim = string.ltrim
 		assertError(ltrim, nil)
@@ -23,6 +23,9 @@ extern "C"
 
 #include "lua.h"
 #include "lauxlib.h"
+#if LUAXS_STR_PERSISTENT_BUFFER
+#  include "lxs_string.hpp"
+#endif
 
 
 #define FREELIST_REF	0	/* free list of references */
@@ -337,7 +340,7 @@ LUALIB_API void luaI_openlib(lua_State* L,
     }
     lua_pop(L, nup);  /* remove upvalues */
 
-    lxs_assert_stack_end(L, name ? 1 : 0);
+    lxs_assert_stack_end(L, (name ? 1 : 0) - nup);
 }
 
 
@@ -414,15 +417,15 @@ LUALIB_API const char *luaL_gsub (lua_State *L, const char *s, const char *p,
                                                                const char *r) {
   const char *wild;
   size_t l = strlen(p);
-  luaL_Buffer b;
-  luaL_buffinit(L, &b);
+  xbuf_decl(b);
+  xbuf_init(L, b);
   while ((wild = strstr(s, p)) != NULL) {
-    luaL_addlstring(&b, s, wild - s);  /* push prefix */
-    luaL_addstring(&b, r);  /* push replacement in place of pattern */
+    xbuf_addlstring(L, b, s, wild - s);  /* push prefix */
+    xbuf_addstring(L, b, r);  /* push replacement in place of pattern */
     s = wild + l;  /* continue after `p' */
   }
-  luaL_addstring(&b, s);  /* push last suffix */
-  luaL_pushresult(&b);
+  xbuf_addstring(L, b, s);  /* push last suffix */
+  xbuf_pushresult(L, b);
   return lua_tostring(L, -1);
 }
 
@@ -165,6 +165,9 @@ typedef struct luaL_Buffer
 #  define xbuf_addvalue(L, name)         luaL_addvalue(&name)
 #  define xbuf_addliteral(L, name, lit)  luaL_addliteral(&name, "" lit)
 #  define xbuf_pushresult(L, name)       luaL_pushresult(&name)
+#  define xbuf_ptr_t                     luaL_Buffer*
+#  define xbuf_ref(name)                 (&name)
+#  define xbuf_deref(ptr)                (*ptr)
 #endif
 
 LUALIB_API void (luaL_buffinit) (lua_State *L, luaL_Buffer *B);
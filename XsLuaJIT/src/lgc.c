@@ -267,6 +267,9 @@ static void traversestack (global_State *g, lua_State *l) {
   for (; o <= lim; o++)
     setnilvalue(o);
   checkstacksizes(l, lim);
+#if LUAXS_STR_PERSISTENT_BUFFER
+  lxs_spb_trim(g->mainthread, l);
+#endif
 }
 
 
@@ -487,6 +490,8 @@ void luaC_freeall (lua_State *L) {
   sweepwholelist(L, &g->rootgc);
   for (i = 0; i < g->strt.size; i++)  /* free all string lists */
     sweepwholelist(L, &g->strt.hash[i]);
+  for (i = 0; i < g->strt.oldsize; i++)  /* and those not yet migrated */
+    sweepwholelist(L, &g->strt.old[i]);
 }
 
 
@@ -571,8 +576,13 @@ static l_mem singlestep (lua_State *L) {
     }
     case GCSsweepstring: {
       lu_mem old = g->totalbytes;
-      sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
-      if (g->sweepstrgc >= g->strt.size)  /* nothing more to sweep? */
+      stringtable *tb = &g->strt;
+      int i = g->sweepstrgc++;
+      if (i < tb->oldsize)  /* old buckets (if migrating) come first */
+        sweepwholelist(L, &tb->old[i]);
+      else
+        sweepwholelist(L, &tb->hash[i - tb->oldsize]);
+      if (g->sweepstrgc >= tb->oldsize + tb->size)  /* nothing more to sweep? */
         g->gcstate = GCSsweep;  /* end sweep-string phase */
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
@@ -613,6 +623,7 @@ void luaC_step (lua_State *L) {
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
   g->gcdept += g->totalbytes - g->GCthreshold;
+  luaS_migrate(L, LUAXS_CORE_STRMIGRATE);  /* pending string table resize */
   do {
     lim -= singlestep(L);
     if (g->gcstate == GCSpause)
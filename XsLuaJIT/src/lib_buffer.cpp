@@ -11,7 +11,13 @@ extern "C"
 #include "lauxlib.h"
 #include "lualib.h"
 
+#include "lobject.h"
 #include "lxs_string.hpp"
+#include "lxs_skernel.h"
+#include "lxs_lz.h"
+
+#include <errno.h>
+#include <stdint.h>
 
 
 //==============================================================================
@@ -95,13 +101,22 @@ static __inline size_t opt_length(lua_State* const L,
 }
 
 
+/// Invalidates all views of the buffer s; for functions that move or drop
+/// content.
+static __inline void touch(lxs_string* const s)
+{
+    ++reinterpret_cast<lxs_sbuffer*>(s)->gen;
+}
+
+
 //------------------------------------------------------------------------------
 
 /// buffer.cap(buffer, [size, [force = true]])
 /// _buffer_:cap([size, [force = true]])
 ///
 /// Returns the specified *buffer*'s current memory capacity; that is how much
-/// memory it has allocated.
+/// memory it has allocated. Short buffers use inline storage, in which case
+/// the capacity is LUAXS_STR_INLINE_CAPACITY and nothing is allocated.
 ///
 /// If the optional argument *size* is specified, allows changing the *buffer*'s
 /// capacity. The optional third argument *force* changes how that is done.
@@ -112,7 +127,8 @@ static __inline size_t opt_length(lua_State* const L,
 /// Example Usage:
 ///     local b = buffer.new()
 ///     b:cap(100) --> will allocate 100 bytes of memory
-///     b:cap(0) --> will deallocate all previously allocated memory
+///     b:cap(0) --> will deallocate all previously allocated memory, the
+///                  buffer falls back to its inline storage
 static int libE_cap(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
@@ -125,6 +141,7 @@ static int libE_cap(lua_State* const L)
 
         bool force = luaL_optbool(L, 3, true);
 
+        touch(s);
         lxs_srealloc(L, s, static_cast<size_t>(msize), force);
     }
     lua_pushinteger(L, static_cast<lua_Integer>(lxs_scap(s)));
@@ -148,18 +165,21 @@ static int libE_len(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    lxs_string* s = lxs_scheckbuffer(L, 1);
+    lxs_sbuffer* b = lxs_sbcheck(L, 1);
     if (lua_isnumber(L, 2))
     {
+        lxs_string* s = lxs_scheckbuffer(L, 1);
+        touch(s);
+
         int delta = luaL_checkinteger(L, 2);
         if (delta == 0)
-            lxs_sclear(L, s);
+            lxs_sbclear(L, b);
         else if (delta < 0)
             lxs_sshrink(L, s, abs(delta));
         else
             lxs_sexpand(L, s, delta);
     }
-    lua_pushinteger(L, static_cast<lua_Integer>(lxs_slen(s)));
+    lua_pushinteger(L, static_cast<lua_Integer>(lxs_sblen(b)));
 
     lxs_assert_stack_end(L, 1);
     return 1;
@@ -179,7 +199,7 @@ static int libE_clear(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    lxs_sclear(L, lxs_scheckbuffer(L, 1));
+    lxs_sbclear(L, lxs_sbcheck(L, 1));
 
     lxs_assert_stack_end(L, 0);
     lua_settop(L, 1);
@@ -375,6 +395,7 @@ static int libE_rep(lua_State* const L)
 /// Returns the *buffer* it was called on.
 /// Appends to a buffer all specified arguments, in the specified order.
 /// All arguments must be strings.
+/// Chunked buffers append in constant time, without moving existing content.
 ///
 /// Example Usage:
 ///     local b = buffer.new()
@@ -386,7 +407,7 @@ static int libE_append(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    lxs_string* s = lxs_scheckbuffer(L, 1);
+    lxs_sbuffer* b = lxs_sbcheck(L, 1);
 
     size_t      len;
     const char* str;
@@ -399,14 +420,14 @@ static int libE_append(lua_State* const L)
         {
             str = luaL_checklstring(L, i, &len);
             if (len > 0)
-                lxs_sappend(L, s, str, len);
+                lxs_sbappend(L, b, str, len);
         }
     }
     else
     {
         str = luaL_checklstring(L, 2, &len);
         if (len > 0)
-            lxs_sappend(L, s, str, len);
+            lxs_sbappend(L, b, str, len);
     }
     lxs_assert_stack_end(L, 0);
 
@@ -432,6 +453,7 @@ static int libE_insert(lua_State* const L)
     size_t len;
     const char* str = lxs_schecklstring(L, 3, &len);
 
+    touch(s);
     lxs_sinsert(L, s, off, str, len);
     lxs_assert_stack_end(L, 0);
 
@@ -441,6 +463,86 @@ static int libE_insert(lua_State* const L)
     return 1;
 }
 
+/// buffer.chunked(b, [chunk_size])
+/// buffer:chunked([chunk_size])
+///
+/// Returns the *buffer* it was called on.
+/// Switches the *buffer* to chunked mode: appended strings are stored in a
+/// list of *chunk_size* bytes large chunks (default: LUAXS_STR_CHUNK_SIZE)
+/// rather than one contiguous block, so appending never moves the existing
+/// content. The chunks are only merged when the content is needed as a whole,
+/// e.g. by tostring or any function accessing an offset.
+/// Passing false (or 0) merges all chunks and leaves chunked mode.
+///
+/// Example Usage:
+///     local b = buffer.new():chunked()
+///     for i = 1, 100000 do b:append(line(i)) end
+///     b:write(io.open('save.txt', 'wb')) --> writes chunk by chunk
+static int libE_chunked(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_sbuffer* b = lxs_sbcheck(L, 1);
+
+    size_t chunk_size = LUAXS_STR_CHUNK_SIZE;
+    if (lua_isboolean(L, 2))
+    {
+        if (!lua_toboolean(L, 2))
+            chunk_size = 0u;
+    }
+    else if (!lua_isnoneornil(L, 2))
+    {
+        int n = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, n >= 0, 2, "must be greater or equal to zero");
+        chunk_size = static_cast<size_t>(n);
+    }
+
+    lxs_sbchunked(L, b, chunk_size);
+    lxs_assert_stack_end(L, 0);
+
+    lua_settop(L, 1);
+
+    lxs_assert_stack_at(L, 1);
+    return 1;
+}
+
+/// buffer.write(b, file)
+/// buffer:write(file)
+///
+/// Writes the *buffer*'s content to *file*, an open io library file handle.
+/// Chunked buffers are written chunk by chunk, without merging them first.
+/// Returns the *buffer* it was called on; or nil and an error message if
+/// writing failed.
+///
+/// Example Usage:
+///     local f = io.open('report.txt', 'wb')
+///     b:write(f)
+///     f:close()
+static int libE_write(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_sbuffer* b = lxs_sbcheck(L, 1);
+    FILE*        f = lxs_checkfilep(L, 2);
+    if (f == NULL)
+        lxs_error(L, "attempt to use a closed file");
+
+    if (!lxs_sbfwrite(L, b, f))
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+
+        lxs_assert_stack_end(L, 2);
+        return 2;
+    }
+    lxs_assert_stack_end(L, 0);
+
+    lua_settop(L, 1);
+
+    lxs_assert_stack_at(L, 1);
+    return 1;
+}
+
 /// buffer.(b)
 /// buffer:()
 ///
@@ -548,6 +650,7 @@ static int libE_remove(lua_State* const L)
     size_t off = opt_offset(L, s, 2);
     size_t len = opt_length(L, s, off, 3);
 
+    touch(s);
     lxs_sremove(L, s, off, len);
     lxs_assert_stack_end(L, 0);
 
@@ -567,7 +670,9 @@ static int libE_trim(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    lxs_strim(L, lxs_scheckbuffer(L, 1));
+    lxs_string* s = lxs_scheckbuffer(L, 1);
+    touch(s);
+    lxs_strim(L, s);
 
     lxs_assert_stack_end(L, 0);
 
@@ -587,7 +692,9 @@ static int libE_ltrim(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    lxs_sltrim(L, lxs_scheckbuffer(L, 1));
+    lxs_string* s = lxs_scheckbuffer(L, 1);
+    touch(s);
+    lxs_sltrim(L, s);
 
     lxs_assert_stack_end(L, 0);
 
@@ -607,7 +714,9 @@ static int libE_rtrim(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    lxs_srtrim(L, lxs_scheckbuffer(L, 1));
+    lxs_string* s = lxs_scheckbuffer(L, 1);
+    touch(s);
+    lxs_srtrim(L, s);
 
     lxs_assert_stack_end(L, 0);
 
@@ -638,6 +747,33 @@ static int libE_split(lua_State* const L)
     return lxs_split(L, lxs_scstr(s), lxs_slen(s), seps);
 }
 
+/// buffer.gsplit(b, seps)
+/// buffer:gsplit(seps)
+///
+/// Returns an iterator over the tokens of the *buffer*, separated by any of the
+/// characters in *seps*. Each step yields the 1-based offset and the length of
+/// the next token (as buffer:split would return it), nothing is copied.
+/// The buffer is re-read on every step; iteration ends early if it shrank.
+///
+/// Example Usage:
+///     for off, len in b:gsplit('\n') do
+///         parse_line(b, off, len)
+///     end
+static int libE_gsplit(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_scheckbuffer(L, 1);
+
+    size_t      slen;
+    const char* seps = luaL_checklstring(L, 2, &slen);
+
+    luaL_argcheck(L, slen > 0, 2, "separator cannot be nil nor empty");
+
+    lxs_assert_stack_end(L, 0);
+    return lxs_gsplit(L, 1, seps, slen, true);
+}
+
 /// buffer.(b)
 /// buffer:()
 ///
@@ -816,13 +952,796 @@ static int libM_gc(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    lxs_sfreebuffer(L, lxs_stobuffer(L, 1));
+    // no lxs_stobuffer; that would flatten a chunked buffer first
+    lxs_sfreebuffer(L, static_cast<lxs_string*>(lua_touserdata(L, 1)));
 
     lxs_assert_stack_end(L, 0);
     return 0;
 }
 
 
+//------------------------------------------------------------------------------
+// binary fields
+//
+// Format characters (pack/unpack; write_*/read_* use the same codes):
+//     b/B  signed/unsigned  8 bit integer
+//     h/H  signed/unsigned 16 bit integer
+//     i/I  signed/unsigned 32 bit integer
+//     l/L  signed/unsigned 64 bit integer (exact up to 2^53)
+//     f    32 bit float
+//     d    64 bit float
+//     z    zero-terminated string
+//     s    string prefixed by its length as an unsigned 32 bit integer
+//     <    little endian (default), > big endian, = native
+// Spaces are ignored. Integer values must fit their field, fractions are
+// truncated.
+
+static bool bin_native_big()
+{
+    const unsigned short one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one) == 0;
+}
+
+/// Returns true for an endianness character and updates big accordingly.
+static bool bin_endian(char c, bool* big)
+{
+    switch (c)
+    {
+    case '<': *big = false;            return true;
+    case '>': *big = true;             return true;
+    case '=': *big = bin_native_big(); return true;
+    }
+    return false;
+}
+
+static bool bin_optbig(lua_State* const L, int narg)
+{
+    bool big = false;
+
+    const char* e = luaL_optstring(L, narg, "<");
+    if (e[0] == '\0' || e[1] != '\0' || !bin_endian(e[0], &big))
+        luaL_argerror(L, narg, "invalid endianness (expected '<', '>' or '=')");
+    return big;
+}
+
+static size_t bin_size(lua_State* const L, char code)
+{
+    switch (code)
+    {
+    case 'b': case 'B':
+        return 1u;
+    case 'h': case 'H':
+        return 2u;
+    case 'i': case 'I': case 'f':
+        return 4u;
+    case 'l': case 'L': case 'd':
+        return 8u;
+    }
+
+    lxs_error(L, "invalid format option " LUA_QL("%c"), code);
+    return 0u;
+}
+
+static void bin_put(lua_State* const L,
+                    lxs_sbuffer* const b,
+                    uint64_t v,
+                    size_t size,
+                    bool big)
+{
+    unsigned char tmp[8];
+    for (size_t i = 0; i < size; ++i)
+        tmp[big ? size - 1u - i : i] = static_cast<unsigned char>(v >> (8u * i));
+
+    lxs_sbappend(L, b, reinterpret_cast<const char*>(tmp), size);
+}
+
+/// Bytes left to read; the read cursor may be past the end. Lengths are
+/// compared against this instead of added to rpos, which could wrap.
+static __inline size_t bin_left(const lxs_sbuffer* const b)
+{
+    return b->rpos < b->s.len ? b->s.len - b->rpos : 0u;
+}
+
+static uint64_t bin_get(lua_State* const L,
+                        lxs_sbuffer* const b,
+                        size_t size,
+                        bool big)
+{
+    if (size > bin_left(b))
+        lxs_error(L, "attempt to read beyond the end of the buffer");
+
+    const unsigned char* p =
+        reinterpret_cast<const unsigned char*>(&b->s.data[b->rpos]);
+    b->rpos += size;
+
+    uint64_t v = 0u;
+    for (size_t i = 0; i < size; ++i)
+        v |= static_cast<uint64_t>(p[big ? size - 1u - i : i]) << (8u * i);
+    return v;
+}
+
+/// Appends the value at narg as field code.
+static void bin_write(lua_State* const L,
+                      lxs_sbuffer* const b,
+                      char code,
+                      bool big,
+                      int narg)
+{
+    switch (code)
+    {
+    case 'z': {
+        size_t      len;
+        const char* str = luaL_checklstring(L, narg, &len);
+        luaL_argcheck(L, strlen(str) == len, narg, "contains embedded zeros");
+        lxs_sbappend(L, b, str, len + 1u);
+        return;
+        }
+    case 's': {
+        size_t      len;
+        const char* str = luaL_checklstring(L, narg, &len);
+        bin_put(L, b, static_cast<uint32_t>(len), 4u, big);
+        lxs_sbappend(L, b, str, len);
+        return;
+        }
+    case 'f': {
+        float    f = static_cast<float>(luaL_checknumber(L, narg));
+        uint32_t u;
+        memcpy(&u, &f, sizeof(u));
+        bin_put(L, b, u, 4u, big);
+        return;
+        }
+    case 'd': {
+        double   d = static_cast<double>(luaL_checknumber(L, narg));
+        uint64_t u;
+        memcpy(&u, &d, sizeof(u));
+        bin_put(L, b, u, 8u, big);
+        return;
+        }
+    }
+
+    const size_t     size   = bin_size(L, code);
+    const bool       sign   = code >= 'a' && code <= 'z';
+    const lua_Number n      = luaL_checknumber(L, narg);
+    const lua_Number half   = static_cast<lua_Number>(
+                                  static_cast<uint64_t>(1) << (8u * size - 1u)
+                              );
+
+    // converting NaN, inf or anything out of range would be undefined
+    if (!(n >= (sign ? -half : 0) && n < (sign ? half : 2 * half)))
+        luaL_argerror(L, narg, "value out of range");
+
+    const uint64_t v = sign
+                     ? static_cast<uint64_t>(static_cast<int64_t>(n))
+                     : static_cast<uint64_t>(n);
+    bin_put(L, b, v, size, big);
+}
+
+/// Reads a field code at the read cursor and pushes its value.
+static void bin_read(lua_State* const L,
+                     lxs_sbuffer* const b,
+                     char code,
+                     bool big)
+{
+    switch (code)
+    {
+    case 'z': {
+        const char* front = &b->s.data[min(b->rpos, b->s.len)];
+        const char* it    = lxs_kfindc(front, b->s.len - (front - b->s.data), '\0');
+        if (!it)
+            lxs_error(L, "attempt to read beyond the end of the buffer");
+        lua_pushlstring(L, front, it - front);
+        b->rpos += (it - front) + 1u;
+        return;
+        }
+    case 's': {
+        const size_t len = static_cast<size_t>(bin_get(L, b, 4u, big));
+        if (len > bin_left(b))
+            lxs_error(L, "attempt to read beyond the end of the buffer");
+        lua_pushlstring(L, &b->s.data[b->rpos], len);
+        b->rpos += len;
+        return;
+        }
+    case 'f': {
+        uint32_t u = static_cast<uint32_t>(bin_get(L, b, 4u, big));
+        float    f;
+        memcpy(&f, &u, sizeof(f));
+        lua_pushnumber(L, static_cast<lua_Number>(f));
+        return;
+        }
+    case 'd': {
+        uint64_t u = bin_get(L, b, 8u, big);
+        double   d;
+        memcpy(&d, &u, sizeof(d));
+        lua_pushnumber(L, static_cast<lua_Number>(d));
+        return;
+        }
+    }
+
+    const size_t size = bin_size(L, code);
+    uint64_t     v    = bin_get(L, b, size, big);
+
+    if (code >= 'a' && code <= 'z')
+    {
+        // sign-extend
+        if (size < 8u && (v >> (8u * size - 1u)) & 1u)
+            v |= ~static_cast<uint64_t>(0) << (8u * size);
+        lua_pushnumber(L, static_cast<lua_Number>(static_cast<int64_t>(v)));
+    }
+    else
+        lua_pushnumber(L, static_cast<lua_Number>(v));
+}
+
+static int bin_write_field(lua_State* const L, char code)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_sbuffer* b = lxs_sbcheck(L, 1);
+    bin_write(L, b, code, bin_optbig(L, 3), 2);
+    lxs_assert_stack_end(L, 0);
+
+    lua_settop(L, 1);
+
+    lxs_assert_stack_at(L, 1);
+    return 1;
+}
+
+static int bin_read_field(lua_State* const L, char code)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_scheckbuffer(L, 1); // reading needs contiguous content
+    bin_read(L, lxs_sbcheck(L, 1), code, bin_optbig(L, 2));
+
+    lxs_assert_stack_end(L, 1);
+    return 1;
+}
+
+/// buffer.write_u8(b, value, [endian = '<']) ... buffer.write_f64
+/// buffer:write_u8(value, [endian = '<']) ...
+///
+/// Returns the *buffer* it was called on.
+/// Appends *value* as a binary field; available for i8, u8, i16, u16, i32,
+/// u32, i64, u64, f32 and f64. *endian* is '<' (little), '>' (big) or '='
+/// (native).
+///
+/// buffer.read_u8(b, [endian = '<']) ... buffer.read_f64
+/// buffer:read_u8([endian = '<']) ...
+///
+/// Reads a binary field at the *buffer*'s read cursor and advances it.
+///
+/// Example Usage:
+///     local b = buffer.new():write_u16(513):write_f32(0.5, '>')
+///     b:read_u16() --> 513
+///     b:read_f32('>') --> 0.5
+#define BIN_FIELD(name, code)                       \
+    static int libE_write_##name(lua_State* const L) \
+    {                                                \
+        return bin_write_field(L, code);             \
+    }                                                \
+    static int libE_read_##name(lua_State* const L)  \
+    {                                                \
+        return bin_read_field(L, code);              \
+    }
+
+BIN_FIELD(i8,  'b')
+BIN_FIELD(u8,  'B')
+BIN_FIELD(i16, 'h')
+BIN_FIELD(u16, 'H')
+BIN_FIELD(i32, 'i')
+BIN_FIELD(u32, 'I')
+BIN_FIELD(i64, 'l')
+BIN_FIELD(u64, 'L')
+BIN_FIELD(f32, 'f')
+BIN_FIELD(f64, 'd')
+
+#undef BIN_FIELD
+
+/// buffer.pack(b, format, ...)
+/// buffer:pack(format, ...)
+///
+/// Returns the *buffer* it was called on.
+/// Appends all values as binary fields described by *format*, see above.
+///
+/// Example Usage:
+///     b:pack('<HIz', 1, 70000, 'name')
+static int libE_pack(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_sbuffer* b   = lxs_sbcheck(L, 1);
+    const char*  fmt = luaL_checkstring(L, 2);
+
+    bool big  = false;
+    int  narg = 3;
+    for (; *fmt; ++fmt)
+    {
+        if (*fmt == ' ' || bin_endian(*fmt, &big))
+            continue;
+        bin_write(L, b, *fmt, big, narg++);
+    }
+    lxs_assert_stack_end(L, 0);
+
+    lua_settop(L, 1);
+
+    lxs_assert_stack_at(L, 1);
+    return 1;
+}
+
+/// buffer.unpack(b, format)
+/// buffer:unpack(format)
+///
+/// Reads the binary fields described by *format* at the *buffer*'s read
+/// cursor, advances it and returns their values.
+///
+/// Example Usage:
+///     local id, size, name = b:unpack('<HIz')
+static int libE_unpack(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_scheckbuffer(L, 1); // reading needs contiguous content
+    lxs_sbuffer* b   = lxs_sbcheck(L, 1);
+    const char*  fmt = luaL_checkstring(L, 2);
+
+    bool big = false;
+    int  n   = 0;
+    for (; *fmt; ++fmt)
+    {
+        if (*fmt == ' ' || bin_endian(*fmt, &big))
+            continue;
+        luaL_checkstack(L, 1, "too many results to unpack");
+        bin_read(L, b, *fmt, big);
+        ++n;
+    }
+
+    lxs_assert_stack_end(L, n);
+    return n;
+}
+
+/// buffer.seek(b, [position])
+/// buffer:seek([position])
+///
+/// Returns the *buffer*'s read cursor (1-based position of the next byte
+/// read_*/unpack will read). If *position* is specified, moves the cursor
+/// there first; len + 1 is the end of the buffer.
+static int libE_seek(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_sbuffer* b = lxs_sbcheck(L, 1);
+    if (!lua_isnoneornil(L, 2))
+    {
+        int pos = luaL_checkinteger(L, 2);
+        luaL_argcheck(L,
+            pos >= 1 && static_cast<size_t>(pos) <= lxs_sblen(b) + 1u,
+            2, "out of range");
+        b->rpos = static_cast<size_t>(pos) - 1u;
+    }
+    lua_pushinteger(L, static_cast<lua_Integer>(b->rpos + 1u));
+
+    lxs_assert_stack_end(L, 1);
+    return 1;
+}
+
+
+//------------------------------------------------------------------------------
+// compression (lxs_lz.h)
+
+typedef void (*lz_transform)(lua_State* const L,
+                             lxs_string* const d,
+                             const char* src,
+                             size_t len);
+
+/// Appends src[0, len) to d as a compressed frame.
+static void lz_compress(lua_State* const L,
+                        lxs_string* const d,
+                        const char* src,
+                        size_t len)
+{
+    lxs_sappend(L, d, LXS_LZ_MAGIC, LXS_LZ_MAGIC_LEN);
+    while (len > 0u)
+    {
+        const size_t n = min(len, static_cast<size_t>(LXS_LZ_BLOCK));
+        lxs_sensure_space(L, d, LXS_LZ_HEADER + n);
+        d->len += lxs_lzblock(src, n, &d->data[d->len]);
+        src    += n;
+        len    -= n;
+    }
+    lxs_sensure_space(L, d, LXS_LZ_HEADER);
+    memset(&d->data[d->len], 0, LXS_LZ_HEADER);
+    d->len += LXS_LZ_HEADER;
+    lxs_sterminate(d);
+}
+
+/// Appends the content of the compressed frame src[0, len) to d.
+static void lz_decompress(lua_State* const L,
+                          lxs_string* const d,
+                          const char* src,
+                          size_t len)
+{
+    const char* const end = src + len;
+
+    if (len < LXS_LZ_MAGIC_LEN
+        || memcmp(src, LXS_LZ_MAGIC, LXS_LZ_MAGIC_LEN) != 0)
+        lxs_error(L, "not a compressed frame");
+    src += LXS_LZ_MAGIC_LEN;
+
+    for (;;)
+    {
+        if (static_cast<size_t>(end - src) < LXS_LZ_HEADER)
+            lxs_error(L, "truncated compressed frame");
+        const uint32_t header = lxs_lzheader(src);
+        src += LXS_LZ_HEADER;
+        if (header == 0u)
+            break;
+        if (lxs_lzsize(header) > static_cast<size_t>(end - src))
+            lxs_error(L, "truncated compressed frame");
+
+        lxs_sensure_space(L, d, LXS_LZ_BLOCK);
+        const size_t n = lxs_lzunblock(header, src, &d->data[d->len]);
+        if (n == static_cast<size_t>(-1))
+            lxs_error(L, "malformed compressed frame");
+        d->len += n;
+        src    += lxs_lzsize(header);
+    }
+    lxs_sterminate(d);
+}
+
+/// Applies fn to the buffer or string at 1, see compress.
+static int lz_apply(lua_State* const L, lz_transform fn)
+{
+    size_t      len;
+    const char* src = lxs_schecklstring(L, 1, &len);
+
+    if (!lua_isnoneornil(L, 2) && !lua_rawequal(L, 1, 2))
+    {
+        fn(L, lxs_scheckbuffer(L, 2), src, len);
+        lua_settop(L, 2);
+        lxs_assert_stack_at(L, 2);
+    }
+    else if (lua_isstring(L, 1))
+    {
+        lua_settop(L, 1);
+        fn(L, lxs_snewbuffer(L), src, len);
+        lxs_assert_stack_at(L, 2);
+    }
+    else
+    {
+        lxs_string* s = lxs_scheckbuffer(L, 1);
+
+        lxs_spb_decl(L, tmp);
+        fn(L, lxs_spb_ptr(tmp), src, len);
+
+        touch(s);
+        lxs_sclear(L, s);
+        if (lxs_spb_ptr(tmp)->len > 0u)
+            lxs_sappend(L, s, lxs_spb_ptr(tmp)->data, lxs_spb_ptr(tmp)->len);
+        reinterpret_cast<lxs_sbuffer*>(s)->rpos = 0u;
+        lxs_spb_release(L, tmp);
+
+        lua_settop(L, 1);
+        lxs_assert_stack_at(L, 1);
+    }
+
+    return 1;
+}
+
+/// buffer.compress(src, [dst])
+/// _buffer_:compress([dst])
+///
+/// Compresses *src*, a buffer or a string, into a frame of independently
+/// compressed 64KB blocks (LZ77, the LZ4 block format, see lxs_lz.h).
+/// If the buffer *dst* is specified the frame is appended to it and *dst* is
+/// returned, otherwise a buffer *src* is replaced by the frame (its read
+/// cursor goes back to the start) and returned, and for a string a new
+/// buffer is returned.
+/// Blocks that do not compress are stored as they are, so the frame is at
+/// most 8 bytes plus 4 per block larger than *src*.
+///
+/// Example Usage:
+///     local b = buffer.new():append(marshal.encode(state)):compress()
+///     b:write(io.open('save.bin', 'wb'))
+static int libE_compress(lua_State* const L)
+{
+    return lz_apply(L, lz_compress);
+}
+
+/// buffer.decompress(src, [dst])
+/// _buffer_:decompress([dst])
+///
+/// Reverses buffer.compress: *src* must hold exactly one frame. Returns
+/// *dst*, *src* or a new buffer like compress does. Raises an error if the
+/// frame is truncated or malformed.
+///
+/// Example Usage:
+///     buffer.new():append(data):compress():decompress():tostring() == data
+static int libE_decompress(lua_State* const L)
+{
+    return lz_apply(L, lz_decompress);
+}
+
+
+//------------------------------------------------------------------------------
+// buffer views
+
+#define LXS_BUFFERVIEW LUA_BUFFERLIBNAME ".view"
+
+/// A range of a buffer's contiguous storage. The buffer is kept alive through
+/// the view's environment table, which is shared by all views of a buffer.
+typedef struct _lxs_sview
+{
+    lxs_sbuffer* b;
+    size_t       off;
+    size_t       len;
+    size_t       gen;  // b->gen at creation
+    const char*  data; // b->s.data at creation
+} lxs_sview;
+
+static __inline bool view_isvalid(lxs_sview* const v)
+{
+    return v->b->gen == v->gen
+        && v->b->s.data == v->data
+        && v->off + v->len <= v->b->s.len;
+}
+
+static lxs_sview* view_check(lua_State* const L, int narg)
+{
+    return static_cast<lxs_sview*>(luaL_checkudata(L, narg, LXS_BUFFERVIEW));
+}
+
+/// Returns the view's bytes; raises an error if the buffer moved or dropped
+/// them since the view was created.
+static const char* view_checklstring(lua_State* const L,
+                                     int narg,
+                                     size_t* len)
+{
+    lxs_sview* v = view_check(L, narg);
+    if (!view_isvalid(v))
+        lxs_error(L, "buffer view is no longer valid");
+
+    *len = v->len;
+    return v->data + v->off;
+}
+
+/// Like lxs_schecklstring, also accepting views.
+static const char* view_checkanylstring(lua_State* const L,
+                                        int narg,
+                                        size_t* len)
+{
+    if (lua_type(L, narg) == LUA_TUSERDATA && !lxs_sisbuffer(L, narg))
+        return view_checklstring(L, narg, len);
+    return lxs_schecklstring(L, narg, len);
+}
+
+/// Resolves arguments 1 and 2 like view_checkanylstring. Resolving a buffer
+/// may flatten it, which invalidates its views, so argument 2 is checked
+/// again once argument 1 no longer moves.
+static const char* view_checkanypair(lua_State* const L,
+                                     size_t* lhs_len,
+                                     const char** rhs,
+                                     size_t* rhs_len)
+{
+    view_checkanylstring(L, 2, rhs_len);
+    const char* lhs = view_checkanylstring(L, 1, lhs_len);
+    *rhs = view_checkanylstring(L, 2, rhs_len);
+    return lhs;
+}
+
+/// buffer.view(b, [offset, [length]])
+/// buffer:view([offset, [length]])
+///
+/// Returns a view of the selected range of the *buffer* (default: everything)
+/// without copying it. Views support len, tostring, find, equals, starts_with,
+/// ends_with, tonumber, hash, ==, < and <=; only tostring creates a string.
+/// A view becomes invalid (and raises an error when used) once the buffer
+/// moves or drops its content: clear, cap, len, insert, remove, the trim
+/// functions or an append that reallocates.
+///
+/// Example Usage:
+///     local b = buffer.new():append('key=value')
+///     local k = b:view(1, 3)
+///     k:equals('key') --> true
+///     k:tostring()    --> 'key'
+static int libE_view(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_string* s   = lxs_scheckbuffer(L, 1);
+    size_t      off = opt_offset(L, s, 2);
+    size_t      len = lxs_slen(s) - off;
+    if (!lua_isnoneornil(L, 3))
+        len = opt_length(L, s, off, 3);
+
+    lxs_sview* v = static_cast<lxs_sview*>(
+        lua_newuserdata(L, sizeof(lxs_sview))
+    );
+    v->b    = reinterpret_cast<lxs_sbuffer*>(s);
+    v->off  = off;
+    v->len  = len;
+    v->gen  = v->b->gen;
+    v->data = s->data;
+
+    lxs_rawgetl(L, LUA_REGISTRYINDEX, LXS_BUFFERVIEW);
+    lua_setmetatable(L, -2);
+
+    // share one { buffer } environment between all views of the buffer
+    lua_getfenv(L, 1);
+    lua_rawgeti(L, -1, 1);
+    if (!lua_rawequal(L, -1, 1))
+    {
+        lua_pop(L, 2);
+        lua_createtable(L, 1, 0);
+        lua_pushvalue(L, 1);
+        lua_rawseti(L, -2, 1);
+        lua_pushvalue(L, -1);
+        lua_setfenv(L, 1);
+    }
+    else
+        lua_pop(L, 1);
+    lua_setfenv(L, -2);
+
+    lxs_assert_stack_end(L, 1);
+    return 1;
+}
+
+static int libV_len(lua_State* const L)
+{
+    size_t len;
+    view_checklstring(L, 1, &len);
+    lua_pushinteger(L, static_cast<lua_Integer>(len));
+    return 1;
+}
+
+static int libV_isvalid(lua_State* const L)
+{
+    lua_pushboolean(L, view_isvalid(view_check(L, 1)) ? 1 : 0);
+    return 1;
+}
+
+static int libV_tostring(lua_State* const L)
+{
+    size_t      len;
+    const char* str = view_checklstring(L, 1, &len);
+    lua_pushlstring(L, str, len);
+    return 1;
+}
+
+/// view:find(string, [init = 1])
+///
+/// Plain (no patterns) search; returns the start and end index of the first
+/// match relative to the view, or nil.
+static int libV_find(lua_State* const L)
+{
+    // resolve the argument first; it may flatten (and move) our buffer
+    size_t      plen;
+    const char* p   = view_checkanylstring(L, 2, &plen);
+    size_t      len;
+    const char* str = view_checklstring(L, 1, &len);
+
+    int init = luaL_optinteger(L, 3, 1);
+    if (init < 0)
+        init = max(0, static_cast<int>(len) + init);
+    else if (init > 0)
+        --init;
+    if (static_cast<size_t>(init) > len)
+        return 0;
+
+    const char* it = lxs_kfind(str + init, len - init, p, plen);
+    if (!it)
+        return 0;
+
+    lua_pushinteger(L, static_cast<lua_Integer>(it - str + 1));
+    lua_pushinteger(L, static_cast<lua_Integer>(it - str + plen));
+    return 2;
+}
+
+static int libV_equals(lua_State* const L)
+{
+    size_t      lhs_len;
+    size_t      rhs_len;
+    const char* rhs;
+    const char* lhs = view_checkanypair(L, &lhs_len, &rhs, &rhs_len);
+
+    lua_pushboolean(L,
+        lhs_len == rhs_len && memcmp(lhs, rhs, lhs_len) == 0);
+    return 1;
+}
+
+static int libV_starts_with(lua_State* const L)
+{
+    // resolve the argument first; it may flatten (and move) our buffer
+    size_t      plen;
+    const char* p   = view_checkanylstring(L, 2, &plen);
+    size_t      len;
+    const char* str = view_checklstring(L, 1, &len);
+
+    lua_pushboolean(L, plen <= len && memcmp(str, p, plen) == 0);
+    return 1;
+}
+
+static int libV_ends_with(lua_State* const L)
+{
+    // resolve the argument first; it may flatten (and move) our buffer
+    size_t      plen;
+    const char* p   = view_checkanylstring(L, 2, &plen);
+    size_t      len;
+    const char* str = view_checklstring(L, 1, &len);
+
+    lua_pushboolean(L,
+        plen <= len && memcmp(str + len - plen, p, plen) == 0);
+    return 1;
+}
+
+/// view:tonumber()
+///
+/// Converts the view like tonumber(view:tostring()) would; returns nil if it
+/// is not a number.
+static int libV_tonumber(lua_State* const L)
+{
+    size_t      len;
+    const char* str = view_checklstring(L, 1, &len);
+
+    char buff[LUAI_MAXNUMBER2STR * 2];
+    if (len < sizeof(buff))
+    {
+        lua_Number n;
+        memcpy(buff, str, len);
+        buff[len] = '\0';
+        if (strlen(buff) == len && luaO_str2d(buff, &n))
+        {
+            lua_pushnumber(L, n);
+            return 1;
+        }
+        return 0;
+    }
+
+    // too long to be a sane number; let the core decide
+    lua_pushlstring(L, str, len);
+    if (!lua_isnumber(L, -1))
+        return 0;
+    lua_pushnumber(L, lua_tonumber(L, -1));
+    return 1;
+}
+
+/// view:hash()
+///
+/// Returns the same hash lxs_shash computes for a buffer with this content.
+static int libV_hash(lua_State* const L)
+{
+    lxs_string tmp;
+    tmp.data = CONST_CAST(char*, view_checklstring(L, 1, &tmp.len));
+    tmp.cap  = tmp.len + 1u;
+
+    lua_pushnumber(L, static_cast<lua_Number>(lxs_shash(&tmp)));
+    return 1;
+}
+
+static int view_compare(lua_State* const L)
+{
+    size_t      lhs_len;
+    size_t      rhs_len;
+    const char* rhs;
+    const char* lhs = view_checkanypair(L, &lhs_len, &rhs, &rhs_len);
+
+    int cmp = memcmp(lhs, rhs, min(lhs_len, rhs_len));
+    if (cmp == 0 && lhs_len != rhs_len)
+        cmp = (lhs_len < rhs_len) ? -1 : 1;
+    return cmp;
+}
+
+static int libV_lt(lua_State* const L)
+{
+    lua_pushboolean(L, view_compare(L) < 0);
+    return 1;
+}
+
+static int libV_le(lua_State* const L)
+{
+    lua_pushboolean(L, view_compare(L) <= 0);
+    return 1;
+}
+
+
 //------------------------------------------------------------------------------
 
 /// buffer.(b)
@@ -836,6 +1755,41 @@ static int libL_call(lua_State* const L)
     return libE_new(L);
 }
 
+#if LUAXS_STR_ALLOC_STATS
+/// buffer.allocstats([reset = false])
+///
+/// Returns a table with the process-wide lxs_string allocation counters:
+/// inits, inlined, allocs, reallocs and frees. If *reset* is true, the
+/// counters are set back to zero after being read.
+///
+/// Example Usage:
+///     buffer.allocstats(true)
+///     buffer.new():append('short'):tostring()
+///     buffer.allocstats().allocs --> 0 (served by inline storage)
+static int libL_allocstats(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_sstats stats;
+    lxs_sallocstats(&stats, luaL_optbool(L, 1, false));
+
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.inits));
+    lxs_rawsetl(L, -2, "inits");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.inlined));
+    lxs_rawsetl(L, -2, "inlined");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.allocs));
+    lxs_rawsetl(L, -2, "allocs");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.reallocs));
+    lxs_rawsetl(L, -2, "reallocs");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.frees));
+    lxs_rawsetl(L, -2, "frees");
+
+    lxs_assert_stack_end(L, 1);
+    return 1;
+}
+#endif // LUAXS_STR_ALLOC_STATS
+
 #if !LUAXS_STR_READONLY_OPTIONS
 /// buffer.(b)
 /// buffer:()
@@ -885,6 +1839,90 @@ static int libL_default_capacity(lua_State* const L)
 }
 #endif // !LUAXS_STR_READONLY_OPTIONS
 
+//------------------------------------------------------------------------------
+// C library access (lxs_api.h); narg must refer to a buffer, except for
+// lxs_bisbuffer.
+
+bool lxs_bisbuffer(lua_State* const L, int narg)
+{
+    return lxs_sisbuffer(L, narg);
+}
+
+void lxs_bappend(lua_State* const L, int narg, const char* str, size_t len)
+{
+    lxs_sbappend(L, lxs_sbcheck(L, narg), str, len);
+}
+
+size_t lxs_blen(lua_State* const L, int narg)
+{
+    return lxs_sblen(lxs_sbcheck(L, narg));
+}
+
+void lxs_bpatch(lua_State* const L,
+                int narg,
+                size_t offset,
+                const char* str,
+                size_t len)
+{
+    lxs_sbuffer* b = lxs_sbcheck(L, narg);
+    lxs_assert(L, offset + len <= lxs_sblen(b));
+
+    // overwrites in place, so neither the chunks nor any view move
+    if (offset < b->s.len)
+    {
+        const size_t n = min(len, b->s.len - offset);
+        memcpy(&b->s.data[offset], str, n);
+        str   += n;
+        len   -= n;
+        offset = 0u;
+    }
+    else
+    {
+        offset -= b->s.len;
+    }
+
+    for (lxs_schunk* c = b->head; c && len > 0u; c = c->next)
+    {
+        if (offset >= c->len)
+        {
+            offset -= c->len;
+            continue;
+        }
+        const size_t n = min(len, c->len - offset);
+        memcpy(&c->data[offset], str, n);
+        str   += n;
+        len   -= n;
+        offset = 0u;
+    }
+}
+
+const char* lxs_bdata(lua_State* const L, int narg, size_t* len)
+{
+    lxs_sbuffer* b = lxs_sbcheck(L, narg);
+    lxs_sbflatten(L, b);
+
+    *len = b->s.len;
+    return b->s.data;
+}
+
+const char* lxs_bread(lua_State* const L, int narg, size_t* len)
+{
+    lxs_sbuffer* b = lxs_sbcheck(L, narg);
+    lxs_sbflatten(L, b);
+
+    const size_t pos = min(b->rpos, b->s.len);
+    *len = b->s.len - pos;
+    return &b->s.data[pos];
+}
+
+void lxs_bskip(lua_State* const L, int narg, size_t len)
+{
+    lxs_sbuffer* b = lxs_sbcheck(L, narg);
+    lxs_assert(L, b->rpos + len <= b->s.len);
+
+    b->rpos += len;
+}
+
 //------------------------------------------------------------------------------
 
 static const luaL_Reg libE_funcs[] = {
@@ -898,6 +1936,8 @@ static const luaL_Reg libE_funcs[] = {
     { "upper",            libE_toupper          },
     { "rep",              libE_rep              },
     { "append",           libE_append           },
+    { "chunked",          libE_chunked          },
+    { "write",            libE_write            },
     { "insert",           libE_insert           },
     { "tostring",         libE_tostring         },
     { "trim_excess",      libE_trim_excess      },
@@ -908,7 +1948,37 @@ static const luaL_Reg libE_funcs[] = {
     { "ltrim",            libE_ltrim            },
     { "rtrim",            libE_rtrim            },
     { "split",            libE_split            },
+    { "gsplit",           libE_gsplit           },
     { "substr",           libE_substr           },
+    { "view",             libE_view             },
+    { "pack",             libE_pack             },
+    { "unpack",           libE_unpack           },
+    { "seek",             libE_seek             },
+    { "compress",         libE_compress         },
+    { "decompress",       libE_decompress       },
+    { "write_i8",         libE_write_i8         },
+    { "write_u8",         libE_write_u8         },
+    { "write_i16",        libE_write_i16        },
+    { "write_u16",        libE_write_u16        },
+    { "write_i32",        libE_write_i32        },
+    { "write_u32",        libE_write_u32        },
+    { "write_i64",        libE_write_i64        },
+    { "write_u64",        libE_write_u64        },
+    { "write_f32",        libE_write_f32        },
+    { "write_f64",        libE_write_f64        },
+    { "read_i8",          libE_read_i8          },
+    { "read_u8",          libE_read_u8          },
+    { "read_i16",         libE_read_i16         },
+    { "read_u16",         libE_read_u16         },
+    { "read_i32",         libE_read_i32         },
+    { "read_u32",         libE_read_u32         },
+    { "read_i64",         libE_read_i64         },
+    { "read_u64",         libE_read_u64         },
+    { "read_f32",         libE_read_f32         },
+    { "read_f64",         libE_read_f64         },
+#if LUAXS_STR_ALLOC_STATS
+    { "allocstats",       libL_allocstats       },
+#endif
 #if !LUAXS_STR_READONLY_OPTIONS
     { "growth_factor",    libL_growth_factor    },
     { "default_capacity", libL_default_capacity },
@@ -916,6 +1986,24 @@ static const luaL_Reg libE_funcs[] = {
     { NULL, NULL }
 };
 
+static const luaL_Reg libV_funcs[] = {
+    { "len",         libV_len         },
+    { "isvalid",     libV_isvalid     },
+    { "tostring",    libV_tostring    },
+    { "find",        libV_find        },
+    { "equals",      libV_equals      },
+    { "starts_with", libV_starts_with },
+    { "ends_with",   libV_ends_with   },
+    { "tonumber",    libV_tonumber    },
+    { "hash",        libV_hash        },
+    { "__tostring",  libV_tostring    },
+    { "__len",       libV_len         },
+    { "__eq",        libV_equals      },
+    { "__lt",        libV_lt          },
+    { "__le",        libV_le          },
+    { NULL, NULL }
+};
+
 static const luaL_Reg libM_funcs[] = {
     { "__tostring", libM_tostring },
     { "__len",      libM_len      },
@@ -933,7 +2021,9 @@ static const luaL_Reg libM_funcs[] = {
 LUA_API int luaopen_buffer(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
-    lxs_assert(L, sizeof(lxs_string) == 12);
+    lxs_assert(L, sizeof(lxs_string) == 12 + LUAXS_STR_INLINE_CAPACITY);
+
+    lxs_kinit();
 
     /// register buffer library (_G.buffer) ----------------
     luaI_openlib(L, LUA_BUFFERLIBNAME, libE_funcs, 0);
@@ -957,6 +2047,16 @@ LUA_API int luaopen_buffer(lua_State* const L)
     lxs_rawsetl(L, LUA_REGISTRYINDEX, LUA_BUFFERLIBNAME);
     ///-----------------------------------------------------
 
+    /// create and store view metatable --------------------
+    lua_createtable(L, 0, _countof(libV_funcs));
+    luaI_openlib(L, NULL, libV_funcs, 0);
+
+    lua_pushvalue(L, -1);
+    lxs_rawsetl(L, -2, "__index");
+
+    lxs_rawsetl(L, LUA_REGISTRYINDEX, LXS_BUFFERVIEW);
+    ///-----------------------------------------------------
+
     /// create and assign _G.buffer's metatable
     lua_createtable(L, 0, 2);
 
@@ -5,516 +5,1115 @@
 
 #if LUAXS_ADDLIB_CONTAINER
 
-#include <eastl/functional.h>
-#include <eastl/vector.h>
+#include <eastl/type_traits.h>
+
+
+lxs_cdefine(set_number,        TYPE_SET_NUMBER       );
+lxs_cdefine(set_string,        TYPE_SET_STRING       );
+lxs_cdefine(hash_set_number,   TYPE_HASH_SET_NUMBER  );
+lxs_cdefine(hash_set_string,   TYPE_HASH_SET_STRING  );
+lxs_cdefine(map_number,        TYPE_MAP_NUMBER       );
+lxs_cdefine(map_string,        TYPE_MAP_STRING       );
+lxs_cdefine(hash_map_number,   TYPE_HASH_MAP_NUMBER  );
+lxs_cdefine(hash_map_string,   TYPE_HASH_MAP_STRING  );
+lxs_cdefine(vector_map_number, TYPE_VECTOR_MAP_NUMBER);
+lxs_cdefine(vector_map_string, TYPE_VECTOR_MAP_STRING);
+
+const char* const lxs_cqueue::tname = TYPE_QUEUE;
+
 
 
 //==============================================================================
+// helpers
 
-extern "C" {
+/// Adds the key k, which must not be present, with the value reference ref.
+template<class C>
+static void lxs_cadd(C* self, typename C::key_type k, int ref)
+{
+    C::key::own(self->allocator(), k);
+    C::kind::insert(self->items, C::kind::value(k, ref));
+    ++self->version;
+}
 
-#define match_type(s, slen, type)                                              \
-    ((slen) == _countof("" type) - 1 &&                                        \
-     memcmp((s), "" type, (slen)) == 0)
+/// Removes the element at it of the container at idx.
+template<class C>
+static void lxs_cerase(lua_State* const L,
+                       int idx,
+                       C* self,
+                       typename C::iterator it)
+{
+    if (C::kind::is_map)
+    {
+        lua_getfenv(L, idx);
+        luaL_unref(L, -1, C::kind::ref_of(*it));
+        lua_pop(L, 1);
+    }
 
-static int libL_new_set(lua_State* const L)
+    C::key::release(self->allocator(), C::kind::key_of(*it));
+    self->items.erase(it);
+    ++self->version;
+}
+
+/// Removes all elements of the container at idx.
+template<class C>
+static void lxs_cclear(lua_State* const L, int idx, C* self)
 {
-    size_t len;
-    const char* type = luaL_checklstring(L, 1, &len);
+    self->release_keys();
+    self->items.clear();
+    ++self->version;
 
-    if (match_type(type, len, "number"))
-        lxs_cmakel(L, set_number, TYPE_SET_NUMBER);
-    else if (match_type(type, len, "string"))
-        lxs_cmakel(L, set_string, TYPE_SET_STRING);
-    else
-        luaL_argerror(L, 1,
-            "unknown or unsupported type; "
-            "only 'number' and 'string' are supported"
-        );
+    if (C::kind::is_map)
+    {
+        lua_newtable(L);
+        lua_setfenv(L, idx);
+    }
+}
 
-    return 1;
+/// Whether all keys of b are in a.
+template<class C>
+static bool lxs_cincludes(const C* a, const C* b)
+{
+    if (b->items.size() > a->items.size())
+        return false;
+
+    for (typename C::impl_type::const_iterator it = b->items.begin();
+         it != b->items.end();
+         ++it)
+    {
+        if (a->items.find(C::kind::key_of(*it)) == a->items.end())
+            return false;
+    }
+    return true;
 }
 
-static int libL_is_container(lua_State* const L)
+/// Inserts the elements (sets) or pairs (maps) of the table t into the
+/// container at idx; values of existing map keys are replaced.
+///
+/// The keys are gathered and, for ordered containers, sorted first; so they
+/// are inserted in order, at the end if they are greater than all keys in the
+/// container, which turns filling an empty vector_map into an append.
+template<class C>
+static void lxs_cinsert_all(lua_State* const L, int idx, C* self, int t)
 {
-    luaL_checkany(L, 1);
+    typedef typename C::key_type         key_type;
+    typedef eastl::pair<key_type, int>   entry;
+    typedef typename C::iterator         iterator;
 
-    lua_settop(L, 1);
+    luaL_checktype(L, t, LUA_TTABLE);
 
-    if (!lua_isuserdata(L, 1))
+    // the key of a table pair is at -2, its value at -1
+    const int at = C::kind::is_map ? -2 : -1;
+    size_t    n  = 0;
+
+    // validate first, an error while gathering would leak the batch
+    lua_pushnil(L);
+    while (lua_next(L, t))
     {
-        lua_pushboolean(L, 0);
-        return 1;
+        key_type k;
+        if (!C::key::test(L, at, &k))
+        {
+            luaL_argerror(L, t, lua_pushfstring(L,
+                "%s %s expected, got %s",
+                C::key::name(),
+                C::kind::is_map ? "keys" : "elements",
+                C::key::is_nan(L, at) ? "NaN" : luaL_typename(L, at)
+            ));
+        }
+
+        lua_pop(L, 1);
+        ++n;
     }
 
-    lua_getmetatable(L, 1);
-    if (!lua_istable(L, -1))
+    if (n == 0)
+        return;
+
+    lxs_assert_stack_begin(L);
+
+    int env = 0;
+    if (C::kind::is_map)
     {
-        lua_pushboolean(L, 0);
-        return 1;
+        lua_getfenv(L, idx);
+        env = lua_gettop(L);
     }
 
+    eastl::vector<entry, lxs_callocator> batch(self->allocator());
+    batch.reserve(n);
+
     lua_pushnil(L);
-    while (lua_next(L, LUA_REGISTRYINDEX))
+    while (lua_next(L, t))
     {
-        lua_pushvalue(L, -2);
+        entry e;
+        C::key::test(L, at, &e.first);
 
-        if (lua_isstring(L, -1))
+        if (C::kind::is_map)
+        {
+            e.second = luaL_ref(L, env);
+        }
+        else
         {
-            size_t      len;
-            const char* str = lua_tolstring(L, -1, &len);
+            e.second = LUA_NOREF;
+            lua_pop(L, 1);
+        }
+        batch.push_back(e);
+    }
+
+    if (C::kind::is_ordered)
+    {
+        eastl::sort(batch.begin(), batch.end(),
+                    lxs_cpair_less<typename C::key>());
+    }
+
+    const lxs_callocator a = self->allocator();
+    for (typename eastl::vector<entry, lxs_callocator>::iterator e = batch.begin();
+         e != batch.end();
+         ++e)
+    {
+        const size_t size = self->items.size();
 
-            if (len >= 11 &&
-                memcmp(str, "container_", 10) == 0 &&
-                lua_istable(L, -2) &&
-                lua_rawequal(L, -4, -2))
+        C::key::own(a, e->first);
+        iterator it = C::kind::insert(self->items,
+                                      C::kind::value(e->first, e->second));
+
+        if (self->items.size() == size)
+        {
+            C::key::release(a, e->first);
+
+            if (C::kind::is_map)
             {
-                lua_pushboolean(L, 1);
-                return 1;
+                luaL_unref(L, env, C::kind::ref_of(*it));
+                C::kind::set_ref(*it, e->second);
             }
         }
-
-        lua_pop(L, 2);
     }
+    ++self->version;
 
-    lua_pushboolean(L, 0);
-    return 1;
+    if (C::kind::is_map)
+        lua_pop(L, 1);
+
+    lxs_assert_stack_end(L, 0);
 }
 
 
 
+//==============================================================================
+// all containers
 
-static int libE_set_number_size(lua_State* const L)
+template<class C>
+static int libE_size(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    set_number* self = lxs_ccheck_set_number(L, 1);
-    lua_pushinteger(L, static_cast<int>(self->size()));
+    C* self = lxs_ccheck<C>(L, 1);
+    lua_pushinteger(L, static_cast<lua_Integer>(self->items.size()));
 
     lxs_assert_stack_end(L, 1);
     return 1;
 }
 
-static int libE_set_number_insert(lua_State* const L)
+template<class C>
+static int libE_contains(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    lua_settop(L, 1);
-    set_number* self = lxs_ccheck_set_number(L, 1);
+    C* self = lxs_ccheck<C>(L, 1);
+    lua_pushboolean(L,
+        self->items.find(lxs_ccheckkey<C>(L, 2)) != self->items.end()
+    );
+
+    lxs_assert_stack_end(L, 1);
+    return 1;
+}
 
-    set_number_result result = self->insert(luaL_checknumber(L, 2));
-    lua_pushboolean(L, result.second);
+/// Returns self and whether the key was present.
+template<class C>
+static int libE_remove(lua_State* const L)
+{
+    C*                            self = lxs_ccheck<C>(L, 1);
+    const typename C::key_type    k    = lxs_ccheckkey<C>(L, 2);
+    const typename C::iterator    it   = self->items.find(k);
+    const bool                    hit  = it != self->items.end();
+
+    if (hit)
+        lxs_cerase(L, 1, self, it);
 
-    lxs_assert_stack_at(L, 2);
+    lua_settop(L, 1);
+    lua_pushboolean(L, hit);
     return 2;
 }
 
-static int libE_set_number_contains(lua_State* const L)
+template<class C>
+static int libE_clear(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
+    lxs_cclear(L, 1, lxs_ccheck<C>(L, 1));
 
-    set_number* self = lxs_ccheck_set_number(L, 1);
+    lua_settop(L, 1);
+    return 1;
+}
 
-    lua_pushboolean(L, self->find(luaL_checknumber(L, 2)) != self->end());
+/// Exchanges the contents (and map values) of two containers of one type.
+template<class C>
+static int libE_swap(lua_State* const L)
+{
+    C* self  = lxs_ccheck<C>(L, 1);
+    C* other = lxs_ccheck<C>(L, 2);
 
-    lxs_assert_stack_end(L, 1);
+    if (self != other)
+    {
+        self->items.swap(other->items);
+        ++self->version;
+        ++other->version;
+
+        if (C::kind::is_map)
+        {
+            lua_getfenv(L, 1);
+            lua_getfenv(L, 2);
+            lua_setfenv(L, 1);
+            lua_setfenv(L, 2);
+        }
+    }
+
+    lua_settop(L, 1);
     return 1;
 }
 
-static int libE_set_number_remove(lua_State* const L)
+/// for k in c:iter() do ... end
+/// for k, v in m:iter() do ... end
+///
+/// Ordered containers iterate in key order.
+template<class C>
+static int libE_iter(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
+    C* self = lxs_ccheck<C>(L, 1);
+    return range<C>::make_gen(L, 1, self->items.begin(), self->items.end());
+}
 
-    set_number* self = lxs_ccheck_set_number(L, 1);
-    lua_pushboolean(L, self->erase(luaL_checknumber(L, 2) != 0));
+template<class C>
+static int libE_insert_all(lua_State* const L)
+{
+    lxs_cinsert_all(L, 1, lxs_ccheck<C>(L, 1), 2);
 
-    lua_settop(L, 2);
-    lxs_assert_stack_at(L, 2);
-    return 2;
+    lua_settop(L, 1);
+    return 1;
 }
 
-static int libE_set_number_clear(lua_State* const L)
+
+
+//==============================================================================
+// ordered containers (set, map, vector_map)
+
+/// Iterates from the first key not less than k.
+template<class C>
+static int libE_lower_bound(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
+    C* self = lxs_ccheck<C>(L, 1);
+    return range<C>::make_gen(L, 1,
+        self->items.lower_bound(lxs_ccheckkey<C>(L, 2)),
+        self->items.end()
+    );
+}
 
-    set_number* self = lxs_ccheck_set_number(L, 1);
-    self->clear();
+/// Iterates from the first key greater than k.
+template<class C>
+static int libE_upper_bound(lua_State* const L)
+{
+    C* self = lxs_ccheck<C>(L, 1);
+    return range<C>::make_gen(L, 1,
+        self->items.upper_bound(lxs_ccheckkey<C>(L, 2)),
+        self->items.end()
+    );
+}
+
+/// Iterates the keys in [lo, hi].
+template<class C>
+static int libE_range(lua_State* const L)
+{
+    C*                         self = lxs_ccheck<C>(L, 1);
+    const typename C::key_type lo   = lxs_ccheckkey<C>(L, 2);
+    const typename C::key_type hi   = lxs_ccheckkey<C>(L, 3);
+
+    if (typename C::key::less()(hi, lo))
+        return range<C>::make_gen(L, 1, self->items.end(), self->items.end());
+
+    return range<C>::make_gen(L, 1,
+        self->items.lower_bound(lo),
+        self->items.upper_bound(hi)
+    );
+}
+
+
+
+//==============================================================================
+// sets (set, hash_set)
+
+/// Returns self and whether k was inserted.
+template<class C>
+static int libE_set_insert(lua_State* const L)
+{
+    C*                         self = lxs_ccheck<C>(L, 1);
+    const typename C::key_type k    = lxs_ccheckkey<C>(L, 2);
+    const bool                 add  = self->items.find(k) == self->items.end();
+
+    if (add)
+        lxs_cadd(self, k, LUA_NOREF);
 
     lua_settop(L, 1);
-    lxs_assert_stack_at(L, 1);
-    return 1;
+    lua_pushboolean(L, add);
+    return 2;
 }
 
-static int libE_set_number_equals(lua_State* const L)
+template<class C>
+static int libE_set_equals(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    luaL_checktype(L, 1, LUA_TUSERDATA);
-    if (lua_type(L, 2) != LUA_TUSERDATA)
+    C* self = lxs_ccheck<C>(L, 1);
+    if (!lua_getmetatable(L, 2))
     {
         lua_pushboolean(L, 0);
         lxs_assert_stack_end(L, 1);
         return 1;
     }
 
-    set_number* self  = lxs_ccheck_set_number(L, 1);
-    set_number* other = lxs_ccheck_set_number(L, 2);
+    luaL_getmetatable(L, C::tname);
+    const bool same = lua_rawequal(L, -1, -2) != 0;
+    lua_pop(L, 2);
 
-    //if (self == other)
-    //{
-    //    lua_pushboolean(L, 1);
-    //    lxs_assert_stack_end(L, 1);
-    //    return 1;
-    //}
-
-    if (self->size() != other->size())
+    if (!same)
     {
         lua_pushboolean(L, 0);
         lxs_assert_stack_end(L, 1);
         return 1;
     }
 
-    lua_pushboolean(L, eastl::equal(
-        self->begin(),
-        self->end(),
-        other->begin(),
-        eastl::equal_to<double>()
-    ));
+    C* other = lxs_ccheck<C>(L, 2);
+    lua_pushboolean(L,
+        self->items.size() == other->items.size() &&
+        lxs_cincludes(self, other)
+    );
+
     lxs_assert_stack_end(L, 1);
     return 1;
 }
 
-static int libE_set_number_swap(lua_State* const L)
+template<class C>
+static int libE_set_diff(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
+    C* self  = lxs_ccheck<C>(L, 1);
+    C* other = lxs_ccheck<C>(L, 2);
 
-    set_number* self = lxs_ccheck_set_number(L, 1);
-    set_number* other = lxs_ccheck_set_number(L, 2);
-    self->swap(*other);
+    if (self == other)
+    {
+        lxs_cclear(L, 1, self);
+    }
+    else
+    {
+        for (typename C::iterator it = other->items.begin();
+             it != other->items.end();
+             ++it)
+        {
+            typename C::iterator hit = self->items.find(*it);
+            if (hit != self->items.end())
+                lxs_cerase(L, 1, self, hit);
+        }
+    }
 
     lua_settop(L, 1);
-    lxs_assert_stack_at(L, 1);
     return 1;
 }
 
-/// for var {, var} in explist do block end
-/// 
-/// explist is evaluated once before the loop is entered.
-/// Its results are an 'iterator function' (which sets the var values)
-/// a 'state' (from which the values can be read), and
-/// an 'initial value' (from which to iterate onwards). 
-///
-/// ipairs in Lua:
-/// function ipairs(t)
-///     local function ipairs_it(t, i)
-///         i = i + 1
-///         local v = t[i]
-///         if v ~= nil then
-///             return i, v
-///         else
-///             return nil
-///         end
-///     end
-///     return ipairs_it, t, 0
-/// end
-static int libE_set_number_iter(lua_State* const L)
+template<class C>
+static int libE_set_intersect(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
+    C* self  = lxs_ccheck<C>(L, 1);
+    C* other = lxs_ccheck<C>(L, 2);
 
-    range<set_number_iterator>::make_gen(L,
-        *lxs_ccheck_set_number(L, 1),
-        TYPE_SET_NUMBER_RANGE,
-        _countof(TYPE_SET_NUMBER_RANGE) - 1
-    );
-    lua_insert(L, 1);
-    lua_pushnil(L);
+    if (self != other)
+    {
+        const lxs_callocator a = self->allocator();
 
-    lxs_assert_stack_end(L, 2);
-    return 3;
+        for (typename C::iterator it = self->items.begin();
+             it != self->items.end(); )
+        {
+            if (other->items.find(*it) == other->items.end())
+            {
+                C::key::release(a, *it);
+                it = self->items.erase(it);
+                ++self->version;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    lua_settop(L, 1);
+    return 1;
 }
 
+template<class C>
+static int libE_set_is_subset_of(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
 
+    C* self  = lxs_ccheck<C>(L, 1);
+    C* other = lxs_ccheck<C>(L, 2);
+    lua_pushboolean(L, lxs_cincludes(other, self));
 
-static int libE_set_number_diff(lua_State* const L)
+    lxs_assert_stack_end(L, 1);
+    return 1;
+}
+
+template<class C>
+static int libE_set_is_superset_of(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    set_number* self  = lxs_ccheck_set_number(L, 1);
-    set_number* other = lxs_ccheck_set_number(L, 2);
+    C* self  = lxs_ccheck<C>(L, 1);
+    C* other = lxs_ccheck<C>(L, 2);
+    lua_pushboolean(L, lxs_cincludes(self, other));
 
-    if (self->size() > 0 && other->size() > 0)
-    {
-        //for (set_number_iterator it = other->begin(); it != other->end(); ++it)
-        //{
-        //    self->erase(*it);
-        //}
-        self->erase(other->begin(), other->end());
-    }
-
-    lua_settop(L, 1);
-    lxs_assert_stack_at(L, 1);
+    lxs_assert_stack_end(L, 1);
     return 1;
 }
 
-static int libE_set_number_intersect(lua_State* const L)
+template<class C>
+static int libE_set_overlaps(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    set_number* self  = lxs_ccheck_set_number(L, 1);
-    set_number* other = lxs_ccheck_set_number(L, 2);
+    C* self  = lxs_ccheck<C>(L, 1);
+    C* other = lxs_ccheck<C>(L, 2);
 
-    if (self->size() > 0 && other->size() > 0)
+    // probe the larger set with the keys of the smaller one
+    if (self->items.size() > other->items.size())
     {
-        self->erase(
-            eastl::find_first_not_of(
-                self->begin(), self->end(),
-                other->begin(), other->end()
-            ),
-            self->end()
-        );
-        //for (set_number_iterator it = other->begin(); it != other->end(); ++it)
-        //{
-        //    if (self->find(*it) == self->end())
-        //    {
-        //        self->erase(it);
-        //    }
-        //}
+        C* t  = self;
+        self  = other;
+        other = t;
     }
 
-    lua_settop(L, 1);
-    lxs_assert_stack_at(L, 1);
+    for (typename C::iterator it = self->items.begin();
+         it != self->items.end();
+         ++it)
+    {
+        if (other->items.find(*it) != other->items.end())
+        {
+            lua_pushboolean(L, 1);
+            lxs_assert_stack_end(L, 1);
+            return 1;
+        }
+    }
+
+    lua_pushboolean(L, 0);
+    lxs_assert_stack_end(L, 1);
     return 1;
 }
 
-static int libE_set_number_is_subset_of(lua_State* const L)
+/// The symmetric difference of two sets is formed by the elements that are
+/// present in one of the sets, but not in the other.
+template<class C>
+static int libE_set_sym_diff(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
-
-    set_number* self  = lxs_ccheck_set_number(L, 1);
-    set_number* other = lxs_ccheck_set_number(L, 2);
+    C* self  = lxs_ccheck<C>(L, 1);
+    C* other = lxs_ccheck<C>(L, 2);
 
-    if (self->size() == 0 || other->size() == 0)
+    if (self == other)
     {
-        lua_pushboolean(L, 0);
+        lxs_cclear(L, 1, self);
     }
     else
     {
-        for (set_number_iterator it = self->begin(); it != self->end(); ++it)
+        for (typename C::iterator it = other->items.begin();
+             it != other->items.end();
+             ++it)
         {
-            if (other->find(*it) == other->end())
-            {
-                lua_pushboolean(L, 0);
-                lxs_assert_stack_end(L, 1);
-                return 1;
-            }
+            typename C::iterator hit = self->items.find(*it);
+            if (hit != self->items.end())
+                lxs_cerase(L, 1, self, hit);
+            else
+                lxs_cadd(self, *it, LUA_NOREF);
         }
     }
 
-    lua_pushboolean(L, 1);
-    lxs_assert_stack_end(L, 1);
+    lua_settop(L, 1);
+    return 1;
+}
+
+template<class C>
+static int libE_set_union(lua_State* const L)
+{
+    C* self  = lxs_ccheck<C>(L, 1);
+    C* other = lxs_ccheck<C>(L, 2);
+
+    if (self != other)
+    {
+        for (typename C::iterator it = other->items.begin();
+             it != other->items.end();
+             ++it)
+        {
+            if (self->items.find(*it) == self->items.end())
+                lxs_cadd(self, *it, LUA_NOREF);
+        }
+    }
+
+    lua_settop(L, 1);
     return 1;
 }
 
-static int libE_set_number_is_superset_of(lua_State* const L)
+template<class C>
+static int libM_set_eq(lua_State* const L)
+{
+    return libE_set_equals<C>(L);
+}
+
+
+
+//==============================================================================
+// maps (map, hash_map, vector_map)
+
+/// Returns the value of k or nil.
+template<class C>
+static int libE_map_get(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    set_number* self  = lxs_ccheck_set_number(L, 1);
-    set_number* other = lxs_ccheck_set_number(L, 2);
+    C*                         self = lxs_ccheck<C>(L, 1);
+    const typename C::iterator it   = self->items.find(lxs_ccheckkey<C>(L, 2));
 
-    if (self->size() == 0 || other->size() == 0)
+    if (it == self->items.end())
     {
-        lua_pushboolean(L, 0);
+        lua_pushnil(L);
     }
     else
     {
-        for (set_number_iterator it = other->begin(); it != other->end(); ++it)
-        {
-            if (self->find(*it) == self->end())
-            {
-                lua_pushboolean(L, 0);
-                lxs_assert_stack_end(L, 1);
-                return 1;
-            }
-        }
+        lua_getfenv(L, 1);
+        lua_rawgeti(L, -1, C::kind::ref_of(*it));
+        lua_remove(L, -2);
     }
 
-    lua_pushboolean(L, 1);
     lxs_assert_stack_end(L, 1);
     return 1;
 }
 
-static int libE_set_number_overlaps(lua_State* const L)
+/// Sets the value of k; nil removes k. Replacing a value does not invalidate
+/// ranges, so values can be updated while iterating.
+template<class C>
+static int libE_map_set(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
+    lua_settop(L, 3);
 
-    set_number* self  = lxs_ccheck_set_number(L, 1);
-    set_number* other = lxs_ccheck_set_number(L, 2);
+    C*                         self = lxs_ccheck<C>(L, 1);
+    const typename C::key_type k    = lxs_ccheckkey<C>(L, 2);
+    const typename C::iterator it   = self->items.find(k);
 
-    if (self->size() == 0 || other->size() == 0)
+    if (lua_isnil(L, 3))
     {
-        lua_pushboolean(L, 0);
+        if (it != self->items.end())
+            lxs_cerase(L, 1, self, it);
     }
     else
     {
-        for (set_number_iterator it = other->begin(); it != other->end(); ++it)
-        {
-            if (self->find(*it) != self->end())
-            {
-                lua_pushboolean(L, 1);
-                lxs_assert_stack_end(L, 1);
-                return 1;
-            }
-        }
+        lua_getfenv(L, 1);
+        lua_pushvalue(L, 3);
 
-        lua_pushboolean(L, 0);
-        lxs_assert_stack_end(L, 1);
-        return 1;
+        if (it != self->items.end())
+            lua_rawseti(L, -2, C::kind::ref_of(*it));
+        else
+            lxs_cadd(self, k, luaL_ref(L, -2));
+    }
+
+    lua_settop(L, 1);
+    return 1;
+}
 
-        //lua_pushboolean(L,
-        //    eastl::find_first_of(
-        //        self->begin(), self->end(),
-        //        other->begin(), other->end()
-        //    ) != self->end()
-        //);
+/// Sets the value of k unless k is present; returns self and whether it was
+/// set.
+template<class C>
+static int libE_map_insert(lua_State* const L)
+{
+    lua_settop(L, 3);
+
+    C*                         self = lxs_ccheck<C>(L, 1);
+    const typename C::key_type k    = lxs_ccheckkey<C>(L, 2);
+    const bool                 add  = self->items.find(k) == self->items.end();
+
+    luaL_argcheck(L, !lua_isnil(L, 3), 3, "value expected");
+
+    if (add)
+    {
+        lua_getfenv(L, 1);
+        lua_pushvalue(L, 3);
+        lxs_cadd(self, k, luaL_ref(L, -2));
     }
 
-    lxs_assert_stack_end(L, 1);
+    lua_settop(L, 1);
+    lua_pushboolean(L, add);
+    return 2;
+}
+
+
+
+//==============================================================================
+// priority queue
+
+static lxs_cqueue* lxs_cqcheck(lua_State* const L, int narg)
+{
+    lxs_cqueue* q = static_cast<lxs_cqueue*>(
+                        luaL_checkudata(L, narg, lxs_cqueue::tname)
+                    );
+    q->L = L;
+    return q;
+}
+
+static double lxs_cqcheckpriority(lua_State* const L, int narg)
+{
+    const double p = luaL_checknumber(L, narg);
+    luaL_argcheck(L, p == p, narg, "NaN is not a valid priority");
+    return p;
+}
+
+/// Returns the handle at narg; 0, which is never queued, if it isn't one.
+static uint64_t lxs_cqcheckhandle(lua_State* const L, int narg)
+{
+    const lua_Number n = luaL_checknumber(L, narg);
+    const uint64_t   h = (n >= 1 && n <= LXS_CQMAXHANDLE)
+                       ? STATIC_CAST(uint64_t, n)
+                       : 0;
+    return STATIC_CAST(lua_Number, h) == n ? h : 0;
+}
+
+/// Pushes the value of handle and frees it; the environment is at env.
+static void lxs_cqtake(lua_State* const L, int env, uint64_t handle)
+{
+    lua_pushnumber(L, STATIC_CAST(lua_Number, handle));
+    lua_rawget(L, env);
+    lua_pushnumber(L, STATIC_CAST(lua_Number, handle));
+    lua_pushnil(L);
+    lua_rawset(L, env);
+}
+
+/// Returns the handle of the new entry, which stays valid until the entry is
+/// popped or removed.
+static int libE_queue_push(lua_State* const L)
+{
+    lua_settop(L, 3);
+
+    lxs_cqueue*  q = lxs_cqcheck(L, 1);
+    const double p = lxs_cqcheckpriority(L, 2);
+    luaL_argcheck(L, !lua_isnil(L, 3), 3, "value expected");
+    if (q->seq >= LXS_CQMAXHANDLE)
+        lxs_error(L, "too many entries pushed");
+
+    lua_getfenv(L, 1);
+    const lua_Number handle = STATIC_CAST(lua_Number, q->push(p));
+    lua_pushnumber(L, handle);
+    lua_pushvalue(L, 3);
+    lua_rawset(L, 4);
+
+    lua_pushnumber(L, handle);
     return 1;
 }
 
-/// The symmetric difference of two sets is formed by the elements that are
-/// present in one of the sets, but not in the other.
-static int libE_set_number_sym_diff(lua_State* const L)
+/// Returns the value and priority of the lowest priority entry and removes
+/// it; nil if the queue is empty.
+static int libE_queue_pop(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
+    lxs_cqueue* q = lxs_cqcheck(L, 1);
+    lua_settop(L, 1);
 
-    set_number* self  = lxs_ccheck_set_number(L, 1);
-    set_number* other = lxs_ccheck_set_number(L, 2);
+    if (!q->top())
+        return 0;
 
-    eastl::vector<double> out;
-    eastl::set_symmetric_difference(
-        self->begin(), self->end(),
-        other->begin(), other->end(),
-        eastl::back_inserter(out)
-    );
-    self->clear();
-    self->insert(out.begin(), out.end());
+    const double p = q->heap.front().priority;
+    lua_getfenv(L, 1);
+    lxs_cqtake(L, 2, q->pop());
+    lua_pushnumber(L, p);
+    return 2;
+}
 
+/// Returns the value, priority and handle of the lowest priority entry.
+static int libE_queue_peek(lua_State* const L)
+{
+    lxs_cqueue* q = lxs_cqcheck(L, 1);
     lua_settop(L, 1);
-    lxs_assert_stack_at(L, 1);
+
+    const lxs_cqueue::entry* e = q->top();
+    if (!e)
+        return 0;
+
+    lua_getfenv(L, 1);
+    lua_pushnumber(L, STATIC_CAST(lua_Number, e->handle));
+    lua_rawget(L, 2);
+    lua_pushnumber(L, e->priority);
+    lua_pushnumber(L, STATIC_CAST(lua_Number, e->handle));
+    return 3;
+}
+
+/// pop_until(priority [, t]) pops all entries up to and including priority
+/// and appends their values to t (or a new table) in order; returns t and
+/// the number of values popped.
+static int libE_queue_pop_until(lua_State* const L)
+{
+    lua_settop(L, 3);
+
+    lxs_cqueue*  q = lxs_cqcheck(L, 1);
+    const double p = lxs_cqcheckpriority(L, 2);
+
+    if (lua_isnil(L, 3))
+    {
+        lua_newtable(L);
+        lua_replace(L, 3);
+    }
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_getfenv(L, 1);
+
+    int n     = STATIC_CAST(int, lua_objlen(L, 3));
+    int count = 0;
+
+    for (const lxs_cqueue::entry* e = q->top();
+         e && e->priority <= p;
+         e = q->top())
+    {
+        lxs_cqtake(L, 4, q->pop());
+        lua_rawseti(L, 3, ++n);
+        ++count;
+    }
+
+    lua_settop(L, 3);
+    lua_pushinteger(L, count);
+    return 2;
+}
+
+/// Returns whether handle was queued.
+static int libE_queue_update_priority(lua_State* const L)
+{
+    lxs_cqueue*       q      = lxs_cqcheck(L, 1);
+    const uint64_t    handle = lxs_cqcheckhandle(L, 2);
+    const double      p      = lxs_cqcheckpriority(L, 3);
+    lxs_cqueue::slot* s      = q->find(handle);
+
+    if (s)
+        q->update(handle, *s, p);
+
+    lua_pushboolean(L, s != NULL);
     return 1;
 }
 
-static int libE_set_number_union(lua_State* const L)
+/// Returns the value of handle, nil if it wasn't queued.
+static int libE_queue_remove(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
+    lxs_cqueue*    q      = lxs_cqcheck(L, 1);
+    const uint64_t handle = lxs_cqcheckhandle(L, 2);
+
+    lua_settop(L, 2);
+    if (!q->find(handle))
+        return 0;
+
+    q->release(handle);
+    lua_getfenv(L, 1);
+    lxs_cqtake(L, 3, handle);
+    return 1;
+}
+
+/// Returns the priority of handle, nil if it isn't queued.
+static int libE_queue_priority(lua_State* const L)
+{
+    lxs_cqueue*             q = lxs_cqcheck(L, 1);
+    const lxs_cqueue::slot* s = q->find(lxs_cqcheckhandle(L, 2));
 
-    set_number* self  = lxs_ccheck_set_number(L, 1);
-    set_number* other = lxs_ccheck_set_number(L, 2);
+    if (!s)
+        return 0;
 
-    if (other->size () > 0)
-        self->insert(other->begin(), other->end());
+    lua_pushnumber(L, s->priority);
+    return 1;
+}
+
+static int libE_queue_size(lua_State* const L)
+{
+    lua_pushinteger(L,
+        static_cast<lua_Integer>(lxs_cqcheck(L, 1)->slots.size()));
+    return 1;
+}
+
+static int libE_queue_clear(lua_State* const L)
+{
+    lxs_cqcheck(L, 1)->clear();
 
     lua_settop(L, 1);
-    lxs_assert_stack_at(L, 1);
+    lua_newtable(L);
+    lua_setfenv(L, 1);
     return 1;
 }
 
+static int libM_queue_gc(lua_State* const L)
+{
+    lxs_cqueue* q = static_cast<lxs_cqueue*>(lua_touserdata(L, 1));
+    q->L = L;
+    q->~lxs_cqueue();
+    return 0;
+}
 
 
 
+//==============================================================================
+// metamethods
 
-static int libM_set_number_gc(lua_State* const L)
+template<class C>
+static int libM_gc(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
-    lxs_cfree(L, lxs_cget_set_number(L, 1));
+    lxs_cfree(L, static_cast<C*>(lua_touserdata(L, 1)));
     lxs_assert_stack_end(L, 0);
     return 0;
 }
 
-static int libM_set_number_len(lua_State* const L)
+template<class C>
+static int libM_len(lua_State* const L)
 {
-    return libE_set_number_size(L);
+    return libE_size<C>(L);
 }
 
-static int libM_set_number_eq(lua_State* const L)
+
+
+//==============================================================================
+// library
+
+#define match_type(s, slen, type)                                              \
+    ((slen) == _countof("" type) - 1 &&                                        \
+     memcmp((s), "" type, (slen)) == 0)
+
+/// new_*(type [, t]) creates a container of 'number' or 'string' keys and
+/// inserts the elements of t (insert_all).
+template<class Number, class String>
+static int libL_new(lua_State* const L)
 {
-    return libE_set_number_equals(L);
+    size_t      len;
+    const char* type = luaL_checklstring(L, 1, &len);
+
+    lua_settop(L, 2);
+
+    if (match_type(type, len, "number"))
+    {
+        Number* cont = lxs_cmake<Number>(L);
+        if (!lua_isnil(L, 2))
+            lxs_cinsert_all(L, 3, cont, 2);
+    }
+    else if (match_type(type, len, "string"))
+    {
+        String* cont = lxs_cmake<String>(L);
+        if (!lua_isnil(L, 2))
+            lxs_cinsert_all(L, 3, cont, 2);
+    }
+    else
+    {
+        luaL_argerror(L, 1,
+            "unknown or unsupported type; "
+            "only 'number' and 'string' are supported"
+        );
+    }
+
+    return 1;
 }
 
-static int libM_set_number_call(lua_State* const L)
+#undef match_type
+
+static int libL_new_queue(lua_State* const L)
 {
-    return libL_new_set(L);
+    lxs_assert_stack_begin(L);
+
+    lxs_cqueue* q = static_cast<lxs_cqueue*>(
+                        lua_newuserdata(L, sizeof(lxs_cqueue))
+                    );
+    new (q) lxs_cqueue(L);
+
+    luaL_getmetatable(L, lxs_cqueue::tname);
+    lxs_assert(L, lua_istable(L, -1));
+    lua_setmetatable(L, -2);
+
+    lua_newtable(L);
+    lua_setfenv(L, -2);
+
+    lxs_assert_stack_end(L, 1);
+    return 1;
 }
 
-#undef match_type
+static int libL_is_container(lua_State* const L)
+{
+    luaL_checkany(L, 1);
 
+    lua_settop(L, 1);
 
-//==============================================================================
+    if (!lua_isuserdata(L, 1) || !lua_getmetatable(L, 1))
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
 
-static const luaL_Reg libL_funcs[] = {
-    { "new_set",      libL_new_set      },
-    { "is_container", libL_is_container },
-    { NULL, NULL }
-};
+    lxs_rawgetl(L, -1, "__container");
+    lua_pushboolean(L, lua_toboolean(L, -1));
+    return 1;
+}
 
 
 //------------------------------------------------------------------------------
 
-static const luaL_Reg libE_set_number[] = {
-    { "size",     libE_set_number_size     },
-    { "insert",   libE_set_number_insert   },
-    { "contains", libE_set_number_contains },
-    { "remove",   libE_set_number_remove   },
-    { "clear",    libE_set_number_clear    },
-    { "equals",   libE_set_number_equals   },
-    { "swap",     libE_set_number_swap     },
-    { "iter",     libE_set_number_iter     },
-    { "diff",           libE_set_number_diff           },
-    { "intersect",      libE_set_number_intersect      },
-    { "is_subset_of",   libE_set_number_is_subset_of   },
-    { "is_superset_of", libE_set_number_is_superset_of },
-    { "overlaps",       libE_set_number_overlaps       },
-    { "sym_diff",       libE_set_number_sym_diff       },
-    { "union",          libE_set_number_union          },
-    { NULL, NULL }
-};
+template<class C>
+static void register_order(lua_State* const L, eastl::true_type)
+{
+    static const luaL_Reg methods[] = {
+        { "lower_bound", libE_lower_bound<C> },
+        { "upper_bound", libE_upper_bound<C> },
+        { "range",       libE_range<C>       },
+        { NULL, NULL }
+    };
+    luaI_openlib(L, NULL, methods, 0);
+}
 
-static const luaL_Reg libM_set_number[] = {
-    { "__gc",       libM_set_number_gc     },
-    { "__len",      libM_set_number_len    },
-    { "__eq",       libM_set_number_eq     },
-    { NULL, NULL }
-};
+template<class C>
+static void register_order(lua_State* const, eastl::false_type)
+{
+}
 
-void register_container_set_number(lua_State* const L) 
+/// sets
+template<class C>
+static void register_kind(lua_State* const L, eastl::false_type)
 {
-    lua_createtable(L, 0, _countof(libE_set_number) - 1);
-    luaI_openlib(L, NULL, libE_set_number, 0);
-    ///-----------------------------------------------------
+    static const luaL_Reg methods[] = {
+        { "insert",         libE_set_insert<C>         },
+        { "equals",         libE_set_equals<C>         },
+        { "diff",           libE_set_diff<C>           },
+        { "intersect",      libE_set_intersect<C>      },
+        { "is_subset_of",   libE_set_is_subset_of<C>   },
+        { "is_superset_of", libE_set_is_superset_of<C> },
+        { "overlaps",       libE_set_overlaps<C>       },
+        { "sym_diff",       libE_set_sym_diff<C>       },
+        { "union",          libE_set_union<C>          },
+        { NULL, NULL }
+    };
+    luaI_openlib(L, NULL, methods, 0);
+
+    lua_pushcfunction(L, libM_set_eq<C>);
+    lxs_rawsetl(L, -3, "__eq");
+}
 
-    /// create and store userdata instance metatable -------
-    lua_createtable(L, 0, _countof(libM_set_number) - 1);
-    luaI_openlib(L, NULL, libM_set_number, 0);
+/// maps
+template<class C>
+static void register_kind(lua_State* const L, eastl::true_type)
+{
+    static const luaL_Reg methods[] = {
+        { "get",    libE_map_get<C>    },
+        { "set",    libE_map_set<C>    },
+        { "insert", libE_map_insert<C> },
+        { NULL, NULL }
+    };
+    luaI_openlib(L, NULL, methods, 0);
+}
+
+template<class C>
+static void register_container(lua_State* const L)
+{
+    static const luaL_Reg methods[] = {
+        { "size",       libE_size<C>       },
+        { "contains",   libE_contains<C>   },
+        { "remove",     libE_remove<C>     },
+        { "clear",      libE_clear<C>      },
+        { "swap",       libE_swap<C>       },
+        { "iter",       libE_iter<C>       },
+        { "insert_all", libE_insert_all<C> },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg metamethods[] = {
+        { "__gc",  libM_gc<C>  },
+        { "__len", libM_len<C> },
+        { NULL, NULL }
+    };
+
+    lxs_assert_stack_begin(L);
+
+    /// create userdata instance metatable and methods -----
+    lua_createtable(L, 0, _countof(metamethods) + 2);
+    luaI_openlib(L, NULL, metamethods, 0);
+    lua_pushboolean(L, 1);
+    lxs_rawsetl(L, -2, "__container");
 
-    lua_pushvalue(L, -2);
+    lua_createtable(L, 0, _countof(methods) + 8);
+    luaI_openlib(L, NULL, methods, 0);
+    register_order<C>(L,
+        eastl::integral_constant<bool, C::kind::is_ordered != 0>()
+    );
+    register_kind<C>(L,
+        eastl::integral_constant<bool, C::kind::is_map != 0>()
+    );
     lxs_rawsetl(L, -2, "__index");
 
-    lxs_rawsetl(L, LUA_REGISTRYINDEX, TYPE_SET_NUMBER);
-    lua_pop(L, 1);
+    lua_setfield(L, LUA_REGISTRYINDEX, C::tname);
     ///-----------------------------------------------------
 
     /// create and store range metatable -------------------
     lua_createtable(L, 0, 1);
-    lua_pushcfunction(L, range<set_number_iterator>::destroy);
+    lua_pushcfunction(L, range<C>::destroy);
     lxs_rawsetl(L, -2, "__gc");
-    lxs_rawsetl(L, LUA_REGISTRYINDEX, TYPE_SET_NUMBER_RANGE);
+    lua_setfield(L, LUA_REGISTRYINDEX, C::rname);
+    ///-----------------------------------------------------
+
+    lxs_assert_stack_end(L, 0);
 }
 
 
+static void register_queue(lua_State* const L)
+{
+    static const luaL_Reg methods[] = {
+        { "push",            libE_queue_push            },
+        { "pop",             libE_queue_pop             },
+        { "peek",            libE_queue_peek            },
+        { "pop_until",       libE_queue_pop_until       },
+        { "update_priority", libE_queue_update_priority },
+        { "remove",          libE_queue_remove          },
+        { "priority",        libE_queue_priority        },
+        { "size",            libE_queue_size            },
+        { "clear",           libE_queue_clear           },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg metamethods[] = {
+        { "__gc",  libM_queue_gc   },
+        { "__len", libE_queue_size },
+        { NULL, NULL }
+    };
+
+    lxs_assert_stack_begin(L);
+
+    lua_createtable(L, 0, _countof(metamethods) + 1);
+    luaI_openlib(L, NULL, metamethods, 0);
+    lua_pushboolean(L, 1);
+    lxs_rawsetl(L, -2, "__container");
+
+    lua_createtable(L, 0, _countof(methods) - 1);
+    luaI_openlib(L, NULL, methods, 0);
+    lxs_rawsetl(L, -2, "__index");
+
+    lua_setfield(L, LUA_REGISTRYINDEX, lxs_cqueue::tname);
+
+    lxs_assert_stack_end(L, 0);
+}
 
-//------------------------------------------------------------------------------
+
+//==============================================================================
+
+extern "C" {
+
+static const luaL_Reg libL_funcs[] = {
+    { "new_set",        libL_new<set_number,        set_string>        },
+    { "new_hash_set",   libL_new<hash_set_number,   hash_set_string>   },
+    { "new_map",        libL_new<map_number,        map_string>        },
+    { "new_hash_map",   libL_new<hash_map_number,   hash_map_string>   },
+    { "new_vector_map", libL_new<vector_map_number, vector_map_string> },
+    { "new_queue",      libL_new_queue                                 },
+    { "is_container",   libL_is_container                              },
+    { NULL, NULL }
+};
 
 LUA_API int luaopen_container(lua_State* const L)
 {
@@ -525,17 +1124,27 @@ LUA_API int luaopen_container(lua_State* const L)
     ///---------------------------------------------------------
 
     /// register all available containers ----------------------
-    register_container_set_number(L);
+    register_container<set_number>(L);
+    register_container<set_string>(L);
+    register_container<hash_set_number>(L);
+    register_container<hash_set_string>(L);
+    register_container<map_number>(L);
+    register_container<map_string>(L);
+    register_container<hash_map_number>(L);
+    register_container<hash_map_string>(L);
+    register_container<vector_map_number>(L);
+    register_container<vector_map_string>(L);
+    register_queue(L);
     ///---------------------------------------------------------
 
     lxs_assert_stack_end(L, 1);
     return 1;
 }
 
+}; // extern "C"
+
 
 
 //==============================================================================
 
 #endif // LUAXS_ADDLIB_CONTAINER
-
-}; // extern "C"
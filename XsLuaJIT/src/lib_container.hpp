@@ -2,11 +2,13 @@
 #define lxs_container_hpp 1
 
 extern "C" {
-
 #include "luajit.h"
+}; // extern "C"
 
 #if LUAXS_ADDLIB_CONTAINER
 
+extern "C" {
+
 #include "lauxlib.h"
 #include "lualib.h"
 #include "lmem.h"
@@ -17,44 +19,86 @@ extern "C" {
 
 #include "leastl.hpp"
 #include <eastl/algorithm.h>
+#include <eastl/functional.h>
+#include <eastl/sort.h>
+#include <eastl/heap.h>
+#include <eastl/vector.h>
 #include <eastl/set.h>
+#include <eastl/map.h>
+#include <eastl/vector_map.h>
+#include <eastl/hash_set.h>
+#include <eastl/hash_map.h>
 
 
 
+//==============================================================================
+// allocator
 
+/// Allocates through luaM_*, so container memory is accounted for by the GC
+/// just like the memory of any other Lua object.
+///
+/// The state is read from the owning container (lxs_container::L), which is
+/// set to the calling thread on every access. That way a memory error unwinds
+/// the thread which caused it and not whichever thread created the container.
+class lxs_callocator
+{
+public:
+    lxs_callocator(const char* = NULL)
+        : L_(NULL)
+    {
+    }
 
+    explicit lxs_callocator(lua_State* const* L)
+        : L_(L)
+    {
+    }
 
+    inline void* allocate(size_t n, int = 0) const
+    {
+        return luaM_malloc(*L_, n);
+    }
 
-//template<class T>
-//struct ref_handle
-//{
-//    int id;
-//
-//    ref_handle()
-//        : id(LUA_NOREF)
-//    {
-//    }
-//
-//    void pin(lua_State* const L, int narg)
-//    {
-//        id = luaL_ref(L, LUA_REGISTRYINDEX);
-//    }
-//
-//    void unpin(lua_State* const L)
-//    {
-//        luaL_unref(L, LUA_REGISTRYINDEX, id);
-//        id = LUA_NOREF;
-//    }
-//
-//    void get(lua_State* const L) const
-//    {
-//        lua_rawgeti(L, LUA_REGISTRYINDEX, id);
-//    }
-//};
+    inline void* allocate(size_t n, size_t alignment, size_t offset, int = 0) const
+    {
+        // luaM_* is as aligned as malloc, which is enough for our elements
+        lxs_assert(*L_, alignment <= sizeof(double) && offset == 0);
+        return luaM_malloc(*L_, n);
+    }
 
+    inline void deallocate(void* p, size_t n) const
+    {
+        luaM_freemem(*L_, p, n);
+    }
 
+    inline const char* get_name() const
+    {
+        return "lxs_callocator";
+    }
 
+    inline void set_name(const char*)
+    {
+    }
 
+private:
+    lua_State* const* L_;
+}; // cs lxs_callocator
+
+/// All allocators share the heap of their Lua state, so containers may swap
+/// their contents instead of copying them.
+inline bool operator==(const lxs_callocator&, const lxs_callocator&)
+{
+    return true;
+}
+
+inline bool operator!=(const lxs_callocator&, const lxs_callocator&)
+{
+    return false;
+}
+
+
+
+//==============================================================================
+// keys
 
 typedef struct lstring
 {
@@ -66,6 +110,12 @@ typedef struct lstring
         , data(NULL)
     {
     }
+
+    lstring(const char* data, size_t len)
+        : len(len)
+        , data(data)
+    {
+    }
 } lstring;
 
 /// That said, to define a strict weak order on a set of objects O, you need to
@@ -104,86 +154,584 @@ typedef struct lstring
 ///     r(z, x)
 ///     == false
 ///
-//template<>
-//struct eastl::less<double>
-//    : public eastl::binary_function<lstring, lstring, bool>
-//{
-//    bool operator()(const double& lhs, const double& rhs) const
-//    {
-//        return lhs < rhs;
-//    }
-//};
-//
-//
-//template<>
-//struct eastl::less<lstring>
-//    : public eastl::binary_function<lstring, lstring, bool>
-//{
-//    bool operator()(const lstring& lhs, const lstring& rhs) const
-//    {
-//        if (memcmp(lhs.data, rhs.data, eastl::min(lhs.len, rhs.len)) < 0)
-//            return true;
-//        return false;
-//    }
-//};
+/// Which is why NaN is rejected as a key: every comparison with it is false.
+/// Strings are ordered bytewise, a shorter prefix first.
+struct lstring_less
+{
+    inline bool operator()(const lstring& lhs, const lstring& rhs) const
+    {
+        const int r = memcmp(lhs.data, rhs.data,
+                             lhs.len < rhs.len ? lhs.len : rhs.len);
+        return r < 0 || (r == 0 && lhs.len < rhs.len);
+    }
+};
 
+struct lstring_equal
+{
+    inline bool operator()(const lstring& lhs, const lstring& rhs) const
+    {
+        return lhs.len == rhs.len && memcmp(lhs.data, rhs.data, lhs.len) == 0;
+    }
+};
 
+/// FNV-1a
+struct lstring_hash
+{
+    inline size_t operator()(const lstring& s) const
+    {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < s.len; ++i)
+            h = (h ^ STATIC_CAST(unsigned char, s.data[i])) * 16777619u;
+        return STATIC_CAST(size_t, h);
+    }
+};
 
+/// eastl::hash<double> truncates to an integer, which puts every fraction of
+/// the same integer into one bucket; this hashes all 64 bits instead.
+struct number_hash
+{
+    inline size_t operator()(double v) const
+    {
+        uint32_t w[2];
+        if (v == 0)
+            v = 0; // -0 == 0
+        memcpy(w, &v, sizeof(w));
+        return STATIC_CAST(size_t, w[0] ^ (w[1] * 2654435761u));
+    }
+};
 
-typedef eastl::set<double>                    set_number;
-typedef set_number::insert_return_type set_number_result;
-typedef set_number::const_iterator     set_number_iterator;
 
-typedef eastl::set<lstring>            set_string;
-typedef set_string::insert_return_type set_string_result;
-typedef set_string::const_iterator     set_string_iterator;
+/// Key policies: how keys are read from and pushed to the stack and how
+/// they are copied into and released by a container.
+struct lxs_cnumber
+{
+    typedef double                  type;
+    typedef eastl::less<double>     less;
+    typedef eastl::equal_to<double> equal;
+    typedef number_hash             hash;
 
+    static inline const char* name()
+    {
+        return "number";
+    }
 
-#define TYPE_SET_NUMBER       "container_set_number"
-#define TYPE_SET_NUMBER_RANGE "container_set_number_range"
+    /// Stores the key at idx in k; false if it isn't one (or NaN).
+    static inline bool test(lua_State* const L, int idx, type* k)
+    {
+        if (lua_type(L, idx) != LUA_TNUMBER)
+            return false;
+        *k = lua_tonumber(L, idx);
+        return *k == *k;
+    }
 
-#define TYPE_SET_STRING       "container_set_string"
-#define TYPE_SET_STRING_RANGE "container_set_string_range"
+    /// Whether the value at idx failed test only for being NaN.
+    static inline bool is_nan(lua_State* const L, int idx)
+    {
+        if (lua_type(L, idx) != LUA_TNUMBER)
+            return false;
+        const type k = lua_tonumber(L, idx);
+        return k != k;
+    }
 
+    static inline void push(lua_State* const L, const type& k)
+    {
+        lua_pushnumber(L, k);
+    }
 
+    static inline void own(const lxs_callocator&, type&)
+    {
+    }
+
+    static inline void release(const lxs_callocator&, const type&)
+    {
+    }
+};
 
-template<class Iterator>
-inline static int push_from_iterator(lua_State *const L, Iterator &it)
+/// String keys are tested as views of the Lua string; only keys which end up
+/// in a container are copied (own), so lookups never allocate.
+struct lxs_cstring
 {
-    lxs_error(L, "Not implemented!");
-    return 0;
+    typedef lstring       type;
+    typedef lstring_less  less;
+    typedef lstring_equal equal;
+    typedef lstring_hash  hash;
+
+    static inline const char* name()
+    {
+        return "string";
+    }
+
+    static inline bool test(lua_State* const L, int idx, type* k)
+    {
+        if (lua_type(L, idx) != LUA_TSTRING)
+            return false;
+        k->data = lua_tolstring(L, idx, &k->len);
+        return true;
+    }
+
+    static inline bool is_nan(lua_State* const, int)
+    {
+        return false;
+    }
+
+    static inline void push(lua_State* const L, const type& k)
+    {
+        lua_pushlstring(L, k.data, k.len);
+    }
+
+    static inline void own(const lxs_callocator& a, type& k)
+    {
+        if (k.len > 0)
+        {
+            char* data = static_cast<char*>(a.allocate(k.len));
+            memcpy(data, k.data, k.len);
+            k.data = data;
+        }
+        else
+        {
+            k.data = "";
+        }
+    }
+
+    static inline void release(const lxs_callocator& a, const type& k)
+    {
+        if (k.len > 0)
+            a.deallocate(const_cast<char*>(k.data), k.len);
+    }
+};
+
+
+
+//==============================================================================
+// kinds
+
+/// Each kind wraps an EASTL container over the keys of a key policy. Maps
+/// store a reference (luaL_ref) into the environment of their userdata for
+/// each value, so values are ordinary, collectable Lua values.
+///
+///     impl_type   the EASTL container
+///     value_type  its element
+///     is_map      whether elements have a value (ref_of, set_ref)
+///     is_ordered  whether iteration is ordered (lower_bound, upper_bound)
+///     make        creates an empty impl_type
+///     value       makes an element from a key and a reference
+///     insert      inserts an element, returns it or the existing one
+
+template<class Key>
+struct lxs_cset
+{
+    typedef Key                                                       key;
+    typedef typename Key::type                                        key_type;
+    typedef eastl::set<key_type, typename Key::less, lxs_callocator>  impl_type;
+    typedef key_type                                                  value_type;
+
+    enum { is_map = 0, is_ordered = 1 };
+
+    static inline impl_type make(const lxs_callocator& a)
+    {
+        return impl_type(typename Key::less(), a);
+    }
+
+    static inline value_type value(const key_type& k, int)
+    {
+        return k;
+    }
+
+    static inline const key_type& key_of(const value_type& v)
+    {
+        return v;
+    }
+
+    static inline int ref_of(const value_type&)
+    {
+        return LUA_NOREF;
+    }
+
+    static inline void set_ref(const value_type&, int)
+    {
+    }
+
+    static inline typename impl_type::iterator insert(impl_type& items,
+                                                      const value_type& v)
+    {
+        return items.insert(items.end(), v);
+    }
+};
+
+template<class Key>
+struct lxs_chash_set
+{
+    typedef Key                                               key;
+    typedef typename Key::type                                key_type;
+    typedef eastl::hash_set<key_type,
+                            typename Key::hash,
+                            typename Key::equal,
+                            lxs_callocator>                   impl_type;
+    typedef key_type                                          value_type;
+
+    enum { is_map = 0, is_ordered = 0 };
+
+    static inline impl_type make(const lxs_callocator& a)
+    {
+        return impl_type(a);
+    }
+
+    static inline value_type value(const key_type& k, int)
+    {
+        return k;
+    }
+
+    static inline const key_type& key_of(const value_type& v)
+    {
+        return v;
+    }
+
+    static inline int ref_of(const value_type&)
+    {
+        return LUA_NOREF;
+    }
+
+    static inline void set_ref(const value_type&, int)
+    {
+    }
+
+    static inline typename impl_type::iterator insert(impl_type& items,
+                                                      const value_type& v)
+    {
+        return items.insert(v).first;
+    }
+};
+
+
+/// Orders (key, reference) pairs by key, see lxs_cinsert_all.
+template<class Key>
+struct lxs_cpair_less
+{
+    template<class Pair>
+    inline bool operator()(const Pair& lhs, const Pair& rhs) const
+    {
+        return typename Key::less()(lhs.first, rhs.first);
+    }
+};
+
+template<class Key, class Impl>
+struct lxs_cmap_base
+{
+    typedef Key                           key;
+    typedef typename Key::type            key_type;
+    typedef Impl                          impl_type;
+    typedef typename Impl::value_type     value_type;
+
+    static inline value_type value(const key_type& k, int ref)
+    {
+        return value_type(k, ref);
+    }
+
+    static inline const key_type& key_of(const value_type& v)
+    {
+        return v.first;
+    }
+
+    static inline int ref_of(const value_type& v)
+    {
+        return v.second;
+    }
+
+    static inline void set_ref(value_type& v, int ref)
+    {
+        v.second = ref;
+    }
+};
+
+template<class Key>
+struct lxs_cmap
+    : public lxs_cmap_base<Key, eastl::map<typename Key::type,
+                                           int,
+                                           typename Key::less,
+                                           lxs_callocator> >
+{
+    typedef lxs_cmap_base<Key, eastl::map<typename Key::type,
+                                          int,
+                                          typename Key::less,
+                                          lxs_callocator> > base;
+
+    enum { is_map = 1, is_ordered = 1 };
+
+    static inline typename base::impl_type make(const lxs_callocator& a)
+    {
+        return typename base::impl_type(typename Key::less(), a);
+    }
+
+    static inline typename base::impl_type::iterator insert(
+        typename base::impl_type& items,
+        const typename base::value_type& v
+    )
+    {
+        return items.insert(items.end(), v);
+    }
+};
+
+template<class Key>
+struct lxs_chash_map
+    : public lxs_cmap_base<Key, eastl::hash_map<typename Key::type,
+                                                int,
+                                                typename Key::hash,
+                                                typename Key::equal,
+                                                lxs_callocator> >
+{
+    typedef lxs_cmap_base<Key, eastl::hash_map<typename Key::type,
+                                               int,
+                                               typename Key::hash,
+                                               typename Key::equal,
+                                               lxs_callocator> > base;
+
+    enum { is_map = 1, is_ordered = 0 };
+
+    static inline typename base::impl_type make(const lxs_callocator& a)
+    {
+        return typename base::impl_type(a);
+    }
+
+    static inline typename base::impl_type::iterator insert(
+        typename base::impl_type& items,
+        const typename base::value_type& v
+    )
+    {
+        return items.insert(v).first;
+    }
+};
+
+/// A sorted vector: slower to modify than a map, but compact and fast to
+/// search and iterate. Bulk inserts of sorted keys append.
+template<class Key>
+struct lxs_cvector_map
+    : public lxs_cmap_base<Key, eastl::vector_map<typename Key::type,
+                                                  int,
+                                                  typename Key::less,
+                                                  lxs_callocator> >
+{
+    typedef lxs_cmap_base<Key, eastl::vector_map<typename Key::type,
+                                                 int,
+                                                 typename Key::less,
+                                                 lxs_callocator> > base;
+
+    enum { is_map = 1, is_ordered = 1 };
+
+    static inline typename base::impl_type make(const lxs_callocator& a)
+    {
+        return typename base::impl_type(typename Key::less(), a);
+    }
+
+    static inline typename base::impl_type::iterator insert(
+        typename base::impl_type& items,
+        const typename base::value_type& v
+    )
+    {
+        return items.insert(items.end(), v);
+    }
+};
+
+
+
+//==============================================================================
+// container userdata
+
+template<class Kind>
+struct lxs_container
+{
+    typedef Kind                             kind;
+    typedef typename Kind::key               key;
+    typedef typename Kind::key_type          key_type;
+    typedef typename Kind::value_type        value_type;
+    typedef typename Kind::impl_type         impl_type;
+    typedef typename impl_type::iterator     iterator;
+
+    /// Registry names of the metatables of the container and its ranges.
+    static const char* const tname;
+    static const char* const rname;
+
+    lua_State* L;       ///< the calling thread, used by the allocator
+    size_t     version; ///< changes with every insertion or removal of a key
+    impl_type  items;
+
+    explicit lxs_container(lua_State* const L)
+        : L(L)
+        , version(0)
+        , items(Kind::make(lxs_callocator(&this->L)))
+    {
+    }
+
+    ~lxs_container()
+    {
+        release_keys();
+    }
+
+    inline lxs_callocator allocator() const
+    {
+        return lxs_callocator(&L);
+    }
+
+    /// Releases the copies of all keys; the caller removes the elements.
+    inline void release_keys()
+    {
+        const lxs_callocator a = allocator();
+        for (iterator it = items.begin(); it != items.end(); ++it)
+            key::release(a, Kind::key_of(*it));
+    }
+};
+
+typedef lxs_container<lxs_cset<lxs_cnumber> >        set_number;
+typedef lxs_container<lxs_cset<lxs_cstring> >        set_string;
+typedef lxs_container<lxs_chash_set<lxs_cnumber> >   hash_set_number;
+typedef lxs_container<lxs_chash_set<lxs_cstring> >   hash_set_string;
+typedef lxs_container<lxs_cmap<lxs_cnumber> >        map_number;
+typedef lxs_container<lxs_cmap<lxs_cstring> >        map_string;
+typedef lxs_container<lxs_chash_map<lxs_cnumber> >   hash_map_number;
+typedef lxs_container<lxs_chash_map<lxs_cstring> >   hash_map_string;
+typedef lxs_container<lxs_cvector_map<lxs_cnumber> > vector_map_number;
+typedef lxs_container<lxs_cvector_map<lxs_cstring> > vector_map_string;
+
+
+#define TYPE_SET_NUMBER        "container_set_number"
+#define TYPE_SET_STRING        "container_set_string"
+#define TYPE_HASH_SET_NUMBER   "container_hash_set_number"
+#define TYPE_HASH_SET_STRING   "container_hash_set_string"
+#define TYPE_MAP_NUMBER        "container_map_number"
+#define TYPE_MAP_STRING        "container_map_string"
+#define TYPE_HASH_MAP_NUMBER   "container_hash_map_number"
+#define TYPE_HASH_MAP_STRING   "container_hash_map_string"
+#define TYPE_VECTOR_MAP_NUMBER "container_vector_map_number"
+#define TYPE_VECTOR_MAP_STRING "container_vector_map_string"
+
+#define lxs_cdefine(Container, type)                                           \
+    template<> const char* const Container::tname = "" type;                   \
+    template<> const char* const Container::rname = "" type "_range"
+
+
+
+//==============================================================================
+// creation and access
+
+/// Pushes a new, empty container. Maps get a new environment table, which
+/// holds their values.
+template<class Container>
+inline static Container* lxs_cmake(lua_State* const L)
+{
+    lxs_assert(L, L);
+    lxs_assert_stack_begin(L);
+
+    Container* cont = static_cast<Container*>(
+                          lua_newuserdata(L, sizeof(Container))
+                      );
+    lxs_assert(L, cont && lua_isuserdata(L, -1));
+
+    // constructing an empty container doesn't allocate, so no __gc can see
+    // it uninitialized
+    new (cont) Container(L);
+
+    luaL_getmetatable(L, Container::tname);
+    lxs_assert(L, lua_istable(L, -1));
+    lua_setmetatable(L, -2);
+
+    if (Container::kind::is_map)
+    {
+        lua_newtable(L);
+        lua_setfenv(L, -2);
+    }
+
+    lxs_assert_stack_end(L, 1);
+    return cont;
+}
+
+template<class Container>
+inline static void lxs_cfree(lua_State* const L, Container* cont)
+{
+    lxs_assert(L, L);
+    lxs_assert_stack_begin(L);
+
+    cont->L = L;
+    cont->~Container();
+
+    lxs_assert_stack_end(L, 0);
 }
 
-template<>
-inline static int push_from_iterator<set_number_iterator>(
-    lua_State *const L,
-    set_number_iterator &it
-)
+template<class Container>
+inline static Container* lxs_cget(lua_State* const L, int narg)
 {
-    lua_pushnumber(L, *it);
-    return 1;
+    lxs_assert(L, L);
+
+    Container* cont = static_cast<Container*>(lua_touserdata(L, narg));
+    cont->L = L;
+    return cont;
 }
 
-template<>
-inline static int push_from_iterator<set_string_iterator>(
-    lua_State *const L,
-    set_string_iterator &it
-)
+template<class Container>
+inline static Container* lxs_ccheck(lua_State* const L, int narg)
+{
+    lxs_assert(L, L);
+
+    Container* cont = static_cast<Container*>(
+                          luaL_checkudata(L, narg, Container::tname)
+                      );
+    cont->L = L;
+    return cont;
+}
+
+/// Checks that the argument narg is a key of the container.
+template<class Container>
+inline static typename Container::key_type lxs_ccheckkey(lua_State* const L,
+                                                         int narg)
+{
+    typename Container::key_type k;
+
+    if (!Container::key::test(L, narg, &k))
+    {
+        if (Container::key::is_nan(L, narg))
+            luaL_argerror(L, narg, "NaN is not a valid key");
+        luaL_typerror(L, narg, Container::key::name());
+    }
+    return k;
+}
+
+
+
+//==============================================================================
+// ranges
+
+/// Pushes the element at it: its key and, for maps, its value. The container
+/// is at idx.
+template<class Container>
+inline static int lxs_cpush(lua_State* const L,
+                            int idx,
+                            const typename Container::value_type& v)
 {
-    lstring s = *it;
-    lua_pushlstring(L, s.data, s.len);
-    return 1;
+    Container::key::push(L, Container::kind::key_of(v));
+
+    if (!Container::kind::is_map)
+        return 1;
+
+    lua_getfenv(L, idx);
+    lua_rawgeti(L, -1, Container::kind::ref_of(v));
+    lua_remove(L, -2);
+    return 2;
 }
 
-template<class Iterator>
+/// A half open range [front, end) of a container; iterated by a generator
+/// closure, which keeps the container alive. Any insertion or removal of a
+/// key invalidates it, replacing the value of a map key does not.
+template<class Container>
 struct range
 {
-    Iterator front;
-    Iterator end;
+    typedef typename Container::iterator iterator;
 
-    range(Iterator front, Iterator end)
+    iterator front;
+    iterator end;
+    size_t   version;
+
+    range(iterator front, iterator end, size_t version)
         : front(front)
         , end(end)
+        , version(version)
     {
     }
 
@@ -201,10 +749,16 @@ struct range
         range *self = static_cast<range *>(
                           lua_touserdata(L, lua_upvalueindex(1))
                       );
+        Container *cont = static_cast<Container *>(
+                              lua_touserdata(L, lua_upvalueindex(2))
+                          );
+
+        if (cont->version != self->version)
+            lxs_error(L, "container modified during iteration");
 
         if (self->front != self->end)
         {
-            int pushes = push_from_iterator<Iterator>(L, self->front);
+            int pushes = lxs_cpush<Container>(L, lua_upvalueindex(2), *self->front);
             ++self->front;
             return pushes;
         }
@@ -214,110 +768,193 @@ struct range
         }
     }
 
+    /// Pushes a generator over [front, end) of the container at idx.
     inline static int make_gen(lua_State *const L,
-                               Iterator &front,
-                               Iterator &end,
-                               const char *type,
-                               size_t len)
+                               int idx,
+                               iterator front,
+                               iterator end)
     {
-        void *self = lua_newuserdata(L, sizeof(range<Iterator>));
+        lxs_assert_stack_begin(L);
+
+        Container *cont = static_cast<Container *>(lua_touserdata(L, idx));
+        void *self = lua_newuserdata(L, sizeof(range));
         lxs_assert(L, self);
 
-        lxs_rawget(L, LUA_REGISTRYINDEX, type, len);
+        new (self) range(front, end, cont->version);
+
+        luaL_getmetatable(L, Container::rname);
         lxs_assert(L, lua_istable(L, -1));
         lua_setmetatable(L, -2);
 
-        new (self) range<Iterator>(front, end);
+        lua_pushvalue(L, idx);
+        lua_pushcclosure(L, range::next, 2);
 
-        lua_pushcclosure(L, range<Iterator>::next, 1);
+        lxs_assert_stack_end(L, 1);
         return 1;
     };
-
-    template<class Container>
-    inline static int make_gen(lua_State *const L,
-                               Container &cont,
-                               const char *type,
-                               size_t len)
-    {
-        return range<Container::const_iterator>::make_gen(
-                   L,
-                   cont.begin(),
-                   cont.end(),
-                   type,
-                   len
-               );
-    }
 }; // cs range
 
 
 
+//==============================================================================
+// priority queue
 
+/// A binary min-heap of (priority, value) entries; equal priorities pop in
+/// the order they were pushed.
+///
+/// An entry's handle is the seq it was first pushed with. Handles are never
+/// reused, so a stale handle can't address a later entry. Values are stored
+/// in the environment of the userdata under their handle, which also keys
+/// slots. Updating or removing an entry only changes its slot: the old heap
+/// entry becomes stale, because its seq no longer matches the slot, and is
+/// dropped once it reaches the top or when stale entries outnumber the live
+/// ones (compact).
+struct lxs_cqueue
+{
+    struct entry
+    {
+        double   priority;
+        uint64_t seq;
+        uint64_t handle;
+    };
 
+    struct slot
+    {
+        double   priority;
+        uint64_t seq; ///< of the live entry
+    };
 
-#define lxs_cmakel(L, type, tname)                                             \
-    lxs_cmake<type>(L, "" tname, _countof(tname) - 1)
-
-template<typename Container>
-inline static Container *lxs_cmake(lua_State *const L,
-                                   const char *type,
-                                   size_t len)
-{
-    lxs_assert(L, L);
-    lxs_assert_stack_begin(L);
+    /// eastl heaps are max-heaps, so the later entry compares less.
+    struct later
+    {
+        inline bool operator()(const entry& lhs, const entry& rhs) const
+        {
+            return lhs.priority > rhs.priority ||
+                   (lhs.priority == rhs.priority && lhs.seq > rhs.seq);
+        }
+    };
 
-    Container *cont = static_cast<Container *>(
-                          lua_newuserdata(L, sizeof(Container))
-                      );
-    lxs_assert(L, cont && lua_isuserdata(L, -1));
+    struct stale
+    {
+        const lxs_cqueue* q;
 
-    lxs_rawget(L, LUA_REGISTRYINDEX, type, len);
-    lxs_assert(L, lua_istable(L, -1));
-    lua_setmetatable(L, -2);
+        inline bool operator()(const entry& e) const
+        {
+            return q->is_stale(e);
+        }
+    };
 
-    new (cont) Container();
+    typedef eastl::vector<entry, lxs_callocator> heap_type;
+    typedef eastl::hash_map<uint64_t,
+                            slot,
+                            eastl::hash<uint64_t>,
+                            eastl::equal_to<uint64_t>,
+                            lxs_callocator>      slot_type;
+
+    static const char* const tname;
+
+    lua_State* L;   ///< the calling thread, used by the allocator
+    uint64_t   seq; ///< of the last pushed entry
+    heap_type  heap;
+    slot_type  slots;
+
+    explicit lxs_cqueue(lua_State* const L)
+        : L(L)
+        , seq(0)
+        , heap(lxs_callocator(&this->L))
+        , slots(lxs_callocator(&this->L))
+    {
+    }
 
-    lxs_assert_stack_end(L, 1);
-    return cont;
-}
+    /// Returns the slot of handle, NULL if it isn't queued.
+    inline slot* find(uint64_t handle)
+    {
+        const slot_type::iterator it = slots.find(handle);
+        return it == slots.end() ? NULL : &it->second;
+    }
 
+    inline bool is_stale(const entry& e) const
+    {
+        const slot_type::const_iterator it = slots.find(e.handle);
+        return it == slots.end() || it->second.seq != e.seq;
+    }
 
-template<typename Container>
-inline static void lxs_cfree(lua_State *const L, Container *cont)
-{
-    lxs_assert(L, L);
-    lxs_assert_stack_begin(L);
+    /// Adds a new entry; returns its handle.
+    inline uint64_t push(double priority)
+    {
+        const slot s = { priority, ++seq };
+        slots.insert(eastl::make_pair(seq, s));
+        return enqueue(seq, s);
+    }
 
-    cont->~Container();
+    /// Replaces the entry of handle, which keeps its handle.
+    inline void update(uint64_t handle, slot& s, double priority)
+    {
+        s.priority = priority;
+        s.seq      = ++seq;
+        enqueue(handle, s);
+    }
 
-    lxs_assert_stack_end(L, 0);
-}
+    /// Removes the slot of handle, its entry becomes stale.
+    inline void release(uint64_t handle)
+    {
+        slots.erase(handle);
+        compact();
+    }
 
+    /// Drops stale entries from the top; returns the top entry or NULL.
+    inline const entry* top()
+    {
+        while (!heap.empty() && is_stale(heap.front()))
+        {
+            eastl::pop_heap(heap.begin(), heap.end(), later());
+            heap.pop_back();
+        }
+        return heap.empty() ? NULL : &heap.front();
+    }
 
-#define lxs_cget_set_number(L, narg)                                    \
-    lxs_cget<set_number>(L, (narg))
+    /// Removes the top entry, which must be live; returns its handle.
+    inline uint64_t pop()
+    {
+        const uint64_t handle = heap.front().handle;
 
-template<typename Container>
-inline static Container *lxs_cget(lua_State *const L, int narg)
-{
-    lxs_assert(L, L);
+        eastl::pop_heap(heap.begin(), heap.end(), later());
+        heap.pop_back();
+        slots.erase(handle);
+        return handle;
+    }
 
-    return static_cast<Container *>(lua_touserdata(L, narg));
-}
+    inline void compact()
+    {
+        if (heap.size() > 2 * slots.size() + 32)
+        {
+            const stale pred = { this };
+            heap.erase(eastl::remove_if(heap.begin(), heap.end(), pred),
+                       heap.end());
+            eastl::make_heap(heap.begin(), heap.end(), later());
+        }
+    }
 
+    inline void clear()
+    {
+        heap.clear();
+        slots.clear();
+    }
 
-#define lxs_ccheck_set_number(L, narg)                                  \
-    lxs_ccheck<set_number>(L, (narg), TYPE_SET_NUMBER)
+    inline uint64_t enqueue(uint64_t handle, const slot& s)
+    {
+        const entry e = { s.priority, s.seq, handle };
+        heap.push_back(e);
+        eastl::push_heap(heap.begin(), heap.end(), later());
+        compact();
+        return handle;
+    }
+}; // cs lxs_cqueue
 
-template<typename Container>
-inline static Container *lxs_ccheck(lua_State *const L,
-                                    int narg,
-                                    const char *type)
-{
-    lxs_assert(L, L);
-    lxs_assert(L, type);
+#define TYPE_QUEUE "container_queue"
 
-    return static_cast<Container *>(luaL_checkudata(L, narg, type));
-}
+/// Handles are lua_Numbers; above 2^53 they would no longer be exact.
+#define LXS_CQMAXHANDLE 9007199254740992.0
 
 
 
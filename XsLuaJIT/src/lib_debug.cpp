@@ -518,9 +518,10 @@ static int libL_traceback_ex(lua_State* const L)
     else
         level = (L == L1) ? 1 : 0;
 
-    lxs_spb_decl(L, s);
     if (lua_gettop(L) != arg && !lua_isstring(L, arg + 1))
         return 1;
+
+    lxs_spb_decl(L, s);
     //else
     //    lxs_sappendc(L, lxs_spb_ptr(s), '\n');
 
@@ -639,10 +640,56 @@ static int libL_traceback_ex(lua_State* const L)
         ++level;
     }
     lxs_spushresult(L, lxs_spb_ptr(s));
+    lxs_spb_release(L, s);
+
+    lxs_assert_stack_end(L, 1);
+    return 1;
+}
+
+#if LUAXS_CORE_STRSTATS
+/// debug.strstats([reset = false])
+///
+/// Returns a table describing the interned string table: size (buckets),
+/// nuse (strings), empty (empty buckets) and maxchain (longest chain), plus
+/// the counters since the last reset: lookups, hits, probes (chain entries
+/// visited) and collisions (entries with the same hash and length but
+/// different contents). If *reset* is true, the counters are set back to zero
+/// after being read.
+///
+/// Example Usage:
+///     local s = debug.strstats()
+///     print(s.probes / s.lookups) --> average chain entries per lookup
+static int libL_strstats(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_strtstat stats;
+    lxs_strtstats(L, &stats, luaL_optbool(L, 1, false));
+
+    lua_createtable(L, 0, 9);
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.size));
+    lxs_rawsetl(L, -2, "size");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.nuse));
+    lxs_rawsetl(L, -2, "nuse");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.empty));
+    lxs_rawsetl(L, -2, "empty");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.maxchain));
+    lxs_rawsetl(L, -2, "maxchain");
+    lua_pushinteger(L, static_cast<lua_Integer>(stats.pending));
+    lxs_rawsetl(L, -2, "pending");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.lookups));
+    lxs_rawsetl(L, -2, "lookups");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.hits));
+    lxs_rawsetl(L, -2, "hits");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.probes));
+    lxs_rawsetl(L, -2, "probes");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.collisions));
+    lxs_rawsetl(L, -2, "collisions");
 
     lxs_assert_stack_end(L, 1);
     return 1;
 }
+#endif // LUAXS_CORE_STRSTATS
 
 #endif // LUAXS_EXTEND_DBLIB
 
@@ -670,6 +717,9 @@ static const luaL_Reg dblib[] = {
     { "getpointer",    libL_getpointer   },
     { "memdump",       libL_memdump      },
     { "traceback_ex",  libL_traceback_ex },
+#  if LUAXS_CORE_STRSTATS
+    { "strstats",      libL_strstats     },
+#  endif
 #endif
     { NULL, NULL }
 };
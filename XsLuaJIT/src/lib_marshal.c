@@ -39,7 +39,15 @@
 #include "lauxlib.h"
 
 #include "lmem.h"
-
+#include "lobject.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "lxs_lz.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -53,77 +61,281 @@
 #define MAR_I32 4
 #define MAR_I64 8
 
-#define MAR_MAGIC 0x8e
-#define SEEN_IDX  3
+#define MAR_MAGIC  0x8e
+#define MAR_MAGIC2 0x8f /* format 2 */
+#define MAR_MAGICZ 0x91 /* compressed, followed by an lxs_lz frame */
+
+/* size of the staging buffer for file and buffer sinks and file sources */
+#define MAR_STAGE_SIZE 4096
 
 
-typedef struct mar_Buffer
+/* Encoder output. Strings are encoded into one growing block, files and
+ * buffers are written to through a fixed-size staging buffer instead, so the
+ * encoded data never has to exist as a whole. Record lengths precede their
+ * records; they are written as placeholders and patched once known. */
+typedef struct mar_Writer
 {
-    size_t size;
-    size_t seek;
-    size_t head;
+    size_t size;  /* capacity of data */
+    size_t head;  /* bytes in data */
+    size_t base;  /* bytes handed to the sink before data[0] */
     char*  data;
-} mar_Buffer;
+    FILE*  f;     /* file sink or NULL */
+    long   fpos;  /* file position the encoded data starts at */
+    int    bidx;  /* stack index of the buffer sink or 0 */
+    size_t bpos;  /* buffer length the encoded data starts at */
+    int    seen;  /* stack index of the value -> reference map */
+    int    strs;  /* stack index of the string -> index map (format 2) */
+    int    nstrs; /* strings in strs */
+    struct mar_Zw* z; /* compression state or NULL */
+    char   stage[MAR_STAGE_SIZE];
+} mar_Writer;
+
+/* Decoder input. Files are read through a fixed-size staging buffer. */
+typedef struct mar_Reader
+{
+    const char* p;    /* next byte */
+    const char* end;  /* end of the bytes available */
+    size_t      read; /* bytes read from the source up to end */
+    FILE*       f;    /* file source or NULL */
+    int         bidx; /* stack index of the buffer source or 0 */
+    size_t      boff; /* offset of the first byte read in the buffer */
+    int         seen; /* stack index of the reference -> value map */
+    int         strs; /* stack index of the string table (format 2) */
+    int         nstrs;/* strings in strs */
+    int         objs; /* stack index of the id -> table map (deltas) or 0 */
+    struct mar_Zr* z; /* decompression state or NULL */
+    char        stage[MAR_STAGE_SIZE];
+} mar_Reader;
+
+/* Compressing writers collect a raw block before it is compressed and handed
+ * on; the frame is written through the regular sink. */
+typedef struct mar_Zw
+{
+    size_t head; /* bytes in raw */
+    char   raw[LXS_LZ_BLOCK];
+    char   block[LXS_LZ_HEADER + LXS_LZ_BLOCK];
+} mar_Zw;
+
+/* Compressed sources are read through src and decompressed a block at a
+ * time; only what was left of the previous block is moved. */
+typedef struct mar_Zr
+{
+    mar_Reader src;
+    int        eof; /* the end of the frame was read */
+    char       raw[LXS_LZ_BLOCK + MAR_I64];
+    char       block[LXS_LZ_BLOCK]; /* a compressed block read from a file */
+} mar_Zr;
+
+#define mar_wpos(w) ((w)->base + (w)->head)
+#define mar_rpos(r) ((r)->read - (size_t)((r)->end - (r)->p))
+#define mar_rmem(r) ((r)->f == NULL && (r)->z == NULL) /* all bytes at hand */
 
 
-static int mar_encode_table(lua_State* L, mar_Buffer* buf, size_t* idx);
-static int mar_decode_table(lua_State* L,
-                            const char* buf,
-                            size_t len,
-                            size_t* idx);
+static void mar_encode_table(lua_State* L, mar_Writer* w, size_t* idx);
+static void mar_decode_table(lua_State* L,
+                             mar_Reader* r,
+                             size_t len,
+                             size_t* idx);
 
 
-static void buf_init(lua_State *L, mar_Buffer* buf)
+/* Sets up w to encode into a string if sink is 0, otherwise into the file or
+ * buffer at stack index sink. */
+static void mar_winit(lua_State* L, mar_Writer* w, int sink, int seen)
 {
-    buf->size = 128;
-    buf->seek = 0;
-    buf->head = 0;
-    if (!(buf->data = luaM_malloc(L, 128)))
-        lxs_error(L, "Out of memory!");
+    w->head = 0;
+    w->base = 0;
+    w->f    = NULL;
+    w->fpos = -1;
+    w->bidx = 0;
+    w->bpos = 0;
+    w->seen = seen;
+    w->strs = seen + 1;
+    w->nstrs = 0;
+    w->z    = NULL;
+
+    if (sink == 0)
+    {
+        w->size = 128;
+        if (!(w->data = luaM_malloc(L, 128)))
+            lxs_error(L, "Out of memory!");
+        return;
+    }
+
+    w->size = MAR_STAGE_SIZE;
+    w->data = w->stage;
+#if LUAXS_ADDLIB_BUFFER
+    if (lxs_bisbuffer(L, sink))
+    {
+        w->bidx = sink;
+        w->bpos = lxs_blen(L, sink);
+        return;
+    }
+#endif
+    if (!(w->f = lxs_checkfilep(L, sink)))
+        lxs_error(L, "attempt to use a closed file");
+    w->fpos = ftell(w->f);
 }
 
-static void buf_done(lua_State* L, mar_Buffer* buf)
+static void mar_wsink(lua_State* L, mar_Writer* w, const char* str, size_t len)
 {
-    luaM_freemem(L, buf->data, buf->size);
+    if (w->f)
+    {
+        if (fwrite(str, 1, len, w->f) != len)
+            lxs_error(L, "cannot write encoded data (%s)", strerror(errno));
+    }
+#if LUAXS_ADDLIB_BUFFER
+    else
+    {
+        lxs_bappend(L, w->bidx, str, len);
+    }
+#endif
+    w->base += len;
 }
 
-static int buf_write(lua_State* L, const char* str, size_t len, mar_Buffer* buf)
+/* Flushes the staging buffer, or frees the string block. */
+static void mar_wdone(lua_State* L, mar_Writer* w)
 {
-    if (len > UINT32_MAX)
-        lxs_error(L, "buffer too long");
+    if (w->data == w->stage)
+    {
+        mar_wsink(L, w, w->data, w->head);
+        w->head = 0;
+    }
+    else
+    {
+        luaM_freemem(L, w->data, w->size);
+    }
+}
 
-    if (buf->size - buf->head < len)
+static void mar_wput(lua_State* L, mar_Writer* w, const void* str, size_t len)
+{
+    if (w->size - w->head < len)
     {
-        size_t new_size = buf->size << 1;
-        size_t cur_head = buf->head;
-        while (new_size - cur_head <= len)
+        if (w->data == w->stage)
+        {
+            mar_wsink(L, w, w->data, w->head);
+            w->head = 0;
+            if (len > w->size)
+            {
+                mar_wsink(L, w, (const char*)str, len);
+                return;
+            }
+        }
+        else
         {
-            new_size = new_size << 1;
+            size_t new_size = w->size << 1;
+            while (new_size - w->head <= len)
+                new_size = new_size << 1;
+            if (!(w->data = luaM_realloc(L, w->data, w->size, new_size)))
+                lxs_error(L, "out of memory!");
+            w->size = new_size;
         }
-        if (!(buf->data = luaM_realloc(L, buf->data, buf->size, new_size)))
-            lxs_error(L, "out of memory!");
+    }
+    memcpy(&w->data[w->head], str, len);
+    w->head += len;
+}
+
+/* Compresses and writes the staged raw block. */
+static void mar_zflush(lua_State* L, mar_Writer* w)
+{
+    mar_Zw* z = w->z;
 
-        buf->size = new_size;
+    if (z->head > 0)
+    {
+        mar_wput(L, w, z->block, lxs_lzblock(z->raw, z->head, z->block));
+        z->head = 0;
+    }
+}
+
+/* Starts a compressed frame; z has to stay referenced while w is used. */
+static void mar_zinit(lua_State* L, mar_Writer* w, mar_Zw* z)
+{
+    const unsigned char m = MAR_MAGICZ;
+
+    mar_wput(L, w, &m, 1);
+    mar_wput(L, w, LXS_LZ_MAGIC, LXS_LZ_MAGIC_LEN);
+    z->head = 0;
+    w->z    = z;
+}
+
+/* Ends a compressed frame. */
+static void mar_zdone(lua_State* L, mar_Writer* w)
+{
+    static const char end[LXS_LZ_HEADER] = { 0 };
+
+    mar_zflush(L, w);
+    mar_wput(L, w, end, LXS_LZ_HEADER);
+    w->z = NULL;
+}
+
+/* A lua_Writer. */
+static int mar_write(lua_State* L, const void* str, size_t len, void* ud)
+{
+    mar_Writer* w = (mar_Writer*)ud;
+    mar_Zw*     z = w->z;
+    const char* s = (const char*)str;
+
+    if (z == NULL)
+    {
+        mar_wput(L, w, str, len);
+        return 0;
+    }
+    while (len > 0)
+    {
+        size_t n = LXS_LZ_BLOCK - z->head;
+        if (n > len)
+            n = len;
+        memcpy(&z->raw[z->head], s, n);
+        z->head += n;
+        s       += n;
+        len     -= n;
+        if (z->head == LXS_LZ_BLOCK)
+            mar_zflush(L, w);
     }
-    memcpy(&buf->data[buf->head], str, len);
-    buf->head += len;
     return 0;
 }
 
-static const char* buf_read(lua_State* L, mar_Buffer* buf, size_t* len)
+/* Writes a record length placeholder; returns its position for mar_patch. */
+static size_t mar_reserve(lua_State* L, mar_Writer* w)
+{
+    /* written as a whole, so it is either staged or flushed, never split */
+    size_t   pos = mar_wpos(w);
+    uint32_t len = 0;
+    mar_write(L, &len, MAR_I32, w);
+    return pos;
+}
+
+/* Patches the placeholder at pos with the length of the record since. */
+static void mar_patch(lua_State* L, mar_Writer* w, size_t pos)
 {
-    if (buf->seek < buf->head)
+    size_t   n = mar_wpos(w) - pos - MAR_I32;
+    uint32_t len = (uint32_t)n;
+
+    if (n > UINT32_MAX)
+        lxs_error(L, "buffer too long");
+
+    if (pos >= w->base)
     {
-        buf->seek = buf->head;
-        *len = buf->seek;
-        return buf->data;
+        memcpy(&w->data[pos - w->base], &len, MAR_I32);
     }
-    *len = 0;
-    return NULL;
+    else if (w->f)
+    {
+        long cur = ftell(w->f);
+        if (w->fpos < 0 || cur < 0
+            || fseek(w->f, w->fpos + (long)pos, SEEK_SET) != 0
+            || fwrite(&len, 1, MAR_I32, w->f) != MAR_I32
+            || fseek(w->f, cur, SEEK_SET) != 0)
+            lxs_error(L, "cannot encode to an unseekable file");
+    }
+#if LUAXS_ADDLIB_BUFFER
+    else
+    {
+        lxs_bpatch(L, w->bidx, w->bpos + pos, (const char*)&len, MAR_I32);
+    }
+#endif
 }
 
 static void mar_encode_value(lua_State* L,
-                             mar_Buffer* buf,
+                             mar_Writer* w,
                              int val,
                              size_t* idx)
 {
@@ -131,44 +343,45 @@ static void mar_encode_value(lua_State* L,
     int val_type = lua_type(L, val);
     lua_pushvalue(L, val);
 
-    buf_write(L, (void*)&val_type, MAR_CHR, buf);
+    mar_write(L, (void*)&val_type, MAR_CHR, w);
     switch (val_type)
     {
     case LUA_TBOOLEAN:
     {
         int int_val = lua_toboolean(L, -1);
-        buf_write(L, (void*)&int_val, MAR_CHR, buf);
+        mar_write(L, (void*)&int_val, MAR_CHR, w);
         break;
     }
     case LUA_TSTRING:
     {
         const char *str_val = lua_tolstring(L, -1, &l);
-        buf_write(L, (void*)&l, MAR_I32, buf);
-        buf_write(L, str_val, l, buf);
+        uint32_t    len     = (uint32_t)l;
+        mar_write(L, (void*)&len, MAR_I32, w);
+        mar_write(L, str_val, l, w);
         break;
     }
     case LUA_TNUMBER:
     {
         lua_Number num_val = lua_tonumber(L, -1);
-        buf_write(L, (void*)&num_val, MAR_I64, buf);
+        mar_write(L, (void*)&num_val, MAR_I64, w);
         break;
     }
     case LUA_TTABLE:
     {
         int tag, ref;
         lua_pushvalue(L, -1);
-        lua_rawget(L, SEEN_IDX);
+        lua_rawget(L, w->seen);
         if (!lua_isnil(L, -1))
         {
             ref = lua_tointeger(L, -1);
             tag = MAR_TREF;
-            buf_write(L, (void*)&tag, MAR_CHR, buf);
-            buf_write(L, (void*)&ref, MAR_I32, buf);
+            mar_write(L, (void*)&tag, MAR_CHR, w);
+            mar_write(L, (void*)&ref, MAR_I32, w);
             lua_pop(L, 1);
         }
         else
         {
-            mar_Buffer rec_buf;
+            size_t pos;
             lua_pop(L, 1); /* pop nil */
             if (luaL_getmetafield(L, -1, "__persist"))
             {
@@ -185,14 +398,10 @@ static void mar_encode_value(lua_State* L,
                 lua_pushvalue(L, -2); /* callback */
                 lua_rawseti(L, -2, 1);
 
-                buf_init(L, &rec_buf);
-
-                mar_encode_table(L, &rec_buf, idx);
-
-                buf_write(L, (void*)&tag, MAR_CHR, buf);
-                buf_write(L, (void*)&rec_buf.head, MAR_I32, buf);
-                buf_write(L, rec_buf.data, rec_buf.head, buf);
-                buf_done(L, &rec_buf);
+                mar_write(L, (void*)&tag, MAR_CHR, w);
+                pos = mar_reserve(L, w);
+                mar_encode_table(L, w, idx);
+                mar_patch(L, w, pos);
                 lua_pop(L, 1);
             }
             else
@@ -201,19 +410,15 @@ static void mar_encode_value(lua_State* L,
 
                 lua_pushvalue(L, -1);
                 lua_pushinteger(L, (*idx)++);
-                lua_rawset(L, SEEN_IDX);
+                lua_rawset(L, w->seen);
 
                 lua_pushvalue(L, -1);
 
-                buf_init(L, &rec_buf);
-
-                mar_encode_table(L, &rec_buf, idx);
+                mar_write(L, (void*)&tag, MAR_CHR, w);
+                pos = mar_reserve(L, w);
+                mar_encode_table(L, w, idx);
+                mar_patch(L, w, pos);
                 lua_pop(L, 1);
-
-                buf_write(L, (void*)&tag, MAR_CHR, buf);
-                buf_write(L, (void*)&rec_buf.head, MAR_I32, buf);
-                buf_write(L, rec_buf.data,rec_buf.head, buf);
-                buf_done(L, &rec_buf);
             }
         }
         break;
@@ -222,18 +427,18 @@ static void mar_encode_value(lua_State* L,
     {
         int tag, ref;
         lua_pushvalue(L, -1);
-        lua_rawget(L, SEEN_IDX);
+        lua_rawget(L, w->seen);
         if (!lua_isnil(L, -1))
         {
             ref = lua_tointeger(L, -1);
             tag = MAR_TREF;
-            buf_write(L, (void*)&tag, MAR_CHR, buf);
-            buf_write(L, (void*)&ref, MAR_I32, buf);
+            mar_write(L, (void*)&tag, MAR_CHR, w);
+            mar_write(L, (void*)&ref, MAR_I32, w);
             lua_pop(L, 1);
         }
         else
         {
-            mar_Buffer rec_buf;
+            size_t pos;
             int i;
             lua_Debug ar;
             lua_pop(L, 1); /* pop nil */
@@ -246,18 +451,14 @@ static void mar_encode_value(lua_State* L,
             tag = MAR_TVAL;
             lua_pushvalue(L, -1);
             lua_pushinteger(L, (*idx)++);
-            lua_rawset(L, SEEN_IDX);
+            lua_rawset(L, w->seen);
 
             lua_pushvalue(L, -1);
 
-            buf_init(L, &rec_buf);
-
-            lua_dump(L, (lua_Writer)buf_write, &rec_buf);
-
-            buf_write(L, (void*)&tag, MAR_CHR, buf);
-            buf_write(L, (void*)&rec_buf.head, MAR_I32, buf);
-            buf_write(L, rec_buf.data, rec_buf.head, buf);
-            buf_done(L, &rec_buf);
+            mar_write(L, (void*)&tag, MAR_CHR, w);
+            pos = mar_reserve(L, w);
+            lua_dump(L, mar_write, w);
+            mar_patch(L, w, pos);
             lua_pop(L, 1);
 
             lua_newtable(L);
@@ -267,13 +468,9 @@ static void mar_encode_value(lua_State* L,
                 lua_rawseti(L, -2, i);
             }
 
-            buf_init(L, &rec_buf);
-
-            mar_encode_table(L, &rec_buf, idx);
-
-            buf_write(L, (void*)&rec_buf.head, MAR_I32, buf);
-            buf_write(L, rec_buf.data, rec_buf.head, buf);
-            buf_done(L, &rec_buf);
+            pos = mar_reserve(L, w);
+            mar_encode_table(L, w, idx);
+            mar_patch(L, w, pos);
             lua_pop(L, 1);
         }
         break;
@@ -282,18 +479,18 @@ static void mar_encode_value(lua_State* L,
     {
         int tag, ref;
         lua_pushvalue(L, -1);
-        lua_rawget(L, SEEN_IDX);
+        lua_rawget(L, w->seen);
         if (!lua_isnil(L, -1))
         {
             ref = lua_tointeger(L, -1);
             tag = MAR_TREF;
-            buf_write(L, (void*)&tag, MAR_CHR, buf);
-            buf_write(L, (void*)&ref, MAR_I32, buf);
+            mar_write(L, (void*)&tag, MAR_CHR, w);
+            mar_write(L, (void*)&ref, MAR_I32, w);
             lua_pop(L, 1);
         }
         else
         {
-            mar_Buffer rec_buf;
+            size_t pos;
             lua_pop(L, 1); /* pop nil */
             if (luaL_getmetafield(L, -1, "__persist"))
             {
@@ -301,7 +498,7 @@ static void mar_encode_value(lua_State* L,
 
                 lua_pushvalue(L, -2);
                 lua_pushinteger(L, (*idx)++);
-                lua_rawset(L, SEEN_IDX);
+                lua_rawset(L, w->seen);
 
                 lua_pushvalue(L, -2);
                 lua_call(L, 1, 1);
@@ -313,14 +510,10 @@ static void mar_encode_value(lua_State* L,
                 lua_rawseti(L, -2, 1);
                 lua_remove(L, -2);
 
-                buf_init(L, &rec_buf);
-
-                mar_encode_table(L, &rec_buf, idx);
-
-                buf_write(L, (void*)&tag, MAR_CHR, buf);
-                buf_write(L, (void*)&rec_buf.head, MAR_I32, buf);
-		        buf_write(L, rec_buf.data, rec_buf.head, buf);
-		        buf_done(L, &rec_buf);
+                mar_write(L, (void*)&tag, MAR_CHR, w);
+                pos = mar_reserve(L, w);
+                mar_encode_table(L, w, idx);
+                mar_patch(L, w, pos);
             }
             else
             {
@@ -337,86 +530,385 @@ static void mar_encode_value(lua_State* L,
     lua_pop(L, 1);
 }
 
-static int mar_encode_table(lua_State *L, mar_Buffer *buf, size_t *idx)
+static void mar_encode_table(lua_State *L, mar_Writer* w, size_t *idx)
 {
     lua_pushnil(L);
     while (lua_next(L, -2) != 0)
     {
-        mar_encode_value(L, buf, -2, idx);
-        mar_encode_value(L, buf, -1, idx);
+        mar_encode_value(L, w, -2, idx);
+        mar_encode_value(L, w, -1, idx);
         lua_pop(L, 1);
     }
-    return 1;
 }
 
-#define mar_incr_ptr(l)                                                        \
-    __pragma(warning(push))                                                    \
-    __pragma(warning(disable: 4018)) /* signed/unsigned mismatch */            \
-    if (((*p)-buf)+(l) > len)                                                  \
-        lxs_error(L, "bad code");                                              \
-    (*p) += (l);                                                               \
-    __pragma(warning(pop))
 
-#define mar_next_len(l,T)                                                      \
-    if (((*p)-buf)+sizeof(T) > len)                                            \
-        lxs_error(L, "bad code");                                              \
-    l = *(T*)*p;                                                               \
-    (*p) += sizeof(T);
+static int mar_zfill(lua_State* L, mar_Reader* r, size_t n);
 
-static void mar_decode_value(lua_State *L,
-                             const char *buf,
-                             size_t len,
-                             const char **p,
-                             size_t *idx)
+/* Makes at least n bytes available, reading files as needed; returns false
+ * if the input ends before. */
+static int mar_fill(lua_State* L, mar_Reader* r, size_t n)
+{
+    size_t left = (size_t)(r->end - r->p);
+    size_t got;
+
+    if (left >= n)
+        return 1;
+    if (r->z != NULL)
+        return mar_zfill(L, r, n);
+    if (r->f == NULL || n > MAR_STAGE_SIZE)
+        return 0;
+
+    memmove(r->stage, r->p, left);
+    got = fread(&r->stage[left], 1, MAR_STAGE_SIZE - left, r->f);
+    r->p    = r->stage;
+    r->end  = &r->stage[left + got];
+    r->read += got;
+    return left + got >= n;
+}
+
+/* Sets up r to decode the string, buffer or file at stack index src; the
+ * reference map goes to stack index seen, the string table above it. */
+static void mar_rinit(lua_State* L, mar_Reader* r, int src, int seen)
+{
+    size_t len = 0;
+
+    r->f     = NULL;
+    r->bidx  = 0;
+    r->boff  = 0;
+    r->seen  = seen;
+    r->strs  = seen + 1;
+    r->nstrs = 0;
+    r->objs  = 0;
+    r->z     = NULL;
+    if (lua_type(L, src) == LUA_TSTRING)
+    {
+        r->p = lua_tolstring(L, src, &len);
+    }
+#if LUAXS_ADDLIB_BUFFER
+    else if (lxs_bisbuffer(L, src))
+    {
+        const char* data = lxs_bdata(L, src, &len);
+        r->bidx = src;
+        r->p    = lxs_bread(L, src, &len);
+        r->boff = (size_t)(r->p - data);
+    }
+#endif
+    else
+    {
+        if (!(r->f = lxs_checkfilep(L, src)))
+            lxs_error(L, "attempt to use a closed file");
+        r->p = r->stage;
+    }
+    r->end  = r->p + len;
+    r->read = len;
+}
+
+static void mar_skip(lua_State* L, mar_Reader* r, size_t len);
+static uint32_t mar_zheader(lua_State* L, mar_Zr* z);
+
+/* __persist hooks may modify a buffer source and move its content; points
+ * r at the same position of the buffer's current content. */
+static void mar_rsync(lua_State* L, mar_Reader* r)
+{
+#if LUAXS_ADDLIB_BUFFER
+    if (r->z != NULL)
+    {
+        mar_rsync(L, &r->z->src);
+        return;
+    }
+    if (r->bidx != 0)
+    {
+        const size_t pos = mar_rpos(r);
+        size_t       len;
+        const char*  data = lxs_bdata(L, r->bidx, &len);
+
+        if (len < r->boff + r->read)
+            lxs_error(L, "marshal source was modified");
+        r->end = data + r->boff + r->read;
+        r->p   = r->end - (r->read - pos);
+    }
+#else
+    (void)L;
+    (void)r;
+#endif
+}
+
+/* Moves a buffer's read cursor or a file's position past the decoded data. */
+static void mar_rdone(lua_State* L, mar_Reader* r)
+{
+    if (r->z != NULL)
+    {
+        /* past the end of the frame, which may not have been read yet */
+        mar_Zr* z = r->z;
+        while (!z->eof)
+        {
+            uint32_t header = mar_zheader(L, z);
+            if (!z->eof)
+                mar_skip(L, &z->src, lxs_lzsize(header));
+        }
+        mar_rdone(L, &z->src);
+        return;
+    }
+#if LUAXS_ADDLIB_BUFFER
+    if (r->bidx != 0)
+        lxs_bskip(L, r->bidx, mar_rpos(r));
+#endif
+    if (r->f && r->end > r->p)
+        fseek(r->f, -(long)(r->end - r->p), SEEK_CUR);
+}
+
+static void mar_need(lua_State* L, mar_Reader* r, size_t n)
+{
+    if (!mar_fill(L, r, n))
+        lxs_error(L, "bad code");
+}
+
+static unsigned char mar_read_u8(lua_State* L, mar_Reader* r)
+{
+    mar_need(L, r, MAR_CHR);
+    return (unsigned char)*r->p++;
+}
+
+static uint32_t mar_read_u32(lua_State* L, mar_Reader* r)
+{
+    uint32_t v;
+    mar_need(L, r, MAR_I32);
+    memcpy(&v, r->p, MAR_I32);
+    r->p += MAR_I32;
+    return v;
+}
+
+static lua_Number mar_read_num(lua_State* L, mar_Reader* r)
+{
+    lua_Number v;
+    mar_need(L, r, MAR_I64);
+    memcpy(&v, r->p, MAR_I64);
+    r->p += MAR_I64;
+    return v;
+}
+
+static void mar_skip(lua_State* L, mar_Reader* r, size_t len)
+{
+    while (len > 0)
+    {
+        size_t n;
+        mar_need(L, r, 1);
+        n = (size_t)(r->end - r->p);
+        if (n > len)
+            n = len;
+        r->p += n;
+        len  -= n;
+    }
+}
+
+/* Reads the next block header of a compressed source. */
+static uint32_t mar_zheader(lua_State* L, mar_Zr* z)
+{
+    uint32_t header;
+
+    mar_need(L, &z->src, LXS_LZ_HEADER);
+    header = lxs_lzheader(z->src.p);
+    z->src.p += LXS_LZ_HEADER;
+    if (header == 0)
+        z->eof = 1;
+    else if (lxs_lzsize(header) > LXS_LZ_BLOCK)
+        lxs_error(L, "bad code");
+    return header;
+}
+
+/* mar_fill for compressed sources: decompresses blocks behind what is left.
+ * Only scalar reads need more than one byte at once, so that is at most
+ * MAR_I64 - 1 bytes. */
+static int mar_zfill(lua_State* L, mar_Reader* r, size_t n)
+{
+    mar_Zr*     z    = r->z;
+    mar_Reader* src  = &z->src;
+    size_t      left = (size_t)(r->end - r->p);
+
+    if (n > MAR_I64)
+        return 0;
+    memmove(z->raw, r->p, left);
+    r->p   = z->raw;
+    r->end = &z->raw[left];
+
+    while (left < n && !z->eof)
+    {
+        uint32_t    header = mar_zheader(L, z);
+        size_t      size   = lxs_lzsize(header);
+        size_t      got;
+        const char* data;
+
+        if (z->eof)
+            break;
+        if ((size_t)(src->end - src->p) >= size)
+        {
+            data    = src->p;
+            src->p += size;
+        }
+        else
+        {
+            size_t i = 0;
+            while (i < size)
+            {
+                size_t k;
+                mar_need(L, src, 1);
+                k = (size_t)(src->end - src->p);
+                if (k > size - i)
+                    k = size - i;
+                memcpy(&z->block[i], src->p, k);
+                src->p += k;
+                i      += k;
+            }
+            data = z->block;
+        }
+
+        got = lxs_lzunblock(header, data, &z->raw[left]);
+        if (got == (size_t)-1)
+            lxs_error(L, "bad code");
+        left    += got;
+        r->end  += got;
+        r->read += got;
+    }
+    return left >= n;
+}
+
+/* Switches r over to the compressed frame following MAR_MAGICZ and pushes
+ * its state, which has to stay on the stack while r is used. Returns the
+ * first byte of the compressed data, its magic. */
+static int mar_zopen(lua_State* L, mar_Reader* r)
+{
+    mar_Zr* z = (mar_Zr*)lua_newuserdata(L, sizeof(mar_Zr));
+    int     i;
+
+    for (i = 0; i < LXS_LZ_MAGIC_LEN; ++i)
+    {
+        if (mar_read_u8(L, r) != (unsigned char)LXS_LZ_MAGIC[i])
+            lxs_error(L, "bad magic");
+    }
+
+    z->src = *r;
+    if (r->f != NULL)
+    {
+        /* staged bytes move along */
+        z->src.p   = &z->src.stage[r->p - r->stage];
+        z->src.end = &z->src.stage[r->end - r->stage];
+    }
+    z->eof = 0;
+
+    r->f    = NULL;
+    r->bidx = 0;
+    r->z    = z;
+    r->p    = z->raw;
+    r->end  = z->raw;
+    r->read = 0;
+
+    if (!mar_fill(L, r, 1))
+        lxs_error(L, "bad header");
+    return mar_read_u8(L, r);
+}
+
+/* Pushes the next len bytes as a string; strings longer than what is
+ * staged are read piecewise. */
+static void mar_read_string(lua_State* L, mar_Reader* r, size_t len)
+{
+    luaL_Buffer b;
+
+    if ((size_t)(r->end - r->p) >= len)
+    {
+        lua_pushlstring(L, r->p, len);
+        r->p += len;
+        return;
+    }
+
+    luaL_buffinit(L, &b);
+    while (len > 0)
+    {
+        size_t n;
+        mar_need(L, r, 1);
+        n = (size_t)(r->end - r->p);
+        if (n > len)
+            n = len;
+        luaL_addlstring(&b, r->p, n);
+        r->p += n;
+        len  -= n;
+    }
+    luaL_pushresult(&b);
+}
+
+/* lua_load state; hands the next left bytes to the undumper. */
+typedef struct mar_Load
+{
+    mar_Reader* r;
+    size_t      left;
+} mar_Load;
+
+static const char* mar_load_reader(lua_State* L, void* ud, size_t* size)
+{
+    mar_Load*   ld = (mar_Load*)ud;
+    mar_Reader* r  = ld->r;
+    const char* s;
+    size_t      n;
+
+    if (ld->left == 0)
+    {
+        *size = 0;
+        return NULL;
+    }
+    mar_need(L, r, 1);
+    n = (size_t)(r->end - r->p);
+    if (n > ld->left)
+        n = ld->left;
+
+    s         = r->p;
+    r->p     += n;
+    ld->left -= n;
+    *size     = n;
+    return s;
+}
+
+static void mar_decode_value(lua_State *L, mar_Reader* r, size_t *idx)
 {
     size_t l;
-    char val_type = **p;
-    mar_incr_ptr(MAR_CHR);
+    char val_type = (char)mar_read_u8(L, r);
     switch (val_type)
     {
     case LUA_TBOOLEAN:
-        lua_pushboolean(L, *(char*)*p);
-        mar_incr_ptr(MAR_CHR);
+        lua_pushboolean(L, mar_read_u8(L, r));
         break;
     case LUA_TNUMBER:
-        lua_pushnumber(L, *(lua_Number*)*p);
-        mar_incr_ptr(MAR_I64);
+        lua_pushnumber(L, mar_read_num(L, r));
         break;
     case LUA_TSTRING:
-        mar_next_len(l, uint32_t);
-        lua_pushlstring(L, *p, l);
-        mar_incr_ptr(l);
+        l = mar_read_u32(L, r);
+        mar_read_string(L, r, l);
         break;
     case LUA_TTABLE:
     {
-        char tag = *(char*)*p;
-        mar_incr_ptr(MAR_CHR);
+        char tag = (char)mar_read_u8(L, r);
         if (tag == MAR_TREF)
         {
-            int ref;
-            mar_next_len(ref, int);
-            lua_rawgeti(L, SEEN_IDX, ref);
+            int ref = (int)mar_read_u32(L, r);
+            lua_rawgeti(L, r->seen, ref);
         }
         else if (tag == MAR_TVAL)
         {
-            mar_next_len(l, uint32_t);
+            l = mar_read_u32(L, r);
             lua_newtable(L);
             lua_pushvalue(L, -1);
-            lua_rawseti(L, SEEN_IDX, (*idx)++);
-            mar_decode_table(L, *p, l, idx);
-            mar_incr_ptr(l);
+            lua_rawseti(L, r->seen, (*idx)++);
+            mar_decode_table(L, r, l, idx);
         }
         else if (tag == MAR_TUSR)
         {
-            mar_next_len(l, uint32_t);
+            l = mar_read_u32(L, r);
             lua_newtable(L);
-            mar_decode_table(L, *p, l, idx);
+            mar_decode_table(L, r, l, idx);
             lua_rawgeti(L, -1, 1);
             lua_call(L, 0, 1);
+            mar_rsync(L, r);
             lua_remove(L, -2);
             lua_pushvalue(L, -1);
-            lua_rawseti(L, SEEN_IDX, (*idx)++);
-            mar_incr_ptr(l);
+            lua_rawseti(L, r->seen, (*idx)++);
         }
         else
         {
@@ -427,31 +919,27 @@ static void mar_decode_value(lua_State *L,
     case LUA_TFUNCTION:
     {
         size_t nups, i;
-        mar_Buffer dec_buf;
-        char tag = *(char*)*p;
-        mar_incr_ptr(1);
+        char tag = (char)mar_read_u8(L, r);
         if (tag == MAR_TREF)
         {
-            int ref;
-            mar_next_len(ref, int);
-            lua_rawgeti(L, SEEN_IDX, ref);
+            int ref = (int)mar_read_u32(L, r);
+            lua_rawgeti(L, r->seen, ref);
         }
         else
         {
-            mar_next_len(l, uint32_t);
-            dec_buf.data = (char*)*p;
-            dec_buf.size = l;
-            dec_buf.head = l;
-            dec_buf.seek = 0;
-            lua_load(L, (lua_Reader)buf_read, &dec_buf, "=marshal");
-            mar_incr_ptr(l);
+            mar_Load ld;
+            ld.r    = r;
+            ld.left = mar_read_u32(L, r);
+            if (lua_load(L, mar_load_reader, &ld, "=marshal") != 0)
+                lua_error(L);
+            mar_skip(L, r, ld.left);
 
             lua_pushvalue(L, -1);
-            lua_rawseti(L, SEEN_IDX, (*idx)++);
+            lua_rawseti(L, r->seen, (*idx)++);
 
-            mar_next_len(l, uint32_t);
+            l = mar_read_u32(L, r);
             lua_newtable(L);
-            mar_decode_table(L, *p, l, idx);
+            mar_decode_table(L, r, l, idx);
             nups = lua_objlen(L, -1);
             for (i = 1; i <= nups; ++i)
             {
@@ -459,31 +947,28 @@ static void mar_decode_value(lua_State *L,
                 lua_setupvalue(L, -3, i);
             }
             lua_pop(L, 1);
-            mar_incr_ptr(l);
         }
         break;
     }
     case LUA_TUSERDATA:
     {
-        char tag = *(char*)*p;
-        mar_incr_ptr(MAR_CHR);
+        char tag = (char)mar_read_u8(L, r);
         if (tag == MAR_TREF)
         {
-            int ref;
-            mar_next_len(ref, int);
-            lua_rawgeti(L, SEEN_IDX, ref);
+            int ref = (int)mar_read_u32(L, r);
+            lua_rawgeti(L, r->seen, ref);
         }
         else if (tag == MAR_TUSR)
         {
-            mar_next_len(l, uint32_t);
+            l = mar_read_u32(L, r);
             lua_newtable(L);
-            mar_decode_table(L, *p, l, idx);
+            mar_decode_table(L, r, l, idx);
             lua_rawgeti(L, -1, 1);
             lua_call(L, 0, 1);
+            mar_rsync(L, r);
             lua_remove(L, -2);
             lua_pushvalue(L, -1);
-            lua_rawseti(L, SEEN_IDX, (*idx)++);
-            mar_incr_ptr(l);
+            lua_rawseti(L, r->seen, (*idx)++);
         }
         else /* tag == MAR_TVAL */
         {
@@ -500,122 +985,1946 @@ static void mar_decode_value(lua_State *L,
     }
 }
 
-#pragma warning(push)
-#pragma warning(disable: 4018) // signed/unsigned mismatch
-static int mar_decode_table(lua_State *L,
-                            const char* buf,
-                            size_t len,
-                            size_t* idx)
+static void mar_decode_table(lua_State *L,
+                             mar_Reader* r,
+                             size_t len,
+                             size_t* idx)
 {
-    const char* p = buf;
-    while (p - buf < len)
+    size_t end = mar_rpos(r) + len;
+
+    if (mar_rmem(r) && len > (size_t)(r->end - r->p))
+        lxs_error(L, "bad code");
+
+    while (mar_rpos(r) < end)
     {
-        mar_decode_value(L, buf, len, &p, idx);
-        mar_decode_value(L, buf, len, &p, idx);
+        mar_decode_value(L, r, idx);
+        mar_decode_value(L, r, idx);
         lua_settable(L, -3);
     }
-    return 1;
+    if (mar_rpos(r) != end)
+        lxs_error(L, "bad code");
 }
-#pragma warning(pop)
 
 
-static int libE_encode(lua_State* L)
-{
-    const unsigned char m = MAR_MAGIC;
-    size_t idx, len;
-    mar_Buffer buf;
+/*
+** Format 2
+**
+** value := NIL | FALSE | TRUE | INT zigzag | NUM f64 | STR len bytes
+**        | SREF index | REF index | TABLE narray nhash value{narray}
+**          (key value)* NIL | FUNC len dump nups value{nups} | PERSIST value
+**
+** All integers are LEB128 varints. Every STR adds its string to the blob's
+** string table, SREF refers to it by position (1-based). Tables, functions
+** and __persist'ed values are numbered as they are started, following the
+** constants, REF refers to them. A TABLE's array values are t[1..narray],
+** nil included, the pairs that follow are the rest; nhash is the hash part
+** size of the source table and only a hint to presize the decoded one.
+*/
 
-    if (lua_isnone(L, 1))
-         lua_pushnil(L);
+#define MAR2_NIL     0
+#define MAR2_FALSE   1
+#define MAR2_TRUE    2
+#define MAR2_INT     3
+#define MAR2_NUM     4
+#define MAR2_STR     5
+#define MAR2_SREF    6
+#define MAR2_REF     7
+#define MAR2_TABLE   8
+#define MAR2_FUNC    9
+#define MAR2_PERSIST 10
+#define MAR2_OBJ     11 /* deltas only */
 
-    if (lua_isnoneornil(L, 2))
-        lua_newtable(L);
-    else if (!lua_istable(L, 2))
-        lxs_error(L, "bad argument #2 to encode (expected table)");
-    lua_settop(L, 2);
+/* the largest array and hash part presized from a TABLE's header */
+#define MAR2_MAXPRESIZE (1 << 20)
 
-    len = lua_objlen(L, 2);
-    lua_newtable(L);
-    for (idx = 1; idx <= len; ++idx)
+/* integral numbers within +-2^53 are encoded as INT */
+#define MAR2_INTMAX 9007199254740992.0
+
+
+static void mar2_encode_value(lua_State* L, mar_Writer* w, size_t* idx);
+static void mar2_decode_value(lua_State* L, mar_Reader* r, size_t* idx);
+static void mard_object(lua_State* L, mar_Reader* r, int id);
+
+
+static void mar_write_tag(lua_State* L, mar_Writer* w, int tag)
+{
+    unsigned char c = (unsigned char)tag;
+    mar_write(L, &c, MAR_CHR, w);
+}
+
+static void mar_write_varint(lua_State* L, mar_Writer* w, uint64_t v)
+{
+    unsigned char b[10];
+    size_t n = 0;
+    while (v >= 0x80)
     {
-        lua_rawgeti(L, 2, idx);
-        if (lua_isnil(L, -1))
-        {
-            lua_pop(L, 1);
-            continue;
-        }
-        lua_pushinteger(L, idx);
-        lua_rawset(L, SEEN_IDX);
+        b[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
     }
-    lua_pushvalue(L, 1);
+    b[n++] = (unsigned char)v;
+    mar_write(L, b, n, w);
+}
 
-    buf_init(L, &buf);
-    buf_write(L, (void*)&m, 1, &buf);
-    mar_encode_value(L, &buf, -1, &idx);
-    lua_pop(L, 1);
-    lua_pushlstring(L, buf.data, buf.head);
-    buf_done(L, &buf);
-    lua_remove(L, SEEN_IDX);
+static uint64_t mar_read_varint(lua_State* L, mar_Reader* r)
+{
+    uint64_t      v = 0;
+    int           shift = 0;
+    unsigned char c;
+    do
+    {
+        if (shift > 63)
+            lxs_error(L, "bad code");
+        c = mar_read_u8(L, r);
+        v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return v;
+}
 
-    return 1;
+static size_t mar_read_size(lua_State* L, mar_Reader* r)
+{
+    uint64_t v = mar_read_varint(L, r);
+    if (v > (uint64_t)INT_MAX)
+        lxs_error(L, "bad code");
+    return (size_t)v;
 }
 
-static int libE_decode(lua_State* L)
+/* Writes a REF if the value at the top of the stack was numbered before. */
+static int mar2_encode_ref(lua_State* L, mar_Writer* w)
 {
-    size_t l, idx, len;
-    const char *p;
-    const char *s = luaL_checklstring(L, 1, &l);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, w->seen);
+    if (lua_isnil(L, -1))
+    {
+        lua_pop(L, 1);
+        return 0;
+    }
+    mar_write_tag(L, w, MAR2_REF);
+    mar_write_varint(L, w, (uint64_t)lua_tointeger(L, -1));
+    lua_pop(L, 1);
+    return 1;
+}
 
-    if (l < 1)
-        lxs_error(L, "bad header");
-    if (*(unsigned char *)s++ != MAR_MAGIC)
-        lxs_error(L, "bad magic");
-    l -= 1;
+/* Numbers the value at stack index i. */
+static void mar2_number(lua_State* L, mar_Writer* w, int i, size_t* idx)
+{
+    lua_pushvalue(L, i);
+    lua_pushinteger(L, (*idx)++);
+    lua_rawset(L, w->seen);
+}
 
-    if (lua_isnoneornil(L, 2))
-        lua_newtable(L);
-    else if (!lua_istable(L, 2))
-        lxs_error(L, "bad argument #2 to decode (expected table)");
-    lua_settop(L, 2);
+static void mar2_encode_string(lua_State* L, mar_Writer* w)
+{
+    size_t      l;
+    const char* s = lua_tolstring(L, -1, &l);
 
-    len = lua_objlen(L, 2);
-    lua_newtable(L);
-    for (idx = 1; idx <= len; ++idx)
+    lua_pushvalue(L, -1);
+    lua_rawget(L, w->strs);
+    if (!lua_isnil(L, -1))
     {
-        lua_rawgeti(L, 2, idx);
-        lua_rawseti(L, SEEN_IDX, idx);
+        mar_write_tag(L, w, MAR2_SREF);
+        mar_write_varint(L, w, (uint64_t)lua_tointeger(L, -1));
+        lua_pop(L, 1);
+        return;
     }
+    lua_pop(L, 1);
 
-    p = s;
-    mar_decode_value(L, s, l, &p, &idx);
-
-    lua_remove(L, SEEN_IDX);
-    lua_remove(L, 2);
+    lua_pushvalue(L, -1);
+    lua_pushinteger(L, ++w->nstrs);
+    lua_rawset(L, w->strs);
 
-    return 1;
+    mar_write_tag(L, w, MAR2_STR);
+    mar_write_varint(L, w, l);
+    mar_write(L, s, l, w);
 }
 
-static int libE_clone(lua_State* L)
+static void mar2_encode_number(lua_State* L, mar_Writer* w)
 {
-    libE_encode(L);
-    lua_replace(L, 1);
-    libE_decode(L);
-    return 1;
+    lua_Number n = lua_tonumber(L, -1);
+
+    /* -0 is kept as a double */
+    if (n == floor(n) && n >= -MAR2_INTMAX && n <= MAR2_INTMAX
+        && (n != 0 || 1 / n > 0))
+    {
+        int64_t i = (int64_t)n;
+        mar_write_tag(L, w, MAR2_INT);
+        mar_write_varint(L, w, i < 0 ? ((uint64_t)-(i + 1) << 1) | 1
+                                     : (uint64_t)i << 1);
+    }
+    else
+    {
+        mar_write_tag(L, w, MAR2_NUM);
+        mar_write(L, &n, MAR_I64, w);
+    }
 }
 
+static int mar2_dump_writer(lua_State* L, const void* p, size_t sz, void* ud)
+{
+    (void)L;
+    luaL_addlstring((luaL_Buffer*)ud, (const char*)p, sz);
+    return 0;
+}
 
-static const luaL_Reg libE_funcs[] =
+static void mar2_encode_function(lua_State* L, mar_Writer* w, size_t* idx)
 {
-    { "encode", libE_encode },
-    { "decode", libE_decode },
-    { "clone",  libE_clone  },
-    { NULL, NULL}
-};
+    luaL_Buffer b;
+    lua_Debug   ar;
+    size_t      l;
+    const char* dump;
+    int         i;
+
+    lua_pushvalue(L, -1);
+    lua_getinfo(L, ">nuS", &ar);
+    if (ar.what[0] != 'L')
+        lxs_error(L, "attempt to persist a C function '%s'", ar.name);
+
+    mar2_number(L, w, -1, idx);
+
+    /* the dump's length goes first */
+    lua_pushvalue(L, -1);
+    luaL_buffinit(L, &b);
+    lua_dump(L, mar2_dump_writer, &b);
+    luaL_pushresult(&b);
+    dump = lua_tolstring(L, -1, &l);
+
+    mar_write_tag(L, w, MAR2_FUNC);
+    mar_write_varint(L, w, l);
+    mar_write(L, dump, l, w);
+    lua_pop(L, 2);
+
+    mar_write_varint(L, w, (uint64_t)ar.nups);
+    for (i = 1; i <= ar.nups; ++i)
+    {
+        lua_getupvalue(L, -1, i);
+        mar2_encode_value(L, w, idx);
+        lua_pop(L, 1);
+    }
+}
 
+/* Encodes the value below the __persist hook at the top of the stack. */
+static void mar2_encode_persist(lua_State* L, mar_Writer* w, size_t* idx)
+{
+    lua_pushvalue(L, -2); /* self */
+    lua_call(L, 1, 1);
+    if (!lua_isfunction(L, -1))
+        lxs_error(L, "__persist must return a function");
+
+    mar2_number(L, w, -2, idx);
+    mar_write_tag(L, w, MAR2_PERSIST);
+    mar2_encode_value(L, w, idx);
+    lua_pop(L, 1);
+}
 
-LUA_API int luaopen_marshal(lua_State *L)
+static void mar2_encode_table(lua_State* L, mar_Writer* w, size_t* idx)
 {
-    lxs_assert_stack_begin(L);
+    const Table* t = hvalue(L->top - 1);
+    int          s = lua_gettop(L);
+    size_t       n = lua_objlen(L, s);
+    size_t       i, start;
+    int          nhash = t->lsizenode ? sizenode(t) : 0;
+
+    /* keys n + 1 and up of the array part are counted in neither */
+    if (n > (size_t)t->sizearray)
+        nhash -= (int)(n - t->sizearray);
+
+    luaL_checkstack(L, LUA_MINSTACK, "table nested too deeply to encode");
+    mar2_number(L, w, s, idx);
+    mar_write_tag(L, w, MAR2_TABLE);
+    mar_write_varint(L, w, n);
+    mar_write_varint(L, w, (uint64_t)(nhash > 0 ? nhash : 0));
+
+    for (i = 1; i <= n; ++i)
+    {
+        lua_rawgeti(L, s, (int)i);
+        mar2_encode_value(L, w, idx);
+        lua_pop(L, 1);
+    }
+
+    /* continue after t[1..n] if it is all array part, else skip it below */
+    start = n < (size_t)t->sizearray ? n : (size_t)t->sizearray;
+    if (start > 0)
+        lua_pushinteger(L, (lua_Integer)start);
+    else
+        lua_pushnil(L);
+    while (lua_next(L, s) != 0)
+    {
+        if (lua_type(L, -2) == LUA_TNUMBER)
+        {
+            lua_Number k = lua_tonumber(L, -2);
+            if (k >= 1 && k <= (lua_Number)n && k == floor(k))
+            {
+                lua_pop(L, 1);
+                continue;
+            }
+        }
+        lua_pushvalue(L, -2);
+        mar2_encode_value(L, w, idx);
+        lua_pop(L, 1);
+        mar2_encode_value(L, w, idx);
+        lua_pop(L, 1);
+    }
+    mar_write_tag(L, w, MAR2_NIL); /* a nil key ends the pairs */
+}
+
+/* Encodes the value at the top of the stack. */
+static void mar2_encode_value(lua_State* L, mar_Writer* w, size_t* idx)
+{
+    int val_type = lua_type(L, -1);
+    switch (val_type)
+    {
+    case LUA_TNIL:
+        mar_write_tag(L, w, MAR2_NIL);
+        break;
+    case LUA_TBOOLEAN:
+        mar_write_tag(L, w, lua_toboolean(L, -1) ? MAR2_TRUE : MAR2_FALSE);
+        break;
+    case LUA_TNUMBER:
+        mar2_encode_number(L, w);
+        break;
+    case LUA_TSTRING:
+        mar2_encode_string(L, w);
+        break;
+    case LUA_TTABLE:
+        if (mar2_encode_ref(L, w))
+            break;
+        if (luaL_getmetafield(L, -1, "__persist"))
+            mar2_encode_persist(L, w, idx);
+        else
+            mar2_encode_table(L, w, idx);
+        break;
+    case LUA_TFUNCTION:
+        if (!mar2_encode_ref(L, w))
+            mar2_encode_function(L, w, idx);
+        break;
+    case LUA_TUSERDATA:
+        if (mar2_encode_ref(L, w))
+            break;
+        if (!luaL_getmetafield(L, -1, "__persist"))
+            lxs_error(L, "attempt to encode userdata (no __persist hook)");
+        mar2_encode_persist(L, w, idx);
+        break;
+    default:
+        lxs_error(L, "invalid value type (%s)", lua_typename(L, val_type));
+    }
+}
+
+
+static void mar2_decode_table(lua_State* L, mar_Reader* r, size_t* idx)
+{
+    size_t narray = mar_read_size(L, r);
+    size_t nhash  = mar_read_size(L, r);
+    size_t i;
+
+    size_t presize;
+
+    /* every array value takes at least a byte, every pair two; nhash is
+     * the hash part size of the source table, which is larger than its
+     * number of pairs if keys were set to nil, so it is only clamped.
+     * Streams can't be checked up front, their tables presize at most
+     * MAR2_MAXPRESIZE slots and grow while decoding */
+    if (mar_rmem(r))
+    {
+        const size_t left = (size_t)(r->end - r->p);
+        if (narray > left)
+            lxs_error(L, "bad code");
+        if (nhash > (left - narray) / 2)
+            nhash = (left - narray) / 2;
+    }
+    presize = narray < MAR2_MAXPRESIZE ? narray : MAR2_MAXPRESIZE;
+    if (nhash > MAR2_MAXPRESIZE)
+        nhash = MAR2_MAXPRESIZE;
+
+    luaL_checkstack(L, LUA_MINSTACK, "table nested too deeply to decode");
+    lua_createtable(L, (int)presize, (int)nhash);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, r->seen, (int)(*idx)++);
+
+    for (i = 1; i <= narray; ++i)
+    {
+        mar2_decode_value(L, r, idx);
+        if (lua_isnil(L, -1))
+            lua_pop(L, 1);
+        else
+            lua_rawseti(L, -2, (int)i);
+    }
+
+    for (;;)
+    {
+        mar2_decode_value(L, r, idx);
+        if (lua_isnil(L, -1))
+            break;
+        mar2_decode_value(L, r, idx);
+        lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);
+}
+
+static void mar2_decode_function(lua_State* L, mar_Reader* r, size_t* idx)
+{
+    mar_Load ld;
+    size_t   nups, i;
+
+    ld.r    = r;
+    ld.left = mar_read_size(L, r);
+    if (lua_load(L, mar_load_reader, &ld, "=marshal") != 0)
+        lua_error(L);
+    mar_skip(L, r, ld.left);
+
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, r->seen, (int)(*idx)++);
+
+    nups = mar_read_size(L, r);
+    for (i = 1; i <= nups; ++i)
+    {
+        mar2_decode_value(L, r, idx);
+        if (lua_setupvalue(L, -2, (int)i) == NULL)
+            lua_pop(L, 1);
+    }
+}
+
+static void mar2_decode_value(lua_State* L, mar_Reader* r, size_t* idx)
+{
+    switch (mar_read_u8(L, r))
+    {
+    case MAR2_NIL:
+        lua_pushnil(L);
+        break;
+    case MAR2_FALSE:
+        lua_pushboolean(L, 0);
+        break;
+    case MAR2_TRUE:
+        lua_pushboolean(L, 1);
+        break;
+    case MAR2_INT:
+    {
+        uint64_t z = mar_read_varint(L, r);
+        int64_t  i = (z & 1) ? -(int64_t)(z >> 1) - 1 : (int64_t)(z >> 1);
+        lua_pushnumber(L, (lua_Number)i);
+        break;
+    }
+    case MAR2_NUM:
+        lua_pushnumber(L, mar_read_num(L, r));
+        break;
+    case MAR2_STR:
+        mar_read_string(L, r, mar_read_size(L, r));
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, r->strs, ++r->nstrs);
+        break;
+    case MAR2_SREF:
+    {
+        size_t i = mar_read_size(L, r);
+        if (i < 1 || i > (size_t)r->nstrs)
+            lxs_error(L, "bad code");
+        lua_rawgeti(L, r->strs, (int)i);
+        break;
+    }
+    case MAR2_REF:
+        lua_rawgeti(L, r->seen, (int)mar_read_size(L, r));
+        break;
+    case MAR2_TABLE:
+        mar2_decode_table(L, r, idx);
+        break;
+    case MAR2_FUNC:
+        mar2_decode_function(L, r, idx);
+        break;
+    case MAR2_OBJ:
+        if (r->objs == 0)
+            lxs_error(L, "bad code");
+        mard_object(L, r, (int)mar_read_size(L, r));
+        break;
+    case MAR2_PERSIST:
+    {
+        int ref = (int)(*idx)++;
+        mar2_decode_value(L, r, idx);
+        lua_call(L, 0, 1);
+        mar_rsync(L, r);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, r->seen, ref);
+        break;
+    }
+    default:
+        lxs_error(L, "bad code");
+    }
+}
+
+
+/// marshal.encode(value [, constants [, sink [, format [, compress]]]])
+///
+/// Returns *value* encoded as a string. Values listed in *constants* are
+/// encoded as references to their index, decode needs the same list.
+/// If *sink*, an open file or a buffer, is given the encoded data is appended
+/// to it instead, through a small staging buffer, and *sink* is returned.
+/// *format* is 1 or 2 (see LUAXS_MARSHAL_FORMAT), the latter by default.
+/// Format 1 patches record lengths in place once known, so files must be
+/// seekable and not opened in append mode.
+/// If *compress* is true the encoded data is compressed in 64KB blocks as it
+/// is written (see buffer.compress); format 2 only. decode detects it.
+static int libE_encode(lua_State* L)
+{
+    unsigned char m;
+    size_t idx, len;
+    int format;
+    mar_Writer w;
+
+    lua_settop(L, 5);
+    if (lua_isnil(L, 2))
+    {
+        lua_newtable(L);
+        lua_replace(L, 2);
+    }
+    else if (!lua_istable(L, 2))
+    {
+        lxs_error(L, "bad argument #2 to encode (expected table)");
+    }
+    format = luaL_optint(L, 4, LUAXS_MARSHAL_FORMAT);
+    luaL_argcheck(L, format == 1 || format == 2, 4, "must be 1 or 2");
+
+    if (lua_toboolean(L, 5))
+    {
+        luaL_argcheck(L, format == 2, 5, "needs format 2");
+        lua_newuserdata(L, sizeof(mar_Zw));
+        lua_replace(L, 5);
+    }
+
+    mar_winit(L, &w, lua_isnil(L, 3) ? 0 : 3, 6);
+    if (lua_toboolean(L, 5))
+        mar_zinit(L, &w, (mar_Zw*)lua_touserdata(L, 5));
+
+    len = lua_objlen(L, 2);
+    lua_newtable(L);
+    for (idx = 1; idx <= len; ++idx)
+    {
+        lua_rawgeti(L, 2, idx);
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+            continue;
+        }
+        lua_pushinteger(L, idx);
+        lua_rawset(L, w.seen);
+    }
+    lua_newtable(L);
+    lua_pushvalue(L, 1);
+
+    m = (unsigned char)(format == 2 ? MAR_MAGIC2 : MAR_MAGIC);
+    mar_write(L, (void*)&m, 1, &w);
+    if (format == 2)
+        mar2_encode_value(L, &w, &idx);
+    else
+        mar_encode_value(L, &w, -1, &idx);
+    lua_pop(L, 1);
+    if (w.z != NULL)
+        mar_zdone(L, &w);
+
+    if (w.data == w.stage)
+        lua_pushvalue(L, 3);
+    else
+        lua_pushlstring(L, w.data, w.head);
+    mar_wdone(L, &w);
+
+    return 1;
+}
+
+/// marshal.decode(source [, constants])
+///
+/// Returns the value encoded in *source*: a string, a buffer or an open file,
+/// in either format, compressed or not.
+/// Buffers and files are read from their current position, which is moved
+/// past the decoded value, so several values can be read one after another.
+/// Files are read through a small staging buffer. __persist hooks may append
+/// to a buffer while it is being decoded; dropping content which is still to
+/// be read raises an error.
+static int libE_decode(lua_State* L)
+{
+    size_t idx, len;
+    int format;
+    mar_Reader r;
+
+    mar_rinit(L, &r, 1, 3);
+
+    if (!mar_fill(L, &r, 1))
+        lxs_error(L, "bad header");
+    format = mar_read_u8(L, &r);
+    if (format != MAR_MAGIC && format != MAR_MAGIC2 && format != MAR_MAGICZ)
+        lxs_error(L, "bad magic");
+
+    lua_settop(L, 2);
+    if (lua_isnil(L, 2))
+    {
+        lua_newtable(L);
+        lua_replace(L, 2);
+    }
+    else if (!lua_istable(L, 2))
+    {
+        lxs_error(L, "bad argument #2 to decode (expected table)");
+    }
+
+    len = lua_objlen(L, 2);
+    lua_newtable(L);
+    for (idx = 1; idx <= len; ++idx)
+    {
+        lua_rawgeti(L, 2, idx);
+        lua_rawseti(L, r.seen, idx);
+    }
+    lua_newtable(L);
+
+    if (format == MAR_MAGICZ)
+    {
+        format = mar_zopen(L, &r);
+        if (format != MAR_MAGIC && format != MAR_MAGIC2)
+            lxs_error(L, "bad magic");
+    }
+
+    if (format == MAR_MAGIC2)
+        mar2_decode_value(L, &r, &idx);
+    else
+        mar_decode_value(L, &r, &idx);
+
+    mar_rdone(L, &r);
+    return 1;
+}
+
+/*
+** Deltas
+**
+** delta := MAGICD root-id { id (key value)* NIL }* 0 ndrop id{ndrop}
+**
+** Keys and values are format 2 values, plus OBJ id for tables. Each record
+** patches the table with the given id: a nil value removes the key. Tables
+** first referenced by a delta start out empty. Dropped ids are no longer
+** reachable from the root.
+**
+** A snapshot is a table:
+**   [1] table -> id      (encoder)
+**   [2] id -> shadow     (encoder; shallow copy as of the last delta)
+**   [3] next free id     (encoder)
+**   [4] id -> table      (decoder)
+**
+** The walk only reads the snapshot: new ids, shadow changes and dropped ids
+** are recorded aside and applied by mard_done once the delta is complete,
+** so an error while encoding leaves the snapshot as it was.
+*/
+
+#define MAR_MAGICD 0x90 /* delta */
+
+/* encode_delta()/snapshot() state; stack indices except for next */
+typedef struct mar_Delta
+{
+    mar_Writer* w;        /* NULL to only update the snapshot */
+    size_t*     idx;
+    int         ids;
+    int         shadows;
+    int         visited;  /* tables reached by this walk */
+    int         pending;  /* tables reached but not diffed yet, then the
+                           * dropped tables and their ids */
+    int         npending;
+    int         ndropped;
+    int         added;    /* table -> id assigned by this walk */
+    int         log;      /* id, key, value triples to apply to shadows */
+    int         nlog;
+    int         next;
+} mar_Delta;
+
+
+/* Pushes the table with the given id, creating it if it is new. */
+static void mard_object(lua_State* L, mar_Reader* r, int id)
+{
+    lua_rawgeti(L, r->objs, id);
+    if (lua_isnil(L, -1))
+    {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, r->objs, id);
+    }
+}
+
+/* Tables are tracked by id unless they have a __persist hook. */
+static int mard_isobject(lua_State* L)
+{
+    if (!lua_istable(L, -1))
+        return 0;
+    if (luaL_getmetafield(L, -1, "__persist"))
+    {
+        lua_pop(L, 1);
+        return 0;
+    }
+    return 1;
+}
+
+/* Values with a __persist hook may change without being replaced, so they
+ * are encoded again in every delta instead of being compared. */
+static int mard_ispersist(lua_State* L, int i)
+{
+    int t = lua_type(L, i);
+    if ((t != LUA_TTABLE && t != LUA_TUSERDATA) || !luaL_getmetafield(L, i, "__persist"))
+        return 0;
+    lua_pop(L, 1);
+    return 1;
+}
+
+/* Returns the id of the table at the top of the stack, assigning one if it
+ * has none yet, and queues the table for the walk if it was not reached. */
+static int mard_id(lua_State* L, mar_Delta* d)
+{
+    int id;
+
+    lua_pushvalue(L, -1);
+    lua_rawget(L, d->ids);
+    id = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (id == 0)
+    {
+        lua_pushvalue(L, -1);
+        lua_rawget(L, d->added);
+        id = (int)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+    }
+    if (id == 0)
+    {
+        id = d->next++;
+        lua_pushvalue(L, -1);
+        lua_pushinteger(L, id);
+        lua_rawset(L, d->added);
+    }
+
+    lua_pushvalue(L, -1);
+    lua_rawget(L, d->visited);
+    if (lua_isnil(L, -1))
+    {
+        lua_pushvalue(L, -2);
+        lua_pushboolean(L, 1);
+        lua_rawset(L, d->visited);
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, d->pending, ++d->npending);
+    }
+    lua_pop(L, 1);
+    return id;
+}
+
+/* Visits the value at the top of the stack and writes it if emit is set. */
+static void mard_value(lua_State* L, mar_Delta* d, int emit)
+{
+    if (mard_isobject(L))
+    {
+        int id = mard_id(L, d);
+        if (emit)
+        {
+            mar_write_tag(L, d->w, MAR2_OBJ);
+            mar_write_varint(L, d->w, (uint64_t)id);
+        }
+    }
+    else if (emit)
+    {
+        mar2_encode_value(L, d->w, d->idx);
+    }
+}
+
+/* Records that key k of shadow id becomes the value at v (stack indices). */
+static void mard_log(lua_State* L, mar_Delta* d, int id, int k, int v)
+{
+    lua_pushvalue(L, v);
+    lua_pushvalue(L, k);
+    lua_pushinteger(L, id);
+    lua_rawseti(L, d->log, ++d->nlog);
+    lua_rawseti(L, d->log, ++d->nlog);
+    lua_rawseti(L, d->log, ++d->nlog);
+}
+
+/* Writes the entries of the table at the top of the stack that changed since
+ * its shadow was taken, and logs the changes to the shadow. */
+static void mard_diff(lua_State* L, mar_Delta* d, int id)
+{
+    int t = lua_gettop(L);
+    int s = t + 1;
+    int changed = 0;
+
+    luaL_checkstack(L, LUA_MINSTACK, "table nested too deeply to encode");
+    lua_rawgeti(L, d->shadows, id);
+    if (lua_isnil(L, -1))
+    {
+        lua_pop(L, 1);
+        lua_newtable(L);
+    }
+
+    /* added and changed entries */
+    lua_pushnil(L);
+    while (lua_next(L, t) != 0)
+    {
+        int diff, emit;
+
+        lua_pushvalue(L, -2);
+        lua_rawget(L, s);
+        diff = !lua_rawequal(L, -1, -2);
+        lua_pop(L, 1);
+
+        if (diff)
+            mard_log(L, d, id, lua_gettop(L) - 1, lua_gettop(L));
+        emit = d->w != NULL && (diff || mard_ispersist(L, -1));
+        if (emit && !changed)
+        {
+            changed = 1;
+            mar_write_varint(L, d->w, (uint64_t)id);
+        }
+        lua_pushvalue(L, -2);
+        mard_value(L, d, emit);
+        lua_pop(L, 1);
+        mard_value(L, d, emit);
+        lua_pop(L, 1);
+    }
+
+    /* removed entries */
+    lua_pushnil(L);
+    while (lua_next(L, s) != 0)
+    {
+        lua_pushvalue(L, -2);
+        lua_rawget(L, t);
+        if (lua_isnil(L, -1))
+        {
+            if (d->w != NULL)
+            {
+                if (!changed)
+                {
+                    changed = 1;
+                    mar_write_varint(L, d->w, (uint64_t)id);
+                }
+                lua_pushvalue(L, -3);
+                if (mard_isobject(L))
+                {
+                    /* not mard_id, the key is gone and need not be walked */
+                    lua_rawget(L, d->ids);
+                    mar_write_tag(L, d->w, MAR2_OBJ);
+                    mar_write_varint(L, d->w, (uint64_t)lua_tointeger(L, -1));
+                }
+                else
+                {
+                    mar2_encode_value(L, d->w, d->idx);
+                }
+                lua_pop(L, 1);
+                mar_write_tag(L, d->w, MAR2_NIL);
+            }
+            mard_log(L, d, id, lua_gettop(L) - 2, lua_gettop(L));
+        }
+        lua_pop(L, 2);
+    }
+
+    if (changed)
+        mar_write_tag(L, d->w, MAR2_NIL);
+    lua_settop(L, t);
+}
+
+/* Walks all tables reachable from the one at the top of the stack, diffing
+ * each, then lists those no longer reachable. */
+static void mard_walk(lua_State* L, mar_Delta* d)
+{
+    int root, n = 0;
+
+    root = mard_id(L, d);
+    if (d->w != NULL)
+        mar_write_varint(L, d->w, (uint64_t)root);
+
+    while (d->npending > 0)
+    {
+        lua_rawgeti(L, d->pending, d->npending);
+        lua_pushnil(L);
+        lua_rawseti(L, d->pending, d->npending--);
+
+        lua_pushvalue(L, -1);
+        lua_rawget(L, d->ids);
+        root = (int)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+
+        mard_diff(L, d, root);
+        lua_pop(L, 1);
+    }
+    if (d->w != NULL)
+        mar_write_varint(L, d->w, 0);
+
+    /* collect unreached tables and their ids in pending */
+    lua_pushnil(L);
+    while (lua_next(L, d->ids) != 0)
+    {
+        lua_pushvalue(L, -2);
+        lua_rawget(L, d->visited);
+        if (lua_isnil(L, -1))
+        {
+            lua_pushvalue(L, -3);
+            lua_rawseti(L, d->pending, ++n);
+            lua_pushvalue(L, -2);
+            lua_rawseti(L, d->pending, ++n);
+        }
+        lua_pop(L, 2);
+    }
+    d->ndropped = n / 2;
+
+    if (d->w != NULL)
+    {
+        mar_write_varint(L, d->w, (uint64_t)d->ndropped);
+        for (n = 2; n <= 2 * d->ndropped; n += 2)
+        {
+            lua_rawgeti(L, d->pending, n);
+            mar_write_varint(L, d->w, (uint64_t)lua_tointeger(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+}
+
+/* Pushes the snapshot's fields ids, shadows and the walk's visited, pending,
+ * added and log tables, and sets up d. */
+static void mard_init(lua_State* L, mar_Delta* d, int snap, mar_Writer* w)
+{
+    luaL_checktype(L, snap, LUA_TTABLE);
+    lua_rawgeti(L, snap, 1);
+    lua_rawgeti(L, snap, 2);
+    lua_rawgeti(L, snap, 3);
+    if (!lua_istable(L, -3) || !lua_istable(L, -2) || !lua_isnumber(L, -1))
+        lxs_error(L, "bad snapshot");
+
+    d->w        = w;
+    d->next     = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    d->ids      = lua_gettop(L) - 1;
+    d->shadows  = d->ids + 1;
+    lua_newtable(L);
+    d->visited  = d->ids + 2;
+    lua_newtable(L);
+    d->pending  = d->ids + 3;
+    d->npending = 0;
+    d->ndropped = 0;
+    lua_newtable(L);
+    d->added    = d->ids + 4;
+    lua_newtable(L);
+    d->log      = d->ids + 5;
+    d->nlog     = 0;
+}
+
+/* Applies what the walk recorded to the snapshot. */
+static void mard_done(lua_State* L, mar_Delta* d, int snap)
+{
+    int i;
+
+    lua_pushnil(L);
+    while (lua_next(L, d->added) != 0)
+    {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, d->ids);
+    }
+
+    for (i = 1; i <= 2 * d->ndropped; i += 2)
+    {
+        lua_rawgeti(L, d->pending, i);
+        lua_pushnil(L);
+        lua_rawset(L, d->ids);
+        lua_rawgeti(L, d->pending, i + 1);
+        lua_pushnil(L);
+        lua_rawset(L, d->shadows);
+    }
+
+    for (i = 1; i <= d->nlog; i += 3)
+    {
+        lua_rawgeti(L, d->log, i);
+        lua_rawget(L, d->shadows);
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_rawgeti(L, d->log, i);
+            lua_pushvalue(L, -2);
+            lua_rawset(L, d->shadows);
+        }
+        lua_rawgeti(L, d->log, i + 1);
+        lua_rawgeti(L, d->log, i + 2);
+        lua_rawset(L, -3);
+        lua_pop(L, 1);
+    }
+
+    lua_pushinteger(L, d->next);
+    lua_rawseti(L, snap, 3);
+}
+
+/// marshal.snapshot([root])
+///
+/// Returns a snapshot for encode_delta/decode_delta. Without *root* it is
+/// empty: the first delta encoded against it contains all of *root*, and it
+/// is what decode_delta starts from. With *root* it records root's current
+/// state, so the first delta only contains what changed since.
+/// Snapshots keep a shallow copy of every table they track; a snapshot is
+/// either used to encode or to decode deltas, not both.
+static int libE_snapshot(lua_State* L)
+{
+    lua_settop(L, 1);
+    lua_createtable(L, 4, 0);
+    lua_newtable(L);
+    lua_rawseti(L, 2, 1);
+    lua_newtable(L);
+    lua_rawseti(L, 2, 2);
+    lua_pushinteger(L, 1);
+    lua_rawseti(L, 2, 3);
+    lua_newtable(L);
+    lua_rawseti(L, 2, 4);
+
+    if (!lua_isnil(L, 1))
+    {
+        size_t    idx = 1;
+        mar_Delta d;
+
+        luaL_checktype(L, 1, LUA_TTABLE);
+        mard_init(L, &d, 2, NULL);
+        d.idx = &idx;
+        lua_pushvalue(L, 1);
+        mard_walk(L, &d);
+        mard_done(L, &d, 2);
+        lua_settop(L, 2);
+    }
+    return 1;
+}
+
+/// marshal.encode_delta(root, snapshot [, sink])
+///
+/// Returns the changes to the tables reachable from *root* since *snapshot*
+/// was taken or last used, encoded as a string; or, like encode, writes them
+/// to *sink* and returns *sink*. *snapshot* is updated to the current state.
+/// Tables are identified by ids the snapshot assigns; added, changed and
+/// removed entries are encoded per table, unchanged tables are only walked.
+/// Other values are encoded in format 2. Tables and userdata with a
+/// __persist hook are encoded again in every delta wherever they are an
+/// entry's value, so the receiver gets a fresh object from the hook; as
+/// keys they are compared by identity only.
+/// Functions are compared by identity too: a function is sent when it is
+/// stored, with copies of its upvalues as format 2 encodes them, so a
+/// tracked table reached through an upvalue arrives as a separate copy, and
+/// later changes to upvalues are not sent unless the function is replaced.
+static int libE_encode_delta(lua_State* L)
+{
+    const unsigned char m = MAR_MAGICD;
+    size_t     idx = 1;
+    mar_Writer w;
+    mar_Delta  d;
+
+    lua_settop(L, 3);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    mar_winit(L, &w, lua_isnil(L, 3) ? 0 : 3, 4);
+    lua_newtable(L);
+    lua_newtable(L);
+    mard_init(L, &d, 2, &w);
+    d.idx = &idx;
+
+    mar_write(L, (void*)&m, 1, &w);
+    lua_pushvalue(L, 1);
+    mard_walk(L, &d);
+    mard_done(L, &d, 2);
+
+    if (w.data == w.stage)
+        lua_pushvalue(L, 3);
+    else
+        lua_pushlstring(L, w.data, w.head);
+    mar_wdone(L, &w);
+
+    return 1;
+}
+
+/// marshal.decode_delta(source, snapshot)
+///
+/// Applies the delta in *source* (a string, buffer or file, see decode) to
+/// the tables decoded with *snapshot* so far, in place, and returns the root.
+/// Deltas have to be applied in the order they were encoded.
+static int libE_decode_delta(lua_State* L)
+{
+    size_t     idx = 1, n;
+    int        root, id;
+    mar_Reader r;
+
+    mar_rinit(L, &r, 1, 3);
+    if (!mar_fill(L, &r, 1))
+        lxs_error(L, "bad header");
+    if (mar_read_u8(L, &r) != MAR_MAGICD)
+        lxs_error(L, "bad magic");
+
+    lua_settop(L, 2);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_rawgeti(L, 2, 4);
+    if (!lua_istable(L, -1))
+        lxs_error(L, "bad snapshot");
+    r.objs = 5;
+
+    root = (int)mar_read_size(L, &r);
+    while ((id = (int)mar_read_size(L, &r)) != 0)
+    {
+        mard_object(L, &r, id);
+        for (;;)
+        {
+            mar2_decode_value(L, &r, &idx);
+            if (lua_isnil(L, -1))
+                break;
+            mar2_decode_value(L, &r, &idx);
+            lua_rawset(L, -3);
+        }
+        lua_pop(L, 2);
+    }
+
+    for (n = mar_read_size(L, &r); n > 0; --n)
+    {
+        lua_pushnil(L);
+        lua_rawseti(L, r.objs, (int)mar_read_size(L, &r));
+    }
+
+    mar_rdone(L, &r);
+    mard_object(L, &r, root);
+    return 1;
+}
+
+/*
+** Lazy decoding
+**
+** marshal.open() indexes a format 2 blob in one pass without creating any
+** objects: the offsets of all tables, functions and persisted values (in the
+** order they are numbered) and of all strings (in string table order). Tables
+** are then decoded one level at a time, when first indexed: their entries are
+** decoded from the recorded offset, nested tables become further proxies.
+**
+** A proxy is an empty table with the blob's proxy metatable. Materializing it
+** fills it in place and removes the metatable, so it is a plain table from
+** then on and references to it stay valid.
+*/
+
+#define MAR_LAZY "marshal.lazy"
+
+/* environment of a mar_Lazy */
+#define MAR_LSOURCE 1 /* the string or buffer */
+#define MAR_LCACHE  2 /* object number -> object (weak values) */
+#define MAR_LPROXY  3 /* proxy -> object number (weak keys) */
+#define MAR_LCONSTS 4 /* constants */
+#define MAR_LMETA   5 /* proxy metatable */
+
+/* Offset index of a blob; offsets are relative to the magic byte. */
+typedef struct mar_Lazy
+{
+    size_t  base;  /* offset of the blob in a buffer source */
+    size_t  len;   /* blob length */
+    size_t* objs;  /* object -> offset of its tag, offset past it */
+    size_t  nobjs;
+    size_t  cobjs; /* capacity of objs, in objects */
+    size_t* strs;  /* string -> offset of its length */
+    size_t  nstrs;
+    size_t  cstrs;
+    int     first; /* number of the first object, constants come before */
+} mar_Lazy;
+
+static void mar_lazy_value(lua_State* L, mar_Lazy* z, int env, mar_Reader* r);
+
+
+static size_t mar_lazy_grow(lua_State* L, size_t** v, size_t n, size_t width)
+{
+    size_t c = n ? n * 2 : 64;
+    *v = (size_t*)luaM_realloc_(L, *v, n * width * sizeof(size_t),
+                                c * width * sizeof(size_t));
+    return c;
+}
+
+/* Indexes the value at r; returns its tag. */
+static int mar_lazy_scan(lua_State* L, mar_Lazy* z, mar_Reader* r)
+{
+    size_t pos = mar_rpos(r);
+    size_t k, n;
+    int    tag = mar_read_u8(L, r);
+
+    switch (tag)
+    {
+    case MAR2_NIL:
+    case MAR2_FALSE:
+    case MAR2_TRUE:
+        return tag;
+    case MAR2_INT:
+    case MAR2_SREF:
+    case MAR2_REF:
+        mar_read_varint(L, r);
+        return tag;
+    case MAR2_NUM:
+        mar_read_num(L, r);
+        return tag;
+    case MAR2_STR:
+        if (z->nstrs == z->cstrs)
+            z->cstrs = mar_lazy_grow(L, &z->strs, z->cstrs, 1);
+        z->strs[z->nstrs++] = pos + 1;
+        mar_skip(L, r, mar_read_size(L, r));
+        return tag;
+    case MAR2_TABLE:
+    case MAR2_FUNC:
+    case MAR2_PERSIST:
+        break;
+    default:
+        lxs_error(L, "bad code");
+    }
+
+    if (z->nobjs == z->cobjs)
+        z->cobjs = mar_lazy_grow(L, &z->objs, z->cobjs, 2);
+    k = z->nobjs++;
+    z->objs[2 * k] = pos;
+
+    if (tag == MAR2_TABLE)
+    {
+        n = mar_read_size(L, r);
+        mar_read_size(L, r);
+        while (n-- > 0)
+            mar_lazy_scan(L, z, r);
+        while (mar_lazy_scan(L, z, r) != MAR2_NIL)
+            mar_lazy_scan(L, z, r);
+    }
+    else if (tag == MAR2_FUNC)
+    {
+        mar_skip(L, r, mar_read_size(L, r));
+        for (n = mar_read_size(L, r); n > 0; --n)
+            mar_lazy_scan(L, z, r);
+    }
+    else
+    {
+        mar_lazy_scan(L, z, r);
+    }
+
+    z->objs[2 * k + 1] = mar_rpos(r);
+    return tag;
+}
+
+/* Points r at offset pos of the blob. The source is looked up again each
+ * time, buffers may have moved their content since. */
+static void mar_lazy_reader(lua_State* L,
+                            mar_Lazy* z,
+                            int env,
+                            mar_Reader* r,
+                            size_t pos)
+{
+    const char* data;
+    size_t len;
+
+    lua_rawgeti(L, env, MAR_LSOURCE);
+#if LUAXS_ADDLIB_BUFFER
+    if (lua_type(L, -1) != LUA_TSTRING)
+        data = lxs_bdata(L, -1, &len);
+    else
+#endif
+    data = lua_tolstring(L, -1, &len);
+    lua_pop(L, 1);
+
+    if (len < z->base + z->len)
+        lxs_error(L, "marshal source was modified");
+
+    r->f     = NULL;
+    r->bidx  = 0;
+    r->boff  = 0;
+    r->seen  = 0;
+    r->strs  = 0;
+    r->nstrs = 0;
+    r->objs  = 0;
+    r->z     = NULL;
+    r->end   = data + z->base + z->len;
+    r->read  = z->len;
+    r->p     = r->end - (z->len - pos);
+}
+
+/* Returns the object whose tag is at pos, or -1. */
+static ptrdiff_t mar_lazy_find(const mar_Lazy* z, size_t pos)
+{
+    size_t lo = 0, hi = z->nobjs;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (z->objs[2 * mid] < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < z->nobjs && z->objs[2 * lo] == pos ? (ptrdiff_t)lo : -1;
+}
+
+/* Pushes object number n: a constant, the cached object or a new one. Tables
+ * are returned as proxies. */
+static void mar_lazy_object(lua_State* L, mar_Lazy* z, int env, int n)
+{
+    mar_Reader r;
+    size_t     k, i, nups;
+
+    if (n < z->first)
+    {
+        lua_rawgeti(L, env, MAR_LCONSTS);
+        lua_rawgeti(L, -1, n);
+        lua_remove(L, -2);
+        return;
+    }
+    if ((size_t)(n - z->first) >= z->nobjs)
+        lxs_error(L, "bad code");
+
+    lua_rawgeti(L, env, MAR_LCACHE);
+    lua_rawgeti(L, -1, n);
+    if (!lua_isnil(L, -1))
+    {
+        lua_remove(L, -2);
+        return;
+    }
+    lua_pop(L, 1);
+
+    luaL_checkstack(L, LUA_MINSTACK, "value nested too deeply to decode");
+    k = (size_t)(n - z->first);
+    mar_lazy_reader(L, z, env, &r, z->objs[2 * k]);
+
+    switch (mar_read_u8(L, &r))
+    {
+    case MAR2_TABLE:
+        lua_newtable(L);
+        lua_rawgeti(L, env, MAR_LMETA);
+        lua_setmetatable(L, -2);
+        lua_rawgeti(L, env, MAR_LPROXY);
+        lua_pushvalue(L, -2);
+        lua_pushinteger(L, n);
+        lua_rawset(L, -3);
+        lua_pop(L, 1);
+        break;
+    case MAR2_FUNC:
+    {
+        mar_Load ld;
+
+        ld.r    = &r;
+        ld.left = mar_read_size(L, &r);
+        if (lua_load(L, mar_load_reader, &ld, "=marshal") != 0)
+            lua_error(L);
+        mar_skip(L, &r, ld.left);
+
+        /* cached before the upvalues, they may refer back to it */
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, -3, n);
+
+        nups = mar_read_size(L, &r);
+        for (i = 1; i <= nups; ++i)
+        {
+            mar_lazy_value(L, z, env, &r);
+            if (lua_setupvalue(L, -2, (int)i) == NULL)
+                lua_pop(L, 1);
+        }
+        lua_remove(L, -2);
+        return;
+    }
+    case MAR2_PERSIST:
+        mar_lazy_value(L, z, env, &r);
+        lua_call(L, 0, 1);
+        break;
+    default:
+        lxs_error(L, "bad code");
+    }
+
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, n);
+    lua_remove(L, -2);
+}
+
+/* Pushes the value at r; r is moved past it. */
+static void mar_lazy_value(lua_State* L, mar_Lazy* z, int env, mar_Reader* r)
+{
+    size_t    pos = mar_rpos(r);
+    ptrdiff_t k;
+
+    switch (mar_read_u8(L, r))
+    {
+    case MAR2_NIL:
+        lua_pushnil(L);
+        break;
+    case MAR2_FALSE:
+        lua_pushboolean(L, 0);
+        break;
+    case MAR2_TRUE:
+        lua_pushboolean(L, 1);
+        break;
+    case MAR2_INT:
+    {
+        uint64_t u = mar_read_varint(L, r);
+        int64_t  i = (u & 1) ? -(int64_t)(u >> 1) - 1 : (int64_t)(u >> 1);
+        lua_pushnumber(L, (lua_Number)i);
+        break;
+    }
+    case MAR2_NUM:
+        lua_pushnumber(L, mar_read_num(L, r));
+        break;
+    case MAR2_STR:
+        mar_read_string(L, r, mar_read_size(L, r));
+        break;
+    case MAR2_SREF:
+    {
+        size_t i = mar_read_size(L, r);
+        size_t next = mar_rpos(r);
+
+        if (i < 1 || i > z->nstrs)
+            lxs_error(L, "bad code");
+        r->p = r->end - (z->len - z->strs[i - 1]);
+        mar_read_string(L, r, mar_read_size(L, r));
+        r->p = r->end - (z->len - next);
+        break;
+    }
+    case MAR2_REF:
+        mar_lazy_object(L, z, env, (int)mar_read_size(L, r));
+        /* __persist hooks may have modified a buffer source */
+        mar_lazy_reader(L, z, env, r, mar_rpos(r));
+        break;
+    case MAR2_TABLE:
+    case MAR2_FUNC:
+    case MAR2_PERSIST:
+        if ((k = mar_lazy_find(z, pos)) < 0)
+            lxs_error(L, "bad code");
+        mar_lazy_object(L, z, env, z->first + (int)k);
+        mar_lazy_reader(L, z, env, r, z->objs[2 * k + 1]);
+        break;
+    default:
+        lxs_error(L, "bad code");
+    }
+}
+
+/* Pushes the mar_Lazy of the proxy at stack index i, or returns NULL if i is
+ * not an unmaterialized proxy. */
+static mar_Lazy* mar_lazy_check(lua_State* L, int i)
+{
+    mar_Lazy* z;
+
+    if (!lua_istable(L, i) || !lua_getmetatable(L, i))
+        return NULL;
+    lua_pushliteral(L, "__lazy");
+    lua_rawget(L, -2);
+    z = (mar_Lazy*)lua_touserdata(L, -1);
+    if (z != NULL && lua_getmetatable(L, -1))
+    {
+        luaL_getmetatable(L, MAR_LAZY);
+        if (lua_rawequal(L, -1, -2))
+        {
+            lua_pop(L, 2);
+            lua_remove(L, -2);
+            return z;
+        }
+        lua_pop(L, 2);
+    }
+    lua_pop(L, 2);
+    return NULL;
+}
+
+/* lua_pcall'ed by mar_lazy_fill with the proxy, z's environment, z and the
+ * proxy's object number. */
+static int mar_lazy_dofill(lua_State* L)
+{
+    mar_Lazy*  z = (mar_Lazy*)lua_touserdata(L, 3);
+    int        n = (int)lua_tointeger(L, 4);
+    mar_Reader r;
+    size_t     narray, j;
+
+    mar_lazy_reader(L, z, 2, &r, z->objs[2 * (size_t)(n - z->first)] + 1);
+    narray = mar_read_size(L, &r);
+    mar_read_size(L, &r);
+    /* every array value takes at least a byte */
+    if (narray > (size_t)(r.end - r.p))
+        lxs_error(L, "bad code");
+    if (narray > 0)
+    {
+        lua_pushvalue(L, 1);
+        luaH_resizearray(L, hvalue(L->top - 1), (int)narray);
+        lua_pop(L, 1);
+    }
+
+    for (j = 1; j <= narray; ++j)
+    {
+        mar_lazy_value(L, z, 2, &r);
+        if (lua_isnil(L, -1))
+            lua_pop(L, 1);
+        else
+            lua_rawseti(L, 1, (int)j);
+    }
+    for (;;)
+    {
+        mar_lazy_value(L, z, 2, &r);
+        if (lua_isnil(L, -1))
+            break;
+        mar_lazy_value(L, z, 2, &r);
+        lua_rawset(L, 1);
+    }
+    return 0;
+}
+
+/* Fills the proxy at stack index i, z's environment is at env. */
+static void mar_lazy_fill(lua_State* L, mar_Lazy* z, int env, int i)
+{
+    int n;
+
+    lua_rawgeti(L, env, MAR_LPROXY);
+    lua_pushvalue(L, i);
+    lua_rawget(L, -2);
+    n = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (n == 0)
+    {
+        lua_pop(L, 1);
+        return;
+    }
+
+    /* a plain table from here on, nested lookups during the fill included */
+    lua_pushvalue(L, i);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_setmetatable(L, i);
+
+    lua_pushcfunction(L, mar_lazy_dofill);
+    lua_pushvalue(L, i);
+    lua_pushvalue(L, env);
+    lua_pushlightuserdata(L, z);
+    lua_pushinteger(L, n);
+    if (lua_pcall(L, 4, 0, 0) == 0)
+        return;
+
+    /* back to an empty proxy, which the next lookup fills again */
+    lua_pushnil(L);
+    while (lua_next(L, i))
+    {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, i);
+    }
+    lua_rawgeti(L, env, MAR_LMETA);
+    lua_setmetatable(L, i);
+    lua_rawgeti(L, env, MAR_LPROXY);
+    lua_pushvalue(L, i);
+    lua_pushinteger(L, n);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    lua_error(L);
+}
+
+/* Materializes the table at stack index i if it is a proxy. */
+static void mar_lazy_materialize(lua_State* L, int i)
+{
+    mar_Lazy* z = mar_lazy_check(L, i);
+
+    if (z != NULL)
+    {
+        lua_getfenv(L, -1);
+        mar_lazy_fill(L, z, lua_gettop(L), i);
+        lua_pop(L, 2);
+    }
+}
+
+/* proxy __index(t, k) */
+static int mar_lazy_index(lua_State* L)
+{
+    lua_settop(L, 2);
+    mar_lazy_materialize(L, 1);
+    lua_rawget(L, 1);
+    return 1;
+}
+
+/* proxy __newindex(t, k, v) */
+static int mar_lazy_newindex(lua_State* L)
+{
+    lua_settop(L, 3);
+    mar_lazy_materialize(L, 1);
+    lua_rawset(L, 1);
+    return 0;
+}
+
+static int mar_lazy_gc(lua_State* L)
+{
+    mar_Lazy* z = (mar_Lazy*)luaL_checkudata(L, 1, MAR_LAZY);
+
+    luaM_freearray(L, z->objs, 2 * z->cobjs, size_t);
+    luaM_freearray(L, z->strs, z->cstrs, size_t);
+    z->objs  = z->strs  = NULL;
+    z->cobjs = z->cstrs = 0;
+    return 0;
+}
+
+static void mar_lazy_weak(lua_State* L, const char* mode)
+{
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushstring(L, mode);
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+}
+
+/// marshal.open(source [, constants])
+///
+/// Returns the value encoded in *source*, a string or a buffer holding
+/// format 2 data, without decoding it: tables are returned as empty proxies
+/// that decode their own entries the first time they are indexed or assigned
+/// to, nested tables again as proxies. Strings, functions and __persist
+/// values are decoded as they are reached; shared references and cycles are
+/// preserved.
+/// open reads *source* once to index it and keeps a reference to it, the data
+/// is never copied. A buffer is read from its read cursor, which is moved
+/// past the value; its content must not be changed while proxies are alive.
+/// Proxies are plain tables once materialized. Until then they have no
+/// entries to pairs, next or #, see materialize, and must not be given a
+/// metatable.
+static int libE_open(lua_State* L)
+{
+    mar_Lazy*  z;
+    mar_Reader r;
+    size_t     len, rem;
+
+    lua_settop(L, 2);
+    if (lua_type(L, 1) == LUA_TSTRING)
+    {
+        len = rem = lua_objlen(L, 1);
+    }
+#if LUAXS_ADDLIB_BUFFER
+    else if (lxs_bisbuffer(L, 1))
+    {
+        lxs_bdata(L, 1, &len);
+        lxs_bread(L, 1, &rem);
+    }
+#endif
+    else
+    {
+        return luaL_argerror(L, 1, "string or buffer expected");
+    }
+    if (lua_isnil(L, 2))
+    {
+        lua_newtable(L);
+        lua_replace(L, 2);
+    }
+    else if (!lua_istable(L, 2))
+    {
+        lxs_error(L, "bad argument #2 to open (expected table)");
+    }
+
+    z = (mar_Lazy*)lua_newuserdata(L, sizeof(mar_Lazy));
+    memset(z, 0, sizeof(mar_Lazy));
+    luaL_getmetatable(L, MAR_LAZY);
+    lua_setmetatable(L, 3);
+    z->base  = len - rem;
+    z->len   = rem;
+    z->first = (int)lua_objlen(L, 2) + 1;
+
+    lua_createtable(L, 5, 0);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, 4, MAR_LSOURCE);
+    mar_lazy_weak(L, "v");
+    lua_rawseti(L, 4, MAR_LCACHE);
+    mar_lazy_weak(L, "k");
+    lua_rawseti(L, 4, MAR_LPROXY);
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, 4, MAR_LCONSTS);
+    lua_createtable(L, 0, 3);
+    lua_pushvalue(L, 3);
+    lua_pushcclosure(L, mar_lazy_index, 1);
+    lua_setfield(L, -2, "__index");
+    lua_pushvalue(L, 3);
+    lua_pushcclosure(L, mar_lazy_newindex, 1);
+    lua_setfield(L, -2, "__newindex");
+    lua_pushvalue(L, 3);
+    lua_setfield(L, -2, "__lazy");
+    lua_rawseti(L, 4, MAR_LMETA);
+    lua_pushvalue(L, 4);
+    lua_setfenv(L, 3);
+
+    mar_lazy_reader(L, z, 4, &r, 0);
+    if (z->len == 0)
+        lxs_error(L, "bad header");
+    if (mar_read_u8(L, &r) != MAR_MAGIC2)
+        lxs_error(L, "bad magic (open needs format 2)");
+    mar_lazy_scan(L, z, &r);
+    z->len = mar_rpos(&r);
+#if LUAXS_ADDLIB_BUFFER
+    if (lua_type(L, 1) != LUA_TSTRING)
+        lxs_bskip(L, 1, z->len);
+#endif
+
+    mar_lazy_reader(L, z, 4, &r, 1);
+    mar_lazy_value(L, z, 4, &r);
+    return 1;
+}
+
+/// marshal.materialize(value [, deep])
+///
+/// Decodes the entries of *value* if it is a proxy returned by open, and
+/// returns *value*, now a plain table. If *deep* is true all proxies
+/// reachable from *value* are materialized as well, so the whole subtree can
+/// be traversed. Other values are returned as they are.
+static int libE_materialize(lua_State* L)
+{
+    lua_settop(L, 2);
+    mar_lazy_materialize(L, 1);
+    if (!lua_toboolean(L, 2) || !lua_istable(L, 1))
+    {
+        lua_settop(L, 1);
+        return 1;
+    }
+
+    /* 3: visited, 4: pending */
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushvalue(L, 1);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, 3);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, 4, 1);
+
+    for (;;)
+    {
+        int n = (int)lua_objlen(L, 4);
+        int i;
+
+        if (n == 0)
+            break;
+        lua_rawgeti(L, 4, n);
+        lua_pushnil(L);
+        lua_rawseti(L, 4, n);
+
+        mar_lazy_materialize(L, 5);
+        lua_pushnil(L);
+        while (lua_next(L, 5) != 0)
+        {
+            for (i = -2; i <= -1; ++i)
+            {
+                if (!lua_istable(L, i))
+                    continue;
+                lua_pushvalue(L, i);
+                lua_rawget(L, 3);
+                if (lua_isnil(L, -1))
+                {
+                    lua_pushvalue(L, i - 1);
+                    lua_pushboolean(L, 1);
+                    lua_rawset(L, 3);
+                    lua_pushvalue(L, i - 1);
+                    lua_rawseti(L, 4, (int)lua_objlen(L, 4) + 1);
+                }
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_settop(L, 1);
+    return 1;
+}
+
+/* marshal.clone() state */
+typedef struct mar_Clone
+{
+    int seen; /* stack index of the source -> copy map */
+    int meta; /* non-zero if copies share the source's metatable */
+} mar_Clone;
+
+static void mar_clone_value(lua_State* L, const mar_Clone* c, int depth);
+
+/* Replaces the table at the top of the stack with a copy whose parts are
+ * presized to the source's. */
+static void mar_clone_table(lua_State* L, const mar_Clone* c, int depth)
+{
+    const Table* t = hvalue(L->top - 1);
+    int s = lua_gettop(L);
+    int d = s + 1;
+    int i, n = t->sizearray;
+
+    luaL_checkstack(L, LUA_MINSTACK, "table nested too deeply to clone");
+    lua_createtable(L, n, t->lsizenode ? sizenode(t) : 0);
+    lua_pushvalue(L, s);
+    lua_pushvalue(L, d);
+    lua_rawset(L, c->seen);
+
+    for (i = 1; i <= n; ++i)
+    {
+        lua_rawgeti(L, s, i);
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+            continue;
+        }
+        mar_clone_value(L, c, depth);
+        lua_rawseti(L, d, i);
+    }
+
+    /* continue after the array part, unless a __persist hook resized it */
+    if (n > 0 && t->sizearray == n)
+        lua_pushinteger(L, n);
+    else
+        lua_pushnil(L);
+    while (lua_next(L, s) != 0)
+    {
+        lua_pushvalue(L, -2);
+        mar_clone_value(L, c, depth);
+        lua_pushvalue(L, -2);
+        mar_clone_value(L, c, depth);
+        lua_rawset(L, d);
+        lua_pop(L, 1);
+    }
+
+    if (c->meta && lua_getmetatable(L, s))
+        lua_setmetatable(L, d);
+    lua_replace(L, s);
+}
+
+static int mar_clone_writer(lua_State* L, const void* p, size_t sz, void* ud)
+{
+    (void)L;
+    luaL_addlstring((luaL_Buffer*)ud, (const char*)p, sz);
+    return 0;
+}
+
+/* Replaces the Lua function at the top of the stack with a copy loaded from
+ * its bytecode, whose upvalues are copies of the source's. */
+static void mar_clone_function(lua_State* L, const mar_Clone* c, int depth)
+{
+    luaL_Buffer b;
+    const char* code;
+    size_t      len;
+    int         s = lua_gettop(L);
+    int         i;
+
+    luaL_checkstack(L, LUA_MINSTACK, "function nested too deeply to clone");
+    luaL_buffinit(L, &b);
+    if (lua_dump(L, mar_clone_writer, &b) != 0)
+        lxs_error(L, "unable to dump given function");
+    luaL_pushresult(&b);
+    code = lua_tolstring(L, -1, &len);
+    if (luaL_loadbuffer(L, code, len, "=marshal") != 0)
+        lua_error(L);
+    lua_remove(L, -2);
+
+    /* registered before the upvalues, they may refer back to it */
+    lua_pushvalue(L, s);
+    lua_pushvalue(L, s + 1);
+    lua_rawset(L, c->seen);
+
+    for (i = 1; lua_getupvalue(L, s, i) != NULL; ++i)
+    {
+        mar_clone_value(L, c, depth);
+        lua_setupvalue(L, s + 1, i);
+    }
+    lua_replace(L, s);
+}
+
+/* Replaces the value at the top of the stack with its copy. */
+static void mar_clone_value(lua_State* L, const mar_Clone* c, int depth)
+{
+    int val_type = lua_type(L, -1);
+    if (val_type == LUA_TFUNCTION)
+    {
+        if (lua_iscfunction(L, -1))
+            return;
+    }
+    else if (val_type != LUA_TTABLE && val_type != LUA_TUSERDATA)
+        return;
+
+    lua_pushvalue(L, -1);
+    lua_rawget(L, c->seen);
+    if (!lua_isnil(L, -1))
+    {
+        lua_replace(L, -2);
+        return;
+    }
+    lua_pop(L, 1);
+
+    if (val_type == LUA_TFUNCTION)
+    {
+        if (depth != 0)
+            mar_clone_function(L, c, depth - 1);
+    }
+    else if (luaL_getmetafield(L, -1, "__persist"))
+    {
+        lua_pushvalue(L, -2); /* self */
+        lua_call(L, 1, 1);
+        if (!lua_isfunction(L, -1))
+            lxs_error(L, "__persist must return a function");
+        lua_call(L, 0, 1);
+        lua_pushvalue(L, -2);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, c->seen);
+        lua_replace(L, -2);
+    }
+    else if (val_type == LUA_TUSERDATA)
+    {
+        lxs_error(L, "attempt to clone userdata (no __persist hook)");
+    }
+    else if (depth != 0)
+    {
+        mar_clone_table(L, c, depth - 1);
+    }
+}
+
+/// marshal.clone(value [, constants [, depth [, metatables]]])
+///
+/// Returns a deep copy of *value*, the same as decode(encode(value)) would,
+/// without the intermediate string: tables are copied directly, cycles and
+/// shared references are preserved, and tables or userdata with a __persist
+/// hook are replaced by the result of the function it returns.
+/// Lua functions are reloaded from their bytecode with copies of their
+/// upvalues, so a copied closure works on the copied tables; like decoded
+/// ones they run in the global environment.
+/// Values listed in *constants* as well as strings, C functions and threads
+/// are not copied but referenced.
+/// Only *depth* levels of tables and functions are copied, deeper ones are
+/// referenced; all levels if omitted. If *metatables* is true, copies share the metatable of
+/// their source.
+static int libE_clone(lua_State* L)
+{
+    mar_Clone c;
+    int depth = luaL_optint(L, 3, -1);
+    size_t i, len;
+
+    if (depth < 0)
+        depth = -1;
+    if (!lua_isnoneornil(L, 2) && !lua_istable(L, 2))
+        lxs_error(L, "bad argument #2 to clone (expected table)");
+    lua_settop(L, 4);
+
+    c.meta = lua_toboolean(L, 4);
+    c.seen = 5;
+    lua_newtable(L);
+    if (!lua_isnil(L, 2))
+    {
+        len = lua_objlen(L, 2);
+        for (i = 1; i <= len; ++i)
+        {
+            lua_rawgeti(L, 2, i);
+            if (lua_isnil(L, -1))
+            {
+                lua_pop(L, 1);
+                continue;
+            }
+            lua_pushvalue(L, -1);
+            lua_rawset(L, c.seen);
+        }
+    }
+
+    lua_pushvalue(L, 1);
+    mar_clone_value(L, &c, depth);
+    return 1;
+}
+
+
+static const luaL_Reg libE_funcs[] =
+{
+    { "encode",       libE_encode       },
+    { "decode",       libE_decode       },
+    { "clone",        libE_clone        },
+    { "snapshot",     libE_snapshot     },
+    { "encode_delta", libE_encode_delta },
+    { "decode_delta", libE_decode_delta },
+    { "open",         libE_open         },
+    { "materialize",  libE_materialize  },
+    { NULL, NULL}
+};
+
+
+LUA_API int luaopen_marshal(lua_State *L)
+{
+    lxs_assert_stack_begin(L);
+
+    luaL_newmetatable(L, MAR_LAZY);
+    lua_pushcfunction(L, mar_lazy_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
 
     luaL_register(L, LUA_MARSHALLIBNAME, libE_funcs);
 
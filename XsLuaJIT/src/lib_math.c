@@ -495,6 +495,7 @@ LUALIB_API int luaopen_math(lua_State *L)
 # if LUAXS_DEBUG
 #  define CCPU(L, name, flag) \
     CDBG(L, "CPU " name ": %s", xs_cpu_supports(flag) ? "Supported" : "N/A");
+    CCPU(L, "SSE2",           XS_CPU_SSE2);
     CCPU(L, "SSE3",           XS_CPU_SSE3I);
     CCPU(L, "SSSE3",          XS_CPU_SSE3S);
     CCPU(L, "SSE4",           XS_CPU_SSE4);
@@ -505,6 +506,7 @@ LUALIB_API int luaopen_math(lua_State *L)
     CCPU(L, "MMX",            XS_CPU_MMX);
     CCPU(L, "3DNow! Ext",     XS_CPU_3DNOW_EXT);
     CCPU(L, "3DNow!",         XS_CPU_3DNOW);
+    CCPU(L, "AVX2",           XS_CPU_AVX2);
 #  undef CCPU
 # endif // LUAXS_DEBUG
 
@@ -212,7 +212,12 @@ static int os_setlocale (lua_State *L) {
   };
   const char *l = luaL_optstring(L, 1, NULL);
   int op = luaL_checkoption(L, 2, "all", catnames);
-  lua_pushstring(L, setlocale(cat[op], l));
+  const char *res = setlocale(cat[op], l);
+  lua_pushstring(L, res);
+#if LUAXS_STR_PATTERN_CACHE
+  if (res && l && (cat[op] == LC_ALL || cat[op] == LC_CTYPE))
+    lxs_pmflush(L);  /* compiled pattern classes depend on ctype */
+#endif
   return 1;
 }
 
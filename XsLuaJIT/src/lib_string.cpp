@@ -7,6 +7,7 @@
 extern "C" {
 
 #include <ctype.h>
+#include <locale.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,6 +23,7 @@ extern "C" {
 
 #include "lxsext.h"
 #include "lxs_string.hpp"
+#include "lxs_skernel.h"
 
 
 /* macro to `unsign' a character */
@@ -70,16 +72,16 @@ static int str_sub(lua_State* L)
 static int str_reverse(lua_State *L)
 {
 #if LUAXS_STR_PERSISTENT_BUFFER
-    lxs_string* b = lxs_spb_get(L);
-
     size_t len;
     const char* str = luaL_checklstring(L, 1, &len);
 
-    while (--len)
+    lxs_string* b = lxs_spb_get(L);
+    lxs_sensure_space(L, b, len);
+    while (len--)
     {
         lxs_sappendc(L, b, str[len]);
     }
-    lxs_spushresult(L, b);
+    lxs_spb_pushresult(L, b);
 #else // LUAXS_STR_PERSISTENT_BUFFER
     size_t l;
     luaL_Buffer b;
@@ -96,14 +98,13 @@ static int str_reverse(lua_State *L)
 static int str_lower(lua_State *L)
 {
 #if LUAXS_STR_PERSISTENT_BUFFER
-    lxs_string* b = lxs_spb_get(L);
-
-    size_t l, i;
+    size_t l;
     const char *s = luaL_checklstring(L, 1, &l);
 
-    for (i = 0; i < l; ++i)
-        lxs_sappendc(L, b, tolower(uchar(s[i])));
-    lxs_spushresult(L, b);
+    lxs_string* b = lxs_spb_get(L);
+    lxs_sappend(L, b, s, l);
+    lxs_klower(lxs_sdata(b), l);
+    lxs_spb_pushresult(L, b);
 #else // LUAXS_STR_PERSISTENT_BUFFER
     size_t l;
     size_t i;
@@ -121,14 +122,13 @@ static int str_lower(lua_State *L)
 static int str_upper(lua_State *L)
 {
 #if LUAXS_STR_PERSISTENT_BUFFER
-    lxs_string* b = lxs_spb_get(L);
-
-    size_t l, i;
+    size_t l;
     const char *s = luaL_checklstring(L, 1, &l);
 
-    for (i = 0; i < l; ++i)
-        lxs_sappendc(L, b, toupper(uchar(s[i])));
-    lxs_spushresult(L, b);
+    lxs_string* b = lxs_spb_get(L);
+    lxs_sappend(L, b, s, l);
+    lxs_kupper(lxs_sdata(b), l);
+    lxs_spb_pushresult(L, b);
 #else // LUAXS_STR_PERSISTENT_BUFFER
     size_t l;
     size_t i;
@@ -154,7 +154,7 @@ static int str_rep(lua_State *L)
     {
         lxs_sappend(L, b, s, l);
     }
-    lxs_spushresult(L, b);
+    lxs_spb_pushresult(L, b);
 #else // LUAXS_STR_PERSISTENT_BUFFER
     luaL_Buffer b;
     luaL_buffinit(L, &b);
@@ -197,7 +197,7 @@ static int str_char(lua_State* L)
         luaL_argcheck(L, uchar(c) == c, i, "invalid value");
         lxs_sappendc(L, b, uchar(c));
     }
-    lxs_spushresult(L, b);
+    lxs_spb_pushresult(L, b);
 #else // LUAXS_STR_PERSISTENT_BUFFER
     luaL_Buffer b;
     luaL_buffinit(L, &b);
@@ -232,7 +232,7 @@ static int str_dump(lua_State *L)
     lxs_string* b = lxs_spb_get(L);
     if (lua_dump(L, writer, b) != 0)
         lxs_error(L, "unable to dump given function");
-    lxs_spushresult(L, b);
+    lxs_spb_pushresult(L, b);
 #else // LUAXS_STR_PERSISTENT_BUFFER
     luaL_Buffer b;
     luaL_checktype(L, 1, LUA_TFUNCTION);
@@ -531,28 +531,650 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
-static const char *lmemfind (const char *s1, size_t l1,
-                               const char *s2, size_t l2) {
-  if (l2 == 0) return s1;  /* empty strings are everywhere */
-  else if (l2 > l1) return NULL;  /* avoids a negative `l1' */
-  else {
-    const char *init;  /* to search for a `*s2' inside `s1' */
-    l2--;  /* 1st char will be checked by `memchr' */
-    l1 = l1-l2;  /* `s2' cannot be found after that */
-    while (l1 > 0 && (init = STATIC_CAST(const char *, memchr(s1, *s2, l1))) != NULL) {
-      init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
-        return init-1;
-      else {  /* correct `l1' and `s1' to try again */
-        l1 -= init-s1;
-        s1 = init;
+#if LUAXS_STR_PATTERN_CACHE || LUAXS_STR_FORMAT_CACHE
+/*
+** {======================================================
+** CACHES
+**
+** Compiled patterns and parsed format strings are cached per state in a
+** userdata holding up to `capacity' entries, keyed by the interned string
+** they were built from, least recently used first out. Entries are single
+** allocations starting with an lxs_scentry. The userdata's environment table
+** anchors the key strings so they cannot be collected (and their addresses
+** reused) while cached.
+** Evicting or flushing bumps the cache's generation; callers holding an entry
+** across calls into Lua fetch it again when that changes.
+** =======================================================
+*/
+
+typedef struct _lxs_scentry
+{
+    const char* key;  // interned key string
+    int         slot; // index of key in the cache's environment
+    size_t      size; // allocation size
+} lxs_scentry;
+
+typedef struct _lxs_scache
+{
+    size_t       count;
+    size_t       capacity;
+    size_t       gen;        // bumped when freeing
+    lxs_scentry* entries[1]; // most recently used first
+} lxs_scache;
+
+static void sc_flush(lua_State* const L, lxs_scache* cache)
+{
+    for (size_t i = 0; i < cache->count; ++i)
+        luaM_freemem(L, cache->entries[i], cache->entries[i]->size);
+    cache->count = 0;
+    ++cache->gen;
+}
+
+static int sc_gc(lua_State* const L)
+{
+    sc_flush(L, static_cast<lxs_scache*>(lua_touserdata(L, 1)));
+    return 0;
+}
+
+/// Pushes a new, empty cache and registers it as name.
+static void sc_new(lua_State* const L, size_t capacity, const char* name)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_scache* cache = static_cast<lxs_scache*>(
+        lua_newuserdata(L, sizeof(lxs_scache) + (capacity - 1) * sizeof(lxs_scentry*)));
+    cache->count    = 0;
+    cache->capacity = capacity;
+    cache->gen      = 0;
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, sc_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_createtable(L, static_cast<int>(capacity), 0);
+    lua_setfenv(L, -2);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, name);
+
+    lxs_assert_stack_end(L, 1);
+}
+
+/// Returns the entry for key, making it the most recently used, or NULL.
+static lxs_scentry* sc_find(lxs_scache* cache, const char* key)
+{
+    for (size_t i = 0; i < cache->count; ++i)
+    {
+        lxs_scentry* entry = cache->entries[i];
+        if (entry->key == key)
+        {
+            memmove(&cache->entries[1], &cache->entries[0], i * sizeof(entry));
+            cache->entries[0] = entry;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/// Adds entry (keyed by the string at kidx) to the cache at cidx, evicting the
+/// least recently used entry if the cache is full.
+static void sc_insert(lua_State* const L, int cidx, int kidx, lxs_scentry* entry)
+{
+    lxs_assert_stack_begin(L);
+
+    lxs_scache* cache = static_cast<lxs_scache*>(lua_touserdata(L, cidx));
+
+    if (cache->count < cache->capacity)
+        entry->slot = static_cast<int>(++cache->count);
+    else
+    {
+        lxs_scentry* lru = cache->entries[cache->capacity - 1];
+        entry->slot = lru->slot;
+        luaM_freemem(L, lru, lru->size);
+        ++cache->gen;
+    }
+    memmove(&cache->entries[1],
+            &cache->entries[0],
+            (cache->count - 1) * sizeof(entry));
+    cache->entries[0] = entry;
+
+    lua_getfenv(L, cidx);
+    lua_pushvalue(L, kidx);
+    lua_rawseti(L, -2, entry->slot);
+    lua_pop(L, 1);
+
+    lxs_assert_stack_end(L, 0);
+}
+
+/// Flushes the cache registered as name, if any.
+static void sc_reset(lua_State* const L, const char* name)
+{
+    lxs_assert_stack_begin(L);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, name);
+    if (lua_isuserdata(L, -1))
+    {
+        sc_flush(L, static_cast<lxs_scache*>(lua_touserdata(L, -1)));
+        lua_newtable(L);
+        lua_setfenv(L, -2);
+    }
+    lua_pop(L, 1);
+
+    lxs_assert_stack_end(L, 0);
+}
+
+/* }====================================================== */
+#endif // LUAXS_STR_PATTERN_CACHE || LUAXS_STR_FORMAT_CACHE
+
+
+
+#if LUAXS_STR_PATTERN_CACHE
+/*
+** {======================================================
+** COMPILED PATTERNS
+**
+** A pattern is compiled once into a sequence of items mirroring what match()
+** interprets; single character items carry their quantifier and, for
+** classes, a precomputed 256 bit membership map. Matches are only attempted
+** at positions starting with the pattern's literal prefix or first character
+** set (if it has one).
+** Compiled patterns live in a cache of LUAXS_STR_PATTERN_CACHE entries.
+**
+** Malformed patterns are not compiled and fall back to match(), which raises
+** the usual error once it reaches the offending item. Errors depending on
+** the subject (capture indices, too many captures) are raised by the compiled
+** matcher at the same point match() would.
+** Class maps depend on the locale's ctype tables; os.setlocale flushes the
+** cache (lxs_pmflush).
+** gsub, which calls back into Lua while holding a compiled pattern, fetches
+** it again when the cache's generation changes.
+** =======================================================
+*/
+
+#define LXS_PMCACHE  LUA_STRLIBNAME ".patterns"
+#define PM_MAXLEN    256  /* longer patterns are interpreted */
+
+enum
+{
+    PM_END,      // end of pattern
+    PM_CHAR,     // literal c
+    PM_ANY,      // .
+    PM_SET,      // %a, [...]
+    PM_OPEN,     // (
+    PM_POSITION, // ()
+    PM_CLOSE,    // )
+    PM_BALANCE,  // %b with c, c2
+    PM_FRONTIER, // %f[...]
+    PM_BACKREF,  // %1-%9 with c
+    PM_EOS       // trailing $
+};
+
+enum
+{
+    PM_ONE,
+    PM_OPT,      // ?
+    PM_STAR,     // *
+    PM_PLUS,     // +
+    PM_MIN       // -
+};
+
+typedef unsigned char lxs_pmset[32];
+
+typedef struct _lxs_pmitem
+{
+    unsigned char        op;
+    unsigned char        rep;
+    unsigned char        c;
+    unsigned char        c2;
+    const unsigned char* set; // PM_SET, PM_FRONTIER
+} lxs_pmitem;
+
+typedef struct _lxs_pmprog
+{
+    lxs_scentry       entry;   // keyed by the pattern string
+    bool              anchor;  // pattern starts with '^'
+    bool              hasfirst;
+    size_t            nprefix;
+    const char*       prefix;  // literal every match starts with
+    lxs_kset          first;   // characters every match starts with
+    const lxs_pmitem* items;   // terminated by PM_END
+} lxs_pmprog;
+
+
+static __inline bool pm_test(const unsigned char* set, int c) {
+  return ((set[c >> 3] >> (c & 7)) & 1) != 0;
+}
+
+
+static __inline bool pm_single(const lxs_pmitem* it, int c) {
+  switch (it->op) {
+    case PM_CHAR: return it->c == c;
+    case PM_ANY:  return true;
+    default:      return pm_test(it->set, c);
+  }
+}
+
+
+static const char *pm_match (MatchState *ms, const char *s,
+                             const lxs_pmitem *it);
+
+
+static const char *pm_max_expand (MatchState *ms, const char *s,
+                                  const lxs_pmitem *it) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  const lxs_pmitem *next = it+1;
+  if (it->op == PM_ANY)
+    i = ms->src_end - s;
+  else
+    while ((s+i)<ms->src_end && pm_single(it, uchar(*(s+i))))
+      i++;
+  if (next->op == PM_CHAR && next->rep == PM_ONE) {
+    /* only try repetitions followed by the literal */
+    if ((s+i) == ms->src_end) i--;
+    for (; i>=0; i--) {
+      if (uchar(*(s+i)) == next->c) {
+        const char *res = pm_match(ms, (s+i+1), next+1);
+        if (res) return res;
+      }
+    }
+    return NULL;
+  }
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    const char *res = pm_match(ms, (s+i), next);
+    if (res) return res;
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+
+static const char *pm_min_expand (MatchState *ms, const char *s,
+                                  const lxs_pmitem *it) {
+  for (;;) {
+    const char *res = pm_match(ms, s, it+1);
+    if (res != NULL)
+      return res;
+    else if (s<ms->src_end && pm_single(it, uchar(*s)))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *pm_start_capture (MatchState *ms, const char *s,
+                                     const lxs_pmitem *it, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) lxs_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=pm_match(ms, s, it)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *pm_end_capture (MatchState *ms, const char *s,
+                                   const lxs_pmitem *it) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = pm_match(ms, s, it)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+static const char *pm_match (MatchState *ms, const char *s,
+                             const lxs_pmitem *it) {
+  for (;;) {
+    switch (it->op) {
+      case PM_END:
+        return s;  /* match succeeded */
+      case PM_OPEN:
+        return pm_start_capture(ms, s, it+1, CAP_UNFINISHED);
+      case PM_POSITION:
+        return pm_start_capture(ms, s, it+1, CAP_POSITION);
+      case PM_CLOSE:
+        return pm_end_capture(ms, s, it+1);
+      case PM_BALANCE: {
+        int cont = 1;
+        if (s >= ms->src_end || uchar(*s) != it->c) return NULL;
+        while (++s < ms->src_end) {
+          if (uchar(*s) == it->c2) {
+            if (--cont == 0) break;
+          }
+          else if (uchar(*s) == it->c) cont++;
+        }
+        if (cont != 0) return NULL;  /* string ends out of balance */
+        s++; it++;
+        break;
+      }
+      case PM_FRONTIER: {
+        int previous = (s == ms->src_init) ? '\0' : uchar(*(s-1));
+        int current = (s < ms->src_end) ? uchar(*s) : '\0';
+        if (pm_test(it->set, previous) || !pm_test(it->set, current))
+          return NULL;
+        it++;
+        break;
+      }
+      case PM_BACKREF:
+        s = match_capture(ms, s, it->c);
+        if (s == NULL) return NULL;
+        it++;
+        break;
+      case PM_EOS:
+        return (s == ms->src_end) ? s : NULL;  /* check end of string */
+      default: {  /* single char item */
+        bool m = s<ms->src_end && pm_single(it, uchar(*s));
+        switch (it->rep) {
+          case PM_OPT: {
+            const char *res;
+            if (m && ((res=pm_match(ms, s+1, it+1)) != NULL))
+              return res;
+            it++;
+            break;
+          }
+          case PM_STAR:
+            return pm_max_expand(ms, s, it);
+          case PM_PLUS:
+            return (m ? pm_max_expand(ms, s+1, it) : NULL);
+          case PM_MIN:
+            return pm_min_expand(ms, s, it);
+          default:
+            if (!m) return NULL;
+            s++; it++;
+        }
       }
     }
-    return NULL;  /* not found */
   }
 }
 
 
+/// Returns the first position in [s, src_end] a match may start at or NULL
+/// if there is none.
+static const char* pm_skip(const MatchState* ms,
+                           const lxs_pmprog* prog,
+                           const char* s)
+{
+    const size_t len = ms->src_end - s;
+
+    if (prog->nprefix > 1)
+        return lxs_kfind(s, len, prog->prefix, prog->nprefix);
+    if (prog->nprefix == 1)
+        return lxs_kfindc(s, len, prog->prefix[0]);
+    if (prog->hasfirst)
+        return lxs_kfindset(s, len, &prog->first);
+    return s;
+}
+
+/// Searches for the first match at or after *init (only at *init if the
+/// pattern is anchored). Returns its end and updates *init to its start or
+/// returns NULL.
+static const char* pm_exec(MatchState* ms,
+                           const lxs_pmprog* prog,
+                           const char** init)
+{
+    const char* s = *init;
+    do
+    {
+        if (!prog->anchor && (s = pm_skip(ms, prog, s)) == NULL)
+            return NULL;
+
+        ms->level = 0;
+        const char* e = pm_match(ms, s, prog->items);
+        if (e)
+        {
+            *init = s;
+            return e;
+        }
+    } while (s++ < ms->src_end && !prog->anchor);
+
+    return NULL;
+}
+
+/// Mirrors classend() but returns NULL for malformed classes.
+static const char* pm_classend(const char* p)
+{
+    switch (*p++)
+    {
+    case L_ESC:
+        return (*p != '\0') ? p + 1 : NULL;
+    case '[':
+        if (*p == '^')
+            ++p;
+        do
+        {
+            if (*p == '\0')
+                return NULL;
+            if (*(p++) == L_ESC && *p != '\0')
+                ++p;
+        } while (*p != ']');
+        return p + 1;
+    default:
+        return p;
+    }
+}
+
+static void pm_fillset(lxs_pmset set, const char* p, const char* ep)
+{
+    memset(set, 0, sizeof(lxs_pmset));
+    for (int c = 0; c < 256; ++c)
+    {
+        bool m = (*p == '[')
+               ? matchbracketclass(c, p, ep - 1) != 0
+               : match_class(c, uchar(*(p + 1))) != 0;
+        if (m)
+            set[c >> 3] |= static_cast<unsigned char>(1u << (c & 7));
+    }
+}
+
+/// Compiles pat or returns NULL if it is malformed.
+static lxs_pmprog* pm_compile(lua_State* const L, const char* pat)
+{
+    lxs_pmitem items[PM_MAXLEN + 1];
+    lxs_pmset  sets[PM_MAXLEN / 2];
+    char       prefix[PM_MAXLEN];
+    size_t     nitems  = 0;
+    size_t     nsets   = 0;
+    size_t     nprefix = 0;
+
+    const char* p      = pat;
+    const bool  anchor = (*p == '^') ? (++p, true) : false;
+
+    while (*p)
+    {
+        lxs_pmitem* it = &items[nitems++];
+        it->rep = PM_ONE;
+        it->c   = 0;
+        it->c2  = 0;
+        it->set = NULL;
+
+        switch (*p)
+        {
+        case '(':
+            it->op = (*(p + 1) == ')') ? PM_POSITION : PM_OPEN;
+            p += (it->op == PM_POSITION) ? 2 : 1;
+            continue;
+        case ')':
+            it->op = PM_CLOSE;
+            ++p;
+            continue;
+        case L_ESC:
+            if (*(p + 1) == 'b')
+            {
+                if (*(p + 2) == '\0' || *(p + 3) == '\0')
+                    return NULL;
+                it->op = PM_BALANCE;
+                it->c  = uchar(*(p + 2));
+                it->c2 = uchar(*(p + 3));
+                p += 4;
+                continue;
+            }
+            if (*(p + 1) == 'f')
+            {
+                p += 2;
+                const char* ep = (*p == '[') ? pm_classend(p) : NULL;
+                if (!ep)
+                    return NULL;
+                it->op  = PM_FRONTIER;
+                it->set = sets[nsets];
+                pm_fillset(sets[nsets++], p, ep);
+                p = ep;
+                continue;
+            }
+            if (isdigit(uchar(*(p + 1))))
+            {
+                it->op = PM_BACKREF;
+                it->c  = uchar(*(p + 1));
+                p += 2;
+                continue;
+            }
+            break;
+        case '$':
+            if (*(p + 1) == '\0')
+            {
+                it->op = PM_EOS;
+                ++p;
+                continue;
+            }
+            break;
+        }
+
+        // single char item
+        const char* ep = pm_classend(p);
+        if (!ep)
+            return NULL;
+
+        if (*p == '.')
+            it->op = PM_ANY;
+        else if (*p == '[' ||
+                 (*p == L_ESC && strchr("acdlpsuwxz", tolower(uchar(*(p + 1))))))
+        {
+            it->op  = PM_SET;
+            it->set = sets[nsets];
+            pm_fillset(sets[nsets++], p, ep);
+        }
+        else
+        {
+            it->op = PM_CHAR;
+            it->c  = uchar(*p == L_ESC ? *(p + 1) : *p);
+        }
+
+        switch (*ep)
+        {
+        case '?': it->rep = PM_OPT;  ++ep; break;
+        case '*': it->rep = PM_STAR; ++ep; break;
+        case '+': it->rep = PM_PLUS; ++ep; break;
+        case '-': it->rep = PM_MIN;  ++ep; break;
+        }
+        p = ep;
+    }
+    items[nitems].op = PM_END;
+
+    // Skipping positions is only safe if nothing before the first consuming
+    // item could raise an error.
+    bool     hasfirst = false;
+    lxs_kset first;
+
+    const lxs_pmitem* it    = items;
+    int               nopen = 0;
+    for (; it->op == PM_OPEN || it->op == PM_POSITION; ++it)
+        ++nopen;
+
+    if (!anchor && nopen < LUA_MAXCAPTURES)
+    {
+        for (; it->op == PM_CHAR && it->rep == PM_ONE; ++it)
+            prefix[nprefix++] = static_cast<char>(it->c);
+
+        if (it->op == PM_CHAR && it->rep == PM_PLUS)
+            prefix[nprefix++] = static_cast<char>(it->c);
+        else if (nprefix == 0 && it->op == PM_BALANCE)
+            prefix[nprefix++] = static_cast<char>(it->c);
+        else if (nprefix == 0 && it->op == PM_SET &&
+                 (it->rep == PM_ONE || it->rep == PM_PLUS))
+        {
+            char   chars[256];
+            size_t count = 0;
+            for (int c = 0; c < 256; ++c)
+            {
+                if (pm_test(it->set, c))
+                    chars[count++] = static_cast<char>(c);
+            }
+            if (count < 256)
+            {
+                lxs_kset_init(&first, chars, count);
+                hasfirst = true;
+            }
+        }
+    }
+
+    const size_t size = sizeof(lxs_pmprog)
+                      + (nitems + 1) * sizeof(lxs_pmitem)
+                      + nsets * sizeof(lxs_pmset)
+                      + nprefix;
+
+    lxs_pmprog* prog  = static_cast<lxs_pmprog*>(luaM_malloc(L, size));
+    lxs_pmitem* pitem = reinterpret_cast<lxs_pmitem*>(prog + 1);
+    lxs_pmset*  pset  = reinterpret_cast<lxs_pmset*>(pitem + nitems + 1);
+    char*       ppre  = reinterpret_cast<char*>(pset + nsets);
+
+    memcpy(pitem, items, (nitems + 1) * sizeof(lxs_pmitem));
+    for (size_t i = 0; i < nitems; ++i)
+    {
+        if (pitem[i].set)
+            pitem[i].set = pset[(pitem[i].set - sets[0]) / sizeof(lxs_pmset)];
+    }
+    memcpy(pset, sets, nsets * sizeof(lxs_pmset));
+    memcpy(ppre, prefix, nprefix);
+
+    prog->entry.key  = pat;
+    prog->entry.slot = 0;
+    prog->entry.size = size;
+    prog->anchor   = anchor;
+    prog->hasfirst = hasfirst;
+    prog->nprefix  = nprefix;
+    prog->prefix   = ppre;
+    prog->items    = pitem;
+    if (hasfirst)
+        prog->first = first;
+
+    return prog;
+}
+
+/// Returns the compiled pattern at pidx, compiling and caching it on a miss,
+/// or NULL if it has to be interpreted.
+static const lxs_pmprog* pm_get(lua_State* const L, int cidx, int pidx)
+{
+    lxs_scache* cache = static_cast<lxs_scache*>(lua_touserdata(L, cidx));
+
+    size_t      len;
+    const char* key = lua_tolstring(L, pidx, &len);
+
+    lxs_scentry* entry = sc_find(cache, key);
+    if (entry)
+        return reinterpret_cast<const lxs_pmprog*>(entry);
+
+    if (len > PM_MAXLEN)
+        return NULL;
+
+    lxs_pmprog* prog = pm_compile(L, key);
+    if (!prog)
+        return NULL;
+
+    sc_insert(L, cidx, pidx, &prog->entry);
+    return prog;
+}
+
+void lxs_pmflush(lua_State* const L)
+{
+    sc_reset(L, LXS_PMCACHE);
+}
+
+/* }====================================================== */
+#endif // LUAXS_STR_PATTERN_CACHE
+
+
 static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   if (i >= ms->level) {
@@ -589,14 +1211,19 @@ static int str_find_aux (lua_State *L, int find) {
   ptrdiff_t init = posrelat(luaL_optinteger(L, 3, 1), l1) - 1;
   if (init < 0) init = 0;
   else if (STATIC_CAST(size_t, init) > l1) init = STATIC_CAST(ptrdiff_t, l1);
-  if (find && (lua_toboolean(L, 4) ||  /* explicit request? */
-      strpbrk(p, SPECIALS) == NULL)) {  /* or no special characters? */
+  if ((find && lua_toboolean(L, 4)) ||  /* explicit request? */
+      (strpbrk(p, SPECIALS) == NULL &&  /* or no special characters? */
+       (find || strlen(p) == l2))) {  /* (match stops at a `\0') */
     /* do a plain search */
-    const char *s2 = lmemfind(s+init, l1-init, p, l2);
+    const char *s2 = lxs_kfind(s+init, l1-init, p, l2);
     if (s2) {
-      lua_pushinteger(L, s2-s+1);
-      lua_pushinteger(L, s2-s+l2);
-      return 2;
+      if (find) {
+        lua_pushinteger(L, s2-s+1);
+        lua_pushinteger(L, s2-s+l2);
+        return 2;
+      }
+      lua_pushlstring(L, s2, l2);  /* whole match */
+      return 1;
     }
   }
   else {
@@ -606,6 +1233,22 @@ static int str_find_aux (lua_State *L, int find) {
     ms.L = L;
     ms.src_init = s;
     ms.src_end = s+l1;
+#if LUAXS_STR_PATTERN_CACHE
+    const lxs_pmprog *prog = pm_get(L, lua_upvalueindex(1), 2);
+    if (prog) {
+      const char *res = pm_exec(&ms, prog, &s1);
+      if (res != NULL) {
+        if (find) {
+          lua_pushinteger(L, s1-s+1);  /* start */
+          lua_pushinteger(L, res-s);   /* end */
+          return push_captures(&ms, NULL, 0) + 2;
+        }
+        else
+          return push_captures(&ms, s1, res);
+      }
+    }
+    else
+#endif
     do {
       const char *res;
       ms.level = 0;
@@ -644,6 +1287,22 @@ static int gmatch_aux (lua_State *L) {
   ms.L = L;
   ms.src_init = s;
   ms.src_end = s+ls;
+#if LUAXS_STR_PATTERN_CACHE
+  /* gmatch takes a leading `^' literally; leave those to match() */
+  const lxs_pmprog *prog = pm_get(L, lua_upvalueindex(4), lua_upvalueindex(2));
+  if (prog && !prog->anchor) {
+    const char *e;
+    src = s + (size_t)lua_tointeger(L, lua_upvalueindex(3));
+    if (src <= ms.src_end && (e = pm_exec(&ms, prog, &src)) != NULL) {
+      lua_Integer newstart = e-s;
+      if (e == src) newstart++;  /* empty match? go at least one position */
+      lua_pushinteger(L, newstart);
+      lua_replace(L, lua_upvalueindex(3));
+      return push_captures(&ms, src, e);
+    }
+    return 0;  /* not found */
+  }
+#endif
   for (src = s + (size_t)lua_tointeger(L, lua_upvalueindex(3));
        src <= ms.src_end;
        src++) {
@@ -666,7 +1325,12 @@ static int gmatch (lua_State *L) {
   luaL_checkstring(L, 2);
   lua_settop(L, 2);
   lua_pushinteger(L, 0);
+#if LUAXS_STR_PATTERN_CACHE
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_pushcclosure(L, gmatch_aux, 4);
+#else
   lua_pushcclosure(L, gmatch_aux, 3);
+#endif
   return 1;
 }
 
@@ -677,30 +1341,31 @@ static int gfind_nodef (lua_State *L) {
 }
 
 
-static void add_s (MatchState *ms, luaL_Buffer *b, const char *s,
-                                                   const char *e) {
+static void add_s (MatchState *ms, xbuf_ptr_t b, const char *s,
+                                                 const char *e) {
+  lua_State *L = ms->L;
   size_t l, i;
-  const char *news = lua_tolstring(ms->L, 3, &l);
+  const char *news = lua_tolstring(L, 3, &l);
   for (i = 0; i < l; i++) {
     if (news[i] != L_ESC)
-      luaL_addchar(b, news[i]);
+      xbuf_addchar(L, xbuf_deref(b), news[i]);
     else {
       i++;  /* skip ESC */
       if (!isdigit(uchar(news[i])))
-        luaL_addchar(b, news[i]);
+        xbuf_addchar(L, xbuf_deref(b), news[i]);
       else if (news[i] == '0')
-          luaL_addlstring(b, s, e - s);
+          xbuf_addlstring(L, xbuf_deref(b), s, e - s);
       else {
         push_onecapture(ms, news[i] - '1', s, e);
-        luaL_addvalue(b);  /* add capture to accumulated result */
+        xbuf_addvalue(L, xbuf_deref(b));  /* add capture to accumulated result */
       }
     }
   }
 }
 
 
-static void add_value (MatchState *ms, luaL_Buffer *b, const char *s,
-                                                       const char *e) {
+static void add_value (MatchState *ms, xbuf_ptr_t b, const char *s,
+                                                     const char *e) {
   lua_State *L = ms->L;
   switch (lua_type(L, 3)) {
     case LUA_TNUMBER:
@@ -727,7 +1392,7 @@ static void add_value (MatchState *ms, luaL_Buffer *b, const char *s,
   }
   else if (!lua_isstring(L, -1))
     lxs_error(L, "invalid replacement value (a %s)", luaL_typename(L, -1));
-  luaL_addvalue(b);  /* add result to accumulator */
+  xbuf_addvalue(L, xbuf_deref(b));  /* add result to accumulator */
 }
 
 
@@ -740,31 +1405,56 @@ static int str_gsub (lua_State *L) {
   int anchor = (*p == '^') ? (p++, 1) : 0;
   int n = 0;
   MatchState ms;
-  luaL_Buffer b;
+  xbuf_decl(b);
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
-  luaL_buffinit(L, &b);
+#if LUAXS_STR_PATTERN_CACHE
+  const lxs_scache *cache =
+    static_cast<const lxs_scache *>(lua_touserdata(L, lua_upvalueindex(1)));
+  const lxs_pmprog *prog = pm_get(L, lua_upvalueindex(1), 2);
+  size_t gen = cache->gen;
+#endif
+  xbuf_init(L, b);
   ms.L = L;
   ms.src_init = src;
   ms.src_end = src+srcl;
   while (n < max_s) {
     const char *e;
-    ms.level = 0;
-    e = match(&ms, src, p);
+#if LUAXS_STR_PATTERN_CACHE
+    if (prog) {
+      if (gen != cache->gen) {  /* evicted by a replacement or finalizer? */
+        prog = pm_get(L, lua_upvalueindex(1), 2);
+        gen = cache->gen;
+      }
+      if (!anchor) {  /* copy what cannot start a match in one go */
+        const char *next = pm_skip(&ms, prog, src);
+        if (next == NULL) break;
+        xbuf_addlstring(L, b, src, next-src);
+        src = next;
+      }
+      ms.level = 0;
+      e = pm_match(&ms, src, prog->items);
+    }
+    else
+#endif
+    {
+      ms.level = 0;
+      e = match(&ms, src, p);
+    }
     if (e) {
       n++;
-      add_value(&ms, &b, src, e);
+      add_value(&ms, xbuf_ref(b), src, e);
     }
     if (e && e>src) /* non empty match? */
       src = e;  /* skip it */
     else if (src < ms.src_end)
-      luaL_addchar(&b, *src++);
+      xbuf_addchar(L, b, *src++);
     else break;
     if (anchor) break;
   }
-  luaL_addlstring(&b, src, ms.src_end-src);
-  luaL_pushresult(&b);
+  xbuf_addlstring(L, b, src, ms.src_end-src);
+  xbuf_pushresult(L, b);
   lua_pushinteger(L, n);  /* number of substitutions */
   return 2;
 }
@@ -880,6 +1570,416 @@ static void addintlen (char *form) {
 }
 
 
+#if LUAXS_STR_FORMAT_CACHE
+/*
+** {======================================================
+** PARSED FORMATS
+**
+** A format string is parsed once into items, each a literal run followed by
+** at most one conversion with its flags, width, precision and the sprintf
+** format str_format would build for it. Parsed formats live in a cache of
+** LUAXS_STR_FORMAT_CACHE entries.
+** Integer and plain string conversions, and %f/%g as far as lxs_sfmt_fixed
+** and lxs_sfmt_general can produce them, are formatted directly; everything
+** else is handed to sprintf as before. The decimal point is checked against
+** the current locale for each call.
+** Malformed formats are not cached and fall back to the loop in str_format,
+** which raises the usual errors.
+** =======================================================
+*/
+
+#define LXS_SFCACHE  LUA_STRLIBNAME ".formats"
+#define SF_MAXLEN    1024  /* longer formats are parsed on every call */
+
+enum
+{
+    SF_LEFT  = 1 << 0, // -
+    SF_PLUS  = 1 << 1, // +
+    SF_SPACE = 1 << 2, // ' '
+    SF_ALT   = 1 << 3, // #
+    SF_ZERO  = 1 << 4  // 0
+};
+
+typedef struct _lxs_sfitem
+{
+    const char* lit;              // literal text preceding the conversion
+    size_t      litlen;
+    char        conv;             // conversion letter, 0 if none
+    unsigned    flags;            // SF_*, in the order of FLAGS
+    int         width;
+    int         prec;             // -1 if not given
+    char        form[MAX_FORMAT]; // `%...', with LUA_INTFRMLEN for integers
+} lxs_sfitem;
+
+typedef struct _lxs_sfmt
+{
+    lxs_scentry entry;            // keyed by the format string
+    size_t      nitems;
+    lxs_sfitem  items[1];
+} lxs_sfmt;
+
+/// Parses fmt or returns NULL if it is malformed.
+static lxs_sfmt* sf_compile(lua_State* const L, const char* fmt, size_t len)
+{
+    const char* const end = fmt + len;
+
+    size_t nitems = 1; // every item but the last one ends with an L_ESC
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (fmt[i] == L_ESC)
+            ++nitems;
+    }
+
+    const size_t size = sizeof(lxs_sfmt) + (nitems - 1) * sizeof(lxs_sfitem);
+    lxs_sfmt*    sf   = static_cast<lxs_sfmt*>(luaM_malloc(L, size));
+    lxs_sfitem*  item = sf->items;
+
+    const char* lit = fmt;
+    const char* p   = fmt;
+    while (p < end)
+    {
+        if (*p != L_ESC)
+        {
+            ++p;
+            continue;
+        }
+
+        item->lit    = lit;
+        item->litlen = static_cast<size_t>(p - lit);
+        item->conv   = '\0';
+
+        if (p[1] == L_ESC) // %% keeps one L_ESC as part of the literal
+        {
+            ++item->litlen;
+            ++item;
+            p  += 2;
+            lit = p;
+            continue;
+        }
+
+        // same grammar as scanformat; the key is '\0' terminated
+        const char* spec  = ++p;
+        unsigned    flags = 0;
+        for (const char* f; *p != '\0' && (f = strchr(FLAGS, *p)) != NULL; ++p)
+            flags |= 1u << (f - FLAGS);
+
+        int width = 0;
+        int prec  = -1;
+        if (static_cast<size_t>(p - spec) < sizeof(FLAGS))
+        {
+            for (int i = 0; i < 2 && isdigit(uchar(*p)); ++i)
+                width = width * 10 + (*p++ - '0');
+            if (*p == '.')
+            {
+                ++p;
+                prec = 0;
+                for (int i = 0; i < 2 && isdigit(uchar(*p)); ++i)
+                    prec = prec * 10 + (*p++ - '0');
+            }
+        }
+        else
+            p = end; // repeated flags
+
+        if (*p == '\0' || !strchr("cdiouxXeEfgGqs", *p))
+        {
+            luaM_freemem(L, sf, size);
+            return NULL;
+        }
+
+        char* form = item->form;
+        *form++ = '%';
+        memcpy(form, spec, p - spec);
+        form += p - spec;
+        if (strchr("diouxX", *p))
+        {
+            memcpy(form, LUA_INTFRMLEN, sizeof(LUA_INTFRMLEN) - 1);
+            form += sizeof(LUA_INTFRMLEN) - 1;
+        }
+        *form++ = *p;
+        *form   = '\0';
+
+        item->conv  = *p;
+        item->flags = flags;
+        item->width = width;
+        item->prec  = prec;
+        ++item;
+        lit = ++p;
+    }
+
+    if (lit < end)
+    {
+        item->lit    = lit;
+        item->litlen = static_cast<size_t>(end - lit);
+        item->conv   = '\0';
+        ++item;
+    }
+
+    sf->entry.key  = fmt;
+    sf->entry.slot = 0;
+    sf->entry.size = size;
+    sf->nitems     = static_cast<size_t>(item - sf->items);
+
+    return sf;
+}
+
+/// Returns the parsed format at fidx, parsing and caching it on a miss,
+/// or NULL if it has to be interpreted.
+static const lxs_sfmt* sf_get(lua_State* const L, int cidx, int fidx)
+{
+    lxs_scache* cache = static_cast<lxs_scache*>(lua_touserdata(L, cidx));
+
+    size_t      len;
+    const char* key = lua_tolstring(L, fidx, &len);
+
+    lxs_scentry* entry = sc_find(cache, key);
+    if (entry)
+        return reinterpret_cast<const lxs_sfmt*>(entry);
+
+    if (len > SF_MAXLEN)
+        return NULL;
+
+    lxs_sfmt* sf = sf_compile(L, key, len);
+    if (!sf)
+        return NULL;
+
+    sc_insert(L, cidx, fidx, &sf->entry);
+    return sf;
+}
+
+/// Returns true if the current locale's decimal point is '.'; looked up once
+/// per call (*point < 0 until then).
+static bool sf_point(int* point)
+{
+    if (*point < 0)
+    {
+        const char* dp = localeconv()->decimal_point;
+        *point = (dp[0] == '.' && dp[1] == '\0') ? 1 : 0;
+    }
+    return *point != 0;
+}
+
+/// Writes the digits of v in conv's (u, o, x, X) radix; returns their count.
+static size_t sf_digits(char* buf, uint64_t v, char conv)
+{
+    if (conv == 'u')
+        return lxs_sfmt_uint(buf, v);
+
+    const unsigned shift = (conv == 'o') ? 3u : 4u;
+    const char*    xdigits = (conv == 'X') ? "0123456789ABCDEF"
+                                           : "0123456789abcdef";
+    char  tmp[24];
+    char* it = tmp + sizeof(tmp);
+    do
+    {
+        *--it = xdigits[v & ((1u << shift) - 1u)];
+        v >>= shift;
+    } while (v != 0u);
+
+    const size_t n = tmp + sizeof(tmp) - it;
+    memcpy(buf, it, n);
+    return n;
+}
+
+/// Writes sign (unless '\0') and s[0, len) to buff, padded to item's width
+/// the way printf does; returns the length written.
+static size_t sf_pad(char* buff,
+                     const lxs_sfitem* item,
+                     char sign,
+                     const char* s,
+                     size_t len)
+{
+    const size_t n   = len + (sign ? 1u : 0u);
+    const size_t pad = (static_cast<size_t>(item->width) > n)
+                     ? static_cast<size_t>(item->width) - n
+                     : 0u;
+    const bool   left = (item->flags & SF_LEFT) != 0;
+    const bool   zero = !left && (item->flags & SF_ZERO) != 0;
+
+    char* out = buff;
+    if (!left && !zero)
+    {
+        memset(out, ' ', pad);
+        out += pad;
+    }
+    if (sign)
+        *out++ = sign;
+    if (zero)
+    {
+        memset(out, '0', pad);
+        out += pad;
+    }
+    memcpy(out, s, len);
+    out += len;
+    if (left)
+    {
+        memset(out, ' ', pad);
+        out += pad;
+    }
+    return static_cast<size_t>(out - buff);
+}
+
+static char sf_sign(const lxs_sfitem* item, bool neg)
+{
+    if (neg)
+        return '-';
+    if (item->flags & SF_PLUS)
+        return '+';
+    if (item->flags & SF_SPACE)
+        return ' ';
+    return '\0';
+}
+
+/// Appends item's conversion of argument arg to b.
+static void sf_item(lua_State* const L,
+                    xbuf_ptr_t b,
+                    const lxs_sfitem* item,
+                    int arg,
+                    int* point)
+{
+    char   buff[MAX_ITEM];  /* to store the formatted item */
+    char   digits[40];
+    size_t n;
+
+    switch (item->conv)
+    {
+        case 'c': {
+            const int c = STATIC_CAST(int, luaL_checknumber(L, arg));
+            if (item->flags != 0 || item->width != 0 || item->prec >= 0)
+            {
+                sprintf(buff, item->form, c);
+                n = strlen(buff);
+                break;
+            }
+            if (uchar(c) != 0)
+                xbuf_addchar(L, xbuf_deref(b), STATIC_CAST(char, c));
+            return;
+        }
+        case 'd':  case 'i': {
+            const LUA_INTFRM_T v = STATIC_CAST(LUA_INTFRM_T, luaL_checknumber(L, arg));
+            if (item->prec >= 0 || (item->flags & SF_ALT))
+            {
+                sprintf(buff, item->form, v);
+                n = strlen(buff);
+                break;
+            }
+            const uint64_t u = (v < 0) ? 0u - STATIC_CAST(uint64_t, v)
+                                       : STATIC_CAST(uint64_t, v);
+            n = sf_pad(buff, item, sf_sign(item, v < 0), digits,
+                       lxs_sfmt_uint(digits, u));
+            break;
+        }
+        case 'o':  case 'u':  case 'x':  case 'X': {
+            const unsigned LUA_INTFRM_T v =
+                STATIC_CAST(unsigned LUA_INTFRM_T, luaL_checknumber(L, arg));
+            if (item->prec >= 0 || (item->flags & ~(SF_LEFT | SF_ZERO)))
+            {
+                sprintf(buff, item->form, v);
+                n = strlen(buff);
+                break;
+            }
+            n = sf_pad(buff, item, '\0', digits,
+                       sf_digits(digits, STATIC_CAST(uint64_t, v), item->conv));
+            break;
+        }
+        case 'f':  case 'g': {
+            const double x    = STATIC_CAST(double, luaL_checknumber(L, arg));
+            const int    prec = (item->prec < 0) ? 6 : item->prec;
+            int          len  = -1;
+            if (!(item->flags & SF_ALT) && sf_point(point))
+            {
+                len = (item->conv == 'f') ? lxs_sfmt_fixed(digits, x, prec)
+                                          : lxs_sfmt_general(digits, x, prec);
+            }
+            if (len < 0)
+            {
+                sprintf(buff, item->form, x);
+                n = strlen(buff);
+            }
+            else if (digits[0] == '-')
+                n = sf_pad(buff, item, '-', digits + 1, len - 1);
+            else
+                n = sf_pad(buff, item, sf_sign(item, false), digits, len);
+            break;
+        }
+        case 'e':  case 'E':  case 'G': {
+            sprintf(buff, item->form, STATIC_CAST(double, luaL_checknumber(L, arg)));
+            n = strlen(buff);
+            break;
+        }
+        case 'q': {
+            addquoted(L, b, arg);
+            return;
+        }
+        default: { /* 's' */
+            size_t l;
+            const char *s = luaL_checklstring(L, arg, &l);
+            if (item->prec < 0 && l >= 100)
+            {
+                /* no precision and string is too long to be formatted;
+                keep original string */
+                lua_pushvalue(L, arg);
+                xbuf_addvalue(L, xbuf_deref(b));
+                return;
+            }
+            if (item->flags & ~SF_LEFT)
+            {
+                sprintf(buff, item->form, s);
+                n = strlen(buff);
+                break;
+            }
+            /* %s stops at an embedded '\0' */
+            size_t len = (item->prec >= 0 && l > static_cast<size_t>(item->prec))
+                       ? static_cast<size_t>(item->prec)
+                       : l;
+            const char* z = static_cast<const char*>(memchr(s, '\0', len));
+            if (z)
+                len = static_cast<size_t>(z - s);
+            n = sf_pad(buff, item, '\0', s, len);
+            break;
+        }
+    }
+
+    xbuf_addlstring(L, xbuf_deref(b), buff, n);
+}
+
+static int sf_format(lua_State* const L, const lxs_sfmt* fmt)
+{
+    const lxs_scache* cache =
+        static_cast<const lxs_scache*>(lua_touserdata(L, lua_upvalueindex(1)));
+    size_t gen   = cache->gen;
+    int    top   = lua_gettop(L);
+    int    arg   = 1;
+    int    point = -1;
+
+    xbuf_decl(b);
+    xbuf_init(L, b);
+
+    for (size_t i = 0; i < fmt->nitems; ++i)
+    {
+        if (gen != cache->gen) // evicted by a finalizer?
+        {
+            fmt = sf_get(L, lua_upvalueindex(1), 1);
+            gen = cache->gen;
+        }
+
+        const lxs_sfitem* item = &fmt->items[i];
+        xbuf_addlstring(L, b, item->lit, item->litlen);
+        if (item->conv)
+        {
+            if (++arg > top)
+                luaL_argerror(L, arg, "no value");
+            sf_item(L, xbuf_ref(b), item, arg, &point);
+        }
+    }
+
+    xbuf_pushresult(L, b);
+    return 1;
+}
+
+/* }====================================================== */
+#endif // LUAXS_STR_FORMAT_CACHE
+
+
 static int str_format (lua_State *L)
 {
     int top = lua_gettop(L);
@@ -888,6 +1988,12 @@ static int str_format (lua_State *L)
     const char *strfrmt = luaL_checklstring(L, arg, &sfl);
     const char *strfrmt_end = strfrmt+sfl;
 
+#if LUAXS_STR_FORMAT_CACHE
+    const lxs_sfmt *fmt = sf_get(L, lua_upvalueindex(1), 1);
+    if (fmt)
+        return sf_format(L, fmt);
+#endif
+
     xbuf_decl(b);
     xbuf_init(L, b);
 
@@ -926,12 +2032,8 @@ static int str_format (lua_State *L)
                     sprintf(buff, form, STATIC_CAST(double, luaL_checknumber(L, arg)));
                     break;
                 }
-                case 'end': {
-#if LUAXS_STR_PERSISTENT_BUFFER
-                    addquoted(L, b, arg);
-#else
-                    addquoted(L, &b, arg);
-#endif
+                case 'q': {
+                    addquoted(L, xbuf_ref(b), arg);
                     continue;  /* skip the 'addsize' at the end */
                 }
                 case 's': {
@@ -989,19 +2091,15 @@ static int libE_trim(lua_State* const L)
 {
     lxs_assert_stack_begin(L);
 
-    const char* front;
-    const char* end;
     size_t      len;
+    const char* front = luaL_checklstring(L, 1, &len);
+    const size_t lead = lxs_klspace(front, len);
 
-    front = luaL_checklstring(L, 1, &len);
-    end   = &front[len - 1];
-
-    for (; len && isspace(*front); --len, ++front)
-    { /* blank */ }
-    for (; len && isspace(*end); --len, --end)
-    { /* blank */ }
+    front += lead;
+    len   -= lead;
+    len   -= lxs_krspace(front, len);
 
-    lua_pushlstring(L, front, STATIC_CAST(size_t, end - front + 1));
+    lua_pushlstring(L, front, len);
 
     lxs_assert_stack_end(L, 1);
     return 1;
@@ -1026,13 +2124,10 @@ static int libE_ltrim(lua_State* const L)
     lxs_assert_stack_begin(L);
 
     size_t len;
-    const char* front = luaL_checklstring(L, 1, &len);
-    const char* end   = &front[len - 1];
-
-    for (; len && isspace(*front); --len, ++front)
-    { /* blank */ }
+    const char*  front = luaL_checklstring(L, 1, &len);
+    const size_t lead  = lxs_klspace(front, len);
 
-    lua_pushlstring(L, front, STATIC_CAST(size_t, end - front + 1));
+    lua_pushlstring(L, front + lead, len - lead);
 
     lxs_assert_stack_end(L, 1);
     return 1;
@@ -1058,12 +2153,8 @@ static int libE_rtrim(lua_State* const L)
 
     size_t len;
     const char* front = luaL_checklstring(L, 1, &len);
-    const char* end   = &front[len - 1];
 
-    for (; len && isspace(*end); --len, --end)
-    { /* blank */ }
-
-    lua_pushlstring(L, front, STATIC_CAST(size_t, end - front + 1));
+    lua_pushlstring(L, front, len - lxs_krspace(front, len));
 
     lxs_assert_stack_end(L, 1);
     return 1;
@@ -1102,6 +2193,31 @@ static int libE_split(lua_State* const L)
     return lxs_split(L, src, len, seps);
 }
 
+/// string.gsplit(s, seps)
+///
+/// Returns an iterator over the substrings of *s*, separated by any of the
+/// characters in *seps*. Yields the same tokens as string.split, in order,
+/// one per call, without building a table or a copy of *s*.
+///
+/// Example usage:
+///     for field in string.gsplit('a,b;;c', ',;') do
+///         print(field) --> 'a', 'b', '', 'c'
+///     end
+static int libE_gsplit(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    luaL_checkstring(L, 1);
+
+    size_t      slen;
+    const char* seps = luaL_checklstring(L, 2, &slen);
+
+    luaL_argcheck(L, slen > 0, 2, "separator cannot be nil nor empty");
+
+    lxs_assert_stack_end(L, 0);
+    return lxs_gsplit(L, 1, seps, slen, false);
+}
+
 #endif // LUAXS_EXTEND_STRLIB
 
 
@@ -1111,14 +2227,22 @@ static const luaL_Reg strlib[] = {
   { "byte",    str_byte    },
   { "char",    str_char    },
   { "dump",    str_dump    },
+#if !LUAXS_STR_PATTERN_CACHE
   { "find",    str_find    },
+#endif
+#if !LUAXS_STR_FORMAT_CACHE
   { "format",  str_format  },
+#endif
   { "gfind",   gfind_nodef },
+#if !LUAXS_STR_PATTERN_CACHE
   { "gmatch",  gmatch      },
   { "gsub",    str_gsub    },
+#endif
   { "len",     str_len     },
   { "lower",   str_lower   },
+#if !LUAXS_STR_PATTERN_CACHE
   { "match",   str_match   },
+#endif
   { "rep",     str_rep     },
   { "reverse", str_reverse },
   { "sub",     str_sub     },
@@ -1128,10 +2252,30 @@ static const luaL_Reg strlib[] = {
   { "ltrim",   libE_ltrim  },
   { "rtrim",   libE_rtrim  },
   { "split",   libE_split  },
+  { "gsplit",  libE_gsplit },
 #endif
   { NULL, NULL }
 };
 
+#if LUAXS_STR_PATTERN_CACHE
+/* share the pattern cache as upvalue 1 */
+static const luaL_Reg strlib_patterns[] = {
+  { "find",    str_find    },
+  { "gmatch",  gmatch      },
+  { "gsub",    str_gsub    },
+  { "match",   str_match   },
+  { NULL, NULL }
+};
+#endif
+
+#if LUAXS_STR_FORMAT_CACHE
+/* parsed format cache as upvalue 1 */
+static const luaL_Reg strlib_formats[] = {
+  { "format",  str_format  },
+  { NULL, NULL }
+};
+#endif
+
 
 /*
 ** Open string library
@@ -1140,7 +2284,18 @@ LUALIB_API int luaopen_string (lua_State *L)
 {
     lxs_assert_stack_begin(L);
 
+    lxs_kinit();
+    CDBG(L, "string kernels: %s", lxs_kname());
+
     luaL_register(L, LUA_STRLIBNAME, strlib);
+#if LUAXS_STR_PATTERN_CACHE
+    sc_new(L, LUAXS_STR_PATTERN_CACHE, LXS_PMCACHE);
+    luaI_openlib(L, NULL, strlib_patterns, 1);
+#endif
+#if LUAXS_STR_FORMAT_CACHE
+    sc_new(L, LUAXS_STR_FORMAT_CACHE, LXS_SFCACHE);
+    luaI_openlib(L, NULL, strlib_formats, 1);
+#endif
 #if defined(LUA_COMPAT_GFIND)
     lua_getfield(L, -1, "gmatch");
     lua_setfield(L, -2, "gfind");
@@ -7,7 +7,9 @@
 extern "C"
 {
 
+#include <locale.h>
 #include <stddef.h>
+#include <string.h>
 
 #define ltablib_c
 #define LUA_LIB
@@ -17,15 +19,82 @@ extern "C"
 #include "lauxlib.h"
 #include "lualib.h"
 
+#include "ldo.h"
+#include "lgc.h"
 #include "lobject.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "lvm.h"
 
 #include "lxsext.h"
 #include "lxs_def.h"
+#include "lxs_skernel.h"
 #include "lxs_string.hpp"
 
 #define aux_getn(L,n)	(luaL_checktype(L, n, LUA_TTABLE), luaL_getn(L, n))
 
 
+//------------------------------------------------------------------------------
+// Element access for insert/remove/move and the vector (*i) functions.
+//
+// t[i] is read from the table's array part directly, only indices beyond it
+// go through luaH_getnum. Any Lua function called in between may reallocate
+// the array part, so it is looked up again for every element.
+
+XS_AINLINE static const TValue* tab_geti(Table* t, int i)
+{
+    return cast(unsigned int, i - 1) < cast(unsigned int, t->sizearray)
+        ? &t->array[i - 1]
+        : luaH_getnum(t, i);
+}
+
+static void tab_seti(lua_State* const L, Table* t, int i, const TValue* v)
+{
+    if (cast(unsigned int, i - 1) < cast(unsigned int, t->sizearray))
+    {
+        setobj2t(L, &t->array[i - 1], v);
+    }
+    else
+    {
+        TValue tmp;
+        setobj(L, &tmp, v); // v may live in t, which luaH_setnum may resize
+        if (ttisnil(&tmp) && ttisnil(luaH_getnum(t, i)))
+            return;
+        setobj2t(L, luaH_setnum(L, t, i), &tmp);
+        v = &tmp;
+    }
+    luaC_barriert(L, t, v);
+}
+
+/// Calls the function at stack index 2 with i and t[i], leaving its result
+/// on the stack.
+static void tab_calli(lua_State* const L, Table* t, int i)
+{
+    StkId func = L->top;
+    setobj2s(L, func, L->base + 1);
+    setnvalue(func + 1, cast_num(i));
+    setobj2s(L, func + 2, tab_geti(t, i));
+    L->top = func + 3;
+    luaD_call(L, func, 1);
+}
+
+/// Reduces t[1, len] with one of the lxs_k*d kernels if all of it lives in
+/// the array part and is a number; returns false otherwise.
+static bool tab_reduce(Table* t, int len, double (*kernel)(const void*, size_t, size_t), double* res)
+{
+    if (len <= 0 || len > t->sizearray)
+        return false;
+
+    const TValue* a = t->array;
+    for (int i = 0; i < len; ++i)
+        if (!ttisnumber(&a[i]))
+            return false;
+
+    *res = kernel(&a[0].value.n, len, sizeof(TValue));
+    return true;
+}
+
+
 static int libE_foreachi(lua_State *L)
 {
     int i;
@@ -100,6 +169,7 @@ static int libE_setn (lua_State *L) {
 static int libE_insert (lua_State *L) {
   int e = aux_getn(L, 1) + 1;  /* first empty element */
   int pos;  /* where to insert new element */
+  Table *t = hvalue(L->base);
   switch (lua_gettop(L)) {
     case 2: {  /* called with only 2 arguments */
       pos = e;  /* insert new element at the end */
@@ -109,6 +179,10 @@ static int libE_insert (lua_State *L) {
       int i;
       pos = luaL_checkint(L, 2);  /* 2nd argument is the position */
       if (pos > e) e = pos;  /* `grow' array if necessary */
+      if (pos >= 1 && e <= t->sizearray) {  /* all in the array part? */
+        memmove(&t->array[pos], &t->array[pos-1], (e-pos)*sizeof(TValue));
+        break;
+      }
       for (i = e; i > pos; i--) {  /* move up elements */
         lua_rawgeti(L, 1, i-1);
         lua_rawseti(L, 1, i);  /* t[i] = t[i-1] */
@@ -127,10 +201,16 @@ static int libE_insert (lua_State *L) {
 static int libE_remove (lua_State *L) {
   int e = aux_getn(L, 1);
   int pos = luaL_optint(L, 2, e);
+  Table *t = hvalue(L->base);
   if (!(1 <= pos && pos <= e))  /* position is outside bounds? */
    return 0;  /* nothing to remove */
   luaL_setn(L, 1, e - 1);  /* t.n = n-1 */
   lua_rawgeti(L, 1, pos);  /* result = t[pos] */
+  if (e <= t->sizearray) {  /* all in the array part? */
+    memmove(&t->array[pos-1], &t->array[pos], (e-pos)*sizeof(TValue));
+    setnilvalue(&t->array[e-1]);  /* t[e] = nil */
+    return 1;
+  }
   for ( ;pos<e; pos++) {
     lua_rawgeti(L, 1, pos+1);
     lua_rawseti(L, 1, pos);  /* t[pos] = t[pos+1] */
@@ -141,32 +221,32 @@ static int libE_remove (lua_State *L) {
 }
 
 
-static void addfield (lua_State *L, luaL_Buffer *b, int i) {
+static void addfield (lua_State *L, xbuf_ptr_t b, int i) {
   lua_rawgeti(L, 1, i);
   if (!lua_isstring(L, -1))
     lxs_error(L, "invalid value (%s) at index %d in table for "
                   LUA_QL("concat"), luaL_typename(L, -1), i);
-  luaL_addvalue(b);
+  xbuf_addvalue(L, xbuf_deref(b));
 }
 
 static int libE_concat (lua_State *L)
 {
-    luaL_Buffer b;
+    xbuf_decl(b);
     size_t lsep;
     int i, last;
     const char *sep = luaL_optlstring(L, 2, "", &lsep);
     luaL_checktype(L, 1, LUA_TTABLE);
     i = luaL_optint(L, 3, 1);
     last = luaL_opt(L, luaL_checkint, 4, luaL_getn(L, 1));
-    luaL_buffinit(L, &b);
+    xbuf_init(L, b);
     for (; i < last; i++)
     {
-        addfield(L, &b, i);
-        luaL_addlstring(&b, sep, lsep);
+        addfield(L, xbuf_ref(b), i);
+        xbuf_addlstring(L, b, sep, lsep);
     }
     if (i == last)  /* add last value (if interval was not empty) */
-        addfield(L, &b, i);
-    luaL_pushresult(&b);
+        addfield(L, xbuf_ref(b), i);
+    xbuf_pushresult(L, b);
     return 1;
 }
 
@@ -263,53 +343,854 @@ static void auxsort (lua_State *L, int l, int u) {
   }  /* repeat the routine for the larger one */
 }
 
+#if LUAXS_TAB_SORT || LUAXS_EXTEND_TABLIB
+
+//------------------------------------------------------------------------------
+// Array part sorting, shared by table.sort and table.stable_sort.
+//
+// Elements are compared and moved in place, t->array is never reallocated
+// by the sorts themselves. Whenever Lua code runs (an order function or a
+// __lt metamethod) the array is checked afterwards; if it was resized the
+// sort fails.
+
+enum lxs_sortkind
+{
+    LXS_SORT_NUM, // all numbers, no order function
+    LXS_SORT_STR, // all strings, no order function, "C" collation
+    LXS_SORT_LT,  // anything else without order function: luaV_lessthan
+    LXS_SORT_FN   // order function at stack index 2
+};
+
+typedef struct _lxs_sort
+{
+    lua_State* L;
+    Table*     t;
+    TValue*    a;    // t->array, as it was when the sort started
+    int        n;
+    int        kind; // lxs_sortkind
+    ptrdiff_t  fn;   // savestack()d order function
+} lxs_sort;
+
+static void sort_invalid(lxs_sort* s)
+{
+    lxs_error(s->L, "invalid order function for sorting");
+}
+
+static void sort_check(lxs_sort* s)
+{
+    if (s->t->array != s->a || s->t->sizearray < s->n)
+        lxs_error(s->L, "table resized during sorting");
+}
+
+XS_AINLINE static void sort_swap(TValue* a, int i, int j)
+{
+    TValue tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+}
+
+XS_AINLINE static bool sort_strlt(const TString* x, const TString* y)
+{
+    if (x == y)
+        return false;
+
+    size_t lx = x->tsv.len;
+    size_t ly = y->tsv.len;
+    int    r  = memcmp(getstr(x), getstr(y), lx < ly ? lx : ly);
+    return r < 0 || (r == 0 && lx < ly);
+}
+
+static bool sort_call(lxs_sort* s, const TValue* x, const TValue* y)
+{
+    lua_State* L = s->L;
+
+    StkId func = L->top;
+    setobj2s(L, func,     restorestack(L, s->fn));
+    setobj2s(L, func + 1, x);
+    setobj2s(L, func + 2, y);
+    L->top = func + 3;
+    luaD_call(L, func, 1);
+
+    bool res = !l_isfalse(L->top - 1);
+    L->top--;
+    sort_check(s);
+    return res;
+}
+
+static bool sort_less(lxs_sort* s, const TValue* x, const TValue* y)
+{
+    bool res = luaV_lessthan(s->L, x, y) != 0;
+    sort_check(s);
+    return res;
+}
+
+XS_AINLINE static bool sort_lt(lxs_sort* s, const TValue* x, const TValue* y)
+{
+    switch (s->kind)
+    {
+    case LXS_SORT_NUM: return nvalue(x) < nvalue(y);
+    case LXS_SORT_STR: return sort_strlt(rawtsvalue(x), rawtsvalue(y));
+    case LXS_SORT_LT:  return sort_less(s, x, y);
+    default:           return sort_call(s, x, y);
+    }
+}
+
+/// Prepares sorting t[1, n] of the table at stack index idx, the optional
+/// order function being at index 2. Returns false if not all of it lives in
+/// the array part.
+static bool sort_init(lua_State* const L, lxs_sort* s, int idx, int n)
+{
+    s->L  = L;
+    s->t  = hvalue(L->base + (idx - 1));
+    s->a  = s->t->array;
+    s->n  = n;
+    s->fn = savestack(L, L->base + 1);
+
+    if (n > s->t->sizearray)
+        return false;
+
+    if (!ttisnil(L->base + 1))
+        s->kind = LXS_SORT_FN;
+    else if (n == 0)
+        s->kind = LXS_SORT_LT;
+    else
+    {
+        int tt = ttype(&s->a[0]);
+        s->kind = tt == LUA_TNUMBER ? LXS_SORT_NUM
+                : tt == LUA_TSTRING ? LXS_SORT_STR
+                :                     LXS_SORT_LT;
+
+        for (int i = 1; i < n && s->kind != LXS_SORT_LT; ++i)
+            if (ttype(&s->a[i]) != tt)
+                s->kind = LXS_SORT_LT;
+
+        // lua_lessthan compares strings by strcoll, which is memcmp only in
+        // the "C" locale
+        if (s->kind == LXS_SORT_STR)
+        {
+            const char* coll = setlocale(LC_COLLATE, NULL);
+            if (coll == NULL || strcmp(coll, "C") != 0)
+                s->kind = LXS_SORT_LT;
+        }
+    }
+    return true;
+}
+
+#endif // LUAXS_TAB_SORT || LUAXS_EXTEND_TABLIB
+
+#if LUAXS_TAB_SORT
+
+//------------------------------------------------------------------------------
+// Pattern-defeating quicksort (Orson Peters' pdqsort) for table.sort.
+//
+// Values are only ever swapped, so no temporary outlives a call and no write
+// barrier is needed.
+
+#define LXS_SORT_INSERTION 24 // ranges below this size are insertion sorted
+#define LXS_SORT_NINTHER  128 // ranges above use Tukey's ninther as pivot
+#define LXS_SORT_PARTIAL    8 // moves before a partial insertion sort gives up
+
+/// Sorts a[i], a[j] and a[k] so that a[i] <= a[j] <= a[k].
+static void sort_three(lxs_sort* s, int i, int j, int k)
+{
+    TValue* a = s->a;
+    if (sort_lt(s, &a[j], &a[i])) sort_swap(a, i, j);
+    if (sort_lt(s, &a[k], &a[j]))
+    {
+        sort_swap(a, j, k);
+        if (sort_lt(s, &a[j], &a[i])) sort_swap(a, i, j);
+    }
+}
+
+static void sort_insertion(lxs_sort* s, int lo, int hi)
+{
+    TValue* a = s->a;
+    for (int i = lo + 1; i <= hi; ++i)
+        for (int j = i; j > lo && sort_lt(s, &a[j], &a[j - 1]); --j)
+            sort_swap(a, j, j - 1);
+}
+
+/// Insertion sort that gives up after LXS_SORT_PARTIAL moves; returns true if
+/// a[lo, hi] got sorted.
+static bool sort_partial(lxs_sort* s, int lo, int hi)
+{
+    TValue* a = s->a;
+    int moves = 0;
+    for (int i = lo + 1; i <= hi; ++i)
+    {
+        int j = i;
+        for (; j > lo && sort_lt(s, &a[j], &a[j - 1]); --j)
+            sort_swap(a, j, j - 1);
+
+        moves += i - j;
+        if (moves > LXS_SORT_PARTIAL)
+            return false;
+    }
+    return true;
+}
+
+static void sort_sift(lxs_sort* s, int lo, int root, int n)
+{
+    TValue* a = s->a;
+    for (;;)
+    {
+        int child = 2 * root + 1;
+        if (child >= n)
+            return;
+        if (child + 1 < n && sort_lt(s, &a[lo + child], &a[lo + child + 1]))
+            ++child;
+        if (!sort_lt(s, &a[lo + root], &a[lo + child]))
+            return;
+
+        sort_swap(a, lo + root, lo + child);
+        root = child;
+    }
+}
+
+static void sort_heap(lxs_sort* s, int lo, int hi)
+{
+    int n = hi - lo + 1;
+    for (int i = n / 2 - 1; i >= 0; --i)
+        sort_sift(s, lo, i, n);
+    for (int i = n - 1; i > 0; --i)
+    {
+        sort_swap(s->a, lo, lo + i);
+        sort_sift(s, lo, 0, i);
+    }
+}
+
+/// Partitions a[lo, hi] around the pivot a[lo] into a[lo, p) < a[p] <= a(p, hi]
+/// and returns p. *partitioned is set if no element had to be moved.
+/// Relies on some element of a[hi - 2, hi] not being less than the pivot.
+static int sort_partition_right(lxs_sort* s, int lo, int hi, bool* partitioned)
+{
+    TValue* a = s->a;
+    int first = lo;
+    int last  = hi + 1;
+
+    do
+    {
+        if (++first > hi) sort_invalid(s);
+    }
+    while (sort_lt(s, &a[first], &a[lo]));
+
+    if (first - 1 == lo)
+    {
+        while (first < last && !sort_lt(s, &a[--last], &a[lo]))
+            ;
+    }
+    else
+    {
+        do
+        {
+            if (--last <= lo) sort_invalid(s);
+        }
+        while (!sort_lt(s, &a[last], &a[lo]));
+    }
+
+    *partitioned = first >= last;
+
+    while (first < last)
+    {
+        sort_swap(a, first, last);
+        do
+        {
+            if (++first > hi) sort_invalid(s);
+        }
+        while (sort_lt(s, &a[first], &a[lo]));
+        do
+        {
+            if (--last <= lo) sort_invalid(s);
+        }
+        while (!sort_lt(s, &a[last], &a[lo]));
+    }
+
+    int p = first - 1;
+    sort_swap(a, lo, p);
+    return p;
+}
+
+/// Like sort_partition_right, but elements equal to the pivot go left:
+/// a[lo, p) <= a[p] < a(p, hi]. Used once the pivot is known to equal the
+/// element preceding the range, so none of a[lo, p] needs sorting any more.
+static int sort_partition_left(lxs_sort* s, int lo, int hi)
+{
+    TValue* a = s->a;
+    int first = lo;
+    int last  = hi + 1;
+
+    do
+    {
+        if (--last < lo) sort_invalid(s);
+    }
+    while (sort_lt(s, &a[lo], &a[last]));
+
+    if (last == hi)
+    {
+        while (first < last && !sort_lt(s, &a[lo], &a[++first]))
+            ;
+    }
+    else
+    {
+        do
+        {
+            if (++first > hi) sort_invalid(s);
+        }
+        while (!sort_lt(s, &a[lo], &a[first]));
+    }
+
+    while (first < last)
+    {
+        sort_swap(a, first, last);
+        do
+        {
+            if (--last < lo) sort_invalid(s);
+        }
+        while (sort_lt(s, &a[lo], &a[last]));
+        do
+        {
+            if (++first > hi) sort_invalid(s);
+        }
+        while (!sort_lt(s, &a[lo], &a[first]));
+    }
+
+    sort_swap(a, lo, last);
+    return last;
+}
+
+static void sort_loop(lxs_sort* s, int lo, int hi, int bad, bool leftmost)
+{
+    TValue* a = s->a;
+    for (;;)
+    {
+        int size = hi - lo + 1;
+        if (size < LXS_SORT_INSERTION)
+        {
+            sort_insertion(s, lo, hi);
+            return;
+        }
+
+        // pivot to a[lo]; some element of a[hi - 2, hi] is not less than it
+        int mid = lo + size / 2;
+        if (size > LXS_SORT_NINTHER)
+        {
+            sort_three(s, lo,     mid,     hi);
+            sort_three(s, lo + 1, mid - 1, hi - 1);
+            sort_three(s, lo + 2, mid + 1, hi - 2);
+            sort_three(s, mid - 1, mid,    mid + 1);
+            sort_swap(a, lo, mid);
+        }
+        else
+            sort_three(s, mid, lo, hi);
+
+        // a[lo - 1] is a pivot of an earlier partition: if the new pivot
+        // isn't greater it's equal and all its duplicates can be skipped
+        if (!leftmost && !sort_lt(s, &a[lo - 1], &a[lo]))
+        {
+            lo = sort_partition_left(s, lo, hi) + 1;
+            continue;
+        }
+
+        bool partitioned;
+        int p  = sort_partition_right(s, lo, hi, &partitioned);
+        int ls = p - lo;
+        int rs = hi - p;
+
+        if (ls < size / 8 || rs < size / 8)
+        {
+            // unbalanced: after log2(n) of those fall back to heap sort,
+            // otherwise break up the pattern that caused it
+            if (--bad == 0)
+            {
+                sort_heap(s, lo, hi);
+                return;
+            }
+
+            if (ls >= LXS_SORT_INSERTION)
+            {
+                sort_swap(a, lo,    lo + ls / 4);
+                sort_swap(a, p - 1, p - ls / 4);
+                if (ls > LXS_SORT_NINTHER)
+                {
+                    sort_swap(a, lo + 1, lo + ls / 4 + 1);
+                    sort_swap(a, lo + 2, lo + ls / 4 + 2);
+                    sort_swap(a, p - 2,  p - ls / 4 - 1);
+                    sort_swap(a, p - 3,  p - ls / 4 - 2);
+                }
+            }
+            if (rs >= LXS_SORT_INSERTION)
+            {
+                sort_swap(a, p + 1, p + 1 + rs / 4);
+                sort_swap(a, hi,    hi + 1 - rs / 4);
+                if (rs > LXS_SORT_NINTHER)
+                {
+                    sort_swap(a, p + 2,  p + 2 + rs / 4);
+                    sort_swap(a, p + 3,  p + 3 + rs / 4);
+                    sort_swap(a, hi - 1, hi - rs / 4);
+                    sort_swap(a, hi - 2, hi - 1 - rs / 4);
+                }
+            }
+        }
+        else if (partitioned
+              && sort_partial(s, lo, p - 1)
+              && sort_partial(s, p + 1, hi))
+        {
+            return; // was (nearly) sorted already
+        }
+
+        sort_loop(s, lo, p - 1, bad, leftmost);
+        lo       = p + 1;
+        leftmost = false;
+    }
+}
+
+/// Sorts t[1, n] in place if all of it lives in the array part of the table
+/// at stack index 1; returns false otherwise, the caller falls back to
+/// auxsort then. Expects the stack to be settled at the two arguments.
+static bool lxs_sortarray(lua_State* const L, int n)
+{
+    lxs_sort s;
+    if (!sort_init(L, &s, 1, n))
+        return false;
+    if (n < 2)
+        return true;
+
+    int bad = 0;
+    while (n >> bad)
+        ++bad;
+
+    sort_loop(&s, 0, n - 1, bad, true);
+    return true;
+}
+
+#endif // LUAXS_TAB_SORT
+
+
 static int libE_sort (lua_State *L) {
   int n = aux_getn(L, 1);
   luaL_checkstack(L, 40, "");  /* assume array is smaller than 2^40 */
   if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
     luaL_checktype(L, 2, LUA_TFUNCTION);
   lua_settop(L, 2);  /* make sure there is two arguments */
+#if LUAXS_TAB_SORT
+  if (lxs_sortarray(L, n))
+    return 0;
+#endif
   auxsort(L, 1, n);
   return 0;
 }
 
 
+#if LUAXS_EXTEND_TABLIB
+
+//------------------------------------------------------------------------------
+// Stable merge sort (after Tim Peters' listsort) for table.stable_sort.
+//
+// Natural runs, ascending or strictly descending (reversed), are extended to
+// a minimum length by binary insertion sort and merged while keeping the run
+// lengths balanced. Before merging two runs the elements already in place at
+// either end are skipped, so (nearly) sorted input costs little more than
+// n comparisons.
+//
+// The merge buffer is the array part of a scratch table, so the collector
+// sees the values in it while order functions run. The sort runs protected:
+// if a comparison raises an error the merge in progress is undone by copying
+// the buffered elements back, the table always keeps all its elements.
+
+#define LXS_MERGE_MAXRUNS 64
+
+typedef struct _lxs_merge
+{
+    lxs_sort* s;
+    Table*    bt;    // scratch table
+    TValue*   b;     // bt->array
+    int       runs;
+    int       base[LXS_MERGE_MAXRUNS];
+    int       len[LXS_MERGE_MAXRUNS];
+    int       dir;   // merge in progress: 1 from the front, -1 from the back
+    int       bi;    // next buffered element (front) or last one (back)
+    int       bn;    // number of buffered elements
+    int       ak;    // next destination in the array
+} lxs_merge;
+
+XS_AINLINE static void merge_set(lua_State* L, Table* t, TValue* dst, const TValue* src)
+{
+    setobj2t(L, dst, src);
+    luaC_barriert(L, t, src);
+}
+
+static int merge_minrun(int n)
+{
+    int r = 0;
+    while (n >= 64)
+    {
+        r |= n & 1;
+        n >>= 1;
+    }
+    return n + r;
+}
+
+/// Returns the length of the run starting at a[lo], reversing it if it is
+/// strictly descending.
+static int merge_run(lxs_sort* s, int lo, int hi)
+{
+    TValue* a = s->a;
+    int i = lo + 1;
+    if (i == hi)
+        return 1;
+
+    if (sort_lt(s, &a[i], &a[lo]))
+    {
+        while (++i < hi && sort_lt(s, &a[i], &a[i - 1]))
+            ;
+        for (int l = lo, r = i - 1; l < r; ++l, --r)
+            sort_swap(a, l, r);
+    }
+    else
+    {
+        while (++i < hi && !sort_lt(s, &a[i], &a[i - 1]))
+            ;
+    }
+    return i - lo;
+}
+
+/// Sorts a[lo, hi) of which a[lo, start) is sorted already.
+static void merge_insertion(lxs_sort* s, int lo, int hi, int start)
+{
+    TValue* a = s->a;
+    for (int i = start; i < hi; ++i)
+    {
+        int l = lo;
+        int r = i;
+        while (l < r)
+        {
+            int m = l + (r - l) / 2;
+            if (sort_lt(s, &a[i], &a[m]))
+                r = m;
+            else
+                l = m + 1;
+        }
+
+        if (l < i)
+        {
+            TValue v = a[i];
+            memmove(&a[l + 1], &a[l], (i - l) * sizeof(TValue));
+            a[l] = v;
+        }
+    }
+}
+
+/// Returns the first index in [lo, hi) whose element is greater than key.
+static int merge_upper(lxs_sort* s, const TValue* key, int lo, int hi)
+{
+    while (lo < hi)
+    {
+        int m = lo + (hi - lo) / 2;
+        if (sort_lt(s, key, &s->a[m]))
+            hi = m;
+        else
+            lo = m + 1;
+    }
+    return lo;
+}
+
+/// Returns the first index in [lo, hi) whose element is not less than key.
+static int merge_lower(lxs_sort* s, const TValue* key, int lo, int hi)
+{
+    while (lo < hi)
+    {
+        int m = lo + (hi - lo) / 2;
+        if (sort_lt(s, &s->a[m], key))
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    return lo;
+}
+
+/// Merges a[lo1, lo1 + n1) and a[lo2, lo2 + n2), n1 <= n2, buffering the first.
+static void merge_lo(lxs_merge* m, int lo1, int n1, int lo2, int n2)
+{
+    lxs_sort* s = m->s;
+    TValue*   a = s->a;
+    TValue*   b = m->b;
+
+    for (int i = 0; i < n1; ++i)
+        merge_set(s->L, m->bt, &b[i], &a[lo1 + i]);
+
+    int j   = lo2;
+    int end = lo2 + n2;
+    m->bi  = 0;
+    m->bn  = n1;
+    m->ak  = lo1;
+    m->dir = 1;
+    while (m->bi < n1 && j < end)
+    {
+        if (sort_lt(s, &a[j], &b[m->bi]))
+            a[m->ak++] = a[j++];
+        else
+            merge_set(s->L, s->t, &a[m->ak++], &b[m->bi++]);
+    }
+    while (m->bi < n1)
+        merge_set(s->L, s->t, &a[m->ak++], &b[m->bi++]);
+    m->dir = 0;
+}
+
+/// Merges a[lo1, lo1 + n1) and a[lo2, lo2 + n2), n1 > n2, buffering the
+/// second and filling in from the back.
+static void merge_hi(lxs_merge* m, int lo1, int n1, int lo2, int n2)
+{
+    lxs_sort* s = m->s;
+    TValue*   a = s->a;
+    TValue*   b = m->b;
+
+    for (int i = 0; i < n2; ++i)
+        merge_set(s->L, m->bt, &b[i], &a[lo2 + i]);
+
+    int i  = lo1 + n1 - 1;
+    m->bi  = n2 - 1;
+    m->ak  = lo2 + n2 - 1;
+    m->dir = -1;
+    while (m->bi >= 0 && i >= lo1)
+    {
+        if (sort_lt(s, &b[m->bi], &a[i]))
+            a[m->ak--] = a[i--];
+        else
+            merge_set(s->L, s->t, &a[m->ak--], &b[m->bi--]);
+    }
+    while (m->bi >= 0)
+        merge_set(s->L, s->t, &a[m->ak--], &b[m->bi--]);
+    m->dir = 0;
+}
+
+/// Merges the runs i and i + 1 of the run stack.
+static void merge_at(lxs_merge* m, int i)
+{
+    lxs_sort* s = m->s;
+    int lo1 = m->base[i];
+    int n1  = m->len[i];
+    int lo2 = m->base[i + 1];
+    int n2  = m->len[i + 1];
+
+    m->len[i] = n1 + n2;
+    if (i == m->runs - 3)
+    {
+        m->base[i + 1] = m->base[i + 2];
+        m->len[i + 1]  = m->len[i + 2];
+    }
+    m->runs--;
+
+    // the first run's elements not greater than the second's first are in
+    // place already, as are the second run's not less than the first's last
+    int k = merge_upper(s, &s->a[lo2], lo1, lo1 + n1);
+    n1 -= k - lo1;
+    lo1 = k;
+    if (n1 == 0)
+        return;
+
+    n2 = merge_lower(s, &s->a[lo1 + n1 - 1], lo2, lo2 + n2) - lo2;
+    if (n2 == 0)
+        return;
+
+    if (n1 <= n2)
+        merge_lo(m, lo1, n1, lo2, n2);
+    else
+        merge_hi(m, lo1, n1, lo2, n2);
+}
+
+static void merge_collapse(lxs_merge* m)
+{
+    int* len = m->len;
+    while (m->runs > 1)
+    {
+        int i = m->runs - 2;
+        if ((i > 0 && len[i - 1] <= len[i] + len[i + 1])
+         || (i > 1 && len[i - 2] <= len[i - 1] + len[i]))
+        {
+            if (len[i - 1] < len[i + 1])
+                --i;
+        }
+        else if (len[i] > len[i + 1])
+            return;
+
+        merge_at(m, i);
+    }
+}
+
+static int merge_sort(lua_State* L)
+{
+    lxs_merge* m = static_cast<lxs_merge*>(lua_touserdata(L, 1));
+    lxs_sort*  s = m->s;
+
+    int n      = s->n;
+    int minrun = merge_minrun(n);
+    for (int lo = 0; lo < n; )
+    {
+        int len = merge_run(s, lo, n);
+        if (len < minrun)
+        {
+            int force = n - lo < minrun ? n - lo : minrun;
+            merge_insertion(s, lo, lo + force, lo + len);
+            len = force;
+        }
+
+        m->base[m->runs] = lo;
+        m->len[m->runs]  = len;
+        m->runs++;
+        merge_collapse(m);
+        lo += len;
+    }
+
+    while (m->runs > 1)
+    {
+        int i = m->runs - 2;
+        if (i > 0 && m->len[i - 1] < m->len[i + 1])
+            --i;
+        merge_at(m, i);
+    }
+    return 0;
+}
+
+/// Stable sorts t[1, n] of the table at stack index idx, which must live in
+/// its array part; expects the scratch table at index 3.
+static void lxs_stablesort(lua_State* const L, int idx, int n)
+{
+    lxs_sort  s;
+    lxs_merge m;
+
+    sort_init(L, &s, idx, n);
+    m.s    = &s;
+    m.bt   = hvalue(L->base + 2);
+    m.b    = m.bt->array;
+    m.runs = 0;
+    m.dir  = 0;
+
+    if (lua_cpcall(L, merge_sort, &m) == 0)
+        return;
+
+    // put the buffered elements back unless the array itself is gone
+    if (m.dir != 0 && s.t->array == s.a && s.t->sizearray >= n)
+    {
+        if (m.dir > 0)
+        {
+            while (m.bi < m.bn)
+                merge_set(L, s.t, &s.a[m.ak++], &m.b[m.bi++]);
+        }
+        else
+        {
+            while (m.bi >= 0)
+                merge_set(L, s.t, &s.a[m.ak--], &m.b[m.bi--]);
+        }
+    }
+    lua_error(L);
+}
+
+/// table.stable_sort(table[, comp])
+///
+/// Sorts the vector part of a *table* in place, just like table.sort, except
+/// that elements which compare equal keep their relative order. Thus sorting
+/// by one key after another sorts by all of them, without tie-breakers in the
+/// comparator.
+///
+/// Inputs which are (nearly) sorted already, in either direction, take close
+/// to linear time. Needs temporary memory for up to half the elements.
+///
+/// Usage example:
+///     table.stable_sort(
+///         { { n = 'b', p = 1 }, { n = 'a', p = 2 }, { n = 'c', p = 1 } },
+///         function (a, b)
+///             return a.p < b.p
+///         end
+///     )
+///     --> { { n = 'b', p = 1 }, { n = 'c', p = 1 }, { n = 'a', p = 2 } }
+static int libE_stable_sort(lua_State* const L)
+{
+    int n = aux_getn(L, 1);
+    if (!lua_isnoneornil(L, 2))
+        luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    lua_settop(L, 2);
+    if (n < 2)
+        return 0;
+
+    lua_createtable(L, n / 2 + 1, 0);
+
+    if (n <= static_cast<int>(hvalue(L->base)->sizearray))
+        lxs_stablesort(L, 1, n);
+    else
+    {
+        // elements in the hash part: sort a copy of them
+        lua_createtable(L, n, 0);
+        for (int i = 1; i <= n; ++i)
+        {
+            lua_rawgeti(L, 1, i);
+            lua_rawseti(L, 4, i);
+        }
+
+        lxs_stablesort(L, 4, n);
+
+        for (int i = 1; i <= n; ++i)
+        {
+            lua_rawgeti(L, 4, i);
+            lua_rawseti(L, 1, i);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+    lxs_assert_stack_at(L, 2);
+    return 0;
+}
+
+#endif // LUAXS_EXTEND_TABLIB
+
+
 /******************************************************************************
  * ltablib.c extensions
  *****************************************************************************/
 
 #if LUAXS_EXTEND_TABLIB
 
-#define DEFINE_MINMAX_VEC_FUNC(NAME, GETTER, ZV)\
-    static int NAME(lua_State* const L)         \
-    {                                           \
-        lxs_assert_stack_begin(L);              \
-                                                \
-        double num = ZV;                        \
-                                                \
-        luaL_checktype(L, 1, LUA_TTABLE);       \
-        luaL_checktype(L, 2, LUA_TFUNCTION);    \
-                                                \
-        int len = luaL_getn(L, 1);              \
-        for (int i = 1; i <= len; ++i)          \
-        {                                       \
-            lua_pushvalue(L, 2);                \
-            lua_pushinteger(L, i);              \
-            lua_rawgeti(L, 1, i);               \
-            lua_call(L, 2, 1);                  \
-                                                \
-            num = GETTER(L, -1, num);           \
-                                                \
-            lua_pop(L, 1);                      \
-        }                                       \
-                                                \
-        if (len == 0)                           \
-            lua_pushnil(L);                     \
-        else                                    \
-            lua_pushnumber(L, num);             \
-                                                \
-        lxs_assert_stack_end(L, 1);             \
-        return 1;                               \
+#define DEFINE_MINMAX_VEC_FUNC(NAME, GETTER, ZV, KERNEL) \
+    static int NAME(lua_State* const L)                 \
+    {                                                   \
+        double num = ZV;                                \
+                                                        \
+        luaL_checktype(L, 1, LUA_TTABLE);               \
+        if (!lua_isnoneornil(L, 2))                     \
+            luaL_checktype(L, 2, LUA_TFUNCTION);        \
+                                                        \
+        lua_settop(L, 2);                               \
+        Table* t  = hvalue(L->base);                    \
+        int   len = luaL_getn(L, 1);                    \
+                                                        \
+        if (!lua_isnil(L, 2))                           \
+        {                                               \
+            for (int i = 1; i <= len; ++i)              \
+            {                                           \
+                tab_calli(L, t, i);                     \
+                num = GETTER(L, -1, num);               \
+                lua_pop(L, 1);                          \
+            }                                           \
+        }                                               \
+        else if (!tab_reduce(t, len, KERNEL, &num))     \
+        {                                               \
+            for (int i = 1; i <= len; ++i)              \
+            {                                           \
+                setobj2s(L, L->top, tab_geti(t, i));    \
+                incr_top(L);                            \
+                num = GETTER(L, -1, num);               \
+                lua_pop(L, 1);                          \
+            }                                           \
+        }                                               \
+                                                        \
+        if (len == 0)                                   \
+            lua_pushnil(L);                             \
+        else                                            \
+            lua_pushnumber(L, num);                     \
+                                                        \
+        lxs_assert_stack_at(L, 3);                      \
+        return 1;                                       \
     }
 
 #define DEFINE_MINMAX_MAP_FUNC(NAME, GETTER, ZV)\
@@ -348,11 +1229,17 @@ static int libE_sort (lua_State *L) {
         return 1;                               \
     }
 
-DEFINE_MINMAX_VEC_FUNC(libE_mini, lxs_mind, HUGE_VAL);
-DEFINE_MINMAX_VEC_FUNC(libE_maxi, lxs_maxd, 0);
+/// table.mini(table[, selector])
+/// table.maxi(table[, selector])
+///
+/// Returns the smallest/largest number *selector(index, value)* returns for
+/// the vector part of a *table*, or of the values themselves if no selector
+/// is given; nil for empty tables.
+DEFINE_MINMAX_VEC_FUNC(libE_mini, lxs_mind,  HUGE_VAL, lxs_kmind);
+DEFINE_MINMAX_VEC_FUNC(libE_maxi, lxs_maxd, -HUGE_VAL, lxs_kmaxd);
 #undef DEFINE_MINMAX_VEC_FUNC
 DEFINE_MINMAX_MAP_FUNC(libE_min, lxs_mind, HUGE_VAL);
-DEFINE_MINMAX_MAP_FUNC(libE_max, lxs_maxd, 0);
+DEFINE_MINMAX_MAP_FUNC(libE_max, lxs_maxd, -HUGE_VAL);
 #undef DEFINE_MINMAX_MAP_FUNC
 
 /// table.create([vector_size[, hashmap_size]])
@@ -387,6 +1274,72 @@ static int libE_create(lua_State* const L)
     return 1;
 }
 
+/// table.move(a1, f, e, t [, a2])
+///
+/// Copies a1[f, e] to a2[t, t + e - f] and returns *a2*, which defaults to
+/// *a1*; the ranges may overlap. Like Lua 5.3's table.move but raw: neither
+/// __index nor __newindex are consulted.
+/// Ranges that lie within the array parts are copied with a single memmove.
+static int libE_move(lua_State* const L)
+{
+    lxs_assert_stack_begin(L);
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int f = luaL_checkint(L, 2);
+    int e = luaL_checkint(L, 3);
+    int t = luaL_checkint(L, 4);
+    int tt = !lua_isnoneornil(L, 5) ? 5 : 1;
+    luaL_checktype(L, tt, LUA_TTABLE);
+
+    if (e >= f)
+    {
+        luaL_argcheck(L, f > 0 || e < INT_MAX + f, 3, "too many elements to move");
+        luaL_argcheck(L, t <= INT_MAX - (e - f), 4, "destination wrap around");
+
+        Table* src = hvalue(L->base);
+        Table* dst = hvalue(L->base + (tt - 1));
+        int    n   = e - f + 1;
+
+        if (f >= 1 && e <= src->sizearray && t >= 1 && t - 1 + n <= dst->sizearray)
+        {
+            memmove(&dst->array[t - 1], &src->array[f - 1], n * sizeof(TValue));
+            if (src != dst && isblack(obj2gco(dst)))
+                luaC_barrierback(L, dst); // dst may now reference white objects
+        }
+        else if (t > e || t <= f || src != dst)
+        {
+            for (int i = 0; i < n; ++i)
+                tab_seti(L, dst, t + i, tab_geti(src, f + i));
+        }
+        else
+        {
+            for (int i = n - 1; i >= 0; --i)
+                tab_seti(L, dst, t + i, tab_geti(src, f + i));
+        }
+    }
+
+    lua_pushvalue(L, tt);
+
+    lxs_assert_stack_end(L, 1);
+    return 1;
+}
+
+/// table.clear(table [, keep_capacity])
+///
+/// Removes all entries of *table* in place; other references to it see an
+/// empty table. The array and hash parts are released unless *keep_capacity*
+/// is true, in which case the table can be refilled to its previous size
+/// without any rehashing.
+/// Like assigning to a field during traversal, clearing a table that is being
+/// traversed by next() is not allowed.
+static int libE_clear(lua_State* const L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    luaH_clear(L, hvalue(L->base), lua_toboolean(L, 2));
+    return 0;
+}
+
 /// table.countall(table)
 ///
 /// Returns the total number of entries in the *table*, this includes the vector
@@ -490,21 +1443,33 @@ static int libE_joini(lua_State* const L)
     xbuf_decl(b);
     xbuf_init(L, b);
 
-    int vlen = lua_objlen(L, 1);
+    Table* t    = hvalue(L->base);
+    int    vlen = lua_objlen(L, 1);
     for (int i = 1; i <= vlen; ++i)
     {
-        lua_rawgeti(L, 1, i);
-    
-        size_t      elen;
-        const char* estr = luaL_checklstring(L, -1, &elen);
+        const TValue* v = tab_geti(t, i);
 
-        if (elen > 0)
-            xbuf_addlstring(L, b, estr, elen);
+        if (ttisstring(v))
+        {
+            if (tsvalue(v)->len > 0)
+                xbuf_addlstring(L, b, svalue(v), tsvalue(v)->len);
+        }
+        else
+        {
+            setobj2s(L, L->top, v);
+            incr_top(L);
+
+            size_t      elen;
+            const char* estr = luaL_checklstring(L, -1, &elen);
+
+            if (elen > 0)
+                xbuf_addlstring(L, b, estr, elen);
+
+            lua_pop(L, 1);
+        }
 
         if (dlen > 0 && i + 1 <= vlen)
             xbuf_addlstring(L, b, delim, dlen);
-
-        lua_pop(L, 1);
     }
     xbuf_pushresult(L, b);
 
@@ -662,7 +1627,7 @@ static int libE_count(lua_State* const L)
     return 1;
 }
 
-/// table.sum(table, selector)
+/// table.sumi(table[, selector])
 ///
 /// Iterates over the vector part of a *table* summing up values using a
 /// *selector* function.
@@ -670,6 +1635,8 @@ static int libE_count(lua_State* const L)
 /// 
 /// The selector has the following signature: *selector(index, value)* and must
 /// return the number to sum up.
+/// Without a selector the values themselves are summed up, which must all be
+/// numbers. If they all live in the array part they're added using SIMD.
 ///
 /// Usage example:
 ///     table.sumi(
@@ -681,24 +1648,33 @@ static int libE_count(lua_State* const L)
 ///     --> 4
 static int libE_sumi(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
-
     luaL_checktype(L, 1, LUA_TTABLE);
-    luaL_checktype(L, 2, LUA_TFUNCTION);
+    if (!lua_isnoneornil(L, 2))
+        luaL_checktype(L, 2, LUA_TFUNCTION);
 
+    lua_settop(L, 2);
+    Table* t   = hvalue(L->base);
+    int    len = luaL_getn(L, 1);
     double sum = 0;
 
-    int len = luaL_getn(L, 1);
-    for (int i = 1; i <= len; ++i)
+    if (!lua_isnil(L, 2))
     {
-        lua_pushvalue(L, 2);
-        lua_pushinteger(L, i);
-        lua_rawgeti(L, 1, i);
-        lua_call(L, 2, 1);
-
-        sum += (luaL_checktype(L, -1, LUA_TNUMBER), lua_tonumber(L, -1));
-
-        lua_pop(L, 1);
+        for (int i = 1; i <= len; ++i)
+        {
+            tab_calli(L, t, i);
+            sum += (luaL_checktype(L, -1, LUA_TNUMBER), nvalue(L->top - 1));
+            lua_pop(L, 1);
+        }
+    }
+    else if (!tab_reduce(t, len, lxs_ksumd, &sum))
+    {
+        for (int i = 1; i <= len; ++i)
+        {
+            const TValue* v = tab_geti(t, i);
+            if (!ttisnumber(v))
+                lxs_error(L, "invalid value (at index %d) in table for 'sumi'", i);
+            sum += nvalue(v);
+        }
     }
 
     if (len == 0)
@@ -706,7 +1682,7 @@ static int libE_sumi(lua_State* const L)
     else
         lua_pushnumber(L, sum);
 
-    lxs_assert_stack_end(L, 1);
+    lxs_assert_stack_at(L, 3);
     return 1;
 }
 
@@ -777,23 +1753,19 @@ static int libE_sum(lua_State* const L)
 ///     table.findi({ 1, 2, 3 }, function (k, v) return v > 3 end) --> 0
 static int libE_findi(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
-
     luaL_checktype(L, 1, LUA_TTABLE);
     luaL_checktype(L, 2, LUA_TFUNCTION);
 
-    int len = lua_objlen(L, 1);
+    lua_settop(L, 2);
+    Table* t   = hvalue(L->base);
+    int    len = lua_objlen(L, 1);
     for (int i = 1; i <= len; ++i)
     {
-        lua_pushvalue(L, 2);    // func
-        lua_pushinteger(L, i);  // index
-        lua_rawgeti(L, 1, i);   // value
-        lua_call(L, 2, 1);
+        tab_calli(L, t, i);
 
-        if (lua_toboolean(L, -1) != 0)
+        if (!l_isfalse(L->top - 1))
         {
             lua_pushinteger(L, i);
-            lxs_assert_stack_end(L, 2);
             return 1;
         }
 
@@ -801,7 +1773,7 @@ static int libE_findi(lua_State* const L)
     }
 
     lua_pushinteger(L, 0);
-    lxs_assert_stack_end(L, 1);
+    lxs_assert_stack_at(L, 3);
     return 1;
 }
 
@@ -830,23 +1802,19 @@ static int libE_findi(lua_State* const L)
 /// TODO: return the matched index as well OR remove in favor of findi()
 static int libE_anyi(lua_State* const L)
 {
-    lxs_assert_stack_begin(L);
-
     luaL_checktype(L, 1, LUA_TTABLE);
     luaL_checktype(L, 2, LUA_TFUNCTION);
 
-    int len = luaL_getn(L, 1);
+    lua_settop(L, 2);
+    Table* t   = hvalue(L->base);
+    int    len = luaL_getn(L, 1);
     for (int i = 1; i <= len; ++i)
     {
-        lua_pushvalue(L, 2);
-        lua_pushinteger(L, i);
-        lua_rawgeti(L, 1, i);
-        lua_call(L, 2, 1);
+        tab_calli(L, t, i);
 
-        if (lua_toboolean(L, -1) != 0)
+        if (!l_isfalse(L->top - 1))
         {
             lua_pushboolean(L, 1);
-            lxs_assert_stack_end(L, 2);
             return 1;
         }
 
@@ -854,7 +1822,7 @@ static int libE_anyi(lua_State* const L)
     }
 
     lua_pushboolean(L, 0);
-    lxs_assert_stack_end(L, 1);
+    lxs_assert_stack_at(L, 3);
     return 1;
 }
 
@@ -965,12 +1933,14 @@ static int libE_any(lua_State* const L)
     return 1;
 }
 
-/// table.mapi(table, modifier)
+/// table.mapi(table, modifier[, inplace])
 ///
 /// Iterates over the vector part of a *table* invoking a *modifier* function
 /// for each index. The return value of the modifier will be the new entry
 /// value.
 /// The modifier has the following signature: *modifier(index, value)*.
+/// The result is a new table, unless *inplace* is true: then *table* itself
+/// is updated and returned.
 ///
 /// Example usage:
 ///     table.mapi(
@@ -988,19 +1958,22 @@ static int libE_mapi(lua_State* const L)
 {
     luaL_checktype(L, 1, LUA_TTABLE);
     luaL_checktype(L, 2, LUA_TFUNCTION);
+    bool inplace = lua_toboolean(L, 3) != 0;
     lua_settop(L, 2);
 
-    int len = luaL_getn(L, 1);
-    lua_createtable(L, max(0, len - 1), 0);
+    Table* t   = hvalue(L->base);
+    int    len = luaL_getn(L, 1);
+    if (inplace)
+        lua_pushvalue(L, 1);
+    else
+        lua_createtable(L, len, 0);
+    Table* r = hvalue(L->base + 2);
 
     for (int i = 1; i <= len; ++i)
     {
-        lua_pushvalue(L, 2);
-        lua_pushinteger(L, i);
-        lua_rawgeti(L, 1, i);
-        lua_call(L, 2, 1);
-
-        lua_rawseti(L, 3, i);
+        tab_calli(L, t, i);
+        tab_seti(L, r, i, L->top - 1);
+        lua_pop(L, 1);
     }
 
     lxs_assert_stack_at(L, 3);
@@ -1061,7 +2034,7 @@ static int libE_map(lua_State* const L)
     return 1;
 }
 
-/// table.retaini(table, selector)
+/// table.retaini(table, selector[, inplace])
 ///
 /// Iterates over the vector part of a *table* invoking a *selector* function to
 /// decide whether each index will be retained or be removed. Leaving only
@@ -1071,6 +2044,8 @@ static int libE_map(lua_State* const L)
 /// return a boolean.
 /// Returning *true* will cause the index to remain, returning *false* and the
 /// index will be removed.
+/// The retained values are returned as a new table, unless *inplace* is true:
+/// then *table* itself is compacted in a single pass and returned.
 ///
 /// Example usage:
 ///     table.retaini(
@@ -1084,29 +2059,41 @@ static int libE_retaini(lua_State* const L)
 {
     luaL_checktype(L, 1, LUA_TTABLE);
     luaL_checktype(L, 2, LUA_TFUNCTION);
-
+    bool inplace = lua_toboolean(L, 3) != 0;
     lua_settop(L, 2);
 
-    int len = luaL_getn(L, 1);
-    int j   = 0;
-    lua_createtable(L, max(0, len - 1), 0);
+    Table* t   = hvalue(L->base);
+    int    len = luaL_getn(L, 1);
+    int    j   = 0;
+    if (inplace)
+        lua_pushvalue(L, 1);
+    else
+        lua_createtable(L, len, 0);
+    Table* r = hvalue(L->base + 2);
 
     for (int i = 1; i <= len; ++i)
     {
-        lua_pushvalue(L, 2);
-        lua_pushinteger(L, i);
-        lua_rawgeti(L, 1, i);
-        lua_call(L, 2, 1);
+        tab_calli(L, t, i);
 
-        if (lua_toboolean(L, -1) != 0)
+        if (!l_isfalse(L->top - 1))
         {
-            lua_rawgeti(L, 1, i);
-            lua_rawseti(L, 3, ++j);
+            ++j;
+            if (!inplace || j != i)
+                tab_seti(L, r, j, tab_geti(t, i));
         }
 
         lua_pop(L, 1);
     }
 
+    // compacted in place: clear the now unused tail
+    if (inplace)
+    {
+        TValue nil;
+        setnilvalue(&nil);
+        for (int i = j + 1; i <= len; ++i)
+            tab_seti(L, r, i, &nil);
+    }
+
     lxs_assert_stack_at(L, 3);
     return 1;
 }
@@ -1199,22 +2186,18 @@ static int libE_alli(lua_State* const L)
     luaL_checktype(L, 2, LUA_TFUNCTION);
     lua_settop(L, 2);
 
-    int len = luaL_getn(L, 1);
-    int j   = 0;
-    lua_createtable(L, max(0, len - 1), 0);
+    Table* t   = hvalue(L->base);
+    int    len = luaL_getn(L, 1);
+    int    j   = 0;
+    lua_createtable(L, len, 0);
+    Table* r = hvalue(L->base + 2);
 
     for (int i = 1; i <= len; ++i)
     {
-        lua_pushvalue(L, 2);
-        lua_pushinteger(L, i);
-        lua_rawgeti(L, 1, i);
-        lua_call(L, 2, 1);
+        tab_calli(L, t, i);
 
-        if (lua_toboolean(L, -1) != 0)
-        {
-            lua_rawgeti(L, 1, i);
-            lua_rawseti(L, 3, ++j);
-        }
+        if (!l_isfalse(L->top - 1))
+            tab_seti(L, r, ++j, tab_geti(t, i));
 
         lua_pop(L, 1);
     }
@@ -1294,7 +2277,10 @@ static const luaL_Reg libE_funcs[] = {
     { "setn"     , libE_setn     },
     { "sort"     , libE_sort     },
 #if LUAXS_EXTEND_TABLIB
+    { "stable_sort", libE_stable_sort },
     { "create",   libE_create   },
+    { "move",     libE_move     },
+    { "clear",    libE_clear    },
     { "countall", libE_countall }, // TODO: think of a better name
     //{ "joinall",  lxs_tablib_joinall   },
 // vectors
@@ -5,7 +5,9 @@
 */
 
 #include <ctype.h>
+#include <locale.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -87,7 +89,130 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
 }
 
 
-int luaO_str2d (const char *s, lua_Number *result) {
+#if LUAXS_CORE_NUMCONV
+/*
+** {======================================================
+** Number conversions
+**
+** Both directions try an exact fast path first and fall back to the CRT for
+** everything else (hex, inf/nan, long mantissas, large exponents, exponent
+** notation on output). The fast paths produce exactly what strtod and
+** sprintf(LUA_NUMBER_FMT) do in the "C" locale; the fallbacks are made to
+** agree by swapping the locale's decimal point for '.'.
+** =======================================================
+*/
+
+/* lxs_string.cpp */
+size_t lxs_sfmt_uint (char *buf, uint64_t v);
+int lxs_sfmt_general (char *buf, double x, int prec);
+
+#define NUM_PRECISION	14	/* of LUA_NUMBER_FMT */
+#define NUM_MAXDIGITS	19	/* mantissa digits that fit into 64 bits */
+#define NUM_MAXPOW10	22	/* largest exact power of ten */
+
+static const lua_Number num_pow10[NUM_MAXPOW10 + 1] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static char num_point (void) {
+  const char *p = localeconv()->decimal_point;
+  return (p[0] != '\0' && p[1] == '\0') ? p[0] : '.';
+}
+
+
+static int num_signbit (lua_Number n) {
+  uint64_t u;
+  memcpy(&u, &n, sizeof(u));
+  return (u >> 63) != 0;
+}
+
+
+int luaO_num2str (char *s, lua_Number n) {
+  int l;
+  char point;
+  /* %.14g prints integral values below 1e14 in full */
+  if (n > -num_pow10[NUM_PRECISION] && n < num_pow10[NUM_PRECISION] &&
+      n == cast_num(cast(int64_t, n))) {
+    int64_t i = cast(int64_t, n);
+    char *p = s;
+    if (i < 0 || (i == 0 && num_signbit(n))) *p++ = '-';
+    return cast_int(p - s) + cast_int(lxs_sfmt_uint(p, cast(uint64_t, i < 0 ? -i : i)));
+  }
+  l = lxs_sfmt_general(s, n, NUM_PRECISION);
+  if (l >= 0)
+    return l;
+  lua_number2str(s, n);
+  point = num_point();
+  if (point != '.') {
+    char *p = strchr(s, point);
+    if (p) *p = '.';
+  }
+  return cast_int(strlen(s));
+}
+
+
+/*
+** Parses [space] [sign] digits [. digits] [e [sign] digits] [space] with
+** at most NUM_MAXDIGITS significant digits, if the value is an exactly
+** representable mantissa times an exact power of ten (so that a single
+** rounding yields what strtod returns).
+*/
+static int str2d_fast (const char *s, lua_Number *result) {
+  uint64_t m = 0;
+  int nd = 0;  /* significant digits */
+  int any = 0;
+  int e = 0;
+  int neg = 0;
+  lua_Number r;
+  while (isspace(cast(unsigned char, *s))) s++;
+  if (*s == '-') { neg = 1; s++; }
+  else if (*s == '+') s++;
+  for (; isdigit(cast(unsigned char, *s)); s++, any = 1) {
+    if (m == 0 && *s == '0') continue;  /* leading zero */
+    if (++nd > NUM_MAXDIGITS) return 0;
+    m = m * 10 + (*s - '0');
+  }
+  if (*s == '.') {
+    for (s++; isdigit(cast(unsigned char, *s)); s++, any = 1) {
+      if (m == 0 && *s == '0') { e--; continue; }
+      if (++nd > NUM_MAXDIGITS) return 0;
+      m = m * 10 + (*s - '0');
+      e--;
+    }
+  }
+  if (!any) return 0;
+  if (*s == 'e' || *s == 'E') {
+    int eneg = 0;
+    int x = 0;
+    s++;
+    if (*s == '-') { eneg = 1; s++; }
+    else if (*s == '+') s++;
+    if (!isdigit(cast(unsigned char, *s))) return 0;
+    for (; isdigit(cast(unsigned char, *s)); s++) {
+      if (x > 1000) return 0;
+      x = x * 10 + (*s - '0');
+    }
+    e += eneg ? -x : x;
+  }
+  while (isspace(cast(unsigned char, *s))) s++;
+  if (*s != '\0') return 0;
+  if (m == 0)
+    r = 0;
+  else if (m <= (cast(uint64_t, 1) << 53) &&
+           e >= -NUM_MAXPOW10 && e <= NUM_MAXPOW10)
+    r = (e < 0) ? cast_num(cast(int64_t, m)) / num_pow10[-e]
+                : cast_num(cast(int64_t, m)) * num_pow10[e];
+  else
+    return 0;
+  *result = neg ? -r : r;
+  return 1;
+}
+#endif
+
+
+static int str2d_crt (const char *s, lua_Number *result) {
   char *endptr;
   *result = lua_str2number(s, &endptr);
   if (endptr == s) return 0;  /* conversion failed */
@@ -100,6 +225,32 @@ int luaO_str2d (const char *s, lua_Number *result) {
 }
 
 
+#if LUAXS_CORE_NUMCONV
+/* retries s with '.' replaced by the locale's decimal point */
+static int str2d_point (const char *s, lua_Number *result) {
+  char buff[200];
+  const char *p = strchr(s, '.');
+  char point = num_point();
+  if (point == '.' || p == NULL || strlen(s) >= sizeof(buff)) return 0;
+  strcpy(buff, s);
+  buff[p - s] = point;
+  return str2d_crt(buff, result);
+}
+
+/* }====================================================== */
+#endif
+
+
+int luaO_str2d (const char *s, lua_Number *result) {
+#if LUAXS_CORE_NUMCONV
+  return str2d_fast(s, result) || str2d_crt(s, result) ||
+         str2d_point(s, result);
+#else
+  return str2d_crt(s, result);
+#endif
+}
+
+
 
 static void pushstr (lua_State *L, const char *str) {
   setsvalue2s(L, L->top, luaS_new(L, str));
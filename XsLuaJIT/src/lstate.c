@@ -77,6 +77,9 @@ static void f_luaopen (lua_State *L, void *ud) {
   luaT_init(L);
   luaX_init(L);
   luaS_fix(luaS_newliteral(L, MEMERRMSG));
+#if LUAXS_STR_PERSISTENT_BUFFER
+  lxs_spb_create(L, L);
+#endif
   g->GCthreshold = 4*g->totalbytes;
   luaJIT_initstate(L);
 }
@@ -110,10 +113,14 @@ static void close_state (lua_State *L) {
   global_State *g = G(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeall(L);  /* collect all objects */
+#if LUAXS_STR_PERSISTENT_BUFFER
+  lxs_spb_destroy(L, L);  /* after all __gc metamethods and other threads */
+#endif
   luaJIT_freestate(L);
   lua_assert(g->rootgc == obj2gco(L));
   lua_assert(g->strt.nuse == 0);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
+  luaM_freearray(L, G(L)->strt.old, G(L)->strt.oldsize, TString *);
   luaZ_freebuffer(L, &g->buff);
   freestack(L, L);
   lua_assert(g->totalbytes == sizeof(LG));
@@ -180,6 +187,13 @@ LUA_API lua_State* lua_newstate(lua_Alloc f, void* ud)
     g->strt.size = 0;
     g->strt.nuse = 0;
     g->strt.hash = NULL;
+    g->strt.old = NULL;
+    g->strt.oldsize = 0;
+    g->strt.migrated = 0;
+#if LUAXS_CORE_STRSTATS
+    g->strt.lookups = g->strt.hits = 0;
+    g->strt.probes = g->strt.collisions = 0;
+#endif
     setnilvalue(registry(L));
     luaZ_initbuffer(L, &g->buff);
     g->panic = NULL;
@@ -206,10 +220,6 @@ LUA_API lua_State* lua_newstate(lua_Alloc f, void* ud)
     }
     else
     {
-#if LUAXS_STR_PERSISTENT_BUFFER
-        lxs_spb_create(L, NULL);
-#endif
-
 #if LUAXS_EXTENT_SCRIPTS_ONLY
         lxs_incr_newstate_cnt(L);
         lxs_set_mt(L);
@@ -238,10 +248,6 @@ LUA_API void lua_close(lua_State* L)
     L = G(L)->mainthread;  /* only the main thread can be closed */
     lua_lock(L);
 
-#if LUAXS_STR_PERSISTENT_BUFFER
-    lxs_spb_destroy(L, NULL);
-#endif
-
     luaF_close(L, L->stack);  /* close all upvalues for this thread */
     luaC_separateudata(L, 1);  /* separate udata that have GC metamethods */
     L->errfunc = 0;  /* no error function during GC metamethods */
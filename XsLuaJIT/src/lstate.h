@@ -16,15 +16,17 @@
 #  include "lcoco.h"
 #endif
 
-#if LUAXS_STR_PERSISTENT_BUFFER
-#  include "lxs_string.hpp"
-#endif
-
-
 struct lua_longjmp;  /* defined in ldo.c */
 struct jit_State;  /* defined in ljit.c */
 typedef int (*luaJIT_GateLJ)(lua_State *L, StkId func, int nresults);
 
+#if LUAXS_STR_PERSISTENT_BUFFER
+struct _lxs_spb;  /* defined in lxs_string.hpp */
+void lxs_spb_create(lua_State *L, lua_State *L1);
+void lxs_spb_destroy(lua_State *L, lua_State *L1);
+void lxs_spb_trim(lua_State *L, lua_State *L1);
+#endif
+
 
 /* table of globals */
 #define gt(L)	(&L->l_gt)
@@ -48,6 +50,15 @@ typedef struct stringtable {
   GCObject **hash;
   lu_int32 nuse;  /* number of elements */
   int size;
+  GCObject **old;  /* previous buckets while resizing (see luaS_resize) */
+  int oldsize;
+  int migrated;  /* buckets of `old' already moved to `hash' */
+#if LUAXS_CORE_STRSTATS
+  lu_mem lookups;  /* luaS_newlstr calls */
+  lu_mem hits;  /* lookups finding an existing string */
+  lu_mem probes;  /* chain entries visited */
+  lu_mem collisions;  /* entries with same hash and length, other contents */
+#endif
 } stringtable;
 
 
@@ -138,7 +149,7 @@ struct lua_State {
     struct lua_longjmp *errorJmp;  /* current error recover point */
     ptrdiff_t errfunc;  /* current error handling function (stack index) */
 #if LUAXS_STR_PERSISTENT_BUFFER
-    lxs_string* pb;
+    struct _lxs_spb *pb;  /* persistent buffer levels */
 #endif
 };
 
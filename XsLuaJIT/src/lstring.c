@@ -17,33 +17,77 @@
 #include "lstate.h"
 #include "lstring.h"
 
+#if LUAXS_CORE_STRHASH
+#include "lxs_skernel.h"
+#endif
 
+#if LUAXS_CORE_STRSTATS
+#define strtcount(tb,c)	((tb)->c++)
+#else
+#define strtcount(tb,c)	((void)0)
+#endif
 
+
+
+/*
+** Resizing only allocates the new bucket array; the strings are moved over
+** by luaS_migrate, LUAXS_CORE_STRMIGRATE buckets at a time, on insertion and
+** by the collector. Until then the old array's unmigrated buckets are
+** searched as well. GCSsweepstring walks the old array before the current
+** one, so migrating never moves an unswept string behind the sweep (see
+** lgc.c); the old array is kept until that phase is over.
+*/
 void luaS_resize (lua_State *L, int newsize) {
   GCObject **newhash;
-  stringtable *tb;
+  stringtable *tb = &G(L)->strt;
   int i;
-  if (G(L)->gcstate == GCSsweepstring)
-    return;  /* cannot resize during GC traverse */
+  if (tb->old != NULL)
+    return;  /* still migrating from the last resize */
   newhash = luaM_newvector(L, newsize, GCObject *);
-  tb = &G(L)->strt;
   for (i=0; i<newsize; i++) newhash[i] = NULL;
-  /* rehash */
-  for (i=0; i<tb->size; i++) {
-    GCObject *p = tb->hash[i];
+  if (tb->size == 0) {  /* creating the table? */
+    tb->size = newsize;
+    tb->hash = newhash;
+    return;
+  }
+  tb->old = tb->hash;
+  tb->oldsize = tb->size;
+  tb->migrated = 0;
+  tb->size = newsize;
+  tb->hash = newhash;
+#if LUAXS_CORE_STRMIGRATE == 0
+  luaS_migrate(L, tb->oldsize);  /* rehash in one go */
+#endif
+}
+
+
+/*
+** moves the next n buckets of the old array into the current one
+*/
+void luaS_migrate (lua_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->old == NULL)
+    return;
+  for (; n > 0 && tb->migrated < tb->oldsize; n--) {
+    GCObject *p = tb->old[tb->migrated];
+    tb->old[tb->migrated++] = NULL;
     while (p) {  /* for each node in the list */
       GCObject *next = p->gch.next;  /* save next */
       unsigned int h = gco2ts(p)->hash;
-      int h1 = lmod(h, newsize);  /* new position */
-      lua_assert(cast_int(h%newsize) == lmod(h, newsize));
-      p->gch.next = newhash[h1];  /* chain it */
-      newhash[h1] = p;
+      int h1 = lmod(h, tb->size);  /* new position */
+      lua_assert(cast_int(h%tb->size) == lmod(h, tb->size));
+      p->gch.next = tb->hash[h1];  /* chain it */
+      tb->hash[h1] = p;
       p = next;
     }
   }
-  luaM_freearray(L, tb->hash, tb->size, TString *);
-  tb->size = newsize;
-  tb->hash = newhash;
+  if (tb->migrated >= tb->oldsize &&  /* done? */
+      G(L)->gcstate != GCSsweepstring) {  /* and not being swept? */
+    luaM_freearray(L, tb->old, tb->oldsize, TString *);
+    tb->old = NULL;
+    tb->oldsize = 0;
+    tb->migrated = 0;
+  }
 }
 
 
@@ -66,33 +110,113 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   ts->tsv.next = tb->hash[h];  /* chain new entry */
   tb->hash[h] = obj2gco(ts);
   tb->nuse++;
+  luaS_migrate(L, LUAXS_CORE_STRMIGRATE);
   if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
     luaS_resize(L, tb->size*2);  /* too crowded */
   return ts;
 }
 
 
-TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
-  GCObject *o;
+#if LUAXS_CORE_STRHASH
+/*
+** hashes all characters of strings up to LUAXS_CORE_STRHASH characters;
+** of longer ones the first and last LUAXS_CORE_STRHASH/2
+*/
+static unsigned int hashstr (const char *str, size_t l) {
+  unsigned int h = cast(unsigned int, l);  /* seed */
+  size_t half = LUAXS_CORE_STRHASH/2;
+  if (l <= LUAXS_CORE_STRHASH)
+    return lxs_khash(str, l, h);
+  h = lxs_khash(str, half, h);
+  return lxs_khash(str + l - half, half, h);
+}
+#else
+static unsigned int hashstr (const char *str, size_t l) {
   unsigned int h = cast(unsigned int, l);  /* seed */
   size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
   size_t l1;
   for (l1=l; l1>=step; l1-=step)  /* compute hash */
     h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
-  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
-       o != NULL;
-       o = o->gch.next) {
+  return h;
+}
+#endif
+
+
+static TString *findstr (lua_State *L, GCObject *o, const char *str,
+                                        size_t l, unsigned int h) {
+  stringtable *tb = &G(L)->strt;
+  for (; o != NULL; o = o->gch.next) {
     TString *ts = rawgco2ts(o);
-    if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0)) {
-      /* string may be dead */
-      if (isdead(G(L), o)) changewhite(o);
-      return ts;
+    strtcount(tb, probes);
+    if (ts->tsv.hash == h && ts->tsv.len == l) {
+      if (memcmp(str, getstr(ts), l) == 0) {
+        strtcount(tb, hits);
+        /* string may be dead */
+        if (isdead(G(L), o)) changewhite(o);
+        return ts;
+      }
+      strtcount(tb, collisions);
     }
   }
+  return NULL;
+}
+
+
+TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
+  TString *ts;
+  stringtable *tb = &G(L)->strt;
+  unsigned int h = hashstr(str, l);
+  strtcount(tb, lookups);
+  if (tb->old != NULL) {  /* migrating? */
+    int i = lmod(h, tb->oldsize);
+    if (i >= tb->migrated && (ts = findstr(L, tb->old[i], str, l, h)) != NULL)
+      return ts;
+  }
+  ts = findstr(L, tb->hash[lmod(h, tb->size)], str, l, h);
+  if (ts != NULL)
+    return ts;
   return newlstr(L, str, l, h);  /* not found */
 }
 
 
+#if LUAXS_CORE_STRSTATS
+LUA_API void lxs_strtstats (lua_State *L, lxs_strtstat *stats, bool reset) {
+  stringtable *tb;
+  int i;
+  lua_lock(L);
+  tb = &G(L)->strt;
+  stats->size = cast(uint32_t, tb->size);
+  stats->nuse = cast(uint32_t, tb->nuse);
+  stats->empty = 0;
+  stats->maxchain = 0;
+  for (i = 0; i < tb->size; i++) {
+    uint32_t n = 0;
+    GCObject *o;
+    for (o = tb->hash[i]; o != NULL; o = o->gch.next) n++;
+    if (n == 0) stats->empty++;
+    else if (n > stats->maxchain) stats->maxchain = n;
+  }
+  stats->pending = 0;
+  if (tb->old != NULL) {
+    stats->pending = cast(uint32_t, tb->oldsize - tb->migrated);
+    for (i = tb->migrated; i < tb->oldsize; i++) {
+      uint32_t n = 0;
+      GCObject *o;
+      for (o = tb->old[i]; o != NULL; o = o->gch.next) n++;
+      if (n > stats->maxchain) stats->maxchain = n;
+    }
+  }
+  stats->lookups = tb->lookups;
+  stats->hits = tb->hits;
+  stats->probes = tb->probes;
+  stats->collisions = tb->collisions;
+  if (reset)
+    tb->lookups = tb->hits = tb->probes = tb->collisions = 0;
+  lua_unlock(L);
+}
+#endif
+
+
 Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
   Udata *u;
   if (s > MAX_SIZET - sizeof(Udata))
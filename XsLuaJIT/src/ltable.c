@@ -330,6 +330,31 @@ void luaH_resizearray (lua_State *L, Table *t, int nasize) {
 }
 
 
+#if LUAXS_EXTEND_TABLIB
+/*
+** Removes all entries of `t'. With `keep' both parts retain their size (and
+** the hash part's free list is reset), otherwise both are released.
+*/
+void luaH_clear (lua_State *L, Table *t, int keep) {
+  int i;
+  for (i=0; i<t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (t->node != dummynode) {
+    int size = sizenode(t);
+    for (i=0; i<size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = NULL;
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free */
+  }
+  if (!keep)
+    resize(L, t, 0, 0);
+}
+#endif
+
+
 static void rehash (lua_State *L, Table *t, const TValue *ek) {
   int nasize, na;
   int nums[MAXBITS+1];  /* nums[i] = number of keys between 2^(i-1) and 2^i */
@@ -30,6 +30,9 @@ LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
 LUAI_FUNC TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key);
+#if LUAXS_EXTEND_TABLIB
+LUAI_FUNC void luaH_clear (lua_State *L, Table *t, int keep);
+#endif
 
 
 #if defined(LUA_DEBUG)
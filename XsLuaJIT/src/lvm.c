@@ -50,8 +50,13 @@ int luaV_tostring (lua_State *L, StkId obj) {
   else {
     char s[LUAI_MAXNUMBER2STR];
     lua_Number n = nvalue(obj);
+#if LUAXS_CORE_NUMCONV
+    int l = luaO_num2str(s, n);
+    setsvalue2s(L, obj, luaS_newlstr(L, s, l));
+#else
     lua_number2str(s, n);
     setsvalue2s(L, obj, luaS_new(L, s));
+#endif
     return 1;
   }
 }
@@ -8,6 +8,8 @@ extern "C" {
 #include "lualib.h"
 
 #include "lobject.h"
+#include "lxs_skernel.h"
+#include "lxs_string.hpp"
 
 #include <stdio.h>
 #include <string.h>
@@ -15,7 +17,6 @@ extern "C" {
 
 #include "leastl.hpp"
 
-#include <eastl/bitset.h>
 #include <eastl/utility.h>
 #include <eastl/hash_map.h>
 
@@ -63,53 +64,106 @@ int lxs_split(lua_State* const L,
         return 1;
     }
 
-    eastl::bitset<255> seps_lookup;
-    char sep; // to ensure only a single pointer-deref per separator
-    while ((sep = *seps))
-    {
-        seps_lookup[static_cast<unsigned char>(sep)] = true;
-        seps++;
-    }
+    lxs_kset seps_lookup;
+    lxs_kset_init(&seps_lookup, seps, strlen(seps));
 
     const char* front = src;
     const char* end   = src + len;
 
     int i = 0;
-    bool in_token = false;
-    for (const char* it = front; it != end; ++it)
+    for (;;)
     {
-        if (seps_lookup[static_cast<unsigned char>(*it)])
+        const char* it = lxs_kfindset(front, end - front, &seps_lookup);
+        if (!it)
         {
-            if (in_token)
-            {
-                lua_pushlstring(L, front, it - front);
-                lua_rawseti(L, -2, ++i);
-
-                in_token = false;
-            }
-            else
-            {
-                lua_pushliteral(L, "");
-                lua_rawseti(L, -2, ++i);
-            }
-        }
-        else if (!in_token)
-        {
-            front = it;
-            in_token = true;
+            lua_pushlstring(L, front, end - front);
+            lua_rawseti(L, -2, ++i);
+            break;
         }
+
+        lua_pushlstring(L, front, it - front);
+        lua_rawseti(L, -2, ++i);
+        front = it + 1;
     }
-    if (in_token)
+
+    lxs_assert_stack_end(L, 1);
+    return 1;
+}
+
+/// Iterator state of lxs_gsplit; the source is upvalue 1.
+typedef struct _lxs_gsplit_state
+{
+    lxs_kset set;
+    size_t   pos;    // offset of the next token
+    bool     done;
+    bool     ranges; // yield (offset, length) instead of strings
+} lxs_gsplit_state;
+
+static int lxs_gsplit_aux(lua_State* const L)
+{
+    lxs_gsplit_state* st = static_cast<lxs_gsplit_state*>(
+        lua_touserdata(L, lua_upvalueindex(2))
+    );
+    if (st->done)
+        return 0;
+
+    // re-read every step; a buffer may have changed in between
+    size_t      len;
+    const char* src = lxs_stolstring(L, lua_upvalueindex(1), &len);
+    if (st->pos > len)
     {
-        lua_pushlstring(L, front, end - front);
-        lua_rawseti(L, -2, ++i);
+        st->done = true;
+        return 0;
     }
+
+    const char* front = src + st->pos;
+    const char* it    = lxs_kfindset(front, len - st->pos, &st->set);
+
+    size_t tlen;
+    if (it)
+        tlen = it - front;
     else
     {
-        lua_pushliteral(L, "");
-        lua_rawseti(L, -2, ++i);
+        tlen     = len - st->pos;
+        st->done = true;
     }
 
+    const size_t offset = st->pos;
+    st->pos += tlen + 1u;
+
+    if (st->ranges)
+    {
+        lua_pushinteger(L, static_cast<lua_Integer>(offset + 1u));
+        lua_pushinteger(L, static_cast<lua_Integer>(tlen));
+        return 2;
+    }
+
+    lua_pushlstring(L, front, tlen);
+    return 1;
+}
+
+int lxs_gsplit(lua_State* const L,
+               int narg,
+               const char* seps,
+               size_t seps_len,
+               bool ranges)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, seps && seps_len > 0);
+    lxs_assert_stack_begin(L);
+
+    lua_pushvalue(L, narg);
+
+    lxs_gsplit_state* st = static_cast<lxs_gsplit_state*>(
+        lua_newuserdata(L, sizeof(lxs_gsplit_state))
+    );
+    lxs_kset_init(&st->set, seps, seps_len);
+    st->pos    = 0u;
+    st->done   = false;
+    st->ranges = ranges;
+
+    lua_pushcclosure(L, lxs_gsplit_aux, 2);
+
     lxs_assert_stack_end(L, 1);
     return 1;
 }
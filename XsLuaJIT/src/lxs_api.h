@@ -52,12 +52,55 @@ LUA_API const char* lxs_tersesource(const char* path);
 #endif // LUAXS_CLOG
 
 
+#if LUAXS_CORE_STRSTATS
+
+/// Interned string table statistics; the counters since the last reset.
+typedef struct _lxs_strtstat
+{
+    uint32_t size;       // buckets
+    uint32_t nuse;       // interned strings
+    uint32_t empty;      // empty buckets
+    uint32_t maxchain;   // longest chain
+    uint32_t pending;    // buckets left to migrate after a resize
+    size_t   lookups;
+    size_t   hits;
+    size_t   probes;     // chain entries visited
+    size_t   collisions; // same hash and length, different contents
+} lxs_strtstat;
+
+LUA_API void lxs_strtstats(lua_State* L, lxs_strtstat* stats, bool reset);
+
+#endif // LUAXS_CORE_STRSTATS
+
+
 
 //==============================================================================
 // Internal C APIs
 //==============================================================================
 
 int lxs_split(lua_State* const L, const char* src, size_t len, const char* seps);
+int lxs_gsplit(lua_State* const L,
+               int narg,
+               const char* seps,
+               size_t seps_len,
+               bool ranges);
+
+#if LUAXS_STR_PATTERN_CACHE
+void   lxs_pmflush(lua_State* const L);
+#endif
+
+#if LUAXS_ADDLIB_BUFFER
+/// Buffer (lib_buffer) access for C libraries. lxs_bdata returns the whole
+/// content, lxs_bread the content from the read cursor on; lxs_bskip advances
+/// the cursor. lxs_bpatch overwrites existing content.
+bool        lxs_bisbuffer(lua_State* const L, int narg);
+void        lxs_bappend(lua_State* const L, int narg, const char* str, size_t len);
+size_t      lxs_blen(lua_State* const L, int narg);
+void        lxs_bpatch(lua_State* const L, int narg, size_t offset, const char* str, size_t len);
+const char* lxs_bdata(lua_State* const L, int narg, size_t* len);
+const char* lxs_bread(lua_State* const L, int narg, size_t* len);
+void        lxs_bskip(lua_State* const L, int narg, size_t len);
+#endif
 
 size_t lxs_countfuncs(const luaL_Reg* funcs);
 size_t lxs_counttable(lua_State* const L, int narg);
@@ -111,6 +154,8 @@ enum XS_CPU {
     XS_CPU_MMX,
     XS_CPU_3DNOW_EXT,
     XS_CPU_3DNOW,
+    XS_CPU_SSE2,
+    XS_CPU_AVX2,
     XS_CPU__MAX
 };
 
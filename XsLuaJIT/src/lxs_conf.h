@@ -141,6 +141,35 @@
     #define LUAXS_STR_INITIAL_CAPACITY 256
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_STR_INLINE_CAPACITY
+///
+/// Defined to a positive integer including zero (to disable) or undefined.
+/// Size in bytes of the storage embedded in every lxs_string (including the
+/// terminating '\0'). Strings start out using this inline storage and only
+/// allocate from the heap once they grow past it, at which point at least
+/// LUAXS_STR_INITIAL_CAPACITY bytes are allocated.
+///
+/// The default of 52 makes sizeof(lxs_string) 64 bytes on Win32.
+/// Using a value of 0 disables inline storage; every lxs_string then
+/// allocates LUAXS_STR_INITIAL_CAPACITY bytes upfront.
+///
+#ifndef LUAXS_STR_INLINE_CAPACITY
+    #define LUAXS_STR_INLINE_CAPACITY 52
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_STR_ALLOC_STATS
+///
+/// Defined as 0/1 or undefined.
+/// If enabled, lxs_string counts its heap allocations, reallocations and
+/// frees. The counters are available via lxs_sallocstats() and from Lua via
+/// buffer.allocstats([reset]); see lib/lxsext_c_bench.lua.
+///
+#ifndef LUAXS_STR_ALLOC_STATS
+    #define LUAXS_STR_ALLOC_STATS LUAXS_DEBUG
+#endif
+
 
 ////////////////////////////////////////////////////////////////////////////////
 /// LUAXS_STR_GROWTH_FACTOR
@@ -201,25 +230,93 @@
 #endif
 
 
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_STR_CHUNK_SIZE
+///
+/// Defined to a positive integer or undefined.
+/// Specifies the default chunk size of chunked buffers (see buffer:chunked).
+/// Chunked buffers append into a list of fixed-size chunks instead of growing
+/// one contiguous block; appends larger than a chunk get a chunk of their own.
+/// Chunks are exempt from LUAXS_STR_MAX_SINGLE_EXPANSION and
+/// LUAXS_STR_MAX_TOTAL_EXPANSION.
+///
+#ifndef LUAXS_STR_CHUNK_SIZE
+    #define LUAXS_STR_CHUNK_SIZE 65536
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_STR_SIMD
+///
+/// Defined as 0/1 or undefined.
+/// Controls the byte scanning kernels (lxs_skernel.h) behind lxs_string's
+/// search, case mapping, trim and split functions.
+/// If enabled, the widest variant the CPU supports (SSE2, SSSE3 or AVX2) is
+/// selected once by lxs_kinit(). AVX2 requires a toolset newer than VS2008.
+/// If disabled, the scalar (CRT) variants are always used.
+///
+#ifndef LUAXS_STR_SIMD
+    #define LUAXS_STR_SIMD 1
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_STR_PATTERN_CACHE
+///
+/// Defined to a non-negative integer or undefined.
+/// Specifies how many compiled patterns string.find, match, gmatch and gsub
+/// keep per Lua state. Patterns are compiled once into items with precomputed
+/// character class maps and a literal prefix or first character set, used to
+/// skip positions that cannot start a match. The least recently used pattern
+/// is evicted first; patterns longer than 256 characters are not compiled.
+/// If 0 patterns are interpreted on every call.
+///
+#ifndef LUAXS_STR_PATTERN_CACHE
+    #define LUAXS_STR_PATTERN_CACHE 32
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_STR_FORMAT_CACHE
+///
+/// Defined to a non-negative integer or undefined.
+/// Specifies how many parsed format strings string.format keeps per Lua
+/// state. Each format is split once into literal runs and conversions;
+/// integer, string and most %f/%g conversions are then written without going
+/// through sprintf. The least recently used format is evicted first; formats
+/// longer than 1024 characters are not cached.
+/// If 0 formats are parsed on every call.
+///
+#ifndef LUAXS_STR_FORMAT_CACHE
+    #define LUAXS_STR_FORMAT_CACHE 32
+#endif
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /// LUAXS_STR_PERSISTENT_BUFFER
 /// 
-/// EXPERIMENTAL: Currently enabling this results in a crash when quitting.
+/// If set to 1, every Lua thread gets a persistent string buffer; much like
+/// LuaJIT 2 does. It replaces luaL_Buffer in lstrlib, ltablib and lauxlib
+/// (see the xbuf_* macros) and avoids a stack slot and an intermediate string
+/// per luaL_Buffer flush.
 ///
-/// If set to 1, a persistent buffer is created; much like LuaJIT 2 does.
-/// Which is then available for LuaJIT's internal operations and can act as a
-/// viable replacement luaL_Buffer with dynamic memory management.
-/// Currently a few functions in lstrlib and ltablib use this.
+/// The buffer is a chain of levels: a function holding one level may call
+/// back into Lua (gsub, tostring, __gc) and callees acquire the next level.
+/// Levels held by frames that were unwound by an error are reclaimed.
+/// During garbage collection idle levels are shrunk to their recent peak (at
+/// least LUAXS_PB_INITIAL_CAPACITY) and nesting levels unused for a whole
+/// cycle are freed.
 /// 
 #ifndef LUAXS_STR_PERSISTENT_BUFFER
-    #define LUAXS_STR_PERSISTENT_BUFFER 0
+    #define LUAXS_STR_PERSISTENT_BUFFER 1
 #endif
 
 ////////////////////////////////////////////////////////////////////////////////
 /// LUAXS_PB_INITIAL_CAPACITY (LUAXS_STR_PERSISTENT_BUFFER)
 ///
 /// Defined to a positive power of 2 integer or undefined.
-/// Specifies the default allocation size of persistent buffers.
+/// Specifies the default allocation size of persistent buffers. Buffers are
+/// never shrunk below this size.
 /// 
 #ifndef LUAXS_PB_INITIAL_CAPACITY
     #define LUAXS_PB_INITIAL_CAPACITY 1024
@@ -230,8 +327,10 @@
 /// 
 /// Defined as 0/1 or undefined.
 /// Changes how persistent buffers are allocated for Lua threads (coroutines).
-/// If enabled persistent buffers are only allocated when needed.
+/// If enabled persistent buffers are only allocated when first needed and
+/// freed again once a coroutine did not use them for a whole GC cycle.
 /// If disabled persistent buffers are always allocated.
+/// The main thread's buffer is always allocated.
 /// 
 #ifndef LUAXS_PB_ONDEMAND_FIBERS
     #define LUAXS_PB_ONDEMAND_FIBERS 0
@@ -470,6 +569,86 @@
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_CORE_NUMCONV
+///
+/// Defined to 0/1 or undefined.
+/// If enabled, number to string conversions (tostring, concatenation) print
+/// integral values and most %.14g results without sprintf, and string to
+/// number conversions (tonumber, arithmetic on strings, the lexer) parse
+/// plain decimals with at most 19 digits and small exponents without strtod.
+/// Both are independent of the current locale: the decimal point is always
+/// '.', also where they fall back to the CRT.
+/// If disabled, lua_number2str and lua_str2number (sprintf/strtod) are used.
+///
+#ifndef LUAXS_CORE_NUMCONV
+    #define LUAXS_CORE_NUMCONV 1
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_CORE_STRHASH
+///
+/// Defined to a non-negative integer or undefined.
+/// Strings of up to this many characters are interned by a hash of all their
+/// characters (lxs_khash: CRC32C, via SSE4.2 where available); of longer
+/// strings the first and last LUAXS_CORE_STRHASH/2 characters are hashed.
+/// If 0 Lua's hash is used, which samples at most 32 characters of any string
+/// and therefore collides on long strings sharing structure (paths).
+///
+#ifndef LUAXS_CORE_STRHASH
+    #define LUAXS_CORE_STRHASH 256
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_CORE_STRMIGRATE
+///
+/// Defined to a non-negative integer or undefined.
+/// Growing or shrinking the string table allocates the new bucket array only;
+/// this many buckets of the old one are then moved over per string created
+/// and per garbage collector step, and lookups search both arrays meanwhile.
+/// If 0 all strings are rehashed at once, as Lua does.
+///
+#ifndef LUAXS_CORE_STRMIGRATE
+    #define LUAXS_CORE_STRMIGRATE 4
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_CORE_STRSTATS
+///
+/// Defined as 0/1 or undefined.
+/// If enabled, the string table counts lookups, hits, chain entries visited
+/// and hash collisions. The counters and chain statistics are available via
+/// lxs_strtstats() and from Lua via debug.strstats([reset]).
+///
+#ifndef LUAXS_CORE_STRSTATS
+    #define LUAXS_CORE_STRSTATS LUAXS_DEBUG
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_TAB_SORT
+///
+/// Defined to 0/1 or undefined.
+/// If enabled, table.sort sorts tables whose elements all live in the array
+/// part in place using pattern-defeating quicksort (introsort with heap sort
+/// as the worst case fallback, insertion sort for short and nearly sorted
+/// ranges). Without an order function, arrays of only numbers or only strings
+/// (in the "C" locale) are compared without going through lua_lessthan.
+/// If an order function resizes the table's array part, sorting fails.
+/// If disabled, or for tables with elements in the hash part, Lua's quicksort
+/// is used.
+///
+#ifndef LUAXS_TAB_SORT
+    #define LUAXS_TAB_SORT 1
+#endif
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /// LUAXS_EXTEND_*
 ///
@@ -523,8 +702,15 @@
 /// LUAXS_ADDLIB_MARSHAL:
 ///     Provides a serialization library, which is aware of cycles and 
 ///     functions as well as fast.
-///     One caveat though is, it serializes to a string and doesn't provide
-///     capabilities to instead use a file.
+///     Serializes to a string or streams directly to/from a file or buffer.
+///     Format 2 strings and buffers can also be opened lazily, decoding
+///     tables when they are first indexed. Format 2 data can be compressed
+///     while it is written (lxs_lz.h).
+///
+/// LUAXS_ADDLIB_CONTAINER:
+///     Provides sets, maps and sorted vector maps, ordered or hashed, keyed
+///     by numbers or strings, and a binary heap priority queue (EASTL).
+///     Their memory is allocated by luaM_* and thus counted by the GC.
 ///
 /// LUAXS_ADDLIB_GAME:
 ///
@@ -535,7 +721,7 @@
     #define LUAXS_ADDLIB_MARSHAL 1
 #endif
 #ifndef LUAXS_ADDLIB_CONTAINER
-    #define LUAXS_ADDLIB_CONTAINER 0
+    #define LUAXS_ADDLIB_CONTAINER 1
 #endif
 #ifndef LUAXS_ADDLIB_GAME
     #define LUAXS_ADDLIB_GAME 0
@@ -546,6 +732,25 @@
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+/// LUAXS_MARSHAL_FORMAT (LUAXS_ADDLIB_MARSHAL)
+///
+/// Defined to 1 or 2.
+/// The format marshal.encode uses unless told otherwise; marshal.decode reads
+/// both.
+/// 1: Fixed-size lengths and numbers, every string in full, tables as
+///    length-prefixed key/value records.
+/// 2: LEB128 lengths, integral numbers as zigzag varints, repeated strings
+///    as references into a per-blob string table, and tables as an array
+///    record followed by the remaining key/value pairs. Needs no length
+///    patching, so it can also be streamed to unseekable files.
+///
+#ifndef LUAXS_MARSHAL_FORMAT
+    #define LUAXS_MARSHAL_FORMAT 2
+#endif
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /// LUAXS_STREAMLINE_*
 ///
@@ -611,4 +816,9 @@
 #  error Invalid LUAXS_CORE_FORMAT value defined; use 0, 1 or 2
 #endif
 
+#if LUAXS_ADDLIB_MARSHAL && \
+    (LUAXS_MARSHAL_FORMAT < 1 || LUAXS_MARSHAL_FORMAT > 2)
+#  error Invalid LUAXS_MARSHAL_FORMAT value defined; use 1 or 2
+#endif
+
 #endif // lxs_conf_h
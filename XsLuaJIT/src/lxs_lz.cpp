@@ -0,0 +1,293 @@
+#define lxs_lz_cpp
+#define LUA_CORE
+
+extern "C"
+{
+#include "lua.h"
+#include "lxs_lz.h"
+
+#include <string.h>
+}; // extern "C"
+
+
+//==============================================================================
+// helpers
+
+typedef unsigned char _lxs_lzbyte;
+
+#define _LXS_LZ_HASH_LOG 13 // 8K 16 bit positions, 16KB of stack
+#define _LXS_LZ_MINMATCH 4
+#define _LXS_LZ_LASTLITS 5  // the last 5 bytes of a block are literals
+#define _LXS_LZ_MFLIMIT  12 // and no match starts within its last 12 bytes
+#define _LXS_LZ_SKIP     6  // the search step grows by one every 64 misses
+
+static __inline uint32_t _lxs_lzread32(const _lxs_lzbyte* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static __inline unsigned _lxs_lzhash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - _LXS_LZ_HASH_LOG);
+}
+
+/// Writes the continuation of a length: 255 until less is left, then that.
+static __inline _lxs_lzbyte* _lxs_lzlength(_lxs_lzbyte* op, size_t n)
+{
+    for (; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = STATIC_CAST(_lxs_lzbyte, n);
+    return op;
+}
+
+/// Writes the literals lits[0, nlits) followed by a match of mlen bytes at
+/// off, or no match if mlen is 0 (the last sequence). Returns the new end of
+/// the output or NULL if it does not fit.
+static _lxs_lzbyte* _lxs_lzsequence(_lxs_lzbyte* op,
+                                    const _lxs_lzbyte* oend,
+                                    const _lxs_lzbyte* lits,
+                                    size_t nlits,
+                                    size_t off,
+                                    size_t mlen)
+{
+    const size_t need = 1 + nlits / 255 + 1 + nlits + 2 + mlen / 255 + 1;
+    if (need > STATIC_CAST(size_t, oend - op))
+        return NULL;
+
+    _lxs_lzbyte* token = op++;
+    unsigned     t;
+
+    if (nlits >= 15)
+    {
+        t  = 15u << 4;
+        op = _lxs_lzlength(op, nlits - 15);
+    }
+    else
+    {
+        t = STATIC_CAST(unsigned, nlits) << 4;
+    }
+    memcpy(op, lits, nlits);
+    op += nlits;
+
+    if (mlen > 0)
+    {
+        *op++ = STATIC_CAST(_lxs_lzbyte, off & 0xFF);
+        *op++ = STATIC_CAST(_lxs_lzbyte, off >> 8);
+
+        mlen -= _LXS_LZ_MINMATCH;
+        if (mlen >= 15)
+        {
+            t |= 15u;
+            op = _lxs_lzlength(op, mlen - 15);
+        }
+        else
+        {
+            t |= STATIC_CAST(unsigned, mlen);
+        }
+    }
+    *token = STATIC_CAST(_lxs_lzbyte, t);
+    return op;
+}
+
+/// Reads the continuation of a length; returns false if the input ends.
+static __inline bool _lxs_lzreadlength(const _lxs_lzbyte** ip,
+                                       const _lxs_lzbyte* iend,
+                                       size_t* n)
+{
+    unsigned b;
+    do
+    {
+        if (*ip >= iend)
+            return false;
+        b   = *(*ip)++;
+        *n += b;
+    }
+    while (b == 255);
+    return true;
+}
+
+
+//==============================================================================
+
+size_t lxs_lzbound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+/// Greedy single-probe matching: one hash table of the last position of
+/// every 4 byte prefix. Incompressible input is skipped over at a growing
+/// step, so it costs little more than a copy.
+size_t lxs_lzcompress(const char* src, size_t len, char* dst, size_t cap)
+{
+    const _lxs_lzbyte* const base   = REINTERPRET_CAST(const _lxs_lzbyte*, src);
+    const _lxs_lzbyte* const end    = base + len;
+    const _lxs_lzbyte*       ip     = base;
+    const _lxs_lzbyte*       anchor = base;
+    _lxs_lzbyte*             op     = REINTERPRET_CAST(_lxs_lzbyte*, dst);
+    const _lxs_lzbyte* const oend   = op + cap;
+
+    uint16_t table[1 << _LXS_LZ_HASH_LOG];
+
+    if (len > LXS_LZ_BLOCK)
+        return 0;
+
+    if (len > _LXS_LZ_MFLIMIT)
+    {
+        const _lxs_lzbyte* const mflimit    = end - _LXS_LZ_MFLIMIT;
+        const _lxs_lzbyte* const matchlimit = end - _LXS_LZ_LASTLITS;
+
+        memset(table, 0, sizeof(table));
+        ++ip;
+
+        while (ip <= mflimit)
+        {
+            const _lxs_lzbyte* match;
+            unsigned attempts = 1u << _LXS_LZ_SKIP;
+
+            for (;;)
+            {
+                const uint32_t v = _lxs_lzread32(ip);
+                const unsigned h = _lxs_lzhash(v);
+
+                match    = base + table[h];
+                table[h] = STATIC_CAST(uint16_t, ip - base);
+                if (match < ip && _lxs_lzread32(match) == v)
+                    break;
+
+                ip += attempts++ >> _LXS_LZ_SKIP;
+                if (ip > mflimit)
+                    goto last;
+            }
+
+            while (ip > anchor && match > base && ip[-1] == match[-1])
+            {
+                --ip;
+                --match;
+            }
+
+            const _lxs_lzbyte* p = ip + _LXS_LZ_MINMATCH;
+            const _lxs_lzbyte* m = match + _LXS_LZ_MINMATCH;
+            while (p < matchlimit && *p == *m)
+            {
+                ++p;
+                ++m;
+            }
+
+            op = _lxs_lzsequence(op, oend, anchor,
+                                 STATIC_CAST(size_t, ip - anchor),
+                                 STATIC_CAST(size_t, ip - match),
+                                 STATIC_CAST(size_t, p - ip));
+            if (op == NULL)
+                return 0;
+            ip = anchor = p;
+
+            // the position before the next search is free to record
+            if (ip <= mflimit)
+                table[_lxs_lzhash(_lxs_lzread32(ip - 2))] =
+                    STATIC_CAST(uint16_t, ip - 2 - base);
+        }
+    }
+
+last:
+    op = _lxs_lzsequence(op, oend, anchor,
+                         STATIC_CAST(size_t, end - anchor), 0, 0);
+    if (op == NULL)
+        return 0;
+    return STATIC_CAST(size_t, op - REINTERPRET_CAST(_lxs_lzbyte*, dst));
+}
+
+size_t lxs_lzdecompress(const char* src, size_t len, char* dst, size_t cap)
+{
+    const _lxs_lzbyte*       ip   = REINTERPRET_CAST(const _lxs_lzbyte*, src);
+    const _lxs_lzbyte* const iend = ip + len;
+    _lxs_lzbyte* const       obeg = REINTERPRET_CAST(_lxs_lzbyte*, dst);
+    _lxs_lzbyte*             op   = obeg;
+    _lxs_lzbyte* const       oend = obeg + cap;
+
+    for (;;)
+    {
+        if (ip >= iend)
+            return STATIC_CAST(size_t, -1);
+
+        const unsigned token = *ip++;
+        size_t n = token >> 4;
+        if (n == 15 && !_lxs_lzreadlength(&ip, iend, &n))
+            return STATIC_CAST(size_t, -1);
+        if (n > STATIC_CAST(size_t, iend - ip) || n > STATIC_CAST(size_t, oend - op))
+            return STATIC_CAST(size_t, -1);
+        memcpy(op, ip, n);
+        ip += n;
+        op += n;
+
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return STATIC_CAST(size_t, -1);
+        const size_t off = ip[0] | (STATIC_CAST(size_t, ip[1]) << 8);
+        ip += 2;
+        if (off == 0 || off > STATIC_CAST(size_t, op - obeg))
+            return STATIC_CAST(size_t, -1);
+
+        n = token & 15;
+        if (n == 15 && !_lxs_lzreadlength(&ip, iend, &n))
+            return STATIC_CAST(size_t, -1);
+        n += _LXS_LZ_MINMATCH;
+        if (n > STATIC_CAST(size_t, oend - op))
+            return STATIC_CAST(size_t, -1);
+
+        const _lxs_lzbyte* match = op - off;
+        if (off >= n)
+        {
+            memcpy(op, match, n);
+            op += n;
+        }
+        else
+        {
+            // overlapping: repeats the last off bytes
+            while (n-- > 0)
+                *op++ = *match++;
+        }
+    }
+    return STATIC_CAST(size_t, op - obeg);
+}
+
+size_t lxs_lzblock(const char* src, size_t len, char* dst)
+{
+    // only worth it if smaller than the raw block
+    size_t   n = len > 1 ? lxs_lzcompress(src, len, dst + LXS_LZ_HEADER, len - 1) : 0;
+    uint32_t header;
+
+    if (n == 0)
+    {
+        memcpy(dst + LXS_LZ_HEADER, src, len);
+        n      = len;
+        header = STATIC_CAST(uint32_t, n) | LXS_LZ_STORED;
+    }
+    else
+    {
+        header = STATIC_CAST(uint32_t, n);
+    }
+
+    dst[0] = STATIC_CAST(char, header & 0xFF);
+    dst[1] = STATIC_CAST(char, (header >> 8) & 0xFF);
+    dst[2] = STATIC_CAST(char, (header >> 16) & 0xFF);
+    dst[3] = STATIC_CAST(char, header >> 24);
+    return LXS_LZ_HEADER + n;
+}
+
+size_t lxs_lzunblock(uint32_t header, const char* src, char* dst)
+{
+    const size_t n = lxs_lzsize(header);
+
+    if (header & LXS_LZ_STORED)
+    {
+        if (n > LXS_LZ_BLOCK)
+            return STATIC_CAST(size_t, -1);
+        memcpy(dst, src, n);
+        return n;
+    }
+    return lxs_lzdecompress(src, n, dst, LXS_LZ_BLOCK);
+}
@@ -0,0 +1,64 @@
+#ifndef lxs_lz_h
+#define lxs_lz_h 1
+
+#include "lxs_def.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+//==============================================================================
+// LZ77 block compression, used by buffer:compress/decompress and compressed
+// marshal data.
+//
+// Blocks use the LZ4 block format: literal runs and (offset, length) matches
+// within the block, no entropy coding. Blocks are compressed independently,
+// so frames can be written and read one block at a time.
+//
+// frame := LXS_LZ_MAGIC { header data }* 0
+//
+// header is a little endian uint32: the size of data, with LXS_LZ_STORED set
+// if data is the raw block because it did not compress. A block holds at
+// most LXS_LZ_BLOCK raw bytes.
+
+XS_BEGIN_EXTERN_C
+
+#define LXS_LZ_MAGIC     "XLZ1"
+#define LXS_LZ_MAGIC_LEN 4
+#define LXS_LZ_BLOCK     0x10000
+#define LXS_LZ_HEADER    4
+#define LXS_LZ_STORED    0x80000000u
+
+/// Returns the largest possible compressed size of len bytes.
+size_t lxs_lzbound(size_t len);
+
+/// Compresses src[0, len), len <= LXS_LZ_BLOCK, into dst[0, cap); returns
+/// the compressed size or 0 if it does not fit.
+size_t lxs_lzcompress(const char* src, size_t len, char* dst, size_t cap);
+
+/// Decompresses src[0, len) into dst[0, cap); returns the decompressed size
+/// or (size_t)-1 if src is malformed or does not fit.
+size_t lxs_lzdecompress(const char* src, size_t len, char* dst, size_t cap);
+
+/// Writes src[0, len), len <= LXS_LZ_BLOCK, as a frame block (header and
+/// data) to dst, which must hold LXS_LZ_HEADER + len bytes; returns its size.
+size_t lxs_lzblock(const char* src, size_t len, char* dst);
+
+/// Decodes the data of a block, lxs_lzsize(header) bytes at src, into dst,
+/// which must hold LXS_LZ_BLOCK bytes; returns the raw size or (size_t)-1.
+size_t lxs_lzunblock(uint32_t header, const char* src, char* dst);
+
+/// Reads a block header.
+static __inline uint32_t lxs_lzheader(const char* p)
+{
+    const unsigned char* u = (const unsigned char*)p;
+    return (uint32_t)u[0]         | ((uint32_t)u[1] << 8)
+         | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+/// Size of the data following a block header.
+#define lxs_lzsize(header) ((size_t)((header) & ~LXS_LZ_STORED))
+
+XS_END_EXTERN_C
+
+#endif // lxs_lz_h
@@ -0,0 +1,1099 @@
+#define lxs_skernel_cpp
+#define LUA_CORE
+
+extern "C"
+{
+#include "lua.h"
+#include "lxs_skernel.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+}; // extern "C"
+
+#include "xscpu.h"
+
+#include <emmintrin.h> // SSE2
+#include <tmmintrin.h> // SSSE3
+#include <nmmintrin.h> // SSE4.2 (crc32)
+#if XS_CPU_AVX2_TOOLSET
+#  include <immintrin.h> // AVX2
+#endif
+
+
+//==============================================================================
+// helpers
+
+XS_AINLINE static unsigned _lxs_kbsf(unsigned mask)
+{
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return idx;
+}
+
+XS_AINLINE static unsigned _lxs_kbsr(unsigned mask)
+{
+    unsigned long idx;
+    _BitScanReverse(&idx, mask);
+    return idx;
+}
+
+XS_AINLINE static bool _lxs_kisspace(char c)
+{
+    return isspace(STATIC_CAST(unsigned char, c)) != 0;
+}
+
+/// Final avalanche of the hash kernels (MurmurHash3's fmix32); CRC32C alone
+/// is linear, bucket indices are its low bits.
+XS_AINLINE static uint32_t _lxs_kmix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/// Is the first non-ASCII-space byte really a non-space? Only bytes above 0x7F
+/// need to be asked; the CRT decides for those depending on the locale.
+XS_AINLINE static bool _lxs_kisstop(char c)
+{
+    return !(c & 0x80) || !_lxs_kisspace(c);
+}
+
+
+//==============================================================================
+// scalar
+
+static const char* _lxs_kfindc_c(const char* s, size_t len, char c)
+{
+    return STATIC_CAST(const char*, memchr(s, c, len));
+}
+
+static const char* _lxs_krfindc_c(const char* s, size_t len, char c)
+{
+    for (const char* it = s + len; it != s; )
+    {
+        if (*--it == c)
+            return it;
+    }
+    return NULL;
+}
+
+/// Returns the start of the maximal suffix of p[0, n) and its period, under
+/// the byte order (rev = false) or its reverse (rev = true).
+static ptrdiff_t _lxs_kmaxsuf(const unsigned char* p,
+                              ptrdiff_t n,
+                              ptrdiff_t* period,
+                              bool rev)
+{
+    ptrdiff_t ms = -1;
+    ptrdiff_t j  = 0;
+    ptrdiff_t k  = 1;
+    ptrdiff_t pr = 1;
+
+    while (j + k < n)
+    {
+        const unsigned char a = p[j + k];
+        const unsigned char b = p[ms + k];
+        if (rev ? a > b : a < b)
+        {
+            j += k;
+            k  = 1;
+            pr = j - ms;
+        }
+        else if (a == b)
+        {
+            if (k != pr)
+                ++k;
+            else
+            {
+                j += pr;
+                k  = 1;
+            }
+        }
+        else
+        {
+            ms = j;
+            j  = ms + 1;
+            k  = pr = 1;
+        }
+    }
+    *period = pr;
+    return ms;
+}
+
+/// Two-Way string matching (Crochemore/Perrin): O(len + plen) time, O(1)
+/// space, regardless of how repetitive s or p are.
+static const char* _lxs_kfind_tw(const char* s,
+                                 size_t len,
+                                 const char* p,
+                                 size_t plen)
+{
+    if (plen > len)
+        return NULL;
+
+    const unsigned char* x = REINTERPRET_CAST(const unsigned char*, p);
+    const unsigned char* y = REINTERPRET_CAST(const unsigned char*, s);
+    const ptrdiff_t      m = STATIC_CAST(ptrdiff_t, plen);
+    const ptrdiff_t      n = STATIC_CAST(ptrdiff_t, len);
+
+    // critical factorization x = x[0, ell] x[ell + 1, m)
+    ptrdiff_t per1, per2;
+    ptrdiff_t ms1 = _lxs_kmaxsuf(x, m, &per1, false);
+    ptrdiff_t ms2 = _lxs_kmaxsuf(x, m, &per2, true);
+    ptrdiff_t ell = (ms1 > ms2) ? ms1 : ms2;
+    ptrdiff_t per = (ms1 > ms2) ? per1 : per2;
+
+    ptrdiff_t i, j = 0;
+    if (memcmp(x, x + per, ell + 1) == 0)
+    {
+        // periodic needle; remember the prefix already known to match
+        ptrdiff_t memory = -1;
+        while (j <= n - m)
+        {
+            i = ((ell > memory) ? ell : memory) + 1;
+            while (i < m && x[i] == y[i + j])
+                ++i;
+            if (i >= m)
+            {
+                i = ell;
+                while (i > memory && x[i] == y[i + j])
+                    --i;
+                if (i <= memory)
+                    return s + j;
+                j     += per;
+                memory = m - per - 1;
+            }
+            else
+            {
+                j     += i - ell;
+                memory = -1;
+            }
+        }
+    }
+    else
+    {
+        per = ((ell + 1 > m - ell - 1) ? ell + 1 : m - ell - 1) + 1;
+        while (j <= n - m)
+        {
+            i = ell + 1;
+            while (i < m && x[i] == y[i + j])
+                ++i;
+            if (i >= m)
+            {
+                i = ell;
+                while (i >= 0 && x[i] == y[i + j])
+                    --i;
+                if (i < 0)
+                    return s + j;
+                j += per;
+            }
+            else
+                j += i - ell;
+        }
+    }
+    return NULL;
+}
+
+/// The filtering searches below verify candidates with memcmp, which is
+/// quadratic on repetitive input ("aaaa...", "aaab"). Once the bytes spent
+/// on rejected candidates exceed the bytes scanned so far by this margin
+/// they hand the rest over to _lxs_kfind_tw.
+#define _LXS_KFIND_BUDGET 256u
+
+XS_AINLINE static bool _lxs_kfind_overspent(size_t* work,
+                                            size_t plen,
+                                            size_t scanned)
+{
+    *work += plen;
+    return *work > 2u * scanned + _LXS_KFIND_BUDGET;
+}
+
+static const char* _lxs_kfind_c(const char* s,
+                                size_t len,
+                                const char* p,
+                                size_t plen)
+{
+    if (plen == 0)
+        return s;
+    if (plen > len)
+        return NULL;
+
+    size_t      work = 0;
+    const char* last = s + (len - plen);
+    for (const char* it = s; it <= last; ++it)
+    {
+        it = STATIC_CAST(const char*, memchr(it, *p, last - it + 1));
+        if (!it)
+            return NULL;
+        if (memcmp(it + 1, p + 1, plen - 1) == 0)
+            return it;
+        if (_lxs_kfind_overspent(&work, plen, it - s))
+            return _lxs_kfind_tw(it + 1, len - (it + 1 - s), p, plen);
+    }
+    return NULL;
+}
+
+static const char* _lxs_kfindset_c(const char* s,
+                                   size_t len,
+                                   const lxs_kset* set)
+{
+    for (const char* end = s + len; s != end; ++s)
+    {
+        if (set->map[STATIC_CAST(unsigned char, *s)])
+            return s;
+    }
+    return NULL;
+}
+
+static void _lxs_klower_c(char* s, size_t len)
+{
+    for (; len; --len, ++s)
+        *s = STATIC_CAST(char, tolower(STATIC_CAST(unsigned char, *s)));
+}
+
+static void _lxs_kupper_c(char* s, size_t len)
+{
+    for (; len; --len, ++s)
+        *s = STATIC_CAST(char, toupper(STATIC_CAST(unsigned char, *s)));
+}
+
+static size_t _lxs_klspace_c(const char* s, size_t len)
+{
+    size_t n = 0;
+    while (n < len && _lxs_kisspace(s[n]))
+        ++n;
+    return n;
+}
+
+static size_t _lxs_krspace_c(const char* s, size_t len)
+{
+    size_t n = len;
+    while (n && _lxs_kisspace(s[n - 1]))
+        --n;
+    return len - n;
+}
+
+/// CRC32C (Castagnoli, reflected 0x82F63B78) byte table; the same polynomial
+/// the SSE4.2 crc32 instruction implements.
+static const uint32_t _lxs_kcrc32c[256] = {
+    0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C,
+    0x26A1E7E8, 0xD4CA64EB, 0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B,
+    0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24, 0x105EC76F, 0xE235446C,
+    0xF165B798, 0x030E349B, 0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+    0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54, 0x5D1D08BF, 0xAF768BBC,
+    0xBC267848, 0x4E4DFB4B, 0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A,
+    0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35, 0xAA64D611, 0x580F5512,
+    0x4B5FA6E6, 0xB93425E5, 0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+    0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45, 0xF779DEAE, 0x05125DAD,
+    0x1642AE59, 0xE4292D5A, 0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A,
+    0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595, 0x417B1DBC, 0xB3109EBF,
+    0xA0406D4B, 0x522BEE48, 0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+    0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687, 0x0C38D26C, 0xFE53516F,
+    0xED03A29B, 0x1F682198, 0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927,
+    0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38, 0xDBFC821C, 0x2997011F,
+    0x3AC7F2EB, 0xC8AC71E8, 0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+    0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096, 0xA65C047D, 0x5437877E,
+    0x4767748A, 0xB50CF789, 0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859,
+    0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46, 0x7198540D, 0x83F3D70E,
+    0x90A324FA, 0x62C8A7F9, 0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+    0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36, 0x3CDB9BDD, 0xCEB018DE,
+    0xDDE0EB2A, 0x2F8B6829, 0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C,
+    0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93, 0x082F63B7, 0xFA44E0B4,
+    0xE9141340, 0x1B7F9043, 0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+    0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3, 0x55326B08, 0xA759E80B,
+    0xB4091BFF, 0x466298FC, 0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C,
+    0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033, 0xA24BB5A6, 0x502036A5,
+    0x4370C551, 0xB11B4652, 0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+    0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D, 0xEF087A76, 0x1D63F975,
+    0x0E330A81, 0xFC588982, 0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D,
+    0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622, 0x38CC2A06, 0xCAA7A905,
+    0xD9F75AF1, 0x2B9CD9F2, 0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+    0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530, 0x0417B1DB, 0xF67C32D8,
+    0xE52CC12C, 0x1747422F, 0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF,
+    0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0, 0xD3D3E1AB, 0x21B862A8,
+    0x32E8915C, 0xC083125F, 0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+    0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90, 0x9E902E7B, 0x6CFBAD78,
+    0x7FAB5E8C, 0x8DC0DD8F, 0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE,
+    0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1, 0x69E9F0D5, 0x9B8273D6,
+    0x88D28022, 0x7AB90321, 0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+    0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69,
+    0xD5CF889D, 0x27A40B9E, 0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E,
+    0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351
+};
+
+static uint32_t _lxs_khash_c(const char* s, size_t len, uint32_t seed)
+{
+    uint32_t crc = ~seed;
+    for (size_t i = 0; i < len; ++i)
+        crc = _lxs_kcrc32c[(crc ^ STATIC_CAST(unsigned char, s[i])) & 0xFF] ^ (crc >> 8);
+    return _lxs_kmix(~crc);
+}
+
+/// The i-th double of a strided array (the values of a TValue array).
+#define _lxs_kat(p, i, stride) \
+    (*REINTERPRET_CAST(const double*, REINTERPRET_CAST(const char*, (p)) + (i) * (stride)))
+
+/// Sums in the same order as _lxs_ksumd_sse2: four interleaved partial sums.
+static double _lxs_ksumd_c(const void* p, size_t n, size_t stride)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i  = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += _lxs_kat(p, i,     stride);
+        s1 += _lxs_kat(p, i + 1, stride);
+        s2 += _lxs_kat(p, i + 2, stride);
+        s3 += _lxs_kat(p, i + 3, stride);
+    }
+
+    double sum = (s0 + s2) + (s1 + s3);
+    for (; i < n; ++i)
+        sum += _lxs_kat(p, i, stride);
+    return sum;
+}
+
+static double _lxs_kmind_c(const void* p, size_t n, size_t stride)
+{
+    double m = HUGE_VAL;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double v = _lxs_kat(p, i, stride);
+        m = v < m ? v : m;
+    }
+    return m;
+}
+
+static double _lxs_kmaxd_c(const void* p, size_t n, size_t stride)
+{
+    double m = -HUGE_VAL;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double v = _lxs_kat(p, i, stride);
+        m = v > m ? v : m;
+    }
+    return m;
+}
+
+
+//==============================================================================
+// SSE2
+
+#define _lxs_kload(p)     _mm_loadu_si128(REINTERPRET_CAST(const __m128i*, (p)))
+#define _lxs_kstore(p, v) _mm_storeu_si128(REINTERPRET_CAST(__m128i*, (p)), (v))
+
+/// 0xFF for ' ' and '\t'..'\r', 0x00 otherwise.
+XS_AINLINE static __m128i _lxs_kspaces_sse2(__m128i chunk)
+{
+    const __m128i sp = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+    const __m128i ct = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8(0x08)),
+                                     _mm_cmplt_epi8(chunk, _mm_set1_epi8(0x0E)));
+    return _mm_or_si128(sp, ct);
+}
+
+static const char* _lxs_kfindc_sse2(const char* s, size_t len, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        const unsigned mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_lxs_kload(s + i), needle));
+        if (mask)
+            return s + i + _lxs_kbsf(mask);
+    }
+    return _lxs_kfindc_c(s + i, len - i, c);
+}
+
+static const char* _lxs_krfindc_sse2(const char* s, size_t len, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+
+    size_t n = len;
+    for (; n >= 16; n -= 16)
+    {
+        const unsigned mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_lxs_kload(s + n - 16), needle));
+        if (mask)
+            return s + n - 16 + _lxs_kbsr(mask);
+    }
+    return _lxs_krfindc_c(s, n, c);
+}
+
+/// Compares the first and last byte of p against 16 candidate positions at
+/// once and only calls memcmp for positions where both match.
+static const char* _lxs_kfind_sse2(const char* s,
+                                   size_t len,
+                                   const char* p,
+                                   size_t plen)
+{
+    if (plen == 0)
+        return s;
+    if (plen > len)
+        return NULL;
+    if (plen == 1)
+        return _lxs_kfindc_sse2(s, len, *p);
+
+    const __m128i first = _mm_set1_epi8(p[0]);
+    const __m128i last  = _mm_set1_epi8(p[plen - 1]);
+    const size_t  span  = len - plen + 1; // number of candidate positions
+
+    size_t work = 0;
+    size_t i    = 0;
+    for (; i + 16 <= span; i += 16)
+    {
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(_lxs_kload(s + i), first),
+            _mm_cmpeq_epi8(_lxs_kload(s + i + plen - 1), last)
+        ));
+        while (mask)
+        {
+            const size_t at = i + _lxs_kbsf(mask);
+            if (memcmp(s + at + 1, p + 1, plen - 2) == 0)
+                return s + at;
+            if (_lxs_kfind_overspent(&work, plen, at))
+                return _lxs_kfind_tw(s + at + 1, len - at - 1, p, plen);
+            mask &= mask - 1;
+        }
+    }
+    return _lxs_kfind_c(s + i, len - i, p, plen);
+}
+
+/// Up to four separators are compared directly, larger sets use the scalar
+/// lookup (or the SSSE3 kernel).
+static const char* _lxs_kfindset_sse2(const char* s,
+                                      size_t len,
+                                      const lxs_kset* set)
+{
+    if (set->count == 0 || set->count > 4)
+        return _lxs_kfindset_c(s, len, set);
+
+    __m128i needles[4];
+    for (size_t k = 0; k < 4; ++k)
+        needles[k] = _mm_set1_epi8(set->chars[k < set->count ? k : 0]);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        const __m128i chunk = _lxs_kload(s + i);
+        const unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, needles[0]),
+                         _mm_cmpeq_epi8(chunk, needles[1])),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, needles[2]),
+                         _mm_cmpeq_epi8(chunk, needles[3]))
+        ));
+        if (mask)
+            return s + i + _lxs_kbsf(mask);
+    }
+    return _lxs_kfindset_c(s + i, len - i, set);
+}
+
+/// Flips bit 5 of every byte in [first, first + 25], which maps 'A'-'Z' to
+/// 'a'-'z' and vice versa. Chunks containing non-ASCII bytes go to the CRT.
+XS_AINLINE static void _lxs_kcase_sse2(char* s,
+                                       size_t len,
+                                       char first,
+                                       void (*scalar)(char*, size_t))
+{
+    const __m128i lo   = _mm_set1_epi8(first - 1);
+    const __m128i hi   = _mm_set1_epi8(first + 26);
+    const __m128i flip = _mm_set1_epi8(0x20);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        const __m128i chunk = _lxs_kload(s + i);
+        if (_mm_movemask_epi8(chunk))
+        {
+            scalar(s + i, 16);
+            continue;
+        }
+
+        const __m128i in = _mm_and_si128(_mm_cmpgt_epi8(chunk, lo),
+                                         _mm_cmplt_epi8(chunk, hi));
+        _lxs_kstore(s + i, _mm_xor_si128(chunk, _mm_and_si128(in, flip)));
+    }
+    scalar(s + i, len - i);
+}
+
+static void _lxs_klower_sse2(char* s, size_t len)
+{
+    _lxs_kcase_sse2(s, len, 'A', _lxs_klower_c);
+}
+
+static void _lxs_kupper_sse2(char* s, size_t len)
+{
+    _lxs_kcase_sse2(s, len, 'a', _lxs_kupper_c);
+}
+
+static size_t _lxs_klspace_sse2(const char* s, size_t len)
+{
+    size_t i = 0;
+    while (i + 16 <= len)
+    {
+        const unsigned mask = ~_mm_movemask_epi8(
+            _lxs_kspaces_sse2(_lxs_kload(s + i))) & 0xFFFF;
+        if (!mask)
+        {
+            i += 16;
+            continue;
+        }
+
+        i += _lxs_kbsf(mask);
+        if (_lxs_kisstop(s[i]))
+            return i;
+        ++i;
+    }
+    return i + _lxs_klspace_c(s + i, len - i);
+}
+
+static size_t _lxs_krspace_sse2(const char* s, size_t len)
+{
+    size_t n = len;
+    while (n >= 16)
+    {
+        const unsigned mask = ~_mm_movemask_epi8(
+            _lxs_kspaces_sse2(_lxs_kload(s + n - 16))) & 0xFFFF;
+        if (!mask)
+        {
+            n -= 16;
+            continue;
+        }
+
+        n = n - 16 + _lxs_kbsr(mask) + 1;
+        if (_lxs_kisstop(s[n - 1]))
+            return len - n;
+        --n;
+    }
+    return (len - n) + _lxs_krspace_c(s, n);
+}
+
+
+XS_AINLINE static __m128d _lxs_kload2d(const void* p, size_t i, size_t stride)
+{
+    return _mm_loadh_pd(_mm_load_sd(&_lxs_kat(p, i, stride)),
+                        &_lxs_kat(p, i + 1, stride));
+}
+
+static double _lxs_ksumd_sse2(const void* p, size_t n, size_t stride)
+{
+    __m128d a0 = _mm_setzero_pd();
+    __m128d a1 = _mm_setzero_pd();
+    size_t  i  = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        a0 = _mm_add_pd(a0, _lxs_kload2d(p, i,     stride));
+        a1 = _mm_add_pd(a1, _lxs_kload2d(p, i + 2, stride));
+    }
+
+    const __m128d a = _mm_add_pd(a0, a1);
+    double sum = _mm_cvtsd_f64(a) + _mm_cvtsd_f64(_mm_unpackhi_pd(a, a));
+    for (; i < n; ++i)
+        sum += _lxs_kat(p, i, stride);
+    return sum;
+}
+
+static double _lxs_kmind_sse2(const void* p, size_t n, size_t stride)
+{
+    __m128d a0 = _mm_set1_pd(HUGE_VAL);
+    __m128d a1 = a0;
+    size_t  i  = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        a0 = _mm_min_pd(_lxs_kload2d(p, i,     stride), a0);
+        a1 = _mm_min_pd(_lxs_kload2d(p, i + 2, stride), a1);
+    }
+
+    const __m128d a = _mm_min_pd(a0, a1);
+    double m = _mm_cvtsd_f64(_mm_min_sd(a, _mm_unpackhi_pd(a, a)));
+    for (; i < n; ++i)
+    {
+        const double v = _lxs_kat(p, i, stride);
+        m = v < m ? v : m;
+    }
+    return m;
+}
+
+static double _lxs_kmaxd_sse2(const void* p, size_t n, size_t stride)
+{
+    __m128d a0 = _mm_set1_pd(-HUGE_VAL);
+    __m128d a1 = a0;
+    size_t  i  = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        a0 = _mm_max_pd(_lxs_kload2d(p, i,     stride), a0);
+        a1 = _mm_max_pd(_lxs_kload2d(p, i + 2, stride), a1);
+    }
+
+    const __m128d a = _mm_max_pd(a0, a1);
+    double m = _mm_cvtsd_f64(_mm_max_sd(a, _mm_unpackhi_pd(a, a)));
+    for (; i < n; ++i)
+    {
+        const double v = _lxs_kat(p, i, stride);
+        m = v > m ? v : m;
+    }
+    return m;
+}
+
+
+//==============================================================================
+// SSSE3
+
+/// Classifies 16 bytes at once with two pshufb table lookups: the low nibble
+/// selects a bitmask of high nibbles, the high nibble selects its bit.
+/// High nibbles 8-15 select 0, which is why only ASCII sets qualify.
+static const char* _lxs_kfindset_ssse3(const char* s,
+                                       size_t len,
+                                       const lxs_kset* set)
+{
+    if (!set->ascii)
+        return _lxs_kfindset_c(s, len, set);
+
+    const __m128i lotbl = _lxs_kload(set->lo);
+    const __m128i hitbl = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nib   = _mm_set1_epi8(0x0F);
+    const __m128i zero  = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        const __m128i chunk = _lxs_kload(s + i);
+        const __m128i lo = _mm_shuffle_epi8(lotbl, _mm_and_si128(chunk, nib));
+        const __m128i hi = _mm_shuffle_epi8(hitbl,
+            _mm_and_si128(_mm_srli_epi16(chunk, 4), nib));
+
+        const unsigned mask = ~_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)) & 0xFFFF;
+        if (mask)
+            return s + i + _lxs_kbsf(mask);
+    }
+    return _lxs_kfindset_c(s + i, len - i, set);
+}
+
+
+//==============================================================================
+// SSE4.2
+
+/// Same result as _lxs_khash_c, four bytes per crc32.
+static uint32_t _lxs_khash_sse42(const char* s, size_t len, uint32_t seed)
+{
+    uint32_t crc = ~seed;
+    for (; len >= 4; s += 4, len -= 4)
+    {
+        uint32_t word;
+        memcpy(&word, s, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; len; ++s, --len)
+        crc = _mm_crc32_u8(crc, STATIC_CAST(unsigned char, *s));
+    return _lxs_kmix(~crc);
+}
+
+
+//==============================================================================
+// AVX2
+
+#if XS_CPU_AVX2_TOOLSET
+
+#define _lxs_kload32(p) \
+    _mm256_loadu_si256(REINTERPRET_CAST(const __m256i*, (p)))
+#define _lxs_kstore32(p, v) \
+    _mm256_storeu_si256(REINTERPRET_CAST(__m256i*, (p)), (v))
+
+XS_AINLINE static __m256i _lxs_kspaces_avx2(__m256i chunk)
+{
+    const __m256i sp = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' '));
+    const __m256i ct = _mm256_and_si256(
+        _mm256_cmpgt_epi8(chunk, _mm256_set1_epi8(0x08)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(0x0E), chunk));
+    return _mm256_or_si256(sp, ct);
+}
+
+static const char* _lxs_kfindc_avx2(const char* s, size_t len, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        const unsigned mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_lxs_kload32(s + i), needle));
+        if (mask)
+            return s + i + _lxs_kbsf(mask);
+    }
+    return _lxs_kfindc_sse2(s + i, len - i, c);
+}
+
+static const char* _lxs_krfindc_avx2(const char* s, size_t len, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+
+    size_t n = len;
+    for (; n >= 32; n -= 32)
+    {
+        const unsigned mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_lxs_kload32(s + n - 32), needle));
+        if (mask)
+            return s + n - 32 + _lxs_kbsr(mask);
+    }
+    return _lxs_krfindc_sse2(s, n, c);
+}
+
+static const char* _lxs_kfind_avx2(const char* s,
+                                   size_t len,
+                                   const char* p,
+                                   size_t plen)
+{
+    if (plen < 2 || plen > len)
+        return _lxs_kfind_sse2(s, len, p, plen);
+
+    const __m256i first = _mm256_set1_epi8(p[0]);
+    const __m256i last  = _mm256_set1_epi8(p[plen - 1]);
+    const size_t  span  = len - plen + 1;
+
+    size_t work = 0;
+    size_t i    = 0;
+    for (; i + 32 <= span; i += 32)
+    {
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(_lxs_kload32(s + i), first),
+            _mm256_cmpeq_epi8(_lxs_kload32(s + i + plen - 1), last)
+        ));
+        while (mask)
+        {
+            const size_t at = i + _lxs_kbsf(mask);
+            if (memcmp(s + at + 1, p + 1, plen - 2) == 0)
+                return s + at;
+            if (_lxs_kfind_overspent(&work, plen, at))
+                return _lxs_kfind_tw(s + at + 1, len - at - 1, p, plen);
+            mask &= mask - 1;
+        }
+    }
+    return _lxs_kfind_sse2(s + i, len - i, p, plen);
+}
+
+static const char* _lxs_kfindset_avx2(const char* s,
+                                      size_t len,
+                                      const lxs_kset* set)
+{
+    if (!set->ascii)
+        return _lxs_kfindset_c(s, len, set);
+
+    // vpshufb works per 128-bit lane, so both tables are broadcast
+    const __m256i lotbl = _mm256_broadcastsi128_si256(_lxs_kload(set->lo));
+    const __m256i hitbl = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                           0, 0, 0, 0, 0, 0, 0, 0,
+                                           1, 2, 4, 8, 16, 32, 64, -128,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nib   = _mm256_set1_epi8(0x0F);
+    const __m256i zero  = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        const __m256i chunk = _lxs_kload32(s + i);
+        const __m256i lo = _mm256_shuffle_epi8(lotbl,
+            _mm256_and_si256(chunk, nib));
+        const __m256i hi = _mm256_shuffle_epi8(hitbl,
+            _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nib));
+
+        const unsigned mask = ~STATIC_CAST(unsigned, _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero)));
+        if (mask)
+            return s + i + _lxs_kbsf(mask);
+    }
+    return _lxs_kfindset_ssse3(s + i, len - i, set);
+}
+
+XS_AINLINE static void _lxs_kcase_avx2(char* s,
+                                       size_t len,
+                                       char first,
+                                       void (*tail)(char*, size_t))
+{
+    const __m256i lo   = _mm256_set1_epi8(first - 1);
+    const __m256i hi   = _mm256_set1_epi8(first + 26);
+    const __m256i flip = _mm256_set1_epi8(0x20);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        const __m256i chunk = _lxs_kload32(s + i);
+        if (_mm256_movemask_epi8(chunk))
+        {
+            tail(s + i, 32);
+            continue;
+        }
+
+        const __m256i in = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, lo),
+                                            _mm256_cmpgt_epi8(hi, chunk));
+        _lxs_kstore32(s + i, _mm256_xor_si256(chunk,
+                                              _mm256_and_si256(in, flip)));
+    }
+    tail(s + i, len - i);
+}
+
+static void _lxs_klower_avx2(char* s, size_t len)
+{
+    _lxs_kcase_avx2(s, len, 'A', _lxs_klower_sse2);
+}
+
+static void _lxs_kupper_avx2(char* s, size_t len)
+{
+    _lxs_kcase_avx2(s, len, 'a', _lxs_kupper_sse2);
+}
+
+static size_t _lxs_klspace_avx2(const char* s, size_t len)
+{
+    size_t i = 0;
+    while (i + 32 <= len)
+    {
+        const unsigned mask = ~STATIC_CAST(unsigned, _mm256_movemask_epi8(
+            _lxs_kspaces_avx2(_lxs_kload32(s + i))));
+        if (!mask)
+        {
+            i += 32;
+            continue;
+        }
+
+        i += _lxs_kbsf(mask);
+        if (_lxs_kisstop(s[i]))
+            return i;
+        ++i;
+    }
+    return i + _lxs_klspace_sse2(s + i, len - i);
+}
+
+static size_t _lxs_krspace_avx2(const char* s, size_t len)
+{
+    size_t n = len;
+    while (n >= 32)
+    {
+        const unsigned mask = ~STATIC_CAST(unsigned, _mm256_movemask_epi8(
+            _lxs_kspaces_avx2(_lxs_kload32(s + n - 32))));
+        if (!mask)
+        {
+            n -= 32;
+            continue;
+        }
+
+        n = n - 32 + _lxs_kbsr(mask) + 1;
+        if (_lxs_kisstop(s[n - 1]))
+            return len - n;
+        --n;
+    }
+    return (len - n) + _lxs_krspace_sse2(s, n);
+}
+
+#undef _lxs_kload32
+#undef _lxs_kstore32
+
+#endif // XS_CPU_AVX2_TOOLSET
+
+#undef _lxs_kload
+#undef _lxs_kstore
+
+
+//==============================================================================
+// dispatch
+
+typedef struct _lxs_kernels
+{
+    const char* name;
+    const char* (*findc)(const char*, size_t, char);
+    const char* (*rfindc)(const char*, size_t, char);
+    const char* (*find)(const char*, size_t, const char*, size_t);
+    const char* (*findset)(const char*, size_t, const lxs_kset*);
+    void        (*lower)(char*, size_t);
+    void        (*upper)(char*, size_t);
+    size_t      (*lspace)(const char*, size_t);
+    size_t      (*rspace)(const char*, size_t);
+    uint32_t    (*hash)(const char*, size_t, uint32_t);
+    double      (*sumd)(const void*, size_t, size_t);
+    double      (*mind)(const void*, size_t, size_t);
+    double      (*maxd)(const void*, size_t, size_t);
+} lxs_kernels;
+
+static const lxs_kernels _lxs_kernels_c = {
+    "scalar",
+    _lxs_kfindc_c,   _lxs_krfindc_c, _lxs_kfind_c,   _lxs_kfindset_c,
+    _lxs_klower_c,   _lxs_kupper_c,  _lxs_klspace_c, _lxs_krspace_c,
+    _lxs_khash_c,
+    _lxs_ksumd_c,    _lxs_kmind_c,   _lxs_kmaxd_c
+};
+
+#if LUAXS_STR_SIMD
+static const lxs_kernels _lxs_kernels_sse2 = {
+    "SSE2",
+    _lxs_kfindc_sse2, _lxs_krfindc_sse2, _lxs_kfind_sse2,   _lxs_kfindset_sse2,
+    _lxs_klower_sse2, _lxs_kupper_sse2,  _lxs_klspace_sse2, _lxs_krspace_sse2,
+    _lxs_khash_c,
+    _lxs_ksumd_sse2,  _lxs_kmind_sse2,   _lxs_kmaxd_sse2
+};
+
+static const lxs_kernels _lxs_kernels_ssse3 = {
+    "SSSE3",
+    _lxs_kfindc_sse2, _lxs_krfindc_sse2, _lxs_kfind_sse2,   _lxs_kfindset_ssse3,
+    _lxs_klower_sse2, _lxs_kupper_sse2,  _lxs_klspace_sse2, _lxs_krspace_sse2,
+    _lxs_khash_c,
+    _lxs_ksumd_sse2,  _lxs_kmind_sse2,   _lxs_kmaxd_sse2
+};
+
+static const lxs_kernels _lxs_kernels_sse42 = {
+    "SSE4.2",
+    _lxs_kfindc_sse2, _lxs_krfindc_sse2, _lxs_kfind_sse2,   _lxs_kfindset_ssse3,
+    _lxs_klower_sse2, _lxs_kupper_sse2,  _lxs_klspace_sse2, _lxs_krspace_sse2,
+    _lxs_khash_sse42,
+    _lxs_ksumd_sse2,  _lxs_kmind_sse2,   _lxs_kmaxd_sse2
+};
+
+#  if XS_CPU_AVX2_TOOLSET
+static const lxs_kernels _lxs_kernels_avx2 = {
+    "AVX2",
+    _lxs_kfindc_avx2, _lxs_krfindc_avx2, _lxs_kfind_avx2,   _lxs_kfindset_avx2,
+    _lxs_klower_avx2, _lxs_kupper_avx2,  _lxs_klspace_avx2, _lxs_krspace_avx2,
+    _lxs_khash_sse42,
+    _lxs_ksumd_sse2,  _lxs_kmind_sse2,   _lxs_kmaxd_sse2
+};
+#  endif
+#endif // LUAXS_STR_SIMD
+
+static const lxs_kernels* _lxs_k = &_lxs_kernels_c;
+
+
+//==============================================================================
+// public API
+
+extern "C" {
+
+void lxs_kinit(void)
+{
+#if LUAXS_STR_SIMD
+    xs_cpu_getinfo();
+
+#  if XS_CPU_AVX2_TOOLSET
+    if (xs_cpu_supports(XS_CPU_AVX2))
+        _lxs_k = &_lxs_kernels_avx2;
+    else
+#  endif
+    if (xs_cpu_supports(XS_CPU_SSE42))
+        _lxs_k = &_lxs_kernels_sse42;
+    else if (xs_cpu_supports(XS_CPU_SSE3S))
+        _lxs_k = &_lxs_kernels_ssse3;
+    else if (xs_cpu_supports(XS_CPU_SSE2))
+        _lxs_k = &_lxs_kernels_sse2;
+    else
+        _lxs_k = &_lxs_kernels_c;
+#endif // LUAXS_STR_SIMD
+}
+
+const char* lxs_kname(void)
+{
+    return _lxs_k->name;
+}
+
+void lxs_kset_init(lxs_kset* set, const char* chars, size_t len)
+{
+    assert(set);
+    assert(chars || len == 0);
+
+    memset(set, 0, sizeof(lxs_kset));
+    set->ascii = true;
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        const unsigned char c = STATIC_CAST(unsigned char, chars[i]);
+        if (set->map[c])
+            continue;
+
+        set->map[c] = 1;
+        if (set->count < _countof(set->chars))
+            set->chars[set->count] = chars[i];
+        set->count++;
+
+        if (c & 0x80)
+            set->ascii = false;
+        else
+            set->lo[c & 0x0F] |= STATIC_CAST(unsigned char, 1u << (c >> 4));
+    }
+}
+
+const char* lxs_kfindc(const char* s, size_t len, char c)
+{
+    assert(s || len == 0);
+    return _lxs_k->findc(s, len, c);
+}
+
+const char* lxs_krfindc(const char* s, size_t len, char c)
+{
+    assert(s || len == 0);
+    return _lxs_k->rfindc(s, len, c);
+}
+
+const char* lxs_kfind(const char* s, size_t len, const char* p, size_t plen)
+{
+    assert(s || len == 0);
+    assert(p || plen == 0);
+    return _lxs_k->find(s, len, p, plen);
+}
+
+const char* lxs_kfindset(const char* s, size_t len, const lxs_kset* set)
+{
+    assert(s || len == 0);
+    assert(set);
+    return _lxs_k->findset(s, len, set);
+}
+
+void lxs_klower(char* s, size_t len)
+{
+    assert(s || len == 0);
+    _lxs_k->lower(s, len);
+}
+
+void lxs_kupper(char* s, size_t len)
+{
+    assert(s || len == 0);
+    _lxs_k->upper(s, len);
+}
+
+size_t lxs_klspace(const char* s, size_t len)
+{
+    assert(s || len == 0);
+    return _lxs_k->lspace(s, len);
+}
+
+size_t lxs_krspace(const char* s, size_t len)
+{
+    assert(s || len == 0);
+    return _lxs_k->rspace(s, len);
+}
+
+uint32_t lxs_khash(const char* s, size_t len, uint32_t seed)
+{
+    assert(s || len == 0);
+    return _lxs_k->hash(s, len, seed);
+}
+
+double lxs_ksumd(const void* p, size_t n, size_t stride)
+{
+    assert(p || n == 0);
+    return _lxs_k->sumd(p, n, stride);
+}
+
+double lxs_kmind(const void* p, size_t n, size_t stride)
+{
+    assert(p || n == 0);
+    return _lxs_k->mind(p, n, stride);
+}
+
+double lxs_kmaxd(const void* p, size_t n, size_t stride)
+{
+    assert(p || n == 0);
+    return _lxs_k->maxd(p, n, stride);
+}
+
+}; // extern "C"
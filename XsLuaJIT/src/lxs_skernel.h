@@ -0,0 +1,73 @@
+#ifndef lxs_skernel_h
+#define lxs_skernel_h 1
+
+#include "lxs_def.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+//==============================================================================
+// Byte scanning kernels used by lxs_string, the buffer and string libraries,
+// and number reductions used by the table library.
+//
+// Every kernel exists as a scalar (CRT) variant and, unless LUAXS_STR_SIMD is
+// disabled, as SSE2/SSSE3/SSE4.2/AVX2 variants. lxs_kinit() picks the widest
+// variant the CPU supports; until it is called the scalar variants are used.
+//
+// All kernels are length based; embedded '\0' characters are regular bytes.
+// Case mapping and white-space detection are vectorized for ASCII only, bytes
+// above 0x7F are always handed to the CRT (tolower/toupper/isspace).
+
+XS_BEGIN_EXTERN_C
+
+/// Separator lookup for lxs_kfindset(); built by lxs_kset_init().
+typedef struct _lxs_kset
+{
+    unsigned char lo[16];   // low nibble -> bitmask of high nibbles (0..7)
+    unsigned char map[256]; // scalar lookup
+    char          chars[4]; // members, if count <= 4
+    size_t        count;    // number of distinct members
+    bool          ascii;    // true if no member is above 0x7F
+} lxs_kset;
+
+void lxs_kinit(void);
+const char* lxs_kname(void);
+
+void lxs_kset_init(lxs_kset* set, const char* chars, size_t len);
+
+/// Returns a pointer to the first/last occurrence of c in s[0, len) or NULL.
+const char* lxs_kfindc(const char* s, size_t len, char c);
+const char* lxs_krfindc(const char* s, size_t len, char c);
+
+/// Returns a pointer to the first occurrence of p[0, plen) in s[0, len) or NULL.
+/// Linear in len + plen even for repetitive input.
+const char* lxs_kfind(const char* s, size_t len, const char* p, size_t plen);
+
+/// Returns a pointer to the first byte in s[0, len) that is a member of set
+/// or NULL.
+const char* lxs_kfindset(const char* s, size_t len, const lxs_kset* set);
+
+/// In-place tolower/toupper.
+void lxs_klower(char* s, size_t len);
+void lxs_kupper(char* s, size_t len);
+
+/// Returns the number of leading/trailing white-space characters in s[0, len).
+size_t lxs_klspace(const char* s, size_t len);
+size_t lxs_krspace(const char* s, size_t len);
+
+/// Returns a 32 bit hash of s[0, len): CRC32C seeded with seed, then mixed.
+/// All variants return the same value, so hashes computed before lxs_kinit()
+/// (the string table's, for instance) stay valid after it.
+uint32_t lxs_khash(const char* s, size_t len, uint32_t seed);
+
+/// Returns the sum, minimum or maximum of n doubles stride bytes apart (the
+/// values of a TValue array, for instance); 0, HUGE_VAL and -HUGE_VAL if n is
+/// 0. All variants add in the same order (four interleaved partial sums).
+double lxs_ksumd(const void* p, size_t n, size_t stride);
+double lxs_kmind(const void* p, size_t n, size_t stride);
+double lxs_kmaxd(const void* p, size_t n, size_t stride);
+
+XS_END_EXTERN_C
+
+#endif // lxs_skernel_h
@@ -7,66 +7,21 @@ extern "C"
 
 #include "lauxlib.h"
 #include "lobject.h"
+#include "lxs_skernel.h"
 #if LUAXS_STR_PERSISTENT_BUFFER
 #  include "lstate.h"
 #endif
 
 #include <ctype.h>
+#include <math.h>
+#include <stddef.h>
 
 extern "C++"
 {
 #include "leastl.hpp"
-
-#include <eastl/bitset.h>
 };
 
 
-//==============================================================================
-
-#if LUAXS_STR_PERSISTENT_BUFFER
-
-lxs_string* lxs_spb_get(lua_State* const L)
-{
-    lxs_assert(L, L);
-    
-    lxs_string* s = L->pb;
-    if (s)
-        lxs_sclear(L, s);
-    else
-        s = lxs_spb_create(G(L)->mainthread, L);
-
-    return s;
-}
-
-lxs_string* lxs_spb_create(lua_State* const Lmain, lua_State* const Lcoro)
-{
-    lxs_assert(Lmain, Lmain);
-    lxs_assert(Lmain, G(Lmain)->mainthread == Lmain);
-
-    lxs_string* s = lxs_screate(
-        Lmain,
-        LUAXS_PB_INITIAL_CAPACITY,
-        true
-    );
-    lxs_assert(Lmain, s);
-    lxs_assert(Lmain, s->cap == LUAXS_PB_INITIAL_CAPACITY);
-    lxs_assert(Lmain, s->len == 0);
-    lxs_assert(Lmain, s->data);
-
-    return (Lcoro ? Lcoro : Lmain)->pb = s;
-}
-
-void lxs_spb_destroy(lua_State* const Lmain, lua_State* const Lcoro)
-{
-    lxs_assert(Lmain, Lmain);
-    lxs_assert(Lmain, G(Lmain)->mainthread == Lmain);
-
-    lxs_sdestroy(Lmain, (Lcoro ? Lcoro : Lmain)->pb);
-}
-
-#endif // LUAXS_STR_PERSISTENT_BUFFER
-
-
 //==============================================================================
 // internal API
 
@@ -83,7 +38,7 @@ static size_t s_default_capacity = LUAXS_STR_INITIAL_CAPACITY;
 
 size_t lxs_sdefault_capacity(size_t new_default_capacity /*= 0u*/)
 {
-    if (s_default_capacity != 0u)
+    if (new_default_capacity != 0u)
         s_default_capacity = new_default_capacity;
 
     return s_default_capacity;
@@ -100,36 +55,209 @@ double lxs_sgrowth_factor(double new_growth_factor /*= 0d*/)
 }
 #endif // !LUAXS_STR_READONLY_OPTIONS
 
-lxs_string* lxs_screate(lua_State* const L,
-                        size_t cap /*= 0u*/,
-                        bool force /*= true*/)
+#if LUAXS_STR_ALLOC_STATS
+static lxs_sstats s_stats;
+#  define LXS_STAT(counter) (++s_stats.counter)
+#else
+#  define LXS_STAT(counter) ((void)0)
+#endif // LUAXS_STR_ALLOC_STATS
+
+#if LUAXS_STR_READONLY_OPTIONS
+#  define LXS_DEFAULT_CAPACITY (LUAXS_STR_INITIAL_CAPACITY)
+#else
+#  define LXS_DEFAULT_CAPACITY (lxs_sdefault_capacity())
+#endif // LUAXS_STR_READONLY_OPTIONS
+
+/// Points s at its inline storage; or at nothing if inline storage is disabled.
+static void lxs_sreset_storage(lxs_string* const s)
+{
+#if LUAXS_STR_INLINE_CAPACITY > 0
+    s->cap    = LUAXS_STR_INLINE_CAPACITY;
+    s->data   = s->sso;
+    s->sso[0] = '\0';
+#else
+    s->cap  = 0u;
+    s->data = NULL;
+#endif
+    s->len = 0u;
+}
+
+
+//==============================================================================
+
+#if LUAXS_STR_PERSISTENT_BUFFER
+
+/// Call depth of the running function; owners deeper than this are gone.
+#define LXS_PB_DEPTH(L) ((L)->ci - (L)->base_ci)
+
+/// Appends a new, free level to L1's chain and returns it.
+static lxs_spb* lxs_spb_push(lua_State* const L, lua_State* const L1)
+{
+    lxs_spb* pb = static_cast<lxs_spb*>(luaM_malloc(L, sizeof(lxs_spb)));
+    lxs_assert(L, pb);
+    LXS_STAT(allocs);
+
+    lxs_sreset_storage(&pb->s);
+    pb->owner = -1;
+    pb->peak  = 0u;
+    pb->white = 0u;
+    pb->next  = NULL;
+
+    lxs_spb** link = &L1->pb;
+    while (*link)
+        link = &(*link)->next;
+    *link = pb;
+
+    // linked first; if this throws the level is merely empty, not leaked
+    lxs_srealloc(L, &pb->s, LUAXS_PB_INITIAL_CAPACITY, true);
+    return pb;
+}
+
+static void lxs_spb_free(lua_State* const L, lxs_spb* const pb)
+{
+    lxs_srelease(L, &pb->s);
+    luaM_freemem(L, pb, sizeof(lxs_spb));
+    LXS_STAT(frees);
+}
+
+lxs_string* lxs_spb_get(lua_State* const L)
 {
     lxs_assert(L, L);
 
-    lxs_string* s = NULL;
-    if (cap == 0u)
+    const ptrdiff_t depth = LXS_PB_DEPTH(L);
+
+    // skip levels held by callers; a holder at our depth or deeper cannot be
+    // active anymore (it returned or was unwound without releasing)
+    lxs_spb* pb = L->pb;
+    while (pb && pb->owner >= 0 && pb->owner < depth)
+        pb = pb->next;
+
+    if (pb)
     {
-        s = static_cast<lxs_string*>(luaM_malloc(L, sizeof(lxs_string)));
+        for (lxs_spb* it = pb->next; it; it = it->next)
+            it->owner = -1;
     }
     else
+        pb = lxs_spb_push(L, L);
+
+    pb->owner = depth;
+    lxs_sclear(L, &pb->s);
+    return &pb->s;
+}
+
+void lxs_spb_put(lua_State* const L, lxs_string* const s)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, s);
+
+    lxs_spb* pb = reinterpret_cast<lxs_spb*>(s);
+    lxs_assert(L, pb->owner >= 0);
+
+    if (s->len + 1u > pb->peak)
+        pb->peak = s->len + 1u;
+    pb->owner = -1;
+}
+
+void lxs_spb_pushresult(lua_State* const L, lxs_string* const s)
+{
+    lxs_spushresult(L, s);
+    lxs_spb_put(L, s);
+}
+
+void lxs_spb_create(lua_State* const L, lua_State* const L1)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, L1);
+    lxs_assert(L, L1->pb == NULL);
+
+    lxs_spb_push(L, L1);
+}
+
+void lxs_spb_destroy(lua_State* const L, lua_State* const L1)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, L1);
+
+    lxs_spb* pb = L1->pb;
+    L1->pb = NULL;
+
+    while (pb)
     {
-        if (!force)
-            cap = lxs_mgrow(L, 0u, cap, true, LXS_GROTH_FACTOR);
+        lxs_spb* next = pb->next;
+        lxs_spb_free(L, pb);
+        pb = next;
+    }
+}
+
+void lxs_spb_trim(lua_State* const L, lua_State* const L1)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, L1);
 
-        lxs_assert(L, cap > 0u);
-        lxs_scheck_mem_limits(L, 0u, cap, 0u);
+    const unsigned char white = G(L)->currentwhite;
+    if (L1->pb && L1->pb->white == white)
+        return;
 
-        s = static_cast<lxs_string*>(
-            luaM_malloc(L, sizeof(lxs_string) + sizeof(char) * cap)
+    const ptrdiff_t depth = LXS_PB_DEPTH(L1);
+#if LUAXS_PB_ONDEMAND_FIBERS
+    const bool keep_first = (L1 == G(L)->mainthread);
+#else
+    const bool keep_first = true;
+#endif
+
+    lxs_spb** link = &L1->pb;
+    while (lxs_spb* pb = *link)
+    {
+        if (pb->owner > depth)
+            pb->owner = -1;
+
+        pb->white = white;
+        if (pb->owner >= 0)
+        {
+            link = &pb->next;
+            continue;
+        }
+
+        if (pb->peak == 0u && !(keep_first && pb == L1->pb))
+        {
+            // unused for a whole cycle
+            *link = pb->next;
+            lxs_spb_free(L, pb);
+            continue;
+        }
+
+        // shrink after spikes, keeping some headroom over the recent peak
+        const size_t cap = lxs_mnext_pow2(
+            max(pb->peak, STATIC_CAST(size_t, LUAXS_PB_INITIAL_CAPACITY))
         );
+        if (pb->s.cap > 2u * cap)
+            lxs_srealloc(L, &pb->s, cap, true);
 
-        s->data = reinterpret_cast<char*>(s + sizeof(lxs_string));
-        lxs_assert(L, s->data);
+        pb->peak = 0u;
+        link = &pb->next;
     }
-    lxs_assert(L, s);
+}
 
-    s->cap = cap;
+#undef LXS_PB_DEPTH
 
+#endif // LUAXS_STR_PERSISTENT_BUFFER
+
+lxs_string* lxs_screate(lua_State* const L,
+                        size_t cap /*= 0u*/,
+                        bool force /*= true*/)
+{
+    lxs_assert(L, L);
+
+    if (cap != 0u && !force)
+        cap = lxs_mgrow(L, 0u, cap, false, LXS_GROTH_FACTOR);
+
+    lxs_string* s = static_cast<lxs_string*>(
+        luaM_malloc(L, sizeof(lxs_string))
+    );
+    lxs_assert(L, s);
+    LXS_STAT(allocs);
+
+    lxs_sinit(L, s, cap);
     return s;
 }
 
@@ -139,31 +267,54 @@ void lxs_sdestroy(lua_State* const L, lxs_string* s)
 
     if (s)
     {
-        if (s->cap != 0u && s->data)
-            luaM_freemem(L, s->data, s->cap);
+        lxs_srelease(L, s);
         luaM_freemem(L, s, sizeof(lxs_string));
+        LXS_STAT(frees);
 
         s = NULL;
     }
 }
 
+void lxs_srelease(lua_State* const L, lxs_string* const s)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, s);
+
+    if (s->data && !lxs_sisinline(s))
+    {
+        luaM_freemem(L, s->data, s->cap);
+        LXS_STAT(frees);
+    }
+    lxs_sreset_storage(s);
+}
+
 void lxs_sinit(lua_State* const L, lxs_string* const s, size_t capacity /*= 0*/)
 {
     lxs_assert(L, L);
     lxs_assert(L, s);
 
-    if (capacity == 0)
-#if LUAXS_STR_READONLY_OPTIONS
-        capacity = LUAXS_STR_INITIAL_CAPACITY;
+    LXS_STAT(inits);
+
+#if LUAXS_STR_INLINE_CAPACITY > 0
+    if (capacity <= LUAXS_STR_INLINE_CAPACITY)
+    {
+        LXS_STAT(inlined);
+        lxs_sreset_storage(s);
+        return;
+    }
 #else
-        capacity = lxs_sdefault_capacity();
-#endif // LUAXS_STR_READONLY_OPTIONS
+    if (capacity == 0)
+        capacity = LXS_DEFAULT_CAPACITY;
+#endif // LUAXS_STR_INLINE_CAPACITY
 
     lxs_scheck_mem_limits(L, 0u, capacity, 0u);
 
     char* buffer = static_cast<char*>(luaM_malloc(L, capacity));
     if (buffer == NULL)
         lxs_error(L, MEMERRMSG);
+    LXS_STAT(allocs);
+
+    buffer[0] = '\0';
 
     s->cap  = capacity;
     s->len  = 0;
@@ -188,10 +339,58 @@ void lxs_srealloc(lua_State* const L,
         LXS_GROTH_FACTOR
     );
 
+#if LUAXS_STR_INLINE_CAPACITY > 0
+    if (new_capacity <= LUAXS_STR_INLINE_CAPACITY)
+    {
+        // shrinking back into inline storage
+        if (!lxs_sisinline(s))
+        {
+            const size_t len = min(s->len,
+                STATIC_CAST(size_t, LUAXS_STR_INLINE_CAPACITY - 1));
+            memcpy(s->sso, s->data, len);
+            luaM_freemem(L, s->data, s->cap);
+            LXS_STAT(frees);
+
+            s->cap  = LUAXS_STR_INLINE_CAPACITY;
+            s->len  = len;
+            s->data = s->sso;
+
+            lxs_sterminate(s);
+        }
+        return;
+    }
+
+    if (lxs_sisinline(s))
+    {
+        // spilling to the heap; the first allocation is at least as large as
+        // the default capacity to avoid a string of small reallocations
+        if (!force)
+            new_capacity = max(new_capacity,
+                STATIC_CAST(size_t, LXS_DEFAULT_CAPACITY));
+        lxs_scheck_mem_limits(L, 0u, new_capacity, 0u);
+
+        char* buffer = static_cast<char*>(luaM_malloc(L, new_capacity));
+        if (buffer == NULL)
+            lxs_error(L, MEMERRMSG);
+        LXS_STAT(allocs);
+
+        memcpy(buffer, s->sso, s->len);
+
+        s->cap  = new_capacity;
+        s->data = buffer;
+
+        lxs_sterminate(s);
+        return;
+    }
+#endif // LUAXS_STR_INLINE_CAPACITY
+
     if (new_capacity == 0u)
     {
         if (s->data)
+        {
             luaM_freemem(L, s->data, s->cap);
+            LXS_STAT(frees);
+        }
 
         s->cap  = 0u;
         s->len  = 0u;
@@ -209,14 +408,17 @@ void lxs_srealloc(lua_State* const L,
 
         if (buffer == NULL)
             lxs_error(L, MEMERRMSG);
+        if (s->data)
+            LXS_STAT(reallocs);
+        else
+            LXS_STAT(allocs);
 
         if (new_capacity - 1u < s->len)
             s->len  = new_capacity - 1u;
         s->cap  = new_capacity;
         s->data = buffer;
 
-        buffer[s->len]       = '\0';
-        buffer[new_capacity] = '\0';
+        buffer[s->len] = '\0';
     }
 }
 
@@ -225,7 +427,7 @@ void lxs_sshrink_to_fit(lua_State* const L, lxs_string* const s)
     lxs_assert(L, L);
     lxs_assert(L, s);
 
-    if (s->cap == 0u)
+    if (s->cap == 0u || lxs_sisinline(s))
         return;
 
     if (s->len == 0u)
@@ -356,6 +558,17 @@ void lxs_sclear(lua_State* const L, lxs_string* const s)
     s->len = 0;
 }
 
+#if LUAXS_STR_ALLOC_STATS
+void lxs_sallocstats(lxs_sstats* const stats, bool reset /*= false*/)
+{
+    assert(stats);
+
+    *stats = s_stats;
+    if (reset)
+        memset(&s_stats, 0, sizeof(lxs_sstats));
+}
+#endif // LUAXS_STR_ALLOC_STATS
+
 bool lxs_sisbuffer(lua_State* const L, int narg)
 {
     lxs_assert(L, L);
@@ -363,7 +576,7 @@ bool lxs_sisbuffer(lua_State* const L, int narg)
     void* ptr = lua_touserdata(L, narg);
     if (ptr)
     {
-        if (lua_getmetatable(L, -1))
+        if (lua_getmetatable(L, narg))
         {
             lxs_rawgetl(L, LUA_REGISTRYINDEX, LUA_BUFFERLIBNAME);
             if (lua_rawequal(L, -1, -2))
@@ -420,24 +633,32 @@ char* lxs_sfind(lxs_string* const s, const char* str, size_t offset /*= 0u*/)
     assert(s);
     assert(s->data);
     assert(str);
+    assert(offset <= s->len);
 
-    return strstr(&s->data[offset], const_cast<char*>(str));
+    return CONST_CAST(char*, lxs_kfind(
+        &s->data[offset],
+        s->len - offset,
+        str,
+        strlen(str)
+    ));
 }
 
 char* lxs_sfindc(lxs_string* const s, char c, size_t offset /*= 0u*/)
 {
     assert(s);
     assert(s->data);
+    assert(offset <= s->len);
 
-    return strchr(&s->data[offset], c);
+    return CONST_CAST(char*, lxs_kfindc(&s->data[offset], s->len - offset, c));
 }
 
 char* lxs_srfindc(lxs_string* const s, char c, size_t offset /*= 0u*/)
 {
     assert(s);
     assert(s->data);
+    assert(offset <= s->len);
 
-    return strrchr(&s->data[offset], c);
+    return CONST_CAST(char*, lxs_krfindc(&s->data[offset], s->len - offset, c));
 }
 
 bool lxs_sequal(lxs_string* const lhs, lxs_string* const rhs)
@@ -626,10 +847,7 @@ void lxs_stoupper(lua_State* const L,
     if (offset == 0 && length == 0)
         length = s->len;
 
-    for (size_t i = offset; length > 0; ++i, --length)
-    {
-        s->data[i] = static_cast<char>(toupper(s->data[i]));
-    }
+    lxs_kupper(&s->data[offset], length);
 }
 
 void lxs_stolower(lua_State* const L,
@@ -645,10 +863,7 @@ void lxs_stolower(lua_State* const L,
     if (offset == 0 && length == 0)
         length = s->len;
 
-    for (size_t i = offset; length > 0; ++i, --length)
-    {
-        s->data[i] = static_cast<char>(tolower(s->data[i]));
-    }
+    lxs_klower(&s->data[offset], length);
 }
 
 void lxs_strim(lua_State* const L, lxs_string* const s)
@@ -658,12 +873,11 @@ void lxs_strim(lua_State* const L, lxs_string* const s)
 
     lxs_sabort_if_empty(s);
 
-    const char* front = &s->data[0];
-    const char* end   = &s->data[s->len - 1];
-    size_t      len   = s->len;
+    const size_t lead = lxs_klspace(s->data, s->len);
+    const char*  front = &s->data[lead];
+    size_t       len   = s->len - lead;
 
-    for (; len && isspace(*front); --len, ++front) {}
-    for (; len && isspace(*end);   --len, --end)   {}
+    len -= lxs_krspace(front, len);
 
     memmove(&s->data[0], front, len);
     s->len = len;
@@ -678,17 +892,13 @@ void lxs_sltrim(lua_State* const L, lxs_string* const s)
     
     lxs_sabort_if_empty(s);
 
-    const char* front = &s->data[0];
-    size_t      len   = s->len;
+    const size_t lead = lxs_klspace(s->data, s->len);
+    const size_t len  = s->len - lead;
 
-    while (len && isspace(*front))
-    {
-        --len;
-        ++front;
-    }
-
-    memmove(&s->data[0], front, len);
+    memmove(&s->data[0], &s->data[lead], len);
     s->len = len;
+
+    lxs_sterminate(s);
 }
 
 void lxs_srtrim(lua_State* const L, lxs_string* const s)
@@ -698,16 +908,7 @@ void lxs_srtrim(lua_State* const L, lxs_string* const s)
     
     lxs_sabort_if_empty(s);
 
-    const char* end = &s->data[s->len - 1];
-    size_t      len = s->len;
-
-    while (len && isspace(*end))
-    {
-        --len;
-        --end;
-    }
-
-    s->len = len;
+    s->len -= lxs_krspace(s->data, s->len);
 
     lxs_sterminate(s);
 }
@@ -738,39 +939,24 @@ const char** lxs_ssplit(lua_State* const L,
     lxs_string result;
     lxs_sinit(L, &result, s->len + 32);
 
-    eastl::bitset<255> seps_lookup;
-    while (*seps)
-    {
-        seps_lookup[STATIC_CAST(unsigned char, *seps)] = true;
-        seps++;
-    }
+    lxs_kset seps_lookup;
+    lxs_kset_init(&seps_lookup, seps, seps_len);
 
     const char* front = s->data;
     const char* end   = s->data + s->len;
-    bool in_token = false;
 
-    for (const char* it = front; it != end; ++it)
+    while (front != end)
     {
-        if (seps_lookup[STATIC_CAST(unsigned char, *it)])
-        {
-            if (in_token)
-            {
-                lxs_sappend(L, &result, front, it - front);
-                lxs_sappendc(L, &result, '\0');
+        const char* it = lxs_kfindset(front, end - front, &seps_lookup);
+        if (!it)
+            it = end;
 
-                in_token = false;
-            }
-        }
-        else if (!in_token)
+        if (it != front)
         {
-            front = it;
-            in_token = true;
+            lxs_sappend(L, &result, front, it - front);
+            lxs_sappendc(L, &result, '\0');
         }
-    }
-    if (in_token)
-    {
-        lxs_sappend(L, &result, front, end - front);
-        lxs_sappendc(L, &result, '\0');
+        front = (it != end) ? it + 1 : end;
     }
     lxs_sappendc(L, &result, '\0');
 
@@ -1017,19 +1203,43 @@ lxs_string* lxs_snewbuffer(lua_State* const L, size_t capacity /*= 0*/)
     lxs_assert(L, L);
     lxs_assert_stack_begin(L);
 
-    lxs_string* s = static_cast<lxs_string*>(
-        lua_newuserdata(L, sizeof(lxs_string))
+    lxs_sbuffer* b = static_cast<lxs_sbuffer*>(
+        lua_newuserdata(L, sizeof(lxs_sbuffer))
     );
-    lxs_assert(L, s && lua_isuserdata(L, -1));
+    lxs_assert(L, b && lua_isuserdata(L, -1));
+
+    b->head  = NULL;
+    b->tail  = NULL;
+    b->clen  = 0u;
+    b->csize = 0u;
+    b->gen   = 0u;
+    b->rpos  = 0u;
+    lxs_sreset_storage(&b->s);
 
     lxs_rawgetl(L, LUA_REGISTRYINDEX, LUA_BUFFERLIBNAME);
     lxs_assert(L, lua_istable(L, -1));
     lua_setmetatable(L, -2);
 
-    lxs_sinit(L, s, capacity);
+    lxs_sinit(L, &b->s, capacity);
 
     lxs_assert_stack_end(L, 1);
-    return s;
+    return &b->s;
+}
+
+static void lxs_sbfree_chunks(lua_State* const L, lxs_sbuffer* const b)
+{
+    lxs_schunk* c = b->head;
+    while (c)
+    {
+        lxs_schunk* next = c->next;
+        luaM_freemem(L, c, offsetof(lxs_schunk, data) + c->cap);
+        LXS_STAT(frees);
+        c = next;
+    }
+
+    b->head = NULL;
+    b->tail = NULL;
+    b->clen = 0u;
 }
 
 void lxs_sfreebuffer(lua_State* const L, lxs_string* s)
@@ -1037,8 +1247,11 @@ void lxs_sfreebuffer(lua_State* const L, lxs_string* s)
     lxs_assert(L, L);
     lxs_assert_stack_begin(L);
 
-    if (s && s->data)
-        luaM_freemem(L, s->data, s->cap);
+    if (s)
+    {
+        lxs_sbfree_chunks(L, reinterpret_cast<lxs_sbuffer*>(s));
+        lxs_srelease(L, s);
+    }
 
     lxs_assert_stack_end(L, 0);
 }
@@ -1047,18 +1260,159 @@ lxs_string* lxs_stobuffer(lua_State* const L, int narg)
 {
     lxs_assert(L, L);
 
-    return static_cast<lxs_string*>(lua_touserdata(L, narg));
+    if (!lxs_sisbuffer(L, narg))
+        return NULL;
+
+    lxs_sbuffer* b = static_cast<lxs_sbuffer*>(lua_touserdata(L, narg));
+    lxs_sbflatten(L, b);
+    return &b->s;
 }
 
 lxs_string* lxs_scheckbuffer(lua_State* const L, int narg)
 {
     lxs_assert(L, L);
 
-    return static_cast<lxs_string*>(
+    lxs_sbuffer* b = lxs_sbcheck(L, narg);
+    lxs_sbflatten(L, b);
+    return &b->s;
+}
+
+lxs_sbuffer* lxs_sbcheck(lua_State* const L, int narg)
+{
+    lxs_assert(L, L);
+
+    return static_cast<lxs_sbuffer*>(
         luaL_checkudata(L, narg, LUA_BUFFERLIBNAME)
     );
 }
 
+void lxs_sbchunked(lua_State* const L, lxs_sbuffer* const b, size_t chunk_size)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, b);
+
+    if (chunk_size == 0u)
+        lxs_sbflatten(L, b);
+    b->csize = chunk_size;
+}
+
+void lxs_sbappend(lua_State* const L,
+                  lxs_sbuffer* const b,
+                  const char* str,
+                  size_t len)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, b);
+    lxs_assert(L, str || len == 0u);
+
+    if (b->csize == 0u)
+    {
+        if (len > 0u)
+            lxs_sappend(L, &b->s, str, len);
+        return;
+    }
+
+    while (len > 0u)
+    {
+        lxs_schunk* c = b->tail;
+        if (c == NULL || c->len == c->cap)
+        {
+            // appends larger than a chunk are stored as they are
+            const size_t cap = max(b->csize, len);
+
+            c = static_cast<lxs_schunk*>(
+                luaM_malloc(L, offsetof(lxs_schunk, data) + cap)
+            );
+            LXS_STAT(allocs);
+
+            c->next = NULL;
+            c->len  = 0u;
+            c->cap  = cap;
+
+            if (b->tail)
+                b->tail->next = c;
+            else
+                b->head = c;
+            b->tail = c;
+        }
+
+        const size_t n = min(len, c->cap - c->len);
+        memcpy(&c->data[c->len], str, n);
+        c->len  += n;
+        b->clen += n;
+        str     += n;
+        len     -= n;
+    }
+}
+
+void lxs_sbflatten(lua_State* const L, lxs_sbuffer* const b)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, b);
+
+    if (b->head == NULL)
+        return;
+
+    lxs_string* s = &b->s;
+
+    // chunked content is exempt from the LUAXS_STR_MAX_*_EXPANSION limits,
+    // hence no lxs_srealloc
+    const size_t need = s->len + b->clen + 1u;
+    if (need > s->cap)
+    {
+        char* data = static_cast<char*>(luaM_malloc(L, need));
+        LXS_STAT(allocs);
+
+        if (s->len > 0u)
+            memcpy(data, s->data, s->len);
+        if (s->data && !lxs_sisinline(s))
+        {
+            luaM_freemem(L, s->data, s->cap);
+            LXS_STAT(frees);
+        }
+
+        s->cap  = need;
+        s->data = data;
+    }
+
+    for (lxs_schunk* c = b->head; c; c = c->next)
+    {
+        memcpy(&s->data[s->len], c->data, c->len);
+        s->len += c->len;
+    }
+    lxs_sterminate(s);
+
+    lxs_sbfree_chunks(L, b);
+}
+
+void lxs_sbclear(lua_State* const L, lxs_sbuffer* const b)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, b);
+
+    lxs_sbfree_chunks(L, b);
+    lxs_sclear(L, &b->s);
+    ++b->gen;
+    b->rpos = 0u;
+}
+
+bool lxs_sbfwrite(lua_State* const L, lxs_sbuffer* const b, FILE* const f)
+{
+    lxs_assert(L, L);
+    lxs_assert(L, b);
+    lxs_assert(L, f);
+
+    if (b->s.len > 0u && fwrite(b->s.data, 1u, b->s.len, f) != b->s.len)
+        return false;
+
+    for (lxs_schunk* c = b->head; c; c = c->next)
+    {
+        if (fwrite(c->data, 1u, c->len, f) != c->len)
+            return false;
+    }
+    return true;
+}
+
 const char* lxs_schecklstring(lua_State* const L,
                               int narg,
                               size_t* len /*= NULL*/)
@@ -1179,6 +1533,186 @@ size_t lxs_sfread(lua_State* const L,
 }
 
 
+//------------------------------------------------------------------------------
+// number formatting
+
+/// Powers of ten that are exact doubles.
+static const double _lxs_spow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const char _lxs_sdigits2[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static bool _lxs_ssignbit(double x)
+{
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return (u >> 63) != 0u;
+}
+
+/// Rounds y (0 <= y < 2^53) to the nearest integer. y carries the error of
+/// one rounded multiplication or division (at most half an ulp), so results
+/// within an ulp of a tie are refused.
+static bool _lxs_sround(double y, uint64_t* v)
+{
+    const double r = floor(y);
+    const double f = y - r; // exact below 2^53
+
+    int e;
+    frexp(y, &e);
+    if (fabs(f - 0.5) <= ldexp(1.0, e - 53))
+        return false;
+
+    *v = STATIC_CAST(uint64_t, r) + (f > 0.5 ? 1u : 0u);
+    return true;
+}
+
+/// Writes v / 10^decimals with exactly decimals fractional digits.
+static int _lxs_spoint(char* buf, uint64_t v, int decimals, bool neg)
+{
+    char         digits[24];
+    const size_t nd = lxs_sfmt_uint(digits, v);
+    const size_t nf = STATIC_CAST(size_t, decimals);
+
+    char* out = buf;
+    if (neg)
+        *out++ = '-';
+
+    if (nd <= nf)
+        *out++ = '0';
+    else
+    {
+        memcpy(out, digits, nd - nf);
+        out += nd - nf;
+    }
+
+    if (nf > 0u)
+    {
+        *out++ = '.';
+        for (size_t z = nd; z < nf; ++z)
+            *out++ = '0';
+
+        const size_t take = (nd < nf) ? nd : nf;
+        memcpy(out, &digits[nd - take], take);
+        out += take;
+    }
+    *out = '\0';
+
+    return STATIC_CAST(int, out - buf);
+}
+
+size_t lxs_sfmt_uint(char* buf, uint64_t v)
+{
+    char  tmp[20];
+    char* it = tmp + sizeof(tmp);
+
+    while (v >= 100u)
+    {
+        const unsigned d = STATIC_CAST(unsigned, v % 100u) * 2u;
+        v /= 100u;
+        *--it = _lxs_sdigits2[d + 1u];
+        *--it = _lxs_sdigits2[d];
+    }
+    if (v >= 10u)
+    {
+        const unsigned d = STATIC_CAST(unsigned, v) * 2u;
+        *--it = _lxs_sdigits2[d + 1u];
+        *--it = _lxs_sdigits2[d];
+    }
+    else
+        *--it = STATIC_CAST(char, '0' + v);
+
+    const size_t n = tmp + sizeof(tmp) - it;
+    memcpy(buf, it, n);
+    buf[n] = '\0';
+    return n;
+}
+
+int lxs_sfmt_fixed(char* buf, double x, int prec)
+{
+    if (prec < 0 || prec > 15)
+        return -1;
+
+    const double a = fabs(x);
+    if (!(a < _lxs_spow10[15] / _lxs_spow10[prec])) // also NaN and infinity
+        return -1;
+
+    uint64_t v;
+    if (!_lxs_sround(a * _lxs_spow10[prec], &v))
+        return -1;
+
+    const bool neg = _lxs_ssignbit(x);
+    if (neg && v == 0u)
+        return -1;
+
+    return _lxs_spoint(buf, v, prec, neg);
+}
+
+int lxs_sfmt_general(char* buf, double x, int prec)
+{
+    if (prec < 0 || prec > 15)
+        return -1;
+    if (prec == 0)
+        prec = 1;
+
+    if (x == 0.0)
+    {
+        if (_lxs_ssignbit(x))
+            return -1;
+        buf[0] = '0';
+        buf[1] = '\0';
+        return 1;
+    }
+
+    // %g uses fixed notation for decimal exponents in [-4, prec)
+    const double a = fabs(x);
+    if (!(a >= 1e-5 && a < _lxs_spow10[prec])) // also NaN and infinity
+        return -1;
+
+    int    e = STATIC_CAST(int, floor(log10(a)));
+    double y = 0.0;
+    for (int tries = 0; ; ++tries)
+    {
+        const int k = prec - 1 - e;
+        y = (k >= 0) ? a * _lxs_spow10[k] : a / _lxs_spow10[-k];
+
+        if (y >= _lxs_spow10[prec])
+            ++e;
+        else if (y < _lxs_spow10[prec - 1])
+            --e;
+        else
+            break;
+
+        if (tries == 1) // log10 was off by more than one; give up
+            return -1;
+    }
+
+    uint64_t v;
+    if (!_lxs_sround(y, &v))
+        return -1;
+    if (v == STATIC_CAST(uint64_t, _lxs_spow10[prec])) // 9.99... -> 10.0
+    {
+        v /= 10u;
+        ++e;
+    }
+    if (e < -4 || e >= prec)
+        return -1;
+
+    int decimals = prec - 1 - e;
+    while (decimals > 0 && v % 10u == 0u)
+    {
+        v /= 10u;
+        --decimals;
+    }
+
+    return _lxs_spoint(buf, v, decimals, x < 0.0);
+}
+
+
 //==============================================================================
 
 }; // extern "C"
\ No newline at end of file
@@ -23,16 +23,70 @@ typedef struct _lxs_string
     size_t cap;
     size_t len;
     char*  data;
+#if LUAXS_STR_INLINE_CAPACITY > 0
+    char   sso[LUAXS_STR_INLINE_CAPACITY]; // data == sso until spilled to heap
+#endif
 } lxs_string;
 
+/// A chunk of a chunked buffer.
+typedef struct _lxs_schunk
+{
+    struct _lxs_schunk* next;
+    size_t              len;
+    size_t              cap;
+    char                data[1];
+} lxs_schunk;
+
+/// Buffer userdata (lib_buffer). The content is s followed by all chunks.
+/// Only chunk-aware functions (lxs_sb*) see the chunks; lxs_scheckbuffer and
+/// lxs_stobuffer flatten them into s first.
+typedef struct _lxs_sbuffer
+{
+    lxs_string  s;     // must be first
+    lxs_schunk* head;
+    lxs_schunk* tail;
+    size_t      clen;  // total length of all chunks
+    size_t      csize; // chunk size; 0 if not chunked
+    size_t      gen;   // bumped when content moves or is dropped; see views
+    size_t      rpos;  // read cursor of buffer:read_*/unpack
+} lxs_sbuffer;
+
+#if LUAXS_STR_ALLOC_STATS
+typedef struct _lxs_sstats
+{
+    size_t inits;    // lxs_sinit calls
+    size_t inlined;  // lxs_sinit calls served by inline storage
+    size_t allocs;   // heap allocations, including lxs_screate and spills
+    size_t reallocs; // heap reallocations
+    size_t frees;    // heap frees
+} lxs_sstats;
+#endif
+
 
 //==============================================================================
 // core/persistent buffer extensions
 
 #if LUAXS_STR_PERSISTENT_BUFFER
+/// One nesting level of a thread's persistent buffer (lua_State::pb).
+typedef struct _lxs_spb
+{
+    lxs_string       s;     // must be first; handed out by lxs_spb_get
+    ptrdiff_t        owner; // call depth (L->ci - L->base_ci) of the holder; -1 if free
+    size_t           peak;  // largest len + 1 released since the last trim; 0 if unused
+    unsigned char    white; // GC white of the last trim; threads are traversed twice a cycle
+    struct _lxs_spb* next;  // next (deeper) level
+} lxs_spb;
+
+/// Returns a cleared buffer level owned by the calling C function.
+/// It stays reserved until released or the function's frame is unwound.
 lxs_string* lxs_spb_get(lua_State* const L);
-lxs_string* lxs_spb_create(lua_State* const L, lua_State* const L1);
+void        lxs_spb_put(lua_State* const L, lxs_string* const s);
+void        lxs_spb_pushresult(lua_State* const L, lxs_string* const s);
+
+/// Lifecycle, called by lstate.c/lgc.c. L may be any thread of L1's state.
+void        lxs_spb_create(lua_State* const L, lua_State* const L1);
 void        lxs_spb_destroy(lua_State* const L, lua_State* const L1);
+void        lxs_spb_trim(lua_State* const L, lua_State* const L1);
 
 #  define xbuf_decl(name)                lxs_string* name
 #  define xbuf_init(L, name)             name = lxs_spb_get(L)
@@ -40,20 +94,36 @@ void        lxs_spb_destroy(lua_State* const L, lua_State* const L1);
 #  define xbuf_addstring(L, name, s)     lxs_sappends(L, name, s)
 #  define xbuf_addliteral(L, name, lit)  lxs_sappendl(L, name, "" lit)
 #  define xbuf_addchar(L, name, c)       lxs_sappendc(L, name, c)
-#  define xbuf_addvalue(L, name)         lxs_sappend_top(L, name)
-#  define xbuf_pushresult(L, name)       lxs_spushresult(L, name)
-
-#  define lxs_spb_ptr(name)     name
-#  define lxs_spb_decl(L, name) lxs_string* name = lxs_spb_get(L)
+#  define xbuf_addvalue(L, name)         (lxs_sappend_top(L, name), lua_pop(L, 1))
+#  define xbuf_pushresult(L, name)       lxs_spb_pushresult(L, name)
+#  define xbuf_ptr_t                     lxs_string*
+#  define xbuf_ref(name)                 name
+#  define xbuf_deref(ptr)                ptr
+
+#  define lxs_spb_ptr(name)        name
+#  define lxs_spb_decl(L, name)    lxs_string* name = lxs_spb_get(L)
+#  define lxs_spb_release(L, name) lxs_spb_put(L, name)
 #else
-#  define lxs_spb_ptr(name)     &name
-#  define lxs_spb_decl(L, name) lxs_string name; lxs_sinit(L, &name)
+#  define lxs_spb_ptr(name)        &name
+#  define lxs_spb_decl(L, name)    lxs_string name; lxs_sinit(L, &name)
+#  define lxs_spb_release(L, name) lxs_srelease(L, &name)
 #endif
 
 
 
 //==============================================================================
 
+__forceinline bool lxs_sisinline(lxs_string* const s)
+{
+    assert(s);
+
+#if LUAXS_STR_INLINE_CAPACITY > 0
+    return s->data == s->sso;
+#else
+    return false;
+#endif
+}
+
 __forceinline size_t lxs_slen(lxs_string* const s)
 {
     assert(s);
@@ -190,6 +260,7 @@ lxs_string* lxs_screate(lua_State* const L,
                         size_t DEFVAL(cap, 0u),
                         bool DEFVAL(force, true));
 void lxs_sdestroy(lua_State* const L, lxs_string* s);
+void lxs_srelease(lua_State* const L, lxs_string* const s);
 
 void lxs_sinit(lua_State* const L,
                lxs_string* const s,
@@ -230,6 +301,10 @@ void lxs_sappend_vformat(lua_State* const L,
 
 void lxs_sclear(lua_State* const L, lxs_string* const s);
 
+#if LUAXS_STR_ALLOC_STATS
+void lxs_sallocstats(lxs_sstats* const stats, bool DEFVAL(reset, false));
+#endif
+
 void lxs_spushresult(lua_State* const L, lxs_string* const s);
 
 bool lxs_sisbuffer(lua_State* const L, int narg);
@@ -331,6 +406,23 @@ lxs_string* lxs_snewbuffer(lua_State* const L, size_t DEFVAL(capacity, 0));
 lxs_string* lxs_stobuffer(lua_State* const L, int narg);
 lxs_string* lxs_scheckbuffer(lua_State* const L, int narg);
 
+lxs_sbuffer* lxs_sbcheck(lua_State* const L, int narg);
+void lxs_sbchunked(lua_State* const L, lxs_sbuffer* const b, size_t chunk_size);
+void lxs_sbappend(lua_State* const L,
+                  lxs_sbuffer* const b,
+                  const char* str,
+                  size_t len);
+void lxs_sbflatten(lua_State* const L, lxs_sbuffer* const b);
+void lxs_sbclear(lua_State* const L, lxs_sbuffer* const b);
+bool lxs_sbfwrite(lua_State* const L, lxs_sbuffer* const b, FILE* const f);
+
+__forceinline size_t lxs_sblen(lxs_sbuffer* const b)
+{
+    assert(b);
+
+    return b->s.len + b->clen;
+}
+
 const char* lxs_schecklstring(lua_State* const L,
                               int narg,
                               size_t* DEFVAL(len, NULL));
@@ -359,6 +451,25 @@ size_t lxs_sfread(lua_State* const L,
                   size_t size);
 
 
+//------------------------------------------------------------------------------
+// number formatting
+//
+// Write exactly what sprintf("%llu"/"%.*f"/"%.*g") would, except that the
+// decimal point is always '.'. The floating point variants return -1 and
+// write nothing for values they leave to sprintf: non-finite values, more
+// than 15 significant digits, exponent notation, negative zero results and
+// values within rounding error of a tie (where CRTs differ).
+
+/// Writes the decimal digits of v and returns their count (at most 20).
+size_t lxs_sfmt_uint(char* buf, uint64_t v);
+
+/// %.{prec}f; writes at most 32 characters.
+int lxs_sfmt_fixed(char* buf, double x, int prec);
+
+/// %.{prec}g; writes at most 24 characters.
+int lxs_sfmt_general(char* buf, double x, int prec);
+
+
 //==============================================================================
 
 #ifdef __cplusplus
@@ -400,6 +400,7 @@ void lxs_core_luastack(lua_State* const L)
 
     lxs_spushresult(L, sptr(s));
     lua_replace(L, top);
+    lxs_spb_release(L, s);
 
     lxs_assert_stack_end(L, 0);
 }
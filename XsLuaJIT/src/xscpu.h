@@ -46,7 +46,7 @@
 #include <windows.h>
 
 #include <stdint.h>
-#include <intrin.h> // __cpuid
+#include <intrin.h> // __cpuid, __cpuidex, _xgetbv
 #include <string.h> // memcmp
 
 #include "lxs_def.h"
@@ -54,7 +54,14 @@
 
 //==============================================================================
 
-
+/// XS_CPU_AVX2_TOOLSET
+/// 1 if the compiler can emit AVX2 (and provides __cpuidex/_xgetbv), else 0.
+/// VS2008 cannot, so XS_CPU_AVX2 is never reported as supported there.
+#if defined(_MSC_VER) && _MSC_VER >= 1700
+#  define XS_CPU_AVX2_TOOLSET 1
+#else
+#  define XS_CPU_AVX2_TOOLSET 0
+#endif
 
 
 //==============================================================================
@@ -122,6 +129,8 @@ static bool _cpu_flags[] = {
     false, // MMX Extensions
     false, // 3DNow! Extensions
     false, // 3DNow! Instructions
+    false, // SSE2 Instructions
+    false, // AVX2 Instructions
     false
 };
 
@@ -142,12 +151,28 @@ static void xs_cpu_getinfo(void)
     if (ids >= 1)
     {
 	    __cpuid(info, 1);
+	    _cpu_flags[XS_CPU_SSE2]  = (info[3] & 0x4000000);
 	    _cpu_flags[XS_CPU_SSE3I] = (info[2] & 0x1);
 	    _cpu_flags[XS_CPU_SSE3S] = (info[2] & 0x200);
 	    _cpu_flags[XS_CPU_SSE41] = (info[2] & 0x80000);
 	    _cpu_flags[XS_CPU_SSE42] = (info[2] & 0x100000);
     }
 
+#if XS_CPU_AVX2_TOOLSET
+    if (ids >= 7)
+    {
+        // AVX2 is only usable if the OS saves the YMM state (OSXSAVE + XCR0)
+        bool ymm;
+
+        __cpuid(info, 1);
+        ymm = (info[2] & 0x18000000) == 0x18000000 &&
+              (_xgetbv(0) & 0x6) == 0x6;
+
+        __cpuidex(info, 7, 0);
+        _cpu_flags[XS_CPU_AVX2] = ymm && (info[1] & 0x20);
+    }
+#endif
+
     if (exIds >= 0x80000001)
     {
         __cpuid(info, 0x80000001);